@@ -0,0 +1,447 @@
+/*
+	Deterministic benchmark of the whole frame, from the simulation to the present.
+	Runs scripted scenes (number of cubes x motion) for a fixed number of frames with a fixed dt,
+	and reports the time of each phase of the frame (min/median/p99/max, in milliseconds) as JSON.
+
+	usage: cube3d_bench [--renderer=software|opengl-headless] [--frames=N] [--scenes=1-static,100k-rotating,...]
+	                    [--threads=N] [--draw-mode=triangles|indexed|packed|instanced|transform]
+	                    [--retained] [--width=N] [--height=N] [--out=file.json] [--trace=trace.json]
+
+	--trace writes the profiler zones of the first scene as Chrome trace_event JSON.
+	With the Opengl renderer, the gpu time of the phases (gpu_upload, gpu_draw, gpu_swap) is also reported.
+
+	The Opengl renderer loads the shaders from ./shaders, so it must run from the build directory.
+	Build with -DDEBUG_PRINT=OFF, otherwise the debug messages are part of the measured time
+	("debug_print" is true in the output).
+*/
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <array>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <numbers>
+#include <memory>
+#include <limits>
+#include <stdexcept>
+
+#include <cstdlib>
+#include <cmath>
+
+#include "graphics.h"
+#include "debug.h"
+#include "profiler.h"
+#include "software/software.h"
+
+#ifdef SUPPORT_OPENGL_HEADLESS
+	#include "opengl/opengl-headless.h"
+#endif
+
+// -------------------------------------------
+
+using namespace Graphics;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr fp_t dt = fp(1) / fp(60);
+static constexpr fp_t cube_w = fp(0.05);
+static constexpr fp_t angular_velocity = std::numbers::pi_v<fp_t>; // radians per second
+static constexpr fp_t speed = fp(0.5);
+
+// -------------------------------------------
+
+enum class Motion {
+	Static,
+	Rotating,
+	Moving
+};
+
+static constexpr auto motion_names = std::to_array<std::string_view>({ "static", "rotating", "moving" });
+
+struct SceneConfig {
+	std::string name;
+	uint32_t n_cubes;
+	Motion motion;
+};
+
+struct Options {
+	std::string renderer = "software";
+	uint32_t n_frames = 120;
+	uint32_t n_threads = 1;
+	uint32_t width = 800;
+	uint32_t height = 800;
+	std::string draw_mode = "triangles";
+	bool retained = false;
+	std::string scenes = "all";
+	std::string out;
+	std::string trace;
+};
+
+// times of every frame, in seconds
+struct PhaseSamples {
+	std::vector<double> physics;
+	std::vector<double> vertex_build;
+	std::vector<double> upload;
+	std::vector<double> draw;
+	std::vector<double> swap;
+	std::vector<double> frame;
+
+	// gpu time, measured by the renderer some frames later, empty when not supported
+	std::vector<double> gpu_upload;
+	std::vector<double> gpu_draw;
+	std::vector<double> gpu_swap;
+};
+
+// -------------------------------------------
+
+static std::vector<SceneConfig> all_scenes ()
+{
+	static constexpr auto counts = std::to_array<std::pair<uint32_t, std::string_view>>({
+		{ 1, "1" },
+		{ 1000, "1k" },
+		{ 100000, "100k" },
+		{ 1000000, "1m" }
+	});
+
+	std::vector<SceneConfig> scenes;
+
+	for (const auto& [n, n_str] : counts) {
+		for (uint32_t m = 0; m < motion_names.size(); m++)
+			scenes.push_back(SceneConfig { .name = std::string(n_str) + "-" + std::string(motion_names[m]), .n_cubes = n, .motion = static_cast<Motion>(m) });
+	}
+
+	return scenes;
+}
+
+static Options parse_options (const int argc, char **argv)
+{
+	Options options;
+
+	for (int i = 1; i < argc; i++) {
+		const std::string_view arg = argv[i];
+		const auto eq = arg.find('=');
+		const std::string_view key = arg.substr(0, eq);
+		const std::string value = (eq == std::string_view::npos) ? std::string() : std::string(arg.substr(eq + 1));
+
+		if (key == "--renderer")
+			options.renderer = value;
+		else if (key == "--frames")
+			options.n_frames = std::stoul(value);
+		else if (key == "--threads")
+			options.n_threads = std::stoul(value);
+		else if (key == "--width")
+			options.width = std::stoul(value);
+		else if (key == "--height")
+			options.height = std::stoul(value);
+		else if (key == "--draw-mode")
+			options.draw_mode = value;
+		else if (key == "--retained")
+			options.retained = true;
+		else if (key == "--scenes")
+			options.scenes = value;
+		else if (key == "--out")
+			options.out = value;
+		else if (key == "--trace")
+			options.trace = value;
+		else
+			throw std::runtime_error("unknown option " + std::string(arg));
+	}
+
+	return options;
+}
+
+static Renderer* create_renderer (const Options& options)
+{
+	if (options.renderer == "software")
+		return new Software::Renderer(options.width, options.height, false, false);
+
+#ifdef SUPPORT_OPENGL_HEADLESS
+	if (options.renderer == "opengl-headless") {
+		static constexpr auto modes = std::to_array<std::pair<std::string_view, Opengl::Renderer::CubeDrawMode>>({
+			{ "triangles", Opengl::Renderer::CubeDrawMode::Triangles },
+			{ "indexed", Opengl::Renderer::CubeDrawMode::Indexed },
+			{ "packed", Opengl::Renderer::CubeDrawMode::Packed },
+			{ "instanced", Opengl::Renderer::CubeDrawMode::Instanced },
+			{ "transform", Opengl::Renderer::CubeDrawMode::Transform }
+		});
+
+		const auto mode = std::find_if(modes.begin(), modes.end(), [&options] (const auto& m) { return m.first == options.draw_mode; });
+
+		if (mode == modes.end())
+			throw std::runtime_error("unknown draw mode " + options.draw_mode);
+
+		auto *renderer = new Opengl::HeadlessRenderer(options.width, options.height);
+		renderer->set_cube_draw_mode(mode->second);
+
+		return renderer;
+	}
+#endif
+
+	throw std::runtime_error("renderer " + options.renderer + " is not available in this build");
+}
+
+// -------------------------------------------
+
+class Scene
+{
+protected:
+	const SceneConfig& config;
+	std::vector<Cube3d> cubes;
+	std::vector<Vector> positions;
+	std::vector<Vector> velocities;
+	fp_t half_size; // cubes are kept in [-half_size, half_size]^3, centered in front of the camera
+	Vector center;
+
+public:
+	Scene (const SceneConfig& config_)
+		: config(config_)
+	{
+		std::mt19937_64 rgenerator(42);
+		std::uniform_real_distribution<fp_t> dist(-1, 1);
+		std::uniform_real_distribution<float> color_dist(0, 1);
+
+		// same density in every scene
+		this->half_size = std::max(fp(0.5), fp(0.1) * std::cbrt(static_cast<fp_t>(config.n_cubes)));
+		this->center = Vector(0, 0, -(this->half_size * fp(2) + fp(1)));
+
+		this->cubes.resize(config.n_cubes);
+		this->positions.resize(config.n_cubes);
+		this->velocities.resize(config.n_cubes);
+
+		for (uint32_t i = 0; i < config.n_cubes; i++) {
+			Cube3d& cube = this->cubes[i];
+
+			cube.set_w(cube_w);
+			cube.set_rotation_axis(Vector(dist(rgenerator), dist(rgenerator), dist(rgenerator) + fp(2)));
+			cube.set_rotation_angle(dist(rgenerator) * std::numbers::pi_v<fp_t>);
+
+			for (auto& c : cube.get_colors_ref())
+				c = Color { .r = color_dist(rgenerator), .g = color_dist(rgenerator), .b = color_dist(rgenerator), .a = 1.0f };
+
+			this->positions[i] = this->center + Vector(dist(rgenerator), dist(rgenerator), dist(rgenerator)) * this->half_size;
+			this->velocities[i] = Vector(dist(rgenerator), dist(rgenerator), dist(rgenerator)) * speed;
+		}
+	}
+
+	void process_physics ()
+	{
+		CUBE3D_PROFILE_ZONE("process_physics");
+
+		switch (this->config.motion) {
+			case Motion::Static:
+			break;
+
+			case Motion::Rotating:
+				for (auto& cube : this->cubes)
+					cube.set_rotation_angle_bounded(cube.get_rotation_angle() + angular_velocity * dt);
+			break;
+
+			case Motion::Moving:
+				for (uint32_t i = 0; i < this->cubes.size(); i++) {
+					Vector& pos = this->positions[i];
+					Vector& vel = this->velocities[i];
+
+					pos += vel * dt;
+
+					// bounce in the walls of the box
+					auto bounce = [this] (const fp_t p, const fp_t c, fp_t& v) {
+						if (std::abs(p - c) > this->half_size)
+							v = -v;
+					};
+
+					bounce(pos.x, this->center.x, vel.x);
+					bounce(pos.y, this->center.y, vel.y);
+					bounce(pos.z, this->center.z, vel.z);
+				}
+			break;
+		}
+	}
+
+	RenderArgs get_render_args () const
+	{
+		return RenderArgs {
+			.world_camera_pos = Vector(0, 0, 0),
+			.world_camera_target = Vector(0, 0, -1),
+			.fovy = Mylib::Math::degrees_to_radians(fp(45)),
+			.z_near = fp(0.1),
+			.z_far = this->half_size * fp(4) + fp(2)
+		};
+	}
+
+	PhaseSamples run (Renderer& renderer, const Options& options)
+	{
+		PhaseSamples samples;
+		std::vector<Renderer::CubeHandle> handles;
+		uint64_t last_gpu_frame = std::numeric_limits<uint64_t>::max();
+
+		for (uint32_t frame = 0; frame < options.n_frames; frame++) {
+			const auto tbegin = Clock::now();
+
+			renderer.wait_next_frame();
+
+			const auto tphysics = Clock::now();
+			this->process_physics();
+			const auto tbuild = Clock::now();
+
+			renderer.setup_projection_matrix(this->get_render_args());
+
+			if (!options.retained)
+				renderer.draw_cube3d_batch(this->cubes, this->positions);
+			else if (handles.empty()) {
+				for (uint32_t i = 0; i < this->cubes.size(); i++)
+					handles.push_back(renderer.create_cube(this->cubes[i], this->positions[i]));
+			}
+			else if (this->config.motion != Motion::Static) {
+				for (uint32_t i = 0; i < this->cubes.size(); i++)
+					renderer.update_cube(handles[i], this->cubes[i], this->positions[i]);
+			}
+
+			const auto trender = Clock::now();
+			renderer.render();
+			const auto tend = Clock::now();
+
+			Profiler::end_frame();
+
+			const Renderer::Stats& stats = renderer.get_ref_stats();
+			auto seconds = [] (const auto d) { return std::chrono::duration<double>(d).count(); };
+
+			samples.physics.push_back(seconds(tbuild - tphysics));
+			samples.vertex_build.push_back(seconds(trender - tbuild) + stats.build_time);
+			samples.upload.push_back(stats.upload_time);
+			samples.draw.push_back(stats.draw_time);
+			samples.swap.push_back(stats.present_time);
+			samples.frame.push_back(seconds(tend - tbegin));
+
+			// results that arrive in the first frames belong to the previous scene
+			const Renderer::GpuStats& gpu_stats = renderer.get_ref_gpu_stats();
+
+			if (gpu_stats.valid && gpu_stats.latency <= frame && gpu_stats.frame != last_gpu_frame) {
+				samples.gpu_upload.push_back(gpu_stats.upload_time);
+				samples.gpu_draw.push_back(gpu_stats.draw_time);
+				samples.gpu_swap.push_back(gpu_stats.present_time);
+				last_gpu_frame = gpu_stats.frame;
+			}
+		}
+
+		for (const auto handle : handles)
+			renderer.destroy_cube(handle);
+
+		return samples;
+	}
+};
+
+// -------------------------------------------
+
+static void write_phase (std::ostream& out, const std::string_view name, std::vector<double> samples, const bool last)
+{
+	std::sort(samples.begin(), samples.end());
+
+	const size_t n = samples.size();
+	const size_t p99 = std::min(n - 1, static_cast<size_t>( std::ceil(0.99 * static_cast<double>(n)) ) - 1);
+	constexpr double to_ms = 1000.0;
+
+	out << "\t\t\t\t\"" << name << "\": { "
+		<< "\"min\": " << (samples.front() * to_ms) << ", "
+		<< "\"median\": " << (samples[n / 2] * to_ms) << ", "
+		<< "\"p99\": " << (samples[p99] * to_ms) << ", "
+		<< "\"max\": " << (samples.back() * to_ms)
+		<< " }" << (last ? "" : ",") << "\n";
+}
+
+int main (int argc, char **argv)
+{
+	try {
+		const Options options = parse_options(argc, argv);
+
+		mylib_assert_exception_msg(options.n_frames > 0, "--frames must be at least 1")
+
+		std::vector<SceneConfig> scenes = all_scenes();
+
+		if (options.scenes != "all") {
+			const std::string list = "," + options.scenes + ",";
+
+			std::erase_if(scenes, [&list] (const SceneConfig& scene) {
+				return list.find("," + scene.name + ",") == std::string::npos;
+			});
+
+			mylib_assert_exception_msg(!scenes.empty(), "no scene matches ", options.scenes)
+		}
+
+		std::unique_ptr<Renderer> renderer(create_renderer(options));
+		renderer->set_n_threads(options.n_threads);
+		renderer->set_background_color( Color { .r = 0.0f, .g = 0.0f, .b = 0.0f, .a = 1.0f } );
+
+		Profiler::set_thread_name("main");
+
+		if (!options.trace.empty())
+			Profiler::capture_frames(options.n_frames, options.trace);
+
+		std::ofstream out_file;
+
+		if (!options.out.empty())
+			out_file.open(options.out);
+
+		std::ostream& out = options.out.empty() ? std::cout : out_file;
+
+		constexpr bool debug_print = (App::Log::min_level <= App::Log::Level::Debug);
+
+		out << std::fixed << std::setprecision(6);
+		out << "{\n";
+		out << "\t\"renderer\": \"" << options.renderer << "\",\n";
+		out << "\t\"draw_mode\": \"" << ((options.renderer == "software") ? "software" : options.draw_mode) << "\",\n";
+		out << "\t\"retained\": " << (options.retained ? "true" : "false") << ",\n";
+		out << "\t\"frames\": " << options.n_frames << ",\n";
+		out << "\t\"dt\": " << dt << ",\n";
+		out << "\t\"threads\": " << renderer->get_n_threads() << ",\n";
+		out << "\t\"width\": " << options.width << ",\n";
+		out << "\t\"height\": " << options.height << ",\n";
+		out << "\t\"debug_print\": " << (debug_print ? "true" : "false") << ",\n";
+		out << "\t\"time_unit\": \"ms\",\n";
+		out << "\t\"scenes\": [\n";
+
+		for (uint32_t i = 0; i < scenes.size(); i++) {
+			const SceneConfig& config = scenes[i];
+
+			std::cerr << "running scene " << config.name << "..." << std::endl;
+
+			Scene scene(config);
+			const PhaseSamples samples = scene.run(*renderer, options);
+			const Renderer::Stats& stats = renderer->get_ref_stats(); // of the last frame
+
+			out << "\t\t{\n";
+			out << "\t\t\t\"name\": \"" << config.name << "\",\n";
+			out << "\t\t\t\"cubes\": " << config.n_cubes << ",\n";
+			out << "\t\t\t\"motion\": \"" << motion_names[ static_cast<uint32_t>(config.motion) ] << "\",\n";
+			out << "\t\t\t\"vertices_per_frame\": " << stats.n_vertices << ",\n";
+			out << "\t\t\t\"uploaded_bytes_per_frame\": " << stats.uploaded_bytes << ",\n";
+			out << "\t\t\t\"phases\": {\n";
+			write_phase(out, "physics", samples.physics, false);
+			write_phase(out, "vertex_build", samples.vertex_build, false);
+			write_phase(out, "upload", samples.upload, false);
+			write_phase(out, "draw", samples.draw, false);
+			write_phase(out, "swap", samples.swap, false);
+			if (!samples.gpu_upload.empty()) {
+				write_phase(out, "gpu_upload", samples.gpu_upload, false);
+				write_phase(out, "gpu_draw", samples.gpu_draw, false);
+				write_phase(out, "gpu_swap", samples.gpu_swap, false);
+			}
+			write_phase(out, "frame", samples.frame, true);
+			out << "\t\t\t}\n";
+			out << "\t\t}" << ((i + 1 < scenes.size()) ? "," : "") << "\n";
+		}
+
+		out << "\t]\n";
+		out << "}\n";
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Exception happenned!" << std::endl << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+/*
+	Microbenchmark of the cube corner computation used by draw_cube3d.
+	Reports cubes/second of the per-corner Rodrigues rotation (calc_corners)
+	and of calc_corners_batch with every instruction set supported by the cpu.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <numbers>
+#include <utility>
+
+#include <cstdlib>
+#include <cmath>
+
+#include "graphics.h"
+#include "cube-geometry.h"
+
+// -------------------------------------------
+
+using namespace Graphics;
+using namespace Graphics::CubeGeometry;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint32_t n_cubes = 100000;
+static constexpr uint32_t n_iterations = 20;
+
+// -------------------------------------------
+
+static std::vector<Cube3d> gen_cubes ()
+{
+	std::mt19937_64 rgenerator(42);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	std::vector<Cube3d> cubes(n_cubes);
+
+	for (auto& cube : cubes) {
+		cube.set_w(0.1f + std::abs(dist(rgenerator)));
+		cube.set_delta(Vector(dist(rgenerator), dist(rgenerator), dist(rgenerator)) * 0.1f);
+		cube.set_rotation_axis(Vector(dist(rgenerator), dist(rgenerator), dist(rgenerator) + 2.0f));
+		cube.set_rotation_angle(dist(rgenerator) * std::numbers::pi_v<float>);
+	}
+
+	return cubes;
+}
+
+static float max_error (const std::vector<Corners>& a, const std::vector<Corners>& b)
+{
+	float error = 0;
+
+	for (size_t i = 0; i < a.size(); i++) {
+		for (uint32_t j = 0; j < Cube3d::get_n_vertices(); j++) {
+			const Vector d = a[i][j] - b[i][j];
+			error = std::max({ error, std::abs(d.x), std::abs(d.y), std::abs(d.z) });
+		}
+	}
+
+	return error;
+}
+
+template <typename Function>
+static double measure_cubes_per_second (Function&& function)
+{
+	double best = 0;
+
+	for (uint32_t it = 0; it < n_iterations; it++) {
+		const auto tbegin = Clock::now();
+		function();
+		const auto tend = Clock::now();
+
+		const double seconds = std::chrono::duration<double>(tend - tbegin).count();
+		best = std::max(best, static_cast<double>(n_cubes) / seconds);
+	}
+
+	return best;
+}
+
+// -------------------------------------------
+
+int main (int argc, char **argv)
+{
+	const std::vector<Cube3d> cubes = gen_cubes();
+	std::vector<Corners> reference(n_cubes);
+	std::vector<Corners> corners(n_cubes);
+
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "cubes=" << n_cubes << " iterations=" << n_iterations << " best_isa=" << get_isa_str(get_best_isa()) << std::endl;
+
+	const double reference_cps = measure_cubes_per_second([&] () {
+		for (uint32_t i = 0; i < n_cubes; i++)
+			reference[i] = calc_corners(cubes[i]);
+	});
+
+	std::cout << "calc_corners (rotate_around_axis per corner): " << reference_cps << " cubes/s" << std::endl;
+
+	const auto best_isa = std::to_underlying(get_best_isa());
+
+	for (auto isa = std::to_underlying(Isa::Scalar); isa <= best_isa; isa++) {
+		const double cps = measure_cubes_per_second([&] () {
+			calc_corners_batch(static_cast<Isa>(isa), cubes, corners);
+		});
+
+		std::cout << "calc_corners_batch " << get_isa_str(static_cast<Isa>(isa)) << ": " << cps << " cubes/s"
+			<< " speedup=" << std::setprecision(2) << (cps / reference_cps)
+			<< " max_error=" << std::setprecision(6) << max_error(reference, corners)
+			<< std::setprecision(0) << std::endl;
+	}
+
+	return EXIT_SUCCESS;
+}
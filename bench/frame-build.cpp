@@ -0,0 +1,151 @@
+/*
+	Benchmark of the multithreaded frame building used by draw_cube3d_batch.
+	Builds the 36 vertices of every cube in per-thread arenas and stitches
+	them into a single buffer, reporting cubes/second, speedup and parallel
+	efficiency for 1 up to all hardware threads.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <numbers>
+#include <thread>
+
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+
+#include "graphics.h"
+#include "cube-geometry.h"
+#include "thread-pool.h"
+
+// -------------------------------------------
+
+using namespace Graphics;
+using namespace Graphics::CubeGeometry;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint32_t n_cubes = 200000;
+static constexpr uint32_t n_iterations = 20;
+static constexpr uint32_t chunk_size = 1024;
+static constexpr uint32_t block_size = 256;
+
+// same layout as Opengl::ProgramTriangle::Vertex
+struct Vertex {
+	Point local_pos;
+	Vector offset;
+	Color color;
+};
+
+// -------------------------------------------
+
+static std::vector<Cube3d> gen_cubes ()
+{
+	std::mt19937_64 rgenerator(42);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	std::vector<Cube3d> cubes(n_cubes);
+
+	for (auto& cube : cubes) {
+		cube.set_w(0.1f + std::abs(dist(rgenerator)));
+		cube.set_rotation_axis(Vector(dist(rgenerator), dist(rgenerator), dist(rgenerator) + 2.0f));
+		cube.set_rotation_angle(dist(rgenerator) * std::numbers::pi_v<float>);
+	}
+
+	return cubes;
+}
+
+static std::vector<Vector> gen_offsets ()
+{
+	std::mt19937_64 rgenerator(43);
+	std::uniform_real_distribution<float> dist(-10.0f, 10.0f);
+	std::vector<Vector> offsets(n_cubes);
+
+	for (auto& offset : offsets)
+		offset = Vector(dist(rgenerator), dist(rgenerator), dist(rgenerator));
+
+	return offsets;
+}
+
+static void build_frame (ThreadPool& pool, ParallelArenaBuilder<Vertex>& builder, std::span<const Cube3d> cubes, std::span<const Vector> offsets, std::vector<Vertex>& dest)
+{
+	const uint32_t n_chunks = (cubes.size() + chunk_size - 1) / chunk_size;
+
+	const uint64_t n_vertices = builder.build(pool, n_chunks, [&] (const uint32_t chunk, auto& emit) {
+		const size_t chunk_first = chunk * chunk_size;
+		const size_t chunk_end = std::min<size_t>(chunk_first + chunk_size, cubes.size());
+		std::array<Corners, block_size> corners;
+
+		for (size_t first = chunk_first; first < chunk_end; first += block_size) {
+			const size_t n = std::min<size_t>(block_size, chunk_end - first);
+
+			calc_corners_batch(cubes.subspan(first, n), corners);
+
+			std::span<Vertex> vertices = emit(n * triangles.size());
+
+			for (size_t i = 0; i < n; i++)
+				mount_triangles(vertices.subspan(i * triangles.size(), triangles.size()), cubes[first + i], offsets[first + i], corners[i]);
+		}
+	});
+
+	dest.resize(n_vertices);
+	builder.stitch(pool, dest);
+}
+
+// -------------------------------------------
+
+int main (int argc, char **argv)
+{
+	const std::vector<Cube3d> cubes = gen_cubes();
+	const std::vector<Vector> offsets = gen_offsets();
+	const uint32_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+	std::vector<Vertex> reference;
+	std::vector<Vertex> vertices;
+	ParallelArenaBuilder<Vertex> builder;
+
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "cubes=" << n_cubes << " iterations=" << n_iterations << " chunk_size=" << chunk_size
+		<< " hardware_threads=" << max_threads << std::endl;
+
+	double single_thread_cps = 0;
+
+	for (uint32_t n_threads = 1; n_threads <= max_threads; n_threads++) {
+		ThreadPool pool(n_threads);
+		double best = 0;
+
+		for (uint32_t it = 0; it < n_iterations; it++) {
+			const auto tbegin = Clock::now();
+			build_frame(pool, builder, cubes, offsets, vertices);
+			const auto tend = Clock::now();
+
+			const double seconds = std::chrono::duration<double>(tend - tbegin).count();
+			best = std::max(best, static_cast<double>(n_cubes) / seconds);
+		}
+
+		if (n_threads == 1) {
+			single_thread_cps = best;
+			reference = vertices;
+		}
+
+		// the output must not depend on the number of threads
+		const bool same = std::equal(vertices.begin(), vertices.end(), reference.begin(), reference.end(), [] (const Vertex& a, const Vertex& b) {
+			return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+		});
+
+		const double speedup = best / single_thread_cps;
+
+		std::cout << "threads=" << n_threads << ": " << best << " cubes/s"
+			<< std::setprecision(2)
+			<< " speedup=" << speedup
+			<< " efficiency=" << (speedup / n_threads)
+			<< " output=" << (same ? "ok" : "MISMATCH")
+			<< std::setprecision(0) << std::endl;
+	}
+
+	return EXIT_SUCCESS;
+}
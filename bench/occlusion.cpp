@@ -0,0 +1,168 @@
+/*
+	Benchmark of the occlusion culling of Renderer::cull_cubes, in a dense field of cubes,
+	a block of 32x32x32 cubes of random colors seen by a camera going around it.
+	Every frame is culled and drawn by the software renderer, without a window,
+	once with frustum culling only and once with occlusion culling, and reports the
+	time of both cull_cubes and render, and the cubes rejected by the occlusion.
+	The occlusion is conservative, so both frames must be equal, which is also checked.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <numbers>
+
+#include <cstdlib>
+#include <cmath>
+
+#include "graphics.h"
+#include "software/software.h"
+
+// -------------------------------------------
+
+using namespace Graphics;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint32_t block_size = 32; // cubes per axis
+static constexpr fp_t cube_w = fp(0.1);
+static constexpr fp_t spacing = fp(0.11); // distance between the centers of neighbor cubes
+static constexpr fp_t camera_distance = fp(4);
+static constexpr uint32_t n_frames = 30;
+static constexpr uint32_t width_px = 800;
+static constexpr uint32_t height_px = 800;
+
+// -------------------------------------------
+
+static void gen_cubes (std::vector<Cube3d>& cubes, std::vector<Vector>& offsets)
+{
+	std::mt19937_64 rgenerator(42);
+	std::uniform_real_distribution<float> color_dist(0, 1);
+
+	const fp_t half = static_cast<fp_t>(block_size - 1) * spacing * fp(0.5);
+
+	for (uint32_t x = 0; x < block_size; x++) {
+		for (uint32_t y = 0; y < block_size; y++) {
+			for (uint32_t z = 0; z < block_size; z++) {
+				Cube3d cube(cube_w);
+
+				for (auto& c : cube.get_colors_ref())
+					c = Color { .r = color_dist(rgenerator), .g = color_dist(rgenerator), .b = color_dist(rgenerator), .a = 1.0f };
+
+				cubes.push_back(cube);
+				offsets.push_back(Vector(static_cast<fp_t>(x) * spacing - half, static_cast<fp_t>(y) * spacing - half, static_cast<fp_t>(z) * spacing - half));
+			}
+		}
+	}
+}
+
+static double elapsed_seconds (const Clock::time_point tbegin)
+{
+	return std::chrono::duration<double>(Clock::now() - tbegin).count();
+}
+
+// -------------------------------------------
+
+struct Result {
+	double cull_time = 0;
+	double render_time = 0;
+	uint64_t n_visible = 0;
+	uint64_t n_occluded = 0;
+};
+
+static std::vector<uint32_t> run_frame (Software::Renderer& renderer, const uint32_t frame, std::span<const Cube3d> cubes, std::span<const Vector> offsets, Result& result)
+{
+	static std::vector<uint8_t> visible;
+	static std::vector<Cube3d> visible_cubes;
+	static std::vector<Vector> visible_offsets;
+
+	const fp_t angle = static_cast<fp_t>(frame) * fp(2) * std::numbers::pi_v<fp_t> / static_cast<fp_t>(n_frames);
+
+	renderer.wait_next_frame();
+	renderer.setup_projection_matrix(RenderArgs {
+		.world_camera_pos = Vector(std::sin(angle), fp(0.5), std::cos(angle)) * camera_distance,
+		.world_camera_target = Vector(0, 0, 0),
+		.fovy = Mylib::Math::degrees_to_radians(fp(45)),
+		.z_near = fp(0.1),
+		.z_far = fp(20)
+	});
+
+	const auto tcull = Clock::now();
+	result.n_visible += renderer.cull_cubes(cubes, offsets, visible);
+	result.cull_time += elapsed_seconds(tcull);
+	result.n_occluded += renderer.get_ref_stats().n_occluded_cubes;
+
+	visible_cubes.clear();
+	visible_offsets.clear();
+
+	for (uint32_t i = 0; i < cubes.size(); i++) {
+		if (visible[i]) {
+			visible_cubes.push_back(cubes[i]);
+			visible_offsets.push_back(offsets[i]);
+		}
+	}
+
+	const auto trender = Clock::now();
+	renderer.draw_cube3d_batch(visible_cubes, visible_offsets);
+	renderer.render();
+	result.render_time += elapsed_seconds(trender);
+
+	return std::vector<uint32_t>(renderer.get_color_buffer().begin(), renderer.get_color_buffer().end());
+}
+
+int main ()
+{
+	try {
+		std::vector<Cube3d> cubes;
+		std::vector<Vector> offsets;
+
+		gen_cubes(cubes, offsets);
+
+		Software::Renderer renderer(width_px, height_px, false, false);
+		renderer.set_n_threads(0);
+		renderer.set_background_color( Color { .r = 0.0f, .g = 0.0f, .b = 0.0f, .a = 1.0f } );
+
+		Result frustum_only;
+		Result occlusion;
+		uint32_t n_mismatches = 0;
+
+		for (uint32_t frame = 0; frame < n_frames; frame++) {
+			renderer.set_occlusion_culling(false);
+			const std::vector<uint32_t> expected = run_frame(renderer, frame, cubes, offsets, frustum_only);
+
+			renderer.set_occlusion_culling(true);
+			const std::vector<uint32_t> got = run_frame(renderer, frame, cubes, offsets, occlusion);
+
+			if (got != expected)
+				n_mismatches++;
+		}
+
+		const double to_ms = 1000.0 / static_cast<double>(n_frames);
+
+		std::cout << std::fixed << std::setprecision(3);
+		std::cout << cubes.size() << " cubes, " << width_px << "x" << height_px << ", " << renderer.get_n_threads() << " threads, " << n_frames << " frames" << std::endl;
+
+		auto print = [to_ms] (const char *name, const Result& r) {
+			std::cout << std::setw(10) << name
+				<< "  visible " << std::setw(8) << (r.n_visible / n_frames)
+				<< "  occluded " << std::setw(8) << (r.n_occluded / n_frames)
+				<< "  cull " << std::setw(8) << (r.cull_time * to_ms) << " ms"
+				<< "  render " << std::setw(8) << (r.render_time * to_ms) << " ms"
+				<< "  total " << std::setw(8) << ((r.cull_time + r.render_time) * to_ms) << " ms" << std::endl;
+		};
+
+		print("frustum", frustum_only);
+		print("occlusion", occlusion);
+
+		std::cout << "frames: " << ((n_mismatches == 0) ? "ok" : "MISMATCH") << " (" << n_mismatches << " different)" << std::endl;
+
+		return (n_mismatches == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	catch (const std::exception& e) {
+		std::cout << "error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
@@ -0,0 +1,131 @@
+/*
+	Benchmark of ObjectStore::process_physics with millions of objects.
+	For every supported instruction set and for 1 up to all hardware threads,
+	reports objects/second, objects/second per thread, speedup and scaling efficiency.
+	The positions and angles must not depend on the instruction set or the number of threads.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <numbers>
+#include <thread>
+#include <memory>
+#include <utility>
+#include <array>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "graphics.h"
+#include "cube-geometry.h"
+#include "thread-pool.h"
+#include "object-store.h"
+
+// -------------------------------------------
+
+using namespace Graphics;
+using App::ObjectStore;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr auto object_counts = std::to_array<uint32_t>({ 1000000, 4000000 });
+static constexpr uint32_t n_iterations = 10;
+static constexpr fp_t dt = fp(1) / fp(60);
+
+// -------------------------------------------
+
+static void gen_objects (ObjectStore& store, const uint32_t n)
+{
+	std::mt19937_64 rgenerator(42);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+	for (uint32_t i = 0; i < n; i++) {
+		Cube3d cube(0.1f);
+		cube.set_rotation_axis(Vector(0, 0, 1));
+
+		store.create(cube,
+			Point(dist(rgenerator) * 100.0f, dist(rgenerator) * 100.0f, dist(rgenerator) * 100.0f),
+			Vector(dist(rgenerator), dist(rgenerator), dist(rgenerator)),
+			dist(rgenerator) * std::numbers::pi_v<float>);
+	}
+}
+
+static bool same_state (const ObjectStore& a, const ObjectStore& b)
+{
+	auto same_angle = [] (const Cube3d& x, const Cube3d& y) {
+		return x.get_rotation_angle() == y.get_rotation_angle();
+	};
+
+	return std::memcmp(a.get_positions().data(), b.get_positions().data(), a.get_positions().size_bytes()) == 0
+		&& std::equal(a.get_cubes().begin(), a.get_cubes().end(), b.get_cubes().begin(), b.get_cubes().end(), same_angle);
+}
+
+// -------------------------------------------
+
+int main (int argc, char **argv)
+{
+	const uint32_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+	const CubeGeometry::Isa best_isa = CubeGeometry::get_best_isa();
+
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "iterations=" << n_iterations << " chunk_size=" << ObjectStore::chunk_size
+		<< " hardware_threads=" << max_threads << std::endl;
+
+	for (const uint32_t n_objects : object_counts) {
+		ObjectStore reference;
+		gen_objects(reference, n_objects);
+		reference.set_isa(CubeGeometry::Isa::Scalar);
+
+		for (uint32_t it = 0; it < n_iterations; it++)
+			reference.process_physics(dt);
+
+		for (auto i = std::to_underlying(CubeGeometry::Isa::Scalar); i <= std::to_underlying(best_isa); i++) {
+			const CubeGeometry::Isa isa = static_cast<CubeGeometry::Isa>(i);
+			double single_thread_ops = 0;
+
+			for (uint32_t n_threads = 1; n_threads <= max_threads; n_threads++) {
+				std::unique_ptr<ThreadPool> pool;
+
+				if (n_threads > 1)
+					pool = std::make_unique<ThreadPool>(n_threads);
+
+				ObjectStore store;
+				gen_objects(store, n_objects);
+				store.set_isa(isa);
+
+				double best = 0;
+
+				for (uint32_t it = 0; it < n_iterations; it++) {
+					const auto tbegin = Clock::now();
+					store.process_physics(dt, pool.get());
+					const auto tend = Clock::now();
+
+					const double seconds = std::chrono::duration<double>(tend - tbegin).count();
+					best = std::max(best, static_cast<double>(n_objects) / seconds);
+				}
+
+				if (n_threads == 1)
+					single_thread_ops = best;
+
+				const double speedup = best / single_thread_ops;
+
+				std::cout << "objects=" << n_objects
+					<< " isa=" << CubeGeometry::get_isa_str(isa)
+					<< " threads=" << n_threads << ": "
+					<< best << " objects/s, "
+					<< (best / n_threads) << " objects/s per thread"
+					<< std::setprecision(2)
+					<< " speedup=" << speedup
+					<< " efficiency=" << (speedup / n_threads)
+					<< " output=" << (same_state(store, reference) ? "ok" : "MISMATCH")
+					<< std::setprecision(0) << std::endl;
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,304 @@
+/*
+	Check of the shader hot reload of the Opengl renderer, with the headless renderer.
+	The shaders are copied to a temporary directory, which becomes the working directory,
+	and a green cube is drawn every frame while the shader files are edited:
+
+	- a fragment shader that doesn't compile and an emptied vertex shader must keep the running programs,
+	- a fragment shader that paints everything red must replace them while the frames go on,
+	- a new renderer must load the red programs from the program cache,
+	- and compile them from the sources when the cached binaries are corrupted.
+
+	Reports how long each reload took and the slowest frame, and returns failure if a check fails.
+
+	usage: cube3d_bench_shader_reload [--timeout-ms=N]
+
+	Must run from the build directory, where the shaders are copied.
+	Needs inotify, so it only runs on Linux.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <array>
+#include <string>
+#include <string_view>
+#include <filesystem>
+#include <functional>
+#include <algorithm>
+#include <exception>
+
+#include <cstdlib>
+#include <cstdint>
+
+#include "graphics.h"
+#include "opengl/opengl-headless.h"
+
+// -------------------------------------------
+
+using namespace Graphics;
+
+using Clock = std::chrono::steady_clock;
+using Pixel = std::array<uint8_t, 4>;
+
+static constexpr uint32_t width = 64;
+static constexpr uint32_t height = 64;
+
+// the unchanged sources must keep the program for at least this long
+static constexpr int keep_ms = 1500;
+
+// -------------------------------------------
+
+struct Wait {
+	bool ok = false;
+	uint32_t n_frames = 0;
+	double ms = 0;
+	double max_frame_ms = 0;
+};
+
+// -------------------------------------------
+
+static Opengl::HeadlessRenderer* create_renderer ()
+{
+	auto *renderer = new Opengl::HeadlessRenderer(width, height);
+
+	renderer->set_readback(true);
+
+	if (!renderer->set_shader_hot_reload(true)) {
+		delete renderer;
+		return nullptr;
+	}
+
+	return renderer;
+}
+
+// draws a green cube in front of the camera, returns the pixel in the center of the frame
+static Pixel render_frame (Opengl::HeadlessRenderer& renderer)
+{
+	Cube3d cube(fp(1));
+
+	for (Color& color : cube.get_colors_ref())
+		color = Color { .r = 0, .g = 1, .b = 0, .a = 1 };
+
+	renderer.wait_next_frame();
+
+	renderer.setup_projection_matrix(RenderArgs {
+		.world_camera_pos = Vector(0, 0, 3),
+		.world_camera_target = Vector(0, 0, 0),
+		.fovy = Mylib::Math::degrees_to_radians(fp(45)),
+		.z_near = fp(0.1),
+		.z_far = fp(100)
+	});
+
+	renderer.draw_cube3d(cube, Vector(0, 0, 0));
+	renderer.render();
+
+	const std::span<const uint8_t> pixels = renderer.get_pixels();
+	const size_t i = ((height / 2) * width + (width / 2)) * 4;
+
+	return Pixel { pixels[i], pixels[i + 1], pixels[i + 2], pixels[i + 3] };
+}
+
+// renders frames until pred is true or timeout_ms passed
+static Wait wait_frames (Opengl::HeadlessRenderer& renderer, const int timeout_ms, const std::function<bool (const Pixel&)>& pred)
+{
+	Wait w;
+	const Clock::time_point start = Clock::now();
+
+	while (true) {
+		const Clock::time_point frame_start = Clock::now();
+		const Pixel pixel = render_frame(renderer);
+		const Clock::time_point frame_end = Clock::now();
+
+		w.n_frames++;
+		w.max_frame_ms = std::max(w.max_frame_ms, std::chrono::duration<double, std::milli>(frame_end - frame_start).count());
+		w.ms = std::chrono::duration<double, std::milli>(frame_end - start).count();
+
+		if (pred(pixel)) {
+			w.ok = true;
+			break;
+		}
+
+		if (w.ms >= timeout_ms)
+			break;
+	}
+
+	return w;
+}
+
+static std::string read_file (const std::filesystem::path& fname)
+{
+	std::ifstream file(fname, std::ios::binary);
+
+	return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+// written in place, as most editors do, so the watcher sees IN_CLOSE_WRITE
+static void write_file (const std::filesystem::path& fname, const std::string_view content)
+{
+	std::ofstream file(fname, std::ios::binary | std::ios::trunc);
+
+	file.write(content.data(), content.size());
+}
+
+static bool is_green (const Pixel& p)
+{
+	return p[0] < 32 && p[1] > 224 && p[2] < 32;
+}
+
+static bool is_red (const Pixel& p)
+{
+	return p[0] > 224 && p[1] < 32 && p[2] < 32;
+}
+
+// -------------------------------------------
+
+static bool check (const bool ok, const std::string_view what)
+{
+	std::cout << (ok ? "ok     " : "FAILED ") << what << std::endl;
+
+	return ok;
+}
+
+static void print_wait (const Wait& w)
+{
+	std::cout << "       " << w.n_frames << " frames in " << w.ms << " ms, slowest frame " << w.max_frame_ms << " ms" << std::endl;
+}
+
+static bool run (const int timeout_ms)
+{
+	bool ok = true;
+
+	Opengl::HeadlessRenderer *renderer = create_renderer();
+
+	if (renderer == nullptr) {
+		std::cout << "shader hot reload is not supported" << std::endl;
+		return false;
+	}
+
+	const std::string vert = read_file("shaders/triangles.vert");
+	const std::string frag = read_file("shaders/triangles.frag");
+
+	// the first frames also finish the links started by the renderer
+	Wait w = wait_frames(*renderer, timeout_ms, is_green);
+	ok &= check(w.ok, "the cube is green");
+	print_wait(w);
+
+	auto unchanged = [] (const Pixel& p) { return !is_green(p); };
+
+	try {
+		write_file("shaders/triangles.frag", "#version 330\n\nvoid main ()\n{\n\tthis does not compile;\n}\n");
+		w = wait_frames(*renderer, keep_ms, unchanged);
+		ok &= check(!w.ok, "a fragment shader that doesn't compile keeps the program");
+
+		// no line to insert the defines of the programs after
+		write_file("shaders/triangles.vert", "");
+		w = wait_frames(*renderer, keep_ms, unchanged);
+		ok &= check(!w.ok, "an emptied vertex shader keeps the program");
+
+		write_file("shaders/triangles.vert", vert);
+		w = wait_frames(*renderer, keep_ms, unchanged);
+		ok &= check(!w.ok, "the restored vertex shader keeps the cube green");
+
+		std::string red = frag;
+		const size_t pos = red.find("o_color = v_color;");
+
+		if (!check(pos != std::string::npos, "triangles.frag writes o_color = v_color")) {
+			delete renderer;
+			return false;
+		}
+
+		red.replace(pos, std::string_view("o_color = v_color;").size(), "o_color = vec4(1.0, 0.0, 0.0, 1.0);");
+		write_file("shaders/triangles.frag", red);
+
+		w = wait_frames(*renderer, timeout_ms, is_red);
+		ok &= check(w.ok, "a valid fragment shader replaces the program");
+		print_wait(w);
+	}
+	catch (const std::exception& e) {
+		ok &= check(false, std::string("no exception while reloading: ") + e.what());
+	}
+
+	delete renderer;
+
+	// the reloaded programs were stored in the cache
+
+	renderer = create_renderer();
+	w = wait_frames(*renderer, timeout_ms, is_red);
+	ok &= check(w.ok, "a new renderer starts with the reloaded program");
+	ok &= check(renderer->get_program_cache()->get_binary_supported() == false || renderer->get_program_cache()->get_n_hits() > 0, "the new renderer loads programs from the cache");
+	print_wait(w);
+	delete renderer;
+
+	// keep the headers, so the driver is the one that rejects the binaries
+
+	uint32_t n_corrupted = 0;
+
+	if (std::filesystem::is_directory("shader-cache")) {
+		for (const auto& entry : std::filesystem::directory_iterator("shader-cache")) {
+			std::string binary = read_file(entry.path());
+
+			for (size_t i = 8; i < binary.size(); i++)
+				binary[i] ^= 0x5A;
+
+			write_file(entry.path(), binary);
+			n_corrupted++;
+		}
+	}
+
+	renderer = create_renderer();
+	w = wait_frames(*renderer, timeout_ms, is_red);
+	ok &= check(w.ok, "corrupted cached binaries are compiled again from the sources");
+	ok &= check(n_corrupted == 0 || renderer->get_program_cache()->get_n_misses() > 0, "the corrupted binaries are cache misses");
+	print_wait(w);
+	delete renderer;
+
+	return ok;
+}
+
+int main (int argc, char **argv)
+{
+	int timeout_ms = 10000;
+
+	for (int i = 1; i < argc; i++) {
+		const std::string_view arg = argv[i];
+
+		if (arg.starts_with("--timeout-ms="))
+			timeout_ms = std::atoi(arg.data() + std::string_view("--timeout-ms=").size());
+		else {
+			std::cout << "unknown argument " << arg << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!std::filesystem::is_directory("shaders")) {
+		std::cout << "run from the build directory, shaders not found" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	// the edits must not touch the shaders of the build directory, or its program cache
+
+	const std::filesystem::path old_dir = std::filesystem::current_path();
+	const std::filesystem::path tmp_dir = std::filesystem::temp_directory_path() / ("cube3d-shader-reload-" + std::to_string(Clock::now().time_since_epoch().count()));
+
+	std::filesystem::create_directories(tmp_dir);
+	std::filesystem::copy("shaders", tmp_dir / "shaders", std::filesystem::copy_options::recursive);
+	std::filesystem::current_path(tmp_dir);
+
+	bool ok;
+
+	try {
+		ok = run(timeout_ms);
+	}
+	catch (const std::exception& e) {
+		std::cout << "exception: " << e.what() << std::endl;
+		ok = false;
+	}
+
+	std::filesystem::current_path(old_dir);
+	std::filesystem::remove_all(tmp_dir);
+
+	std::cout << (ok ? "all checks passed" : "some checks failed") << std::endl;
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,286 @@
+/*
+	Benchmark of the SpatialGrid kept by an ObjectStore with 1m moving cubes.
+	Reports the cost per frame of keeping the grid updated by process_physics,
+	and the latency of box, sphere, ray and frustum queries, compared to a
+	linear scan of all the objects, which is also used to check the results.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <numbers>
+
+#include <cstdlib>
+#include <cmath>
+
+#include "graphics.h"
+#include "object-store.h"
+#include "spatial-grid.h"
+
+// -------------------------------------------
+
+using namespace Graphics;
+using App::ObjectStore;
+using App::SpatialGrid;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint32_t n_objects = 1000000;
+static constexpr fp_t world_half_size = 50; // objects are in [-50, 50]^3, 1 per m^3
+static constexpr fp_t cell_size = 2;
+static constexpr uint32_t n_frames = 30;
+static constexpr fp_t dt = fp(1) / fp(60);
+static constexpr uint32_t n_queries = 1000;
+static constexpr uint32_t n_frustum_queries = 20;
+static constexpr uint32_t n_checked_queries = 20; // also run with a linear scan
+
+// -------------------------------------------
+
+static void gen_objects (ObjectStore& store)
+{
+	std::mt19937_64 rgenerator(42);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+	for (uint32_t i = 0; i < n_objects; i++) {
+		Cube3d cube(0.1f);
+		cube.set_rotation_axis(Vector(0, 0, 1));
+
+		store.create(cube,
+			Point(dist(rgenerator), dist(rgenerator), dist(rgenerator)) * world_half_size,
+			Vector(dist(rgenerator), dist(rgenerator), dist(rgenerator)),
+			dist(rgenerator) * std::numbers::pi_v<float>);
+	}
+}
+
+static double elapsed_seconds (const Clock::time_point tbegin)
+{
+	return std::chrono::duration<double>(Clock::now() - tbegin).count();
+}
+
+static Sphere get_sphere (const ObjectStore& store, const uint32_t i)
+{
+	return calc_bounding_sphere(store.get_cubes()[i], store.get_positions()[i]);
+}
+
+static fp_t dot (const Vector& a, const Vector& b)
+{
+	return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
+// -------------------------------------------
+
+/*
+	Runs a query n times with the grid, and the first n_checked_queries
+	also with a linear scan, comparing the results.
+	grid_query(q, out) and scan_query(q, out) append the ids found by query q.
+*/
+
+template <typename GridQuery, typename ScanQuery>
+static void bench_query (const char *name, const uint32_t n, GridQuery&& grid_query, ScanQuery&& scan_query)
+{
+	std::vector<SpatialGrid::Id> found;
+	std::vector<SpatialGrid::Id> expected;
+	uint64_t n_found = 0;
+	bool ok = true;
+
+	const auto tbegin = Clock::now();
+
+	for (uint32_t q = 0; q < n; q++) {
+		found.clear();
+		grid_query(q, found);
+		n_found += found.size();
+	}
+
+	const double grid_time = elapsed_seconds(tbegin) / n;
+	double scan_time = 0;
+
+	for (uint32_t q = 0; q < n_checked_queries; q++) {
+		found.clear();
+		expected.clear();
+
+		grid_query(q, found);
+
+		const auto tscan = Clock::now();
+		scan_query(q, expected);
+		scan_time += elapsed_seconds(tscan);
+
+		std::sort(found.begin(), found.end());
+		std::sort(expected.begin(), expected.end());
+
+		ok = ok && (found == expected);
+	}
+
+	scan_time /= n_checked_queries;
+
+	std::cout << std::setprecision(2) << name << ": "
+		<< (grid_time * 1e6) << " us/query, "
+		<< (static_cast<double>(n_found) / n) << " objects/query, "
+		<< "linear scan " << (scan_time * 1e6) << " us/query, "
+		<< "speedup=" << (scan_time / grid_time)
+		<< " output=" << (ok ? "ok" : "MISMATCH") << std::endl;
+}
+
+// -------------------------------------------
+
+int main (int argc, char **argv)
+{
+	std::mt19937_64 rgenerator(7);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+	std::cout << std::fixed;
+	std::cout << "objects=" << n_objects << " cell_size=" << cell_size << " frames=" << n_frames << std::endl;
+
+	ObjectStore store; // with the grid
+	ObjectStore reference; // without the grid, for the cost of the physics alone
+	SpatialGrid grid(cell_size);
+
+	gen_objects(store);
+	gen_objects(reference);
+
+	// build
+
+	{
+		const auto tbegin = Clock::now();
+		store.set_spatial_grid(&grid);
+		std::cout << std::setprecision(2) << "build: " << (elapsed_seconds(tbegin) * 1e3) << " ms" << std::endl;
+	}
+
+	// update per frame
+
+	{
+		double physics_time = 0;
+		double physics_grid_time = 0;
+		const uint64_t n_cell_changes = grid.get_n_cell_changes();
+
+		for (uint32_t frame = 0; frame < n_frames; frame++) {
+			auto tbegin = Clock::now();
+			reference.process_physics(dt);
+			physics_time += elapsed_seconds(tbegin);
+
+			tbegin = Clock::now();
+			store.process_physics(dt);
+			physics_grid_time += elapsed_seconds(tbegin);
+		}
+
+		std::cout << std::setprecision(2) << "update: "
+			<< ((physics_grid_time - physics_time) / n_frames * 1e3) << " ms/frame"
+			<< " (process_physics " << (physics_time / n_frames * 1e3) << " ms/frame without the grid, "
+			<< (physics_grid_time / n_frames * 1e3) << " ms/frame with it), "
+			<< (static_cast<double>(grid.get_n_cell_changes() - n_cell_changes) / n_frames) << " cell changes/frame"
+			<< std::endl;
+	}
+
+	// queries, the same random inputs for the grid and the scan
+
+	std::vector<Point> points(n_queries);
+	std::vector<Vector> directions(n_queries);
+
+	for (uint32_t q = 0; q < n_queries; q++) {
+		points[q] = Point(dist(rgenerator), dist(rgenerator), dist(rgenerator)) * world_half_size;
+		directions[q] = Vector(dist(rgenerator), dist(rgenerator), dist(rgenerator));
+	}
+
+	const Vector box_half_size(2, 2, 2);
+
+	bench_query("box 4x4x4", n_queries,
+		[&] (const uint32_t q, auto& out) {
+			grid.query_box(points[q] - box_half_size, points[q] + box_half_size, out);
+		},
+		[&] (const uint32_t q, auto& out) {
+			const Point min = points[q] - box_half_size;
+			const Point max = points[q] + box_half_size;
+
+			for (uint32_t i = 0; i < store.size(); i++) {
+				const Sphere s = get_sphere(store, i);
+				fp_t distance2 = 0;
+
+				for (uint32_t axis = 0; axis < 3; axis++) {
+					const fp_t v = std::clamp(s.center[axis], min[axis], max[axis]) - s.center[axis];
+					distance2 += v * v;
+				}
+
+				if (distance2 <= (s.radius * s.radius))
+					out.push_back(store.get_handles()[i]);
+			}
+		});
+
+	bench_query("sphere r=2", n_queries,
+		[&] (const uint32_t q, auto& out) {
+			grid.query_sphere(Sphere { .center = points[q], .radius = 2 }, out);
+		},
+		[&] (const uint32_t q, auto& out) {
+			for (uint32_t i = 0; i < store.size(); i++) {
+				const Sphere s = get_sphere(store, i);
+				const Vector d = s.center - points[q];
+
+				if (dot(d, d) <= ((s.radius + 2) * (s.radius + 2)))
+					out.push_back(store.get_handles()[i]);
+			}
+		});
+
+	// the closest hit only, ties between spheres at the same distance are not expected with random positions
+	bench_query("ray", n_queries,
+		[&] (const uint32_t q, auto& out) {
+			const SpatialGrid::RayHit hit = grid.query_ray(points[q], directions[q], 100);
+
+			if (hit.id != SpatialGrid::invalid_id)
+				out.push_back(hit.id);
+		},
+		[&] (const uint32_t q, auto& out) {
+			const Vector& d = directions[q];
+			const fp_t a = dot(d, d);
+			fp_t best_t = 100;
+			SpatialGrid::Id best = SpatialGrid::invalid_id;
+
+			for (uint32_t i = 0; i < store.size(); i++) {
+				const Sphere s = get_sphere(store, i);
+				const Vector oc = points[q] - s.center;
+				const fp_t b = dot(oc, d);
+				const fp_t k = dot(oc, oc) - (s.radius * s.radius);
+				const fp_t discriminant = b*b - a*k;
+
+				if (discriminant < 0)
+					continue;
+
+				fp_t t = (-b - std::sqrt(discriminant)) / a;
+
+				if (t < 0) {
+					if (k > 0)
+						continue;
+					t = 0;
+				}
+
+				if (t <= best_t) {
+					best_t = t;
+					best = store.get_handles()[i];
+				}
+			}
+
+			if (best != SpatialGrid::invalid_id)
+				out.push_back(best);
+		});
+
+	std::vector<Frustum> frustums(n_frustum_queries);
+
+	for (uint32_t q = 0; q < n_frustum_queries; q++) {
+		frustums[q] = Frustum(
+			Mylib::Math::gen_perspective_matrix<fp_t>(Mylib::Math::degrees_to_radians(fp(45)), 800, 800, fp(0.1), fp(30), fp(1))
+			* Mylib::Math::gen_look_at_matrix<fp_t>(points[q], points[q] + directions[q], Vector(0, 1, 0)));
+	}
+
+	bench_query("frustum far=30", n_frustum_queries,
+		[&] (const uint32_t q, auto& out) {
+			grid.query_frustum(frustums[q], out);
+		},
+		[&] (const uint32_t q, auto& out) {
+			for (uint32_t i = 0; i < store.size(); i++) {
+				if (!frustums[q].is_outside(get_sphere(store, i)))
+					out.push_back(store.get_handles()[i]);
+			}
+		});
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,202 @@
+/*
+	Benchmark of the greedy meshing of a VoxelWorld, a terrain of 512x512 columns up to 96 voxels high.
+	Reports the triangles of the meshes, compared to drawing every voxel as a cube
+	and to drawing only the faces that are not hidden, the time to mesh the whole world
+	with 1 up to all hardware threads, and, for edits of a few voxels per frame,
+	the time update_meshes takes from the frame and the calls of update_meshes until the new meshes are published.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <thread>
+
+#include <cstdlib>
+#include <cmath>
+
+#include "graphics.h"
+#include "voxel.h"
+
+// -------------------------------------------
+
+using namespace Graphics;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int32_t world_size = 512; // columns per axis
+static constexpr int32_t max_height = 96;
+static constexpr uint32_t n_edit_frames = 200;
+static constexpr uint32_t n_edits_per_frame = 8;
+
+// -------------------------------------------
+
+static double elapsed_seconds (const Clock::time_point tbegin)
+{
+	return std::chrono::duration<double>(Clock::now() - tbegin).count();
+}
+
+static int32_t get_height (const int32_t x, const int32_t z)
+{
+	const double fx = static_cast<double>(x);
+	const double fz = static_cast<double>(z);
+	const double h = 0.5 + 0.25 * std::sin(fx * 0.031) * std::cos(fz * 0.027) + 0.15 * std::sin((fx + fz) * 0.071) + 0.1 * std::cos(fx * 0.13 - fz * 0.11);
+
+	return std::clamp(static_cast<int32_t>(h * max_height), 1, max_height);
+}
+
+// stone, dirt and grass layers
+static VoxelWorld::Voxel get_color (const int32_t y, const int32_t height)
+{
+	if (y == (height - 1))
+		return VoxelWorld::make_voxel( Color { .r = 0.2f, .g = 0.7f, .b = 0.2f, .a = 1.0f } );
+	else if (y >= (height - 4))
+		return VoxelWorld::make_voxel( Color { .r = 0.5f, .g = 0.35f, .b = 0.2f, .a = 1.0f } );
+	else
+		return VoxelWorld::make_voxel( Color { .r = 0.5f, .g = 0.5f, .b = 0.5f, .a = 1.0f } );
+}
+
+static uint64_t gen_terrain (VoxelWorld& world)
+{
+	uint64_t n_voxels = 0;
+
+	for (int32_t z = 0; z < world_size; z++) {
+		for (int32_t x = 0; x < world_size; x++) {
+			const int32_t height = get_height(x, z);
+
+			for (int32_t y = 0; y < height; y++)
+				world.set_voxel(x, y, z, get_color(y, height));
+
+			n_voxels += height;
+		}
+	}
+
+	return n_voxels;
+}
+
+static uint64_t count_visible_faces (const VoxelWorld& world)
+{
+	uint64_t n_faces = 0;
+
+	for (int32_t z = 0; z < world_size; z++) {
+		for (int32_t x = 0; x < world_size; x++) {
+			for (int32_t y = 0; y < get_height(x, z); y++) {
+				n_faces += static_cast<uint64_t>(world.get_voxel(x - 1, y, z) == 0) + static_cast<uint64_t>(world.get_voxel(x + 1, y, z) == 0)
+					+ static_cast<uint64_t>(world.get_voxel(x, y - 1, z) == 0) + static_cast<uint64_t>(world.get_voxel(x, y + 1, z) == 0)
+					+ static_cast<uint64_t>(world.get_voxel(x, y, z - 1) == 0) + static_cast<uint64_t>(world.get_voxel(x, y, z + 1) == 0);
+			}
+		}
+	}
+
+	return n_faces;
+}
+
+static uint64_t count_mesh_triangles (const VoxelWorld& world)
+{
+	uint64_t n = 0;
+
+	for (const VoxelWorld::Chunk& chunk : world.get_ref_chunks())
+		n += chunk.mesh.size() / 3;
+
+	return n;
+}
+
+// -------------------------------------------
+
+int main ()
+{
+	try {
+		std::cout << std::fixed << std::setprecision(3);
+
+		{
+			VoxelWorld world(fp(0.1));
+
+			const uint64_t n_voxels = gen_terrain(world);
+			world.flush_meshes();
+
+			const uint64_t n_cube_triangles = n_voxels * 12;
+			const uint64_t n_face_triangles = count_visible_faces(world) * 2;
+			const uint64_t n_mesh_triangles = count_mesh_triangles(world);
+
+			std::cout << n_voxels << " voxels in " << world.get_ref_chunks().size() << " chunks" << std::endl;
+			std::cout << "triangles: cubes " << n_cube_triangles
+				<< ", visible faces " << n_face_triangles
+				<< ", greedy mesh " << n_mesh_triangles
+				<< " (" << (static_cast<double>(n_cube_triangles) / static_cast<double>(n_mesh_triangles)) << "x fewer than cubes)" << std::endl;
+		}
+
+		const uint32_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+		for (uint32_t n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+			VoxelWorld world(fp(0.1), n_threads);
+
+			gen_terrain(world);
+
+			const auto tbegin = Clock::now();
+			world.flush_meshes();
+			const double t = elapsed_seconds(tbegin);
+
+			std::cout << "mesh all chunks, " << std::setw(3) << n_threads << " threads: " << std::setw(9) << (t * 1000.0) << " ms, "
+				<< std::setw(8) << (t * 1000.0 / static_cast<double>(world.get_ref_chunks().size())) << " ms per chunk" << std::endl;
+		}
+
+		// edits of the surface, update_meshes is called once per frame as in a game loop
+
+		VoxelWorld world(fp(0.1));
+		gen_terrain(world);
+		world.flush_meshes();
+
+		std::mt19937_64 rgenerator(42);
+		std::uniform_int_distribution<int32_t> dist(0, world_size - 1);
+
+		double update_time = 0;
+		double max_update_time = 0;
+		uint64_t n_frames_to_publish = 0;
+		uint64_t n_published = 0;
+
+		for (uint32_t frame = 0; frame < n_edit_frames; frame++) {
+			for (uint32_t i = 0; i < n_edits_per_frame; i++) {
+				const int32_t x = dist(rgenerator);
+				const int32_t z = dist(rgenerator);
+				const int32_t y = get_height(x, z) - 1;
+
+				world.set_voxel(x, y, z, (world.get_voxel(x, y, z) == 0) ? get_color(y, y + 1) : 0);
+			}
+
+			uint32_t frames = 0;
+			uint32_t published = 0;
+
+			// the frames of the game loop until this frame's edits are published
+			while (true) {
+				const auto tbegin = Clock::now();
+				published += world.update_meshes();
+				const double t = elapsed_seconds(tbegin);
+
+				update_time += t;
+				max_update_time = std::max(max_update_time, t);
+				frames++;
+
+				if (!world.is_meshing())
+					break;
+
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+
+			n_frames_to_publish += frames;
+			n_published += published;
+		}
+
+		std::cout << n_edits_per_frame << " edits per frame: update_meshes " << (update_time * 1000.0 / static_cast<double>(n_frames_to_publish)) << " ms avg, "
+			<< (max_update_time * 1000.0) << " ms max, "
+			<< (static_cast<double>(n_published) / n_edit_frames) << " chunks meshed per edit frame, "
+			<< (static_cast<double>(n_frames_to_publish) / n_edit_frames) << " calls, 100 us apart, until published" << std::endl;
+
+		return EXIT_SUCCESS;
+	}
+	catch (const std::exception& e) {
+		std::cout << "error: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
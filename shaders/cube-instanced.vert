@@ -0,0 +1,35 @@
+#version 330
+
+in vec3 i_position; // unit cube coords, in range [-0.5, 0.5]
+in vec4 i_center_size; // xyz = center of the cube, w = width
+in vec4 i_rotation; // unit quaternion
+in vec4 i_color0;
+in vec4 i_color1;
+in vec4 i_color2;
+in vec4 i_color3;
+in vec4 i_color4;
+in vec4 i_color5;
+in vec4 i_color6;
+in vec4 i_color7;
+
+out vec4 v_color;
+
+uniform mat4 u_projection_matrix;
+
+vec3 rotate (vec4 q, vec3 v)
+{
+	return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);
+}
+
+void main ()
+{
+	vec4 colors[8] = vec4[8](i_color0, i_color1, i_color2, i_color3, i_color4, i_color5, i_color6, i_color7);
+
+	// same order as Cube3d::PositionIndex
+	int corner = (i_position.x > 0.0 ? 2 : 0) + (i_position.y < 0.0 ? 1 : 0) + (i_position.z > 0.0 ? 4 : 0);
+
+	v_color = colors[corner];
+
+	vec3 world_pos = i_center_size.xyz + rotate(i_rotation, i_position * i_center_size.w);
+	gl_Position = u_projection_matrix * vec4(world_pos, 1.0);
+}
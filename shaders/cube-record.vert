@@ -0,0 +1,21 @@
+#version 330
+
+// Passes an instance record (see ProgramCubeInstanced::Instance) to a geometry shader, one point per cube.
+
+in vec4 i_center_size; // xyz = center of the cube, w = width, 0 for free slots
+in vec4 i_rotation; // unit quaternion
+in uvec4 i_colors0; // rgba8 colors of the corners 0 to 3
+in uvec4 i_colors1; // rgba8 colors of the corners 4 to 7
+
+out vec4 g_center_size;
+out vec4 g_rotation;
+flat out uvec4 g_colors0;
+flat out uvec4 g_colors1;
+
+void main ()
+{
+	g_center_size = i_center_size;
+	g_rotation = i_rotation;
+	g_colors0 = i_colors0;
+	g_colors1 = i_colors1;
+}
\ No newline at end of file
@@ -0,0 +1,15 @@
+#version 330
+
+in vec4 i_center_size; // xyz = center of the cube, w = projected size in pixels
+in vec4 i_color; // rgba8, average of the corners
+
+out vec4 v_color;
+
+uniform mat4 u_projection_matrix;
+
+void main ()
+{
+	v_color = i_color;
+	gl_Position = u_projection_matrix * vec4(i_center_size.xyz, 1.0);
+	gl_PointSize = i_center_size.w;
+}
\ No newline at end of file
@@ -1,8 +1,22 @@
 #version 330
 
-in vec3 i_position;
-in vec3 i_offset;
-in vec4 i_color;
+#ifdef PACKED_VERTEX
+	in vec3 i_position; // snorm16, in units of the cube scale
+	in vec4 i_color; // rgba8
+
+	uniform samplerBuffer u_cubes; // one texel per cube: xyz = offset, w = scale
+	uniform int u_first_object; // first cube of the texture buffer range, see TextureBufferBatches
+#elif defined(OBJECT_TRANSFORM)
+	in vec3 i_position; // object local coords, not rotated
+	in vec4 i_color; // rgba8
+
+	uniform samplerBuffer u_transforms; // two texels per object: rotation quaternion, translation
+	uniform int u_first_object; // first object of the texture buffer range, see TextureBufferBatches
+#else
+	in vec3 i_position;
+	in vec3 i_offset;
+	in vec4 i_color;
+#endif
 
 out vec4 v_color;
 
@@ -11,6 +25,17 @@ uniform mat4 u_projection_matrix;
 void main ()
 {
 	v_color = i_color;
+#ifdef PACKED_VERTEX
+	vec4 cube = texelFetch(u_cubes, gl_VertexID / 36 - u_first_object);
+	gl_Position = u_projection_matrix * vec4( (cube.xyz + i_position * cube.w), 1.0 );
+#elif defined(OBJECT_TRANSFORM)
+	int object = gl_VertexID / 36 - u_first_object;
+	vec4 q = texelFetch(u_transforms, object * 2);
+	vec3 translation = texelFetch(u_transforms, object * 2 + 1).xyz;
+	vec3 rotated = i_position + 2.0 * cross(q.xyz, cross(q.xyz, i_position) + q.w * i_position);
+	gl_Position = u_projection_matrix * vec4( (translation + rotated), 1.0 );
+#else
 	gl_Position = u_projection_matrix * vec4( (i_offset + i_position), 1.0 );
+#endif
 	//gl_Position = i_position;
 }
\ No newline at end of file
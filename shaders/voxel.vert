@@ -0,0 +1,16 @@
+#version 330
+
+in vec3 i_position; // in voxels, relative to the chunk origin
+in vec4 i_color; // rgba8
+
+out vec4 v_color;
+
+uniform mat4 u_projection_matrix;
+uniform vec3 u_chunk_origin; // world coords
+uniform float u_voxel_size;
+
+void main ()
+{
+	v_color = i_color;
+	gl_Position = u_projection_matrix * vec4( (u_chunk_origin + i_position * u_voxel_size), 1.0 );
+}
\ No newline at end of file
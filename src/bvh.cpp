@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <tuple>
+
+#include "bvh.h"
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+
+// ---------------------------------------------------
+
+static inline fp_t calc_surface_area (const Point& min, const Point& max) noexcept
+{
+	const Vector size = max - min;
+	return fp(2) * (size.x*size.y + size.y*size.z + size.z*size.x);
+}
+
+void SphereBvh::update (std::span<const Sphere> spheres)
+{
+	if (spheres.size() != this->sphere_ids.size()) {
+		this->build(spheres);
+		return;
+	}
+
+	const fp_t cost = this->refit(spheres);
+	this->n_refits++;
+
+	if (cost > (this->built_cost * rebuild_cost_ratio))
+		this->build(spheres);
+}
+
+void SphereBvh::build (std::span<const Sphere> spheres)
+{
+	const uint32_t n = spheres.size();
+
+	this->nodes.clear();
+	this->sphere_ids.resize(n);
+
+	for (uint32_t i = 0; i < n; i++)
+		this->sphere_ids[i] = i;
+
+	if (n > 0) {
+		this->nodes.reserve(2 * ((n + leaf_size - 1) / leaf_size));
+		this->build_node(spheres, 0, n);
+	}
+
+	this->built_cost = this->refit(spheres);
+	this->n_builds++;
+}
+
+uint32_t SphereBvh::build_node (std::span<const Sphere> spheres, const uint32_t first, const uint32_t count)
+{
+	const uint32_t node_id = this->nodes.size();
+
+	this->nodes.push_back(Node {
+		.min = Point::zero(),
+		.max = Point::zero(),
+		.first = first,
+		.count = count,
+		.second_child = 0
+	});
+
+	if (count <= leaf_size)
+		return node_id;
+
+	// split at the median of the longest axis of the centers
+
+	Point cmin = spheres[ this->sphere_ids[first] ].center;
+	Point cmax = cmin;
+
+	for (uint32_t i = first + 1; i < (first + count); i++) {
+		const Point& c = spheres[ this->sphere_ids[i] ].center;
+
+		for (uint32_t axis = 0; axis < 3; axis++) {
+			cmin[axis] = std::min(cmin[axis], c[axis]);
+			cmax[axis] = std::max(cmax[axis], c[axis]);
+		}
+	}
+
+	const Vector size = cmax - cmin;
+	uint32_t axis = 0;
+
+	if (size[1] > size[axis])
+		axis = 1;
+	if (size[2] > size[axis])
+		axis = 2;
+
+	const auto begin = this->sphere_ids.begin() + first;
+	const auto middle = begin + (count / 2);
+
+	std::nth_element(begin, middle, begin + count, [spheres, axis] (const uint32_t a, const uint32_t b) {
+		return spheres[a].center[axis] < spheres[b].center[axis];
+	});
+
+	this->build_node(spheres, first, count / 2);
+	const uint32_t second_child = this->build_node(spheres, first + (count / 2), count - (count / 2));
+
+	this->nodes[node_id].second_child = second_child;
+
+	return node_id;
+}
+
+fp_t SphereBvh::refit (std::span<const Sphere> spheres)
+{
+	fp_t cost = 0;
+
+	// children are always after their parent
+	for (uint32_t i = this->nodes.size(); i-- > 0; ) {
+		Node& node = this->nodes[i];
+
+		if (node.second_child == 0) {
+			node.min = Point(std::numeric_limits<fp_t>::max(), std::numeric_limits<fp_t>::max(), std::numeric_limits<fp_t>::max());
+			node.max = Point(std::numeric_limits<fp_t>::lowest(), std::numeric_limits<fp_t>::lowest(), std::numeric_limits<fp_t>::lowest());
+
+			for (uint32_t j = node.first; j < (node.first + node.count); j++) {
+				const Sphere& s = spheres[ this->sphere_ids[j] ];
+
+				for (uint32_t axis = 0; axis < 3; axis++) {
+					node.min[axis] = std::min(node.min[axis], s.center[axis] - s.radius);
+					node.max[axis] = std::max(node.max[axis], s.center[axis] + s.radius);
+				}
+			}
+		}
+		else {
+			const Node& a = this->nodes[i + 1];
+			const Node& b = this->nodes[node.second_child];
+
+			for (uint32_t axis = 0; axis < 3; axis++) {
+				node.min[axis] = std::min(a.min[axis], b.min[axis]);
+				node.max[axis] = std::max(a.max[axis], b.max[axis]);
+			}
+		}
+
+		cost += calc_surface_area(node.min, node.max);
+	}
+
+	return cost;
+}
+
+uint32_t SphereBvh::cull (const Frustum& frustum, std::span<const Sphere> spheres, std::vector<uint8_t>& visible) const
+{
+	struct StackEntry {
+		uint32_t node_id;
+		uint32_t plane_mask; // planes that still need to be tested, the node is inside the others
+	};
+
+	constexpr uint32_t all_planes = (1 << std::tuple_size_v<decltype(Frustum::planes)>) - 1;
+
+	visible.assign(spheres.size(), 0);
+
+	if (this->nodes.empty())
+		return 0;
+
+	uint32_t n_visible = 0;
+
+	// depth is about log2(n / leaf_size), 64 entries are enough for any uint32_t n
+	std::array<StackEntry, 64> stack;
+	uint32_t stack_size = 0;
+
+	stack[stack_size++] = StackEntry { .node_id = 0, .plane_mask = all_planes };
+
+	while (stack_size > 0) {
+		const StackEntry entry = stack[--stack_size];
+		const Node& node = this->nodes[entry.node_id];
+		uint32_t plane_mask = entry.plane_mask;
+		bool outside = false;
+
+		for (uint32_t p = 0; p < frustum.planes.size(); p++) {
+			if (!(plane_mask & (1 << p)))
+				continue;
+
+			const Frustum::Plane& plane = frustum.planes[p];
+			fp_t near_distance = plane.d; // corner farthest along the normal
+			fp_t far_distance = plane.d; // corner farthest against the normal
+
+			for (uint32_t axis = 0; axis < 3; axis++) {
+				const fp_t n = plane.normal[axis];
+				near_distance += n * ((n >= 0) ? node.max[axis] : node.min[axis]);
+				far_distance += n * ((n >= 0) ? node.min[axis] : node.max[axis]);
+			}
+
+			if (near_distance < 0) {
+				outside = true;
+				break;
+			}
+
+			if (far_distance >= 0)
+				plane_mask &= ~(1 << p);
+		}
+
+		if (outside)
+			continue;
+
+		if (plane_mask == 0) {
+			// the whole subtree is inside
+			for (uint32_t j = node.first; j < (node.first + node.count); j++)
+				visible[ this->sphere_ids[j] ] = 1;
+			n_visible += node.count;
+		}
+		else if (node.second_child == 0) {
+			for (uint32_t j = node.first; j < (node.first + node.count); j++) {
+				const uint32_t id = this->sphere_ids[j];
+
+				if (!frustum.is_outside(spheres[id])) {
+					visible[id] = 1;
+					n_visible++;
+				}
+			}
+		}
+		else {
+			stack[stack_size++] = StackEntry { .node_id = node.second_child, .plane_mask = plane_mask };
+			stack[stack_size++] = StackEntry { .node_id = entry.node_id + 1, .plane_mask = plane_mask };
+		}
+	}
+
+	return n_visible;
+}
+
+// ---------------------------------------------------
+
+} // end namespace Graphics
@@ -0,0 +1,80 @@
+#ifndef __CUBE3D_SDL_BVH_HEADER_H__
+#define __CUBE3D_SDL_BVH_HEADER_H__
+
+#include <span>
+#include <vector>
+
+#include <cstdint>
+
+#include <my-lib/std.h>
+#include <my-lib/macros.h>
+
+#include "graphics.h"
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+
+// ---------------------------------------------------
+
+/*
+	Bounding volume hierarchy of spheres, used for frustum culling.
+	The nodes are axis aligned boxes, built top-down splitting at the median of
+	the longest axis, with up to leaf_size spheres per leaf.
+	Nodes are stored in depth-first order, the first child of a node is the next node,
+	so the whole tree is refitted bottom-up by a single reverse loop.
+	The spheres of a subtree are a contiguous range of sphere_ids.
+
+	update refits the tree when the spheres move, without changing its topology,
+	which keeps it correct but makes the boxes loose as the spheres scatter.
+	It is rebuilt when the number of spheres changes, or when the refitted tree costs
+	more than rebuild_cost_ratio times the cost just after the last build
+	(cost = sum of the surface areas of the nodes).
+*/
+
+class SphereBvh
+{
+public:
+	static constexpr uint32_t leaf_size = 8;
+	static constexpr fp_t rebuild_cost_ratio = 2;
+
+protected:
+	struct Node {
+		Point min;
+		Point max;
+		uint32_t first; // first element of sphere_ids of the subtree
+		uint32_t count; // spheres of the subtree
+		uint32_t second_child; // 0 for leaves, the root is never a child
+	};
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> sphere_ids;
+	fp_t built_cost = 0;
+
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(uint64_t, n_builds, 0)
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(uint64_t, n_refits, 0)
+
+protected:
+	uint32_t build_node (std::span<const Sphere> spheres, const uint32_t first, const uint32_t count);
+	void build (std::span<const Sphere> spheres);
+	fp_t refit (std::span<const Sphere> spheres); // returns the cost of the tree
+
+public:
+	// refits or rebuilds the tree for the new positions of the spheres
+	void update (std::span<const Sphere> spheres);
+
+	/*
+		visible[i] = 1 if sphere i intersects the frustum, 0 otherwise.
+		spheres must be the ones of the last update.
+		Subtrees completely inside the frustum are accepted without testing their spheres.
+		Returns the number of visible spheres.
+	*/
+	uint32_t cull (const Frustum& frustum, std::span<const Sphere> spheres, std::vector<uint8_t>& visible) const;
+};
+
+// ---------------------------------------------------
+
+} // end namespace Graphics
+
+#endif
@@ -0,0 +1,45 @@
+// compiled with -mavx2 (or /arch:AVX2), only called when cpuid reports avx2
+
+#include "cube-geometry-kernel.h"
+
+#ifdef CUBE3D_SIMD_X86
+
+#include <immintrin.h>
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+namespace CubeGeometry
+{
+
+// ---------------------------------------------------
+
+namespace {
+
+struct Avx2Ops {
+	using V = __m256;
+	static constexpr uint32_t n_lanes = 8;
+	static inline V load (const float *p) { return _mm256_loadu_ps(p); }
+	static inline void store (float *p, const V v) { _mm256_storeu_ps(p, v); }
+	static inline V set1 (const float v) { return _mm256_set1_ps(v); }
+	static inline V add (const V a, const V b) { return _mm256_add_ps(a, b); }
+	static inline V sub (const V a, const V b) { return _mm256_sub_ps(a, b); }
+	static inline V mul (const V a, const V b) { return _mm256_mul_ps(a, b); }
+};
+
+} // end anonymous namespace
+
+// ---------------------------------------------------
+
+void calc_corners_kernel_avx2 (const KernelInput& in, const KernelOutput& out, const uint32_t n)
+{
+	calc_corners_kernel_lanes<Avx2Ops>(in, out, n);
+}
+
+// ---------------------------------------------------
+
+} // end namespace CubeGeometry
+} // end namespace Graphics
+
+#endif
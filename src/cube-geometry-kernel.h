@@ -0,0 +1,159 @@
+#ifndef __CUBE3D_SDL_CUBE_GEOMETRY_KERNEL_HEADER_H__
+#define __CUBE3D_SDL_CUBE_GEOMETRY_KERNEL_HEADER_H__
+
+/*
+	Internal header of cube-geometry.cpp.
+	The kernels are compiled in different translation units with different
+	instruction set flags, so this header must not include anything with
+	inline functions that could be shared with the rest of the program.
+*/
+
+#include <cstdint>
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+namespace CubeGeometry
+{
+
+// ---------------------------------------------------
+
+// SoA input, n elements per array
+struct KernelInput {
+	const float *half_w;
+	const float *dx, *dy, *dz; // Shape::delta
+	const float *kx, *ky, *kz; // normalized rotation axis
+	const float *c, *s; // cosine and sine of the rotation angle
+};
+
+// SoA output, element i of corner j is at x[j*n + i]
+struct KernelOutput {
+	float *x, *y, *z;
+};
+
+void calc_corners_kernel_scalar (const KernelInput& in, const KernelOutput& out, const uint32_t n);
+
+#ifdef CUBE3D_SIMD_X86
+	void calc_corners_kernel_sse (const KernelInput& in, const KernelOutput& out, const uint32_t n);
+	void calc_corners_kernel_avx2 (const KernelInput& in, const KernelOutput& out, const uint32_t n);
+#endif
+
+// ---------------------------------------------------
+
+// Internal linkage, so each translation unit keeps the copy
+// compiled with its own instruction set flags.
+
+namespace {
+
+// ---------------------------------------------------
+
+/*
+	Generic kernel, Ops provides the vector type V and its operations.
+	R = cos*I + sin*[k]x + (1 - cos)*k*k^T
+	corner = R*delta + R*(half_w * sign) = center + sx*col0 + sy*col1 + sz*col2
+*/
+
+template <typename Ops>
+inline void calc_corners_kernel (const KernelInput& in, const KernelOutput& out, const uint32_t i, const uint32_t n)
+{
+	using V = typename Ops::V;
+
+	const V one = Ops::set1(1.0f);
+
+	const V kx = Ops::load(in.kx + i);
+	const V ky = Ops::load(in.ky + i);
+	const V kz = Ops::load(in.kz + i);
+	const V c = Ops::load(in.c + i);
+	const V s = Ops::load(in.s + i);
+	const V t = Ops::sub(one, c);
+
+	const V txy = Ops::mul(Ops::mul(t, kx), ky);
+	const V txz = Ops::mul(Ops::mul(t, kx), kz);
+	const V tyz = Ops::mul(Ops::mul(t, ky), kz);
+	const V skx = Ops::mul(s, kx);
+	const V sky = Ops::mul(s, ky);
+	const V skz = Ops::mul(s, kz);
+
+	const V r00 = Ops::add(Ops::mul(Ops::mul(t, kx), kx), c);
+	const V r01 = Ops::sub(txy, skz);
+	const V r02 = Ops::add(txz, sky);
+	const V r10 = Ops::add(txy, skz);
+	const V r11 = Ops::add(Ops::mul(Ops::mul(t, ky), ky), c);
+	const V r12 = Ops::sub(tyz, skx);
+	const V r20 = Ops::sub(txz, sky);
+	const V r21 = Ops::add(tyz, skx);
+	const V r22 = Ops::add(Ops::mul(Ops::mul(t, kz), kz), c);
+
+	const V dx = Ops::load(in.dx + i);
+	const V dy = Ops::load(in.dy + i);
+	const V dz = Ops::load(in.dz + i);
+	const V h = Ops::load(in.half_w + i);
+
+	const V cx = Ops::add(Ops::add(Ops::mul(r00, dx), Ops::mul(r01, dy)), Ops::mul(r02, dz));
+	const V cy = Ops::add(Ops::add(Ops::mul(r10, dx), Ops::mul(r11, dy)), Ops::mul(r12, dz));
+	const V cz = Ops::add(Ops::add(Ops::mul(r20, dx), Ops::mul(r21, dy)), Ops::mul(r22, dz));
+
+	// rotated half axes: right, up and back
+	const V ax = Ops::mul(h, r00), ay = Ops::mul(h, r10), az = Ops::mul(h, r20);
+	const V bx = Ops::mul(h, r01), by = Ops::mul(h, r11), bz = Ops::mul(h, r21);
+	const V ex = Ops::mul(h, r02), ey = Ops::mul(h, r12), ez = Ops::mul(h, r22);
+
+	// left/right combined with top/bottom
+	const V ltx = Ops::add(Ops::sub(cx, ax), bx), lty = Ops::add(Ops::sub(cy, ay), by), ltz = Ops::add(Ops::sub(cz, az), bz);
+	const V lbx = Ops::sub(Ops::sub(cx, ax), bx), lby = Ops::sub(Ops::sub(cy, ay), by), lbz = Ops::sub(Ops::sub(cz, az), bz);
+	const V rtx = Ops::add(Ops::add(cx, ax), bx), rty = Ops::add(Ops::add(cy, ay), by), rtz = Ops::add(Ops::add(cz, az), bz);
+	const V rbx = Ops::sub(Ops::add(cx, ax), bx), rby = Ops::sub(Ops::add(cy, ay), by), rbz = Ops::sub(Ops::add(cz, az), bz);
+
+	auto store = [&out, i, n] (const uint32_t corner, const V x, const V y, const V z) {
+		Ops::store(out.x + corner*n + i, x);
+		Ops::store(out.y + corner*n + i, y);
+		Ops::store(out.z + corner*n + i, z);
+	};
+
+	// same order as Cube3d::PositionIndex
+	store(0, Ops::sub(ltx, ex), Ops::sub(lty, ey), Ops::sub(ltz, ez)); // LeftTopFront
+	store(1, Ops::sub(lbx, ex), Ops::sub(lby, ey), Ops::sub(lbz, ez)); // LeftBottomFront
+	store(2, Ops::sub(rtx, ex), Ops::sub(rty, ey), Ops::sub(rtz, ez)); // RightTopFront
+	store(3, Ops::sub(rbx, ex), Ops::sub(rby, ey), Ops::sub(rbz, ez)); // RightBottomFront
+	store(4, Ops::add(ltx, ex), Ops::add(lty, ey), Ops::add(ltz, ez)); // LeftTopBack
+	store(5, Ops::add(lbx, ex), Ops::add(lby, ey), Ops::add(lbz, ez)); // LeftBottomBack
+	store(6, Ops::add(rtx, ex), Ops::add(rty, ey), Ops::add(rtz, ez)); // RightTopBack
+	store(7, Ops::add(rbx, ex), Ops::add(rby, ey), Ops::add(rbz, ez)); // RightBottomBack
+}
+
+struct ScalarOps {
+	using V = float;
+	static constexpr uint32_t n_lanes = 1;
+	static inline V load (const float *p) { return *p; }
+	static inline void store (float *p, const V v) { *p = v; }
+	static inline V set1 (const float v) { return v; }
+	static inline V add (const V a, const V b) { return a + b; }
+	static inline V sub (const V a, const V b) { return a - b; }
+	static inline V mul (const V a, const V b) { return a * b; }
+};
+
+// processes the elements that don't fill a whole vector
+
+template <typename Ops>
+inline void calc_corners_kernel_lanes (const KernelInput& in, const KernelOutput& out, const uint32_t n)
+{
+	uint32_t i = 0;
+
+	for (; (i + Ops::n_lanes) <= n; i += Ops::n_lanes)
+		calc_corners_kernel<Ops>(in, out, i, n);
+
+	for (; i < n; i++)
+		calc_corners_kernel<ScalarOps>(in, out, i, n);
+}
+
+// ---------------------------------------------------
+
+} // end anonymous namespace
+
+// ---------------------------------------------------
+
+} // end namespace CubeGeometry
+} // end namespace Graphics
+
+#endif
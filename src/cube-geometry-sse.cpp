@@ -0,0 +1,43 @@
+#include "cube-geometry-kernel.h"
+
+#ifdef CUBE3D_SIMD_X86
+
+#include <immintrin.h>
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+namespace CubeGeometry
+{
+
+// ---------------------------------------------------
+
+namespace {
+
+struct SseOps {
+	using V = __m128;
+	static constexpr uint32_t n_lanes = 4;
+	static inline V load (const float *p) { return _mm_loadu_ps(p); }
+	static inline void store (float *p, const V v) { _mm_storeu_ps(p, v); }
+	static inline V set1 (const float v) { return _mm_set1_ps(v); }
+	static inline V add (const V a, const V b) { return _mm_add_ps(a, b); }
+	static inline V sub (const V a, const V b) { return _mm_sub_ps(a, b); }
+	static inline V mul (const V a, const V b) { return _mm_mul_ps(a, b); }
+};
+
+} // end anonymous namespace
+
+// ---------------------------------------------------
+
+void calc_corners_kernel_sse (const KernelInput& in, const KernelOutput& out, const uint32_t n)
+{
+	calc_corners_kernel_lanes<SseOps>(in, out, n);
+}
+
+// ---------------------------------------------------
+
+} // end namespace CubeGeometry
+} // end namespace Graphics
+
+#endif
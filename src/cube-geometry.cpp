@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <utility>
+#include <array>
+
+#include <cmath>
+
+#ifdef CUBE3D_SIMD_X86
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#endif
+#endif
+
+#include <my-lib/std.h>
+
+#include "cube-geometry.h"
+#include "cube-geometry-kernel.h"
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+namespace CubeGeometry
+{
+
+// ---------------------------------------------------
+
+const char* get_isa_str (const Isa isa)
+{
+	static constexpr auto strs = std::to_array<const char*>({
+		"Scalar",
+		"Sse",
+		"Avx2"
+	});
+
+	mylib_assert_exception_msg(std::to_underlying(isa) < strs.size(), "invalid enum class value ", std::to_underlying(isa))
+
+	return strs[ std::to_underlying(isa) ];
+}
+
+Isa get_best_isa ()
+{
+#ifdef CUBE3D_SIMD_X86
+	#if defined(_MSC_VER)
+		int regs[4];
+
+		__cpuid(regs, 1);
+		const bool osxsave = (regs[2] & (1 << 27)) != 0;
+		const bool avx = (regs[2] & (1 << 28)) != 0;
+
+		__cpuidex(regs, 7, 0);
+		const bool avx2 = (regs[1] & (1 << 5)) != 0;
+
+		// the os must save the ymm registers
+		if (osxsave && avx && avx2 && ((_xgetbv(0) & 0x06) == 0x06))
+			return Isa::Avx2;
+
+		return Isa::Sse; // sse2 is part of x86-64
+	#else
+		__builtin_cpu_init();
+
+		if (__builtin_cpu_supports("avx2"))
+			return Isa::Avx2;
+		if (__builtin_cpu_supports("sse2"))
+			return Isa::Sse;
+	#endif
+#endif
+
+	return Isa::Scalar;
+}
+
+Corners calc_corners (const Cube3d& cube)
+{
+	const Vector local_pos = cube.get_value_delta();
+
+	using enum Cube3d::PositionIndex;
+	
+	Corners points;
+
+	points[LeftTopFront] = Point(
+		local_pos.x - cube.get_w()*fp(0.5),
+		local_pos.y + cube.get_h()*fp(0.5),
+		local_pos.z - cube.get_d()*fp(0.5)
+		);
+	
+	points[LeftBottomFront] = Point(
+		local_pos.x - cube.get_w()*fp(0.5),
+		local_pos.y - cube.get_h()*fp(0.5),
+		local_pos.z - cube.get_d()*fp(0.5)
+		);
+	
+	points[RightTopFront] = Point(
+		local_pos.x + cube.get_w()*fp(0.5),
+		local_pos.y + cube.get_h()*fp(0.5),
+		local_pos.z - cube.get_d()*fp(0.5)
+		);
+	
+	points[RightBottomFront] = Point(
+		local_pos.x + cube.get_w()*fp(0.5),
+		local_pos.y - cube.get_h()*fp(0.5),
+		local_pos.z - cube.get_d()*fp(0.5)
+		);
+	
+	points[LeftTopBack] = Point(
+		local_pos.x - cube.get_w()*fp(0.5),
+		local_pos.y + cube.get_h()*fp(0.5),
+		local_pos.z + cube.get_d()*fp(0.5)
+		);
+	
+	points[LeftBottomBack] = Point(
+		local_pos.x - cube.get_w()*fp(0.5),
+		local_pos.y - cube.get_h()*fp(0.5),
+		local_pos.z + cube.get_d()*fp(0.5)
+		);
+	
+	points[RightTopBack] = Point(
+		local_pos.x + cube.get_w()*fp(0.5),
+		local_pos.y + cube.get_h()*fp(0.5),
+		local_pos.z + cube.get_d()*fp(0.5)
+		);
+	
+	points[RightBottomBack] = Point(
+		local_pos.x + cube.get_w()*fp(0.5),
+		local_pos.y - cube.get_h()*fp(0.5),
+		local_pos.z + cube.get_d()*fp(0.5)
+		);
+	
+	if (cube.get_rotation_angle() != fp(0)) {
+		for (auto& p : points)
+			p.rotate_around_axis(cube.get_ref_rotation_axis(), cube.get_rotation_angle());
+	}
+
+	return points;
+}
+
+void calc_corners_batch (const Isa isa, std::span<const Cube3d> cubes, std::span<Corners> corners)
+{
+	// cubes are processed in blocks that fit in the L1 cache
+	constexpr uint32_t block_size = 128;
+	constexpr uint32_t n_corners = Cube3d::get_n_vertices();
+
+	struct alignas(32) Block {
+		float half_w[block_size];
+		float dx[block_size], dy[block_size], dz[block_size];
+		float kx[block_size], ky[block_size], kz[block_size];
+		float c[block_size], s[block_size];
+		float x[n_corners * block_size], y[n_corners * block_size], z[n_corners * block_size];
+	};
+
+	Block block;
+
+	const KernelInput in = {
+		.half_w = block.half_w,
+		.dx = block.dx, .dy = block.dy, .dz = block.dz,
+		.kx = block.kx, .ky = block.ky, .kz = block.kz,
+		.c = block.c, .s = block.s
+	};
+
+	const KernelOutput out = { .x = block.x, .y = block.y, .z = block.z };
+
+	mylib_assert_exception(corners.size() >= cubes.size())
+
+	for (size_t first = 0; first < cubes.size(); first += block_size) {
+		const uint32_t n = static_cast<uint32_t>( std::min<size_t>(block_size, cubes.size() - first) );
+
+		// AoS -> SoA, sine and cosine once per cube
+
+		for (uint32_t i = 0; i < n; i++) {
+			const Cube3d& cube = cubes[first + i];
+			const Vector& delta = cube.get_ref_delta();
+			const Vector& axis = cube.get_ref_rotation_axis();
+			const fp_t length = axis.length();
+			const fp_t angle = (length > fp(0)) ? cube.get_rotation_angle() : fp(0);
+			const fp_t inv_length = (length > fp(0)) ? (fp(1) / length) : fp(0);
+
+			block.half_w[i] = cube.get_w() * fp(0.5);
+			block.dx[i] = delta.x;
+			block.dy[i] = delta.y;
+			block.dz[i] = delta.z;
+			block.kx[i] = axis.x * inv_length;
+			block.ky[i] = axis.y * inv_length;
+			block.kz[i] = axis.z * inv_length;
+			block.c[i] = std::cos(angle);
+			block.s[i] = std::sin(angle);
+		}
+
+		switch (isa) {
+		#ifdef CUBE3D_SIMD_X86
+			case Isa::Avx2:
+				calc_corners_kernel_avx2(in, out, n);
+			break;
+
+			case Isa::Sse:
+				calc_corners_kernel_sse(in, out, n);
+			break;
+		#endif
+
+			default:
+				calc_corners_kernel_scalar(in, out, n);
+		}
+
+		// SoA -> AoS
+
+		for (uint32_t i = 0; i < n; i++) {
+			Corners& dest = corners[first + i];
+
+			for (uint32_t j = 0; j < n_corners; j++)
+				dest[j] = Point(block.x[j*n + i], block.y[j*n + i], block.z[j*n + i]);
+		}
+	}
+}
+
+void calc_corners_kernel_scalar (const KernelInput& in, const KernelOutput& out, const uint32_t n)
+{
+	calc_corners_kernel_lanes<ScalarOps>(in, out, n);
+}
+
+// ---------------------------------------------------
+
+} // end namespace CubeGeometry
+} // end namespace Graphics
@@ -0,0 +1,132 @@
+#ifndef __CUBE3D_SDL_CUBE_GEOMETRY_HEADER_H__
+#define __CUBE3D_SDL_CUBE_GEOMETRY_HEADER_H__
+
+#include <span>
+#include <array>
+
+#include "graphics.h"
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+namespace CubeGeometry
+{
+
+// ---------------------------------------------------
+
+// corners of a cube relative to the object position, indexed by Cube3d::PositionIndex
+using Corners = std::array<Point, Cube3d::get_n_vertices()>;
+
+// 6 faces * 2 triangles per face * 3 vertices per triangle
+// counter-clockwise when seen from outside the cube, which is the front face for GL_CULL_FACE
+
+inline constexpr auto triangles = [] () {
+	using enum Cube3d::PositionIndex;
+
+	return std::to_array<Cube3d::PositionIndex>({
+		// bottom
+		LeftBottomFront, RightBottomFront, LeftBottomBack,
+		RightBottomBack, LeftBottomBack, RightBottomFront,
+
+		// top
+		LeftTopFront, LeftTopBack, RightTopFront,
+		RightTopBack, RightTopFront, LeftTopBack,
+
+		// front
+		LeftTopFront, RightTopFront, LeftBottomFront,
+		RightBottomFront, LeftBottomFront, RightTopFront,
+
+		// back
+		LeftTopBack, LeftBottomBack, RightTopBack,
+		RightBottomBack, RightTopBack, LeftBottomBack,
+
+		// left
+		LeftTopFront, LeftBottomFront, LeftTopBack,
+		LeftBottomBack, LeftTopBack, LeftBottomFront,
+
+		// right
+		RightTopFront, RightTopBack, RightBottomFront,
+		RightBottomBack, RightBottomFront, RightTopBack
+	});
+}();
+
+// corner of a cube of width 1 centered at the origin
+
+inline Point get_unit_corner (const Cube3d::PositionIndex i)
+{
+	using enum Cube3d::PositionIndex;
+
+	const bool right = (i == RightTopFront || i == RightBottomFront || i == RightTopBack || i == RightBottomBack);
+	const bool bottom = (i == LeftBottomFront || i == RightBottomFront || i == LeftBottomBack || i == RightBottomBack);
+	const bool back = (i >= LeftTopBack);
+
+	return Point(
+		right ? fp(0.5) : fp(-0.5),
+		bottom ? fp(-0.5) : fp(0.5),
+		back ? fp(0.5) : fp(-0.5)
+		);
+}
+
+enum class Isa { // any change here will need a change in get_isa_str
+	Scalar,
+	Sse,
+	Avx2
+};
+
+const char* get_isa_str (const Isa isa);
+
+// best instruction set supported by the running cpu, checked with cpuid
+Isa get_best_isa ();
+
+// Computes the 8 corners of the cube rotating each corner
+// with Point::rotate_around_axis (Rodrigues' formula).
+Corners calc_corners (const Cube3d& cube);
+
+// Computes the corners of many cubes.
+// The rotation matrix is computed only once per cube,
+// and several cubes are transformed at once in SoA form.
+// corners.size() must be at least cubes.size().
+void calc_corners_batch (const Isa isa, std::span<const Cube3d> cubes, std::span<Corners> corners);
+
+inline void calc_corners_batch (std::span<const Cube3d> cubes, std::span<Corners> corners)
+{
+	static const Isa isa = get_best_isa();
+	calc_corners_batch(isa, cubes, corners);
+}
+
+/*
+	Vertex writers shared by the renderers.
+	Vertex must have the fields local_pos, offset and color,
+	like Opengl::ProgramTriangle::Vertex.
+*/
+
+// 36 vertices, one per entry of triangles
+template <typename Vertex, typename Points = Corners>
+inline void mount_triangles (std::span<Vertex> vertices, const Cube3d& cube, const Vector& offset, const Points& points)
+{
+	for (uint32_t i = 0; const Cube3d::PositionIndex p : triangles) {
+		vertices[i].local_pos = points[p];
+		vertices[i].offset = offset;
+		vertices[i].color = cube.get_vertex_color(p);
+		i++;
+	}
+}
+
+// 8 vertices, one per corner, indexed by Cube3d::PositionIndex
+template <typename Vertex>
+inline void mount_corners (std::span<Vertex> vertices, const Cube3d& cube, const Vector& offset, const Corners& points)
+{
+	for (uint32_t i = 0; i < Cube3d::get_n_vertices(); i++) {
+		vertices[i].local_pos = points[i];
+		vertices[i].offset = offset;
+		vertices[i].color = cube.get_vertex_color(static_cast<Cube3d::PositionIndex>(i));
+	}
+}
+
+// ---------------------------------------------------
+
+} // end namespace CubeGeometry
+} // end namespace Graphics
+
+#endif
@@ -3,72 +3,42 @@
 
 // ---------------------------------------------------
 
-#define DEBUG
+#include <utility>
 
-// ---------------------------------------------------
-
-#if defined(DEBUG) && !defined(__ANDROID__)
-	#include <iostream>
-	#include <iomanip>
-#endif
-
-#include <my-lib/std.h>
-
-#include <SDL.h>
+#include "log.h"
 
 namespace App
 {
 
 // ---------------------------------------------------
 
-#ifdef DEBUG
-	#ifdef __ANDROID__
-		template <typename... Types>
-		void dprint (Types&&... vars)
-		{
-			const std::string str = Mylib::build_str_from_stream("CUBE3D: ", vars...);
-			SDL_Log("%s", str.data());
-		}
-
-		template <typename... Types>
-		void dprintln (Types&&... vars)
-		{
-			dprint(vars..., '\n');
-		}
+/*
+	dprint and dprintln write debug level messages with the asynchronous logger of log.h.
+	They are functions, so that "using App::dprintln" works, but then the arguments are
+	evaluated even when the debug level is compiled out.
+	In the hot paths, use the log_trace macro instead.
+*/
 
-		inline constexpr void debug_config_stream ()
-		{
-		}
-	#else
-		template <typename... Types>
-		void dprint (Types&&... vars)
-		{
-			Mylib::print_stream(std::cout, vars...);
-		}
-
-		template <typename... Types>
-		void dprintln (Types&&... vars)
-		{
-			dprint(vars..., '\n');
-		}
+template <typename... Types>
+inline void dprint (Types&&... vars)
+{
+	if constexpr (Log::Level::Debug >= Log::min_level)
+		Log::write(Log::Level::Debug, std::forward<Types>(vars)...);
+}
 
-		inline void debug_config_stream ()
-		{
-			std::cout << std::setprecision(4);
-			std::cout << std::fixed;
-		}
-	#endif
-#else
-	#define dprint(...)
-	#define dprintln(...)
+template <typename... Types>
+inline void dprintln (Types&&... vars)
+{
+	dprint(std::forward<Types>(vars)..., '\n');
+}
 
-	inline constexpr void debug_config_stream ()
-	{
-	}
-#endif
+// the logger configures its own stream
+inline constexpr void debug_config_stream ()
+{
+}
 
 // ---------------------------------------------------
 
 } // end namespace
 
-#endif
\ No newline at end of file
+#endif
@@ -11,10 +11,16 @@
 #include <my-lib/std.h>
 
 #include "graphics.h"
+#include "bvh.h"
+#include "occlusion.h"
 
 #ifdef SUPPORT_OPENGL
 	#include "opengl/opengl.h"
 #endif
+#ifdef SUPPORT_OPENGL_HEADLESS
+	#include "opengl/opengl-headless.h"
+#endif
+#include "software/software.h"
 #ifdef SUPPORT_VULKAN
 	#error "Vulkan is not supported yet!"
 #endif
@@ -27,6 +33,8 @@ const char* Renderer::get_type_str (const Type value)
 {
 	static constexpr auto strs = std::to_array<const char*>({
 		"Opengl",
+		"OpenglHeadless",
+		"Software",
 		"Vulkan"
 	});
 
@@ -35,6 +43,109 @@ const char* Renderer::get_type_str (const Type value)
 	return strs[ std::to_underlying(value) ];
 }
 
+Renderer::~Renderer ()
+{
+	if (this->thread_pool != nullptr)
+		delete this->thread_pool;
+
+	if (this->cull_bvh != nullptr)
+		delete this->cull_bvh;
+
+	if (this->occlusion_buffer != nullptr)
+		delete this->occlusion_buffer;
+}
+
+void Renderer::set_n_threads (const uint32_t n_threads)
+{
+	if (this->thread_pool != nullptr) {
+		delete this->thread_pool;
+		this->thread_pool = nullptr;
+	}
+
+	if (n_threads != 1)
+		this->thread_pool = new ThreadPool(n_threads);
+}
+
+uint32_t Renderer::cull_cubes (std::span<const Cube3d> cubes, std::span<const Vector> offsets, std::vector<uint8_t>& visible)
+{
+	if (this->cull_bvh == nullptr)
+		this->cull_bvh = new SphereBvh;
+
+	this->cull_spheres.resize(cubes.size());
+
+	for (size_t i = 0; i < cubes.size(); i++)
+		this->cull_spheres[i] = calc_bounding_sphere(cubes[i], offsets[i]);
+
+	this->cull_bvh->update(this->cull_spheres);
+
+	uint32_t n_visible = this->cull_bvh->cull(this->frustum, this->cull_spheres, visible);
+
+	this->stats.n_submitted_cubes += cubes.size();
+	this->stats.n_culled_cubes += cubes.size() - n_visible;
+
+	if (this->occlusion_culling && n_visible > 0) {
+		if (this->occlusion_buffer == nullptr)
+			this->occlusion_buffer = new OcclusionBuffer(OcclusionBuffer::get_default_config());
+
+		const uint32_t n_occluded = this->occlusion_buffer->cull(this->cull_matrix, cubes, offsets, visible);
+
+		n_visible -= n_occluded;
+		this->stats.n_occluded_cubes += n_occluded;
+	}
+
+	return n_visible;
+}
+
+Renderer::CubeHandle Renderer::create_cube (const Cube3d& cube, const Vector& offset)
+{
+	CubeHandle handle;
+
+	if (this->retained_free_handles.empty()) {
+		handle = this->retained_cubes.size();
+		this->retained_cubes.emplace_back();
+	}
+	else {
+		handle = this->retained_free_handles.back();
+		this->retained_free_handles.pop_back();
+	}
+
+	this->retained_cubes[handle] = RetainedCube { .cube = cube, .offset = offset, .alive = true };
+
+	return handle;
+}
+
+void Renderer::update_cube (const CubeHandle handle, const Cube3d& cube, const Vector& offset)
+{
+	mylib_assert_exception_msg(handle < this->retained_cubes.size() && this->retained_cubes[handle].alive, "invalid cube handle ", handle)
+
+	this->retained_cubes[handle].cube = cube;
+	this->retained_cubes[handle].offset = offset;
+}
+
+void Renderer::destroy_cube (const CubeHandle handle)
+{
+	mylib_assert_exception_msg(handle < this->retained_cubes.size() && this->retained_cubes[handle].alive, "invalid cube handle ", handle)
+
+	this->retained_cubes[handle].alive = false;
+	this->retained_free_handles.push_back(handle);
+}
+
+void Renderer::draw_retained_cubes ()
+{
+	this->retained_batch_cubes.clear();
+	this->retained_batch_offsets.clear();
+
+	for (const RetainedCube& r : this->retained_cubes) {
+		if (r.alive) {
+			this->retained_batch_cubes.push_back(r.cube);
+			this->retained_batch_offsets.push_back(r.offset);
+		}
+	}
+
+	this->draw_cube3d_batch(this->retained_batch_cubes, this->retained_batch_offsets);
+	this->stats.n_retained_cubes += this->retained_batch_cubes.size();
+}
+
 Renderer* init (const Renderer::Type renderer_type, const uint32_t screen_width_px, const uint32_t screen_height_px, const bool fullscreen)
 {
 	Renderer *r;
@@ -44,6 +155,16 @@ Renderer* init (const Renderer::Type renderer_type, const uint32_t screen_width_
 			r = new Opengl::Renderer(screen_width_px, screen_height_px, fullscreen);
 		break;
 
+	#ifdef SUPPORT_OPENGL_HEADLESS
+		case Renderer::Type::OpenglHeadless:
+			r = new Opengl::HeadlessRenderer(screen_width_px, screen_height_px);
+		break;
+	#endif
+
+		case Renderer::Type::Software:
+			r = new Software::Renderer(screen_width_px, screen_height_px, fullscreen);
+		break;
+
 		default:
 			throw std::runtime_error("Bad Video Driver!");
 	}
@@ -53,7 +174,7 @@ Renderer* init (const Renderer::Type renderer_type, const uint32_t screen_width_
 
 void quit (Renderer *renderer)
 {
-
+	delete renderer;
 }
 
 // ---------------------------------------------------
@@ -13,6 +13,10 @@
 #include <string>
 #include <algorithm>
 #include <array>
+#include <span>
+#include <vector>
+#include <limits>
+#include <chrono>
 
 #include <my-lib/std.h>
 #include <my-lib/macros.h>
@@ -21,6 +25,8 @@
 #include <my-lib/math-matrix.h>
 #include <my-lib/math-geometry.h>
 
+#include "thread-pool.h"
+
 // ---------------------------------------------------
 
 namespace Graphics
@@ -52,10 +58,24 @@ struct Color {
 	float g;
 	float b;
 	float a; // alpha
+
+	constexpr bool operator== (const Color& other) const noexcept = default;
 };
 
 // ---------------------------------------------------
 
+inline uint32_t pack_color_rgba8 (const Color& color) noexcept
+{
+	auto to_u8 = [] (const float v) -> uint32_t {
+		return static_cast<uint32_t>( std::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f );
+	};
+
+	// byte order in memory is r, g, b, a (little endian)
+	return to_u8(color.r) | (to_u8(color.g) << 8) | (to_u8(color.b) << 16) | (to_u8(color.a) << 24);
+}
+
+// ---------------------------------------------------
+
 class Shape
 {
 public:
@@ -138,6 +158,11 @@ public:
 		return this->colors;
 	}
 
+	const std::array<Color, 8>& get_colors_ref () const noexcept
+	{
+		return this->colors;
+	}
+
 	inline fp_t get_h () const noexcept
 	{
 		return this->w;
@@ -161,30 +186,268 @@ struct RenderArgs {
 
 // ---------------------------------------------------
 
+struct Sphere {
+	Point center;
+	fp_t radius;
+};
+
+// sphere that contains the cube in any rotation
+inline Sphere calc_bounding_sphere (const Cube3d& cube, const Vector& offset) noexcept
+{
+	constexpr fp_t half_diagonal = fp(0.8660254); // sqrt(3) / 2
+	return Sphere { .center = offset, .radius = cube.get_ref_delta().length() + cube.get_w() * half_diagonal };
+}
+
+// ---------------------------------------------------
+
+/*
+	The 6 planes of the view volume, extracted from a projection * look-at matrix
+	(Gribb and Hartmann), in world coords.
+	A default constructed frustum has null planes and contains everything.
+*/
+
+class Frustum
+{
+public:
+	struct Plane {
+		Vector normal; // points to the inside, unit length
+		fp_t d; // dot(normal, p) + d >= 0 for points inside
+	};
+
+	std::array<Plane, 6> planes; // left, right, bottom, top, near, far
+
+public:
+	Frustum () noexcept
+	{
+		for (Plane& plane : this->planes)
+			plane = Plane { .normal = Vector::zero(), .d = 0 };
+	}
+
+	// m is row-major, clip = m * world
+	Frustum (const Matrix4& m) noexcept
+	{
+		const float *r = m.get_raw();
+
+		auto make_plane = [r] (const uint32_t row, const fp_t sign) -> Plane {
+			const Vector normal(r[12] + sign*r[row*4 + 0], r[13] + sign*r[row*4 + 1], r[14] + sign*r[row*4 + 2]);
+			const fp_t d = r[15] + sign*r[row*4 + 3];
+			const fp_t length = normal.length();
+			return Plane { .normal = normal * (fp(1) / length), .d = d / length };
+		};
+
+		for (uint32_t i = 0; i < 6; i++)
+			this->planes[i] = make_plane(i / 2, (i % 2 == 0) ? fp(1) : fp(-1));
+	}
+
+	inline bool is_outside (const Sphere& sphere) const noexcept
+	{
+		for (const Plane& plane : this->planes) {
+			const Point& c = sphere.center;
+			const fp_t distance = plane.normal.x*c.x + plane.normal.y*c.y + plane.normal.z*c.z + plane.d;
+
+			if (distance < -sphere.radius)
+				return true;
+		}
+
+		return false;
+	}
+};
+
+// ---------------------------------------------------
+
+/*
+	Level of detail of a cube, chosen by its projected size on the screen,
+	which is about w * px_per_unit / distance to the camera.
+	Cubes of a few pixels are drawn as impostors, a screen-aligned square of their average color,
+	and cubes smaller than a pixel are not drawn at all.
+*/
+
+class LodSelector
+{
+public:
+	enum class Lod : uint8_t {
+		Full,
+		Impostor,
+		Skipped
+	};
+
+	static constexpr uint32_t n_lods = 3;
+
+	struct Config {
+		bool enabled;
+		fp_t impostor_size_px; // cubes smaller than this are drawn as impostors
+		fp_t skip_size_px; // cubes smaller than this are not drawn
+	};
+
+	OO_ENCAPSULATE_OBJ(Config, config)
+
+protected:
+	Point camera_pos;
+	fp_t px_per_unit; // projected size of a length of 1 at a distance of 1
+
+public:
+	LodSelector () noexcept
+		: config { .enabled = false, .impostor_size_px = 4, .skip_size_px = 1 },
+		  camera_pos(Point::zero()),
+		  px_per_unit(0)
+	{
+	}
+
+	void setup (const RenderArgs& args, const uint32_t window_height_px) noexcept
+	{
+		this->camera_pos = args.world_camera_pos;
+		this->px_per_unit = static_cast<fp_t>(window_height_px) / (fp(2) * std::tan(args.fovy * fp(0.5)));
+	}
+
+	inline fp_t calc_size_px (const Cube3d& cube, const Vector& offset) const noexcept
+	{
+		return cube.get_w() * this->px_per_unit / (offset - this->camera_pos).length();
+	}
+
+	// compares squared sizes, so it doesn't need a sqrt
+	inline Lod select (const Cube3d& cube, const Vector& offset) const noexcept
+	{
+		const Vector d = offset - this->camera_pos;
+		const fp_t distance2 = d.x*d.x + d.y*d.y + d.z*d.z;
+		const fp_t size = cube.get_w() * this->px_per_unit; // size_px * distance
+		const fp_t size2 = size * size;
+
+		if (size2 < (this->config.skip_size_px * this->config.skip_size_px * distance2))
+			return Lod::Skipped;
+		else if (size2 < (this->config.impostor_size_px * this->config.impostor_size_px * distance2))
+			return Lod::Impostor;
+		else
+			return Lod::Full;
+	}
+};
+
+// ---------------------------------------------------
+
+class SphereBvh;
+class OcclusionBuffer;
+class VoxelWorld;
+
 class Renderer
 {
 public:
 	enum class Type { // any change here will need a change in get_type_str
 		Opengl,
+		OpenglHeadless, // offscreen, no window and no vsync
+		Software, // cpu rasterizer, no graphics api
 		Vulkan,
 		Unsupported // must be the last one
 	};
 
 	static const char* get_type_str (const Type t);
 
+	// reset by wait_next_frame
+	struct Stats {
+		uint64_t n_cubes; // drawn with draw_cube3d
+		uint64_t n_retained_cubes; // alive retained cubes
+		uint64_t n_vertices; // vertices generated by the cpu
+		uint64_t uploaded_bytes; // bytes sent to the gpu
+		uint64_t n_submitted_cubes; // given to cull_cubes
+		uint64_t n_culled_cubes; // outside the frustum, rejected by cull_cubes
+		uint64_t n_occluded_cubes; // hidden by other cubes, rejected by cull_cubes when occlusion_culling is set
+		uint64_t n_voxel_triangles; // of the chunks of the VoxelWorld drawn with draw_voxel_world
+		std::array<uint64_t, LodSelector::n_lods> lod_histogram; // cubes drawn in each Lod, when the LodSelector is enabled
+
+		// cpu time spent by render in each phase, in seconds
+		double build_time; // geometry built inside render, by renderers that defer it
+		double upload_time;
+		double draw_time;
+		double present_time; // swap, or waiting for the frame when there is no window
+	};
+
+	// gpu time of the phases of a previous frame, in seconds, for renderers that measure it
+	struct GpuStats {
+		bool valid; // false while no frame was measured, or when the renderer doesn't support it
+		uint64_t frame; // frame that was measured, counted by render
+		uint64_t latency; // frames between the measured frame and the current one
+		uint64_t n_dropped; // frames whose results were not ready in time and were discarded
+		double upload_time;
+		double draw_time;
+		double present_time;
+	};
+
+	// measures consecutive phases, each lap adds the time since the previous one to a Stats time
+	class PhaseTimer
+	{
+	private:
+		std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+	public:
+		inline void lap (double& time)
+		{
+			const auto now = std::chrono::steady_clock::now();
+			time += std::chrono::duration<double>(now - this->last).count();
+			this->last = now;
+		}
+	};
+
+	using CubeHandle = uint32_t;
+	static constexpr CubeHandle invalid_cube_handle = std::numeric_limits<CubeHandle>::max();
+
 protected:
-	SDL_Window *sdl_window;
+	SDL_Window *sdl_window = nullptr;
 	OO_ENCAPSULATE_SCALAR_READONLY(uint32_t, window_width_px)
 	OO_ENCAPSULATE_SCALAR_READONLY(uint32_t, window_height_px)
 	OO_ENCAPSULATE_SCALAR_READONLY(bool, fullscreen)
 	OO_ENCAPSULATE_SCALAR_READONLY(float, window_aspect_ratio)
 	OO_ENCAPSULATE_OBJ(Color, background_color)
+	OO_ENCAPSULATE_OBJ_READONLY(Stats, stats)
+	OO_ENCAPSULATE_OBJ_READONLY(GpuStats, gpu_stats) // not reset by reset_stats
+	OO_ENCAPSULATE_OBJ_READONLY(Frustum, frustum) // set by setup_projection_matrix
+	OO_ENCAPSULATE_OBJ(LodSelector, lod_selector) // camera set by setup_projection_matrix, only used by some renderers
+	OO_ENCAPSULATE_SCALAR_INIT(bool, occlusion_culling, false) // used by cull_cubes
+
+protected:
+	struct RetainedCube {
+		Cube3d cube;
+		Vector offset;
+		bool alive;
+	};
+
+	// worker threads for backends that build frames in parallel, nullptr when single-threaded
+	ThreadPool *thread_pool = nullptr;
+
+	// used by cull_cubes, the hierarchy is created by its first call
+	SphereBvh *cull_bvh = nullptr;
+	std::vector<Sphere> cull_spheres;
+	Matrix4 cull_matrix; // projection * look-at, set by setup_projection_matrix along with the frustum
+	OcclusionBuffer *occlusion_buffer = nullptr; // created by the first call with occlusion_culling set
+
+	// used by the default retained mode implementation
+	std::vector<RetainedCube> retained_cubes;
+	std::vector<CubeHandle> retained_free_handles;
+	std::vector<Cube3d> retained_batch_cubes; // alive cubes of the frame, reused by draw_retained_cubes
+	std::vector<Vector> retained_batch_offsets;
+
+	inline void reset_stats () noexcept
+	{
+		this->stats = Stats {};
+	}
+
+	// default retained mode implementation, draws every alive cube with draw_cube3d_batch
+	void draw_retained_cubes ();
 
 public:
 	inline Renderer (const uint32_t window_width_px_, const uint32_t window_height_px_, const bool fullscreen_)
 		: window_width_px(window_width_px_), window_height_px(window_height_px_), fullscreen(fullscreen_)
 	{
 		this->window_aspect_ratio = static_cast<float>(this->window_width_px) / static_cast<float>(this->window_height_px);
+		this->reset_stats();
+		this->gpu_stats = GpuStats {};
+	}
+
+	virtual ~Renderer ();
+
+	// n_threads includes the main thread, 0 means all hardware threads
+	void set_n_threads (const uint32_t n_threads);
+
+	inline uint32_t get_n_threads () const noexcept
+	{
+		return (this->thread_pool != nullptr) ? this->thread_pool->get_n_threads() : 1;
 	}
 
 	inline float get_inverted_window_aspect_ratio () const
@@ -200,8 +463,72 @@ public:
 
 	virtual void wait_next_frame () = 0;
 	virtual void draw_cube3d (const Cube3d& cube, const Vector& offset) = 0;
+
+	// same as calling draw_cube3d(cubes[i], offsets[i]) for every cube
+	virtual void draw_cube3d_batch (std::span<const Cube3d> cubes, std::span<const Vector> offsets)
+	{
+		mylib_assert_exception_msg(offsets.size() >= cubes.size(), "batch of ", cubes.size(), " cubes has only ", offsets.size(), " offsets")
+
+		for (size_t i = 0; i < cubes.size(); i++)
+			this->draw_cube3d(cubes[i], offsets[i]);
+	}
+
 	virtual void setup_projection_matrix (const RenderArgs& args) = 0;
 	virtual void render () = 0;
+
+	/*
+		Frustum culling against the frustum of the last setup_projection_matrix.
+		Sets visible[i] to 1 if cubes[i] at offsets[i] may be visible, 0 otherwise,
+		and returns the number of visible cubes.
+		The bounding spheres of the cubes are kept in a SphereBvh, refitted every call,
+		so the cubes should be given in the same order every frame.
+		With occlusion_culling, the cubes inside the frustum are also tested against
+		the nearest big ones in an OcclusionBuffer, and the hidden ones are rejected.
+	*/
+	uint32_t cull_cubes (std::span<const Cube3d> cubes, std::span<const Vector> offsets, std::vector<uint8_t>& visible);
+
+	/*
+		Retained mode.
+		The renderer keeps the cubes between frames, so they don't need
+		to be drawn every frame. Only cubes whose shape, colors, rotation
+		or position change need to be updated.
+	*/
+
+	virtual CubeHandle create_cube (const Cube3d& cube, const Vector& offset);
+	virtual void update_cube (const CubeHandle handle, const Cube3d& cube, const Vector& offset);
+	virtual void destroy_cube (const CubeHandle handle);
+
+	/*
+		Retained cubes culled against the frustum by the GPU, instead of by the caller,
+		so the CPU cost of a frame doesn't depend on the number of cubes.
+		Returns false if the renderer doesn't support it.
+		Can only be changed while there are no retained cubes.
+	*/
+	virtual bool set_gpu_culling (const bool enabled)
+	{
+		return !enabled;
+	}
+
+	/*
+		Shaders edited while running are compiled again in the background and replace
+		the running ones at the start of a later frame, only if they compile and link.
+		Returns false if the renderer doesn't support it.
+	*/
+	virtual bool set_shader_hot_reload (const bool enabled)
+	{
+		return !enabled;
+	}
+
+	/*
+		Draws the chunk meshes of a VoxelWorld in this frame, the last meshes published
+		by VoxelWorld::update_meshes. The renderer keeps a copy of each mesh,
+		uploaded again only when it changes. The world must live until the next frame.
+		Returns false if the renderer doesn't support it.
+	*/
+	virtual bool draw_voxel_world (const VoxelWorld& world)
+	{
+		return false;
+	}
 };
 
 // ---------------------------------------------------
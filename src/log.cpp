@@ -0,0 +1,132 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+
+#ifdef __ANDROID__
+	#include <SDL.h>
+#endif
+
+#include "log.h"
+
+// ---------------------------------------------------
+
+namespace App
+{
+namespace Log
+{
+
+// ---------------------------------------------------
+
+static const char* get_level_prefix (const Level level)
+{
+	switch (level) {
+		case Level::Warning:
+			return "warning: ";
+
+		case Level::Error:
+			return "error: ";
+
+		default:
+			return "";
+	}
+}
+
+Logger::Logger ()
+{
+	this->records = std::make_unique<Record[]>(capacity);
+
+	for (uint32_t i = 0; i < capacity; i++)
+		this->records[i].sequence.store(i, std::memory_order_relaxed);
+
+	this->thread = std::thread(&Logger::thread_loop, this);
+}
+
+Logger::~Logger ()
+{
+	this->stop.store(true, std::memory_order_release);
+	this->thread.join();
+}
+
+bool Logger::print_next (std::ostream& out)
+{
+	const uint64_t pos = this->dequeue_pos.load(std::memory_order_relaxed);
+	Record& record = this->records[pos & (capacity - 1)];
+
+	if (record.sequence.load(std::memory_order_acquire) != (pos + 1))
+		return false;
+
+	out << get_level_prefix(record.level);
+	record.print(record.storage, out);
+
+	// the record can be written again in the next round of the ring
+	record.sequence.store(pos + capacity, std::memory_order_release);
+	this->dequeue_pos.store(pos + 1, std::memory_order_release);
+
+	return true;
+}
+
+void Logger::thread_loop ()
+{
+#ifdef __ANDROID__
+	std::ostringstream out;
+#else
+	std::ostream& out = std::cout;
+#endif
+
+	out << std::setprecision(4) << std::fixed;
+
+	uint64_t n_reported_dropped = 0;
+
+	while (true) {
+		// read stop before draining, so messages written before the destructor are printed
+		const bool stopping = this->stop.load(std::memory_order_acquire);
+		bool printed = false;
+
+		while (this->print_next(out))
+			printed = true;
+
+		const uint64_t n_dropped = this->n_dropped.load(std::memory_order_relaxed);
+
+		if (n_dropped != n_reported_dropped) {
+			out << get_level_prefix(Level::Warning) << "log buffer full, " << (n_dropped - n_reported_dropped) << " messages dropped\n";
+			n_reported_dropped = n_dropped;
+			printed = true;
+		}
+
+		if (printed) {
+		#ifdef __ANDROID__
+			SDL_Log("CUBE3D: %s", out.str().data());
+			out.str("");
+		#else
+			out.flush();
+		#endif
+		}
+
+		if (stopping)
+			break;
+
+		if (!printed)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+void Logger::flush ()
+{
+	const uint64_t pos = this->enqueue_pos.load(std::memory_order_relaxed);
+
+	while (this->dequeue_pos.load(std::memory_order_acquire) < pos)
+		std::this_thread::yield();
+}
+
+Logger& get_logger ()
+{
+	// started by the first message, so there is no thread when nothing is logged
+	static Logger logger;
+	return logger;
+}
+
+// ---------------------------------------------------
+
+} // end namespace Log
+} // end namespace App
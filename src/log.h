@@ -0,0 +1,196 @@
+#ifndef __CUBE3D_SDL_LOG_HEADER_H__
+#define __CUBE3D_SDL_LOG_HEADER_H__
+
+#include <atomic>
+#include <thread>
+#include <tuple>
+#include <string>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <ostream>
+#include <algorithm>
+
+#include <cstdint>
+#include <cstddef>
+
+#include <my-lib/std.h>
+
+// ---------------------------------------------------
+
+/*
+	Leveled logging.
+
+	log_trace/log_debug/log_info/log_warning/log_error(args...) print the arguments in a line.
+	Levels below min_level are removed at compile time (the arguments are not even evaluated),
+	set with cmake -DLOG_LEVEL=trace|debug|info|warning|error|none. DEBUG_PRINT=OFF removes trace and debug.
+	Use log_trace for messages of every frame or every object.
+
+	The caller only copies the arguments to a lock-free ring buffer,
+	and they are formatted and printed by a background thread.
+	C strings are copied to a std::string, since they may not live until they are printed.
+	Char arrays are kept by pointer, so they must be string literals.
+	When the buffer is full, the message is dropped and counted, the caller never waits.
+*/
+
+#define log_msg(level, ...) \
+	do { \
+		if constexpr ((level) >= App::Log::min_level) \
+			App::Log::write(level, __VA_ARGS__, '\n'); \
+	} while (0)
+
+#define log_trace(...) log_msg(App::Log::Level::Trace, __VA_ARGS__)
+#define log_debug(...) log_msg(App::Log::Level::Debug, __VA_ARGS__)
+#define log_info(...) log_msg(App::Log::Level::Info, __VA_ARGS__)
+#define log_warning(...) log_msg(App::Log::Level::Warning, __VA_ARGS__)
+#define log_error(...) log_msg(App::Log::Level::Error, __VA_ARGS__)
+
+namespace App
+{
+namespace Log
+{
+
+// ---------------------------------------------------
+
+enum class Level : uint8_t {
+	Trace,
+	Debug,
+	Info,
+	Warning,
+	Error,
+	None
+};
+
+#ifdef CUBE3D_LOG_LEVEL
+	inline constexpr Level config_level = static_cast<Level>(CUBE3D_LOG_LEVEL);
+#else
+	inline constexpr Level config_level = Level::Debug;
+#endif
+
+#ifdef CUBE3D_NO_DEBUG_PRINT
+	inline constexpr Level min_level = std::max(config_level, Level::Info);
+#else
+	inline constexpr Level min_level = config_level;
+#endif
+
+// ---------------------------------------------------
+
+class Logger
+{
+public:
+	static constexpr uint32_t capacity = 4096; // messages, power of 2
+	static constexpr size_t storage_size = 192; // bytes of arguments stored in place, bigger ones go to the heap
+
+	struct Record {
+		std::atomic<uint64_t> sequence;
+		Level level;
+		void (*print) (std::byte *storage, std::ostream& out); // prints and destroys the arguments
+		alignas(std::max_align_t) std::byte storage[storage_size];
+	};
+
+protected:
+	std::unique_ptr<Record[]> records;
+
+	// bounded multi-producer queue (Vyukov): a record is free to write when
+	// its sequence equals the position, and ready to print when it equals position+1
+	alignas(64) std::atomic<uint64_t> enqueue_pos = 0;
+	alignas(64) std::atomic<uint64_t> dequeue_pos = 0; // only written by the background thread
+	alignas(64) std::atomic<uint64_t> n_dropped = 0;
+	std::atomic<bool> stop = false;
+
+	std::thread thread;
+
+protected:
+	void thread_loop ();
+	bool print_next (std::ostream& out);
+
+	template <typename Tuple>
+	static void print_tuple (std::byte *storage, std::ostream& out)
+	{
+		if constexpr (sizeof(Tuple) <= storage_size) {
+			Tuple *args = std::launder(reinterpret_cast<Tuple*>(storage));
+			std::apply([&out] (const auto&... vars) { Mylib::print_stream(out, vars...); }, *args);
+			args->~Tuple();
+		}
+		else {
+			Tuple *args = *std::launder(reinterpret_cast<Tuple**>(storage));
+			std::apply([&out] (const auto&... vars) { Mylib::print_stream(out, vars...); }, *args);
+			delete args;
+		}
+	}
+
+public:
+	Logger ();
+	~Logger ();
+
+	template <typename Tuple, typename... Types>
+	void push (const Level level, Types&&... vars)
+	{
+		uint64_t pos = this->enqueue_pos.load(std::memory_order_relaxed);
+		Record *record;
+
+		while (true) {
+			record = &this->records[pos & (capacity - 1)];
+			const uint64_t sequence = record->sequence.load(std::memory_order_acquire);
+			const int64_t diff = static_cast<int64_t>(sequence) - static_cast<int64_t>(pos);
+
+			if (diff == 0) {
+				if (this->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0) {
+				// full, the background thread didn't print this record yet
+				this->n_dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			else
+				pos = this->enqueue_pos.load(std::memory_order_relaxed);
+		}
+
+		static_assert(alignof(Tuple) <= alignof(std::max_align_t));
+
+		if constexpr (sizeof(Tuple) <= storage_size)
+			new (record->storage) Tuple(std::forward<Types>(vars)...);
+		else
+			new (record->storage) Tuple*(new Tuple(std::forward<Types>(vars)...));
+
+		record->level = level;
+		record->print = &print_tuple<Tuple>;
+		record->sequence.store(pos + 1, std::memory_order_release); // publishes the record
+	}
+
+	// waits until the messages written before the call are printed
+	void flush ();
+};
+
+Logger& get_logger ();
+
+// how an argument is kept until it is printed
+template <typename T>
+using stored_t = std::conditional_t<
+	!std::is_array_v<std::remove_reference_t<T>>
+		&& (std::is_same_v<std::decay_t<T>, const char*> || std::is_same_v<std::decay_t<T>, char*>),
+	std::string,
+	std::decay_t<T>
+>;
+
+template <typename... Types>
+void write (const Level level, Types&&... vars)
+{
+	using Tuple = std::tuple<stored_t<Types>...>;
+	get_logger().push<Tuple>(level, std::forward<Types>(vars)...);
+}
+
+inline void flush ()
+{
+	if constexpr (min_level != Level::None)
+		get_logger().flush();
+}
+
+// ---------------------------------------------------
+
+} // end namespace Log
+} // end namespace App
+
+#endif
@@ -3,7 +3,12 @@
 #include <chrono>
 #include <random>
 #include <numbers>
-#include <list>
+#include <vector>
+#include <array>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <limits>
 
 #include <cstdlib>
 
@@ -11,7 +16,9 @@
 #include <my-lib/macros.h>
 
 #include "graphics.h"
+#include "object-store.h"
 #include "debug.h"
+#include "profiler.h"
 
 // -------------------------------------------
 
@@ -55,6 +62,21 @@ namespace Config {
 	inline constexpr fp_t player_speed = 0.5;
 	inline constexpr fp_t camera_rotate_angular_speed = Mylib::Math::degrees_to_radians(fp(90));
 	inline constexpr fp_t camera_move_speed = 0.5;
+	inline constexpr bool retained_render = true; // objects are kept by the renderer, see Renderer::create_cube
+	inline constexpr uint32_t render_threads = 0; // threads used to build the frame in immediate mode, 0 means all hardware threads
+	inline constexpr bool frustum_culling = true; // objects outside the camera view are not given to the renderer
+	inline constexpr bool gpu_culling = true; // in retained mode, the renderer culls on the gpu instead, when supported
+	inline constexpr bool occlusion_culling = false; // cpu culling also rejects objects hidden behind near big objects
+	inline constexpr bool shader_hot_reload = false; // shaders/ edited while running replace the running ones
+	inline constexpr LodSelector::Config lod = { // level of detail of the cubes drawn without retained mode
+		.enabled = true,
+		.impostor_size_px = 4, // smaller cubes are drawn as a single point
+		.skip_size_px = 1 // smaller cubes are not drawn
+	};
+	inline constexpr bool pipelined_simulation = false; // simulates frame N+1 in another thread while frame N is rendered
+	inline constexpr uint32_t physics_threads = 0; // threads of the physics with many objects, 0 means all hardware threads
+	inline constexpr uint32_t profiler_capture_frames = 60; // frames written to profiler_trace_fname when F9 is pressed
+	inline constexpr const char *profiler_trace_fname = "cube3d-trace.json";
 }
 
 // -------------------------------------------
@@ -71,44 +93,44 @@ constexpr fp_t ClockDuration_to_fp (const ClockDuration& d)
 
 // -------------------------------------------
 
-class Object
-{
-protected:
-	OO_ENCAPSULATE_OBJ(Point, pos)
-	OO_ENCAPSULATE_OBJ(Vector, velocity)
-public:
-	virtual void render (const fp_t dt) = 0;
+/*
+	What the render thread needs to draw a frame.
+	It is written by the simulation and only read by the render thread,
+	so the objects can be simulated while the previous frame is rendered.
+*/
 
-	inline void process_physics (const fp_t dt)
-	{
-		this->pos += this->velocity * dt;
-	}
+struct FrameState {
+	std::vector<ObjectStore::Handle> object_ids;
+	std::vector<Cube3d> cubes;
+	std::vector<Vector> offsets;
 };
 
-class ObjCube3d : public Object
-{
-protected:
-	OO_ENCAPSULATE_OBJ(Cube3d, cube)
-public:
-	void render (const fp_t dt) override final
-	{
-		renderer->draw_cube3d(this->cube, this->pos);
-
-		constexpr fp_t angular_velocity = Mylib::Math::degrees_to_radians(fp(360)) / fp(2);
-//dprintln("xxxxxxxx ", Mylib::Math::degrees_to_radians(fp(360)));
-		cube.set_rotation_axis(Vector { 0, 0, 1 });
-		cube.set_rotation_angle_bounded(cube.get_rotation_angle() + angular_velocity * dt);
-
-		dprintln("cube position=", this->get_ref_pos());
-		dprintln("cube rotation angle=", Mylib::Math::radians_to_degrees(this->cube.get_rotation_angle()));
-	}
+// Input collected by the main thread, applied in the beginning of the simulation of a frame.
+struct SimulationInput {
+	fp_t dt = 0;
+	bool set_player_velocity = false;
+	Vector player_velocity;
 };
 
 // -------------------------------------------
 
-std::list<Object*> objects;
-Object *player = nullptr;
+ObjectStore objects;
+ObjectStore::Handle player = ObjectStore::invalid_handle;
+std::unique_ptr<ThreadPool> physics_pool; // only used by the simulation, created once there are enough objects
 Line camera;
+SimulationInput simulation_input;
+
+// retained mode handles, indexed by object handle, only used by the render thread
+std::vector<Renderer::CubeHandle> render_handles;
+std::vector<uint64_t> render_handles_frame; // last frame the object was rendered
+
+// set in main when the renderer culls the retained cubes on the gpu, then the objects are not culled here
+bool renderer_gpu_culling = false;
+
+// frustum culling results, only used by the render thread
+std::vector<uint8_t> visible_objects; // indexed like the FrameState
+std::vector<Cube3d> visible_cubes;
+std::vector<Vector> visible_offsets;
 
 // -------------------------------------------
 
@@ -133,12 +155,10 @@ static void init_objs ()
 
 	renderer->set_background_color( { .r = 0.0f, .g = 0.0f, .b = 0.0f, .a = 1.0f } );
 
-	ObjCube3d& obj_cube = *static_cast<ObjCube3d*>(objects.emplace_back(new ObjCube3d));
-	player = &obj_cube;
-	obj_cube.set_pos(Point(0, -0.3, -1));
-	obj_cube.set_velocity(Vector(0, 0, 0));
-	Cube3d& cube = obj_cube.get_ref_cube();
-	cube.set_w(fp(0.25));
+	constexpr fp_t angular_velocity = Mylib::Math::degrees_to_radians(fp(360)) / fp(2);
+
+	Cube3d cube(fp(0.25));
+	cube.set_rotation_axis(Vector(0, 0, 1));
 
 #if 0
 	cube.set_vertex_color(Cube3d::LeftBottomFront,    { .r = 0.0f, .g = 1.0f, .b = 0.0f, .a = 1.0f });
@@ -153,12 +173,16 @@ static void init_objs ()
 	for (auto& c : cube.get_colors_ref())
 		c = random_color();
 #endif
+
+	player = objects.create(cube, Point(0, -0.3, -1), Vector(0, 0, 0), angular_velocity);
 }
 
 // -------------------------------------------
 
-static void render_objs (const fp_t dt)
+static void render_frame_state (const FrameState& state, const uint64_t frame)
 {
+	CUBE3D_PROFILE_ZONE("render_objs");
+
 	renderer->setup_projection_matrix({
 		.world_camera_pos = camera.base_point,
 		//.world_camera_target = player->get_ref_pos(),
@@ -168,20 +192,178 @@ static void render_objs (const fp_t dt)
 		.z_far = 100
 	});
 
-	for (auto *obj : objects)
-		obj->render(dt);
+	const bool cpu_culling = Config::frustum_culling && !renderer_gpu_culling;
+
+	if (cpu_culling)
+		renderer->cull_cubes(state.cubes, state.offsets, visible_objects);
+
+	auto is_visible = [cpu_culling] (const size_t i) -> bool {
+		return !cpu_culling || visible_objects[i];
+	};
+
+	if constexpr (Config::retained_render) {
+		// the renderer only uploads what changed
+
+		for (size_t i = 0; i < state.cubes.size(); i++) {
+			const ObjectStore::Handle id = state.object_ids[i];
+
+			if (!is_visible(i))
+				continue; // destroyed below, and created again when it comes back into view
+
+			if (id >= render_handles.size()) {
+				render_handles.resize(id + 1, Renderer::invalid_cube_handle);
+				render_handles_frame.resize(id + 1, 0);
+			}
+
+			if (render_handles[id] == Renderer::invalid_cube_handle)
+				render_handles[id] = renderer->create_cube(state.cubes[i], state.offsets[i]);
+			else
+				renderer->update_cube(render_handles[id], state.cubes[i], state.offsets[i]);
+
+			render_handles_frame[id] = frame;
+		}
+
+		// objects that are not in the frame anymore were destroyed by the simulation, or culled
+
+		for (uint32_t id = 0; id < render_handles.size(); id++) {
+			if (render_handles[id] != Renderer::invalid_cube_handle && render_handles_frame[id] != frame) {
+				renderer->destroy_cube(render_handles[id]);
+				render_handles[id] = Renderer::invalid_cube_handle;
+			}
+		}
+	}
+	else if constexpr (Config::frustum_culling) {
+		visible_cubes.clear();
+		visible_offsets.clear();
+
+		for (size_t i = 0; i < state.cubes.size(); i++) {
+			if (is_visible(i)) {
+				visible_cubes.push_back(state.cubes[i]);
+				visible_offsets.push_back(state.offsets[i]);
+			}
+		}
+
+		if (!visible_cubes.empty())
+			renderer->draw_cube3d_batch(visible_cubes, visible_offsets);
+	}
+	else if (!state.cubes.empty())
+		renderer->draw_cube3d_batch(state.cubes, state.offsets);
 }
 
 // -------------------------------------------
 
-static void process_physics (const fp_t dt)
+static void simulate_frame (const SimulationInput& input, FrameState& state)
 {
-	for (auto *obj : objects)
-		obj->process_physics(dt);
+	CUBE3D_PROFILE_ZONE("simulate");
+
+	if (input.set_player_velocity)
+		objects.get_ref_velocity(player) = input.player_velocity;
+
+	{
+		CUBE3D_PROFILE_ZONE("process_physics");
+
+		// smaller scenes never use the pool, so its threads are only started when needed
+		if constexpr (Config::physics_threads != 1) {
+			if (!physics_pool && objects.size() >= ObjectStore::parallel_min_objects)
+				physics_pool = std::make_unique<ThreadPool>(Config::physics_threads);
+		}
+
+		objects.process_physics(input.dt, physics_pool.get());
+	}
+
+	log_trace("player position=", objects.get_ref_pos(player));
+
+	CUBE3D_PROFILE_ZONE("snapshot");
+
+	// the components are already contiguous, so this is just a copy of the arrays
+	state.object_ids.assign(objects.get_handles().begin(), objects.get_handles().end());
+	state.cubes.assign(objects.get_cubes().begin(), objects.get_cubes().end());
+	state.offsets.assign(objects.get_positions().begin(), objects.get_positions().end());
 }
 
 // -------------------------------------------
 
+/*
+	Runs simulate_frame in its own thread, one frame ahead of the render thread.
+	There are two FrameState buffers: while the render thread draws frame N from one of them,
+	the simulation thread writes frame N+1 to the other.
+	The handoff uses only two atomic frame counters, with wait/notify, no locks.
+	SDL and the graphics api are only called from the main thread.
+*/
+
+class SimulationPipeline
+{
+protected:
+	static constexpr uint64_t stop_frame = std::numeric_limits<uint64_t>::max();
+
+	std::thread thread;
+	std::array<FrameState, 2> states;
+	SimulationInput input;
+	std::atomic<uint64_t> requested_frame = 0; // written by the main thread
+	std::atomic<uint64_t> done_frame = 0;      // written by the simulation thread
+
+	void thread_loop ()
+	{
+		uint64_t frame = 0;
+
+		Profiler::set_thread_name("simulation");
+
+		while (true) {
+			this->requested_frame.wait(frame, std::memory_order_acquire);
+			frame = this->requested_frame.load(std::memory_order_acquire);
+
+			if (frame == stop_frame)
+				break;
+
+			simulate_frame(this->input, this->states[frame % 2]);
+
+			this->done_frame.store(frame, std::memory_order_release);
+			this->done_frame.notify_one();
+		}
+	}
+
+public:
+	SimulationPipeline ()
+		: thread(&SimulationPipeline::thread_loop, this)
+	{
+	}
+
+	~SimulationPipeline ()
+	{
+		this->requested_frame.store(stop_frame, std::memory_order_release);
+		this->requested_frame.notify_one();
+		this->thread.join();
+	}
+
+	// Starts the simulation of a frame.
+	// Must only be called after wait() returned the previous frame,
+	// since the buffer of frame-2 is reused.
+	void request (const uint64_t frame, const SimulationInput& input)
+	{
+		this->input = input;
+		this->requested_frame.store(frame, std::memory_order_release);
+		this->requested_frame.notify_one();
+	}
+
+	// Blocks until the frame is simulated.
+	// The returned state is valid until the request of frame+2.
+	const FrameState& wait (const uint64_t frame)
+	{
+		CUBE3D_PROFILE_ZONE("wait_simulation");
+
+		while (true) {
+			const uint64_t done = this->done_frame.load(std::memory_order_acquire);
+			if (done >= frame)
+				break;
+			this->done_frame.wait(done, std::memory_order_acquire);
+		}
+
+		return this->states[frame % 2];
+	}
+};
+
+// -------------------------------------------
+
 static void process_keys (const Uint8 *keys, const fp_t dt)
 {
 	if (keys[SDL_SCANCODE_A])
@@ -199,6 +381,13 @@ static void process_keys (const Uint8 *keys, const fp_t dt)
 		camera.base_point += camera.direction * Config::camera_move_speed * dt;
 }
 
+static void set_player_velocity (const Vector& velocity)
+{
+	// the player belongs to the simulation
+	simulation_input.set_player_velocity = true;
+	simulation_input.player_velocity = velocity;
+}
+
 static void process_keydown (const SDL_KeyboardEvent& event, const fp_t dt)
 {
 	switch (event.keysym.sym) {
@@ -207,27 +396,31 @@ static void process_keydown (const SDL_KeyboardEvent& event, const fp_t dt)
 		break;
 
 		case SDLK_LEFT:
-			player->set_velocity(Vector(-Config::player_speed, 0, 0));
+			set_player_velocity(Vector(-Config::player_speed, 0, 0));
 		break;
 
 		case SDLK_RIGHT:
-			player->set_velocity(Vector(Config::player_speed, 0, 0));
+			set_player_velocity(Vector(Config::player_speed, 0, 0));
 		break;
 
 		case SDLK_UP:
-			player->set_velocity(Vector(0, Config::player_speed, 0));
+			set_player_velocity(Vector(0, Config::player_speed, 0));
 		break;
 
 		case SDLK_DOWN:
-			player->set_velocity(Vector(0, -Config::player_speed, 0));
+			set_player_velocity(Vector(0, -Config::player_speed, 0));
 		break;
 
 		case SDLK_RIGHTBRACKET:
-			player->set_velocity(Vector(0, 0, -Config::player_speed));
+			set_player_velocity(Vector(0, 0, -Config::player_speed));
 		break;
 		
 		case SDLK_LEFTBRACKET:
-			player->set_velocity(Vector(0, 0, Config::player_speed));
+			set_player_velocity(Vector(0, 0, Config::player_speed));
+		break;
+
+		case SDLK_F9:
+			Profiler::capture_frames(Config::profiler_capture_frames, Config::profiler_trace_fname);
 		break;
 	}
 }
@@ -241,7 +434,7 @@ static void process_keyup (const SDL_KeyboardEvent& event, const fp_t dt)
 		case SDLK_DOWN:
 		case SDLK_RIGHTBRACKET:
 		case SDLK_LEFTBRACKET:
-			player->set_velocity(Vector(0, 0, 0));
+			set_player_velocity(Vector(0, 0, 0));
 		break;
 	}
 }
@@ -288,6 +481,18 @@ static void main_loop ()
 	busy_wait_dt = 0;
 	fps = 0;
 
+	uint64_t frame = 1;
+	FrameState serial_state;
+
+	Profiler::set_thread_name("main");
+	std::unique_ptr<SimulationPipeline> pipeline;
+
+	if constexpr (Config::pipelined_simulation) {
+		pipeline = std::make_unique<SimulationPipeline>();
+		pipeline->request(frame, simulation_input);
+		simulation_input = SimulationInput();
+	}
+
 	while (alive) {
 		const ClockTime tbegin = Clock::now();
 		ClockTime tend;
@@ -298,8 +503,8 @@ static void main_loop ()
 		virtual_dt = (real_dt > Config::max_dt) ? Config::max_dt : real_dt;
 
 	#if 1
-		dprintln("----------------------------------------------");
-		dprintln("start new frame render target_dt=", Config::target_dt,
+		log_trace("----------------------------------------------");
+		log_trace("start new frame render target_dt=", Config::target_dt,
 			" required_dt=", required_dt,
 			" real_dt=", real_dt,
 			" sleep_dt=", sleep_dt,
@@ -314,10 +519,49 @@ static void main_loop ()
 		process_keys(keys, virtual_dt);
 		process_events(virtual_dt);
 
-		process_physics(virtual_dt);
-		render_objs(virtual_dt);
+		simulation_input.dt = virtual_dt;
+
+		const FrameState *state;
+
+		if constexpr (Config::pipelined_simulation) {
+			state = &pipeline->wait(frame);
+			pipeline->request(frame + 1, simulation_input); // runs while this frame is rendered
+		}
+		else {
+			simulate_frame(simulation_input, serial_state);
+			state = &serial_state;
+		}
+
+		simulation_input = SimulationInput();
+
+		render_frame_state(*state, frame);
 		renderer->render();
 
+		Profiler::end_frame();
+
+		frame++;
+
+		log_trace("renderer stats: cubes=", renderer->get_ref_stats().n_cubes,
+			" retained_cubes=", renderer->get_ref_stats().n_retained_cubes,
+			" vertices=", renderer->get_ref_stats().n_vertices,
+			" uploaded_bytes=", renderer->get_ref_stats().uploaded_bytes,
+			" submitted_cubes=", renderer->get_ref_stats().n_submitted_cubes,
+			" culled_cubes=", renderer->get_ref_stats().n_culled_cubes,
+			" occluded_cubes=", renderer->get_ref_stats().n_occluded_cubes,
+			" lod_full=", renderer->get_ref_stats().lod_histogram[ std::to_underlying(LodSelector::Lod::Full) ],
+			" lod_impostor=", renderer->get_ref_stats().lod_histogram[ std::to_underlying(LodSelector::Lod::Impostor) ],
+			" lod_skipped=", renderer->get_ref_stats().lod_histogram[ std::to_underlying(LodSelector::Lod::Skipped) ]
+			);
+
+		if (renderer->get_ref_gpu_stats().valid) {
+			log_trace("gpu time of frame ", renderer->get_ref_gpu_stats().frame,
+				": upload=", renderer->get_ref_gpu_stats().upload_time,
+				" draw=", renderer->get_ref_gpu_stats().draw_time,
+				" swap=", renderer->get_ref_gpu_stats().present_time,
+				" dropped=", renderer->get_ref_gpu_stats().n_dropped
+				);
+		}
+
 		const ClockTime trequired = Clock::now();
 		elapsed = trequired - tbegin;
 		required_dt = ClockDuration_to_fp(elapsed);
@@ -357,6 +601,21 @@ void main (const int argc, char **argv)
 {
 	renderer = Graphics::init(Renderer::Type::Opengl, 800, 800, false);
 
+	// only immediate mode builds frames with the thread pool, retained cubes are kept by the renderer
+	if constexpr (!Config::retained_render)
+		renderer->set_n_threads(Config::render_threads);
+
+	renderer->get_ref_lod_selector().set_config(Config::lod);
+	renderer->set_occlusion_culling(Config::occlusion_culling);
+
+	if constexpr (Config::shader_hot_reload) {
+		if (!renderer->set_shader_hot_reload(true))
+			log_warning("shader hot reload is not supported");
+	}
+
+	if constexpr (Config::retained_render && Config::gpu_culling)
+		renderer_gpu_culling = renderer->set_gpu_culling(true);
+
 	main_loop();
 
 	Graphics::quit(renderer);
@@ -374,10 +633,12 @@ int main (int argc, char **argv)
 		App::main(argc, argv);
 	}
 	catch (const std::exception& e) {
+		App::Log::flush(); // pending messages first
 		std::cout << "Exception happenned!" << std::endl << e.what() << std::endl;
 		return EXIT_FAILURE;
 	}
 	catch (...) {
+		App::Log::flush();
 		std::cout << "Unknown exception happenned!" << std::endl;
 		return EXIT_FAILURE;
 	}
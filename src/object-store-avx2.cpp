@@ -0,0 +1,48 @@
+// compiled with -mavx2 (or /arch:AVX2), only called when cpuid reports avx2
+
+#include "object-store-kernel.h"
+
+#ifdef CUBE3D_SIMD_X86
+
+#include <immintrin.h>
+
+// ---------------------------------------------------
+
+namespace App
+{
+
+// ---------------------------------------------------
+
+namespace {
+
+struct Avx2Ops {
+	using V = __m256;
+	static constexpr uint32_t n_lanes = 8;
+	static inline V load (const float *p) { return _mm256_loadu_ps(p); }
+	static inline void store (float *p, const V v) { _mm256_storeu_ps(p, v); }
+	static inline V set1 (const float v) { return _mm256_set1_ps(v); }
+	static inline V add (const V a, const V b) { return _mm256_add_ps(a, b); }
+	static inline V sub (const V a, const V b) { return _mm256_sub_ps(a, b); }
+	static inline V mul (const V a, const V b) { return _mm256_mul_ps(a, b); }
+	static inline V trunc (const V a) { return _mm256_cvtepi32_ps(_mm256_cvttps_epi32(a)); }
+};
+
+} // end anonymous namespace
+
+// ---------------------------------------------------
+
+void integrate_kernel_avx2 (float *pos, const float *velocity, const float dt, const uint32_t n)
+{
+	integrate_kernel_lanes<Avx2Ops>(pos, velocity, dt, n);
+}
+
+void rotate_kernel_avx2 (float *angle, const float *angular_velocity, const float dt, const uint32_t n)
+{
+	rotate_kernel_lanes<Avx2Ops>(angle, angular_velocity, dt, n);
+}
+
+// ---------------------------------------------------
+
+} // end namespace App
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef __CUBE3D_SDL_OBJECT_STORE_KERNEL_HEADER_H__
+#define __CUBE3D_SDL_OBJECT_STORE_KERNEL_HEADER_H__
+
+/*
+	Internal header of object-store.cpp.
+	The kernels are compiled in different translation units with different
+	instruction set flags, so this header must not include anything with
+	inline functions that could be shared with the rest of the program.
+*/
+
+#include <cstdint>
+
+// ---------------------------------------------------
+
+namespace App
+{
+
+// ---------------------------------------------------
+
+// pos[i] += velocity[i] * dt, for n floats (the x, y and z of every object)
+void integrate_kernel_scalar (float *pos, const float *velocity, const float dt, const uint32_t n);
+
+// angle[i] = angle[i] + angular_velocity[i] * dt, wrapped to (-2pi, 2pi) like Cube3d::set_rotation_angle_bounded
+void rotate_kernel_scalar (float *angle, const float *angular_velocity, const float dt, const uint32_t n);
+
+#ifdef CUBE3D_SIMD_X86
+	void integrate_kernel_sse (float *pos, const float *velocity, const float dt, const uint32_t n);
+	void rotate_kernel_sse (float *angle, const float *angular_velocity, const float dt, const uint32_t n);
+	void integrate_kernel_avx2 (float *pos, const float *velocity, const float dt, const uint32_t n);
+	void rotate_kernel_avx2 (float *angle, const float *angular_velocity, const float dt, const uint32_t n);
+#endif
+
+// ---------------------------------------------------
+
+// Internal linkage, so each translation unit keeps the copy
+// compiled with its own instruction set flags.
+
+namespace {
+
+// ---------------------------------------------------
+
+inline constexpr float two_pi = 6.28318530717958647692f;
+inline constexpr float inv_two_pi = 1.0f / two_pi;
+
+struct ScalarOps {
+	using V = float;
+	static constexpr uint32_t n_lanes = 1;
+	static inline V load (const float *p) { return *p; }
+	static inline void store (float *p, const V v) { *p = v; }
+	static inline V set1 (const float v) { return v; }
+	static inline V add (const V a, const V b) { return a + b; }
+	static inline V sub (const V a, const V b) { return a - b; }
+	static inline V mul (const V a, const V b) { return a * b; }
+	static inline V trunc (const V a) { return static_cast<float>(static_cast<int32_t>(a)); } // same as cvttps
+};
+
+// Generic kernels, Ops provides the vector type V and its operations.
+// The elements that don't fill a whole vector are processed with ScalarOps,
+// which gives the same results.
+
+template <typename Ops>
+inline void integrate_kernel_lanes (float *pos, const float *velocity, const float dt, const uint32_t n)
+{
+	const typename Ops::V vdt = Ops::set1(dt);
+	uint32_t i = 0;
+
+	for (; (i + Ops::n_lanes) <= n; i += Ops::n_lanes)
+		Ops::store(pos + i, Ops::add(Ops::load(pos + i), Ops::mul(Ops::load(velocity + i), vdt)));
+
+	for (; i < n; i++)
+		pos[i] = ScalarOps::add(pos[i], ScalarOps::mul(velocity[i], dt));
+}
+
+template <typename Ops>
+inline typename Ops::V rotate_kernel (const typename Ops::V angle, const typename Ops::V angular_velocity, const typename Ops::V dt)
+{
+	using V = typename Ops::V;
+
+	const V a = Ops::add(angle, Ops::mul(angular_velocity, dt));
+	const V turns = Ops::trunc(Ops::mul(a, Ops::set1(inv_two_pi)));
+
+	return Ops::sub(a, Ops::mul(turns, Ops::set1(two_pi)));
+}
+
+template <typename Ops>
+inline void rotate_kernel_lanes (float *angle, const float *angular_velocity, const float dt, const uint32_t n)
+{
+	const typename Ops::V vdt = Ops::set1(dt);
+	uint32_t i = 0;
+
+	for (; (i + Ops::n_lanes) <= n; i += Ops::n_lanes)
+		Ops::store(angle + i, rotate_kernel<Ops>(Ops::load(angle + i), Ops::load(angular_velocity + i), vdt));
+
+	for (; i < n; i++)
+		angle[i] = rotate_kernel<ScalarOps>(angle[i], angular_velocity[i], dt);
+}
+
+// ---------------------------------------------------
+
+} // end anonymous namespace
+
+// ---------------------------------------------------
+
+} // end namespace App
+
+#endif
@@ -0,0 +1,46 @@
+#include "object-store-kernel.h"
+
+#ifdef CUBE3D_SIMD_X86
+
+#include <immintrin.h>
+
+// ---------------------------------------------------
+
+namespace App
+{
+
+// ---------------------------------------------------
+
+namespace {
+
+struct SseOps {
+	using V = __m128;
+	static constexpr uint32_t n_lanes = 4;
+	static inline V load (const float *p) { return _mm_loadu_ps(p); }
+	static inline void store (float *p, const V v) { _mm_storeu_ps(p, v); }
+	static inline V set1 (const float v) { return _mm_set1_ps(v); }
+	static inline V add (const V a, const V b) { return _mm_add_ps(a, b); }
+	static inline V sub (const V a, const V b) { return _mm_sub_ps(a, b); }
+	static inline V mul (const V a, const V b) { return _mm_mul_ps(a, b); }
+	static inline V trunc (const V a) { return _mm_cvtepi32_ps(_mm_cvttps_epi32(a)); }
+};
+
+} // end anonymous namespace
+
+// ---------------------------------------------------
+
+void integrate_kernel_sse (float *pos, const float *velocity, const float dt, const uint32_t n)
+{
+	integrate_kernel_lanes<SseOps>(pos, velocity, dt, n);
+}
+
+void rotate_kernel_sse (float *angle, const float *angular_velocity, const float dt, const uint32_t n)
+{
+	rotate_kernel_lanes<SseOps>(angle, angular_velocity, dt, n);
+}
+
+// ---------------------------------------------------
+
+} // end namespace App
+
+#endif
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <type_traits>
+
+#include "object-store.h"
+#include "object-store-kernel.h"
+#include "profiler.h"
+
+// ---------------------------------------------------
+
+namespace App
+{
+
+// ---------------------------------------------------
+
+using Graphics::fp_t;
+using Graphics::Vector;
+using Graphics::Point;
+using Graphics::Cube3d;
+
+// ---------------------------------------------------
+
+ObjectStore::Handle ObjectStore::create (const Cube3d& cube, const Point& pos, const Vector& velocity, const fp_t angular_velocity)
+{
+	Handle handle;
+
+	if (this->free_handles.empty()) {
+		handle = this->indices.size();
+		this->indices.push_back(invalid_index);
+	}
+	else {
+		handle = this->free_handles.back();
+		this->free_handles.pop_back();
+	}
+
+	this->indices[handle] = this->handles.size();
+
+	this->positions.push_back(pos);
+	this->velocities.push_back(velocity);
+	this->cubes.push_back(cube);
+	this->angles.push_back(cube.get_rotation_angle());
+	this->angular_velocities.push_back(angular_velocity);
+	this->handles.push_back(handle);
+
+	if (this->spatial_grid != nullptr)
+		this->spatial_grid->insert(handle, Graphics::calc_bounding_sphere(cube, pos));
+
+	return handle;
+}
+
+void ObjectStore::destroy (const Handle handle)
+{
+	mylib_assert_exception_msg(this->is_alive(handle), "invalid object handle ", handle)
+
+	const uint32_t i = this->indices[handle];
+	const uint32_t last = this->handles.size() - 1;
+
+	if (i != last) {
+		this->positions[i] = this->positions[last];
+		this->velocities[i] = this->velocities[last];
+		this->cubes[i] = this->cubes[last];
+		this->angles[i] = this->angles[last];
+		this->angular_velocities[i] = this->angular_velocities[last];
+		this->handles[i] = this->handles[last];
+
+		this->indices[ this->handles[i] ] = i;
+	}
+
+	this->positions.pop_back();
+	this->velocities.pop_back();
+	this->cubes.pop_back();
+	this->angles.pop_back();
+	this->angular_velocities.pop_back();
+	this->handles.pop_back();
+
+	this->indices[handle] = invalid_index;
+	this->free_handles.push_back(handle);
+
+	if (this->spatial_grid != nullptr)
+		this->spatial_grid->remove(handle);
+}
+
+void ObjectStore::process_physics (const fp_t dt, Graphics::ThreadPool *pool)
+{
+	const uint32_t n = this->size();
+
+	if (pool != nullptr && pool->get_n_threads() > 1 && n >= parallel_min_objects) {
+		const uint32_t n_chunks = (n + chunk_size - 1) / chunk_size;
+
+		// chunks write disjoint ranges of the arrays
+		pool->parallel_for(n_chunks, [this, dt, n] (const uint32_t chunk, const uint32_t thread_id) {
+			const uint32_t first = chunk * chunk_size;
+			this->process_physics_range(first, std::min(chunk_size, n - first), dt);
+		});
+	}
+	else
+		this->process_physics_range(0, n, dt);
+
+	if (this->spatial_grid != nullptr)
+		this->update_spatial_grid();
+}
+
+void ObjectStore::set_spatial_grid (SpatialGrid *grid)
+{
+	this->spatial_grid = grid;
+
+	if (grid == nullptr)
+		return;
+
+	mylib_assert_exception_msg(grid->get_size() == 0, "the spatial grid must be empty, it has ", grid->get_size(), " objects")
+
+	for (uint32_t i = 0; i < this->size(); i++)
+		grid->insert(this->handles[i], Graphics::calc_bounding_sphere(this->cubes[i], this->positions[i]));
+}
+
+void ObjectStore::update_spatial_grid ()
+{
+	CUBE3D_PROFILE_ZONE("update_spatial_grid");
+
+	// serial, most objects stay in their cell and only their sphere is written
+	for (uint32_t i = 0; i < this->size(); i++)
+		this->spatial_grid->update(this->handles[i], Graphics::calc_bounding_sphere(this->cubes[i], this->positions[i]));
+}
+
+void ObjectStore::process_physics_range (const uint32_t first, const uint32_t n, const fp_t dt)
+{
+	using Graphics::CubeGeometry::Isa;
+
+	static_assert(std::is_same_v<fp_t, float>);
+	static_assert(sizeof(Point) == (3 * sizeof(float)) && sizeof(Vector) == (3 * sizeof(float)),
+		"positions and velocities are integrated as flat float arrays");
+
+	float *pos = reinterpret_cast<float*>(this->positions.data() + first);
+	const float *velocity = reinterpret_cast<const float*>(this->velocities.data() + first);
+	float *angle = this->angles.data() + first;
+	const float *angular_velocity = this->angular_velocities.data() + first;
+
+	switch (this->isa) {
+	#ifdef CUBE3D_SIMD_X86
+		case Isa::Avx2:
+			integrate_kernel_avx2(pos, velocity, dt, n * 3);
+			rotate_kernel_avx2(angle, angular_velocity, dt, n);
+		break;
+
+		case Isa::Sse:
+			integrate_kernel_sse(pos, velocity, dt, n * 3);
+			rotate_kernel_sse(angle, angular_velocity, dt, n);
+		break;
+	#endif
+
+		default:
+			integrate_kernel_scalar(pos, velocity, dt, n * 3);
+			rotate_kernel_scalar(angle, angular_velocity, dt, n);
+	}
+
+	for (uint32_t i = first; i < (first + n); i++)
+		this->cubes[i].set_rotation_angle(this->angles[i]);
+}
+
+void integrate_kernel_scalar (float *pos, const float *velocity, const float dt, const uint32_t n)
+{
+	integrate_kernel_lanes<ScalarOps>(pos, velocity, dt, n);
+}
+
+void rotate_kernel_scalar (float *angle, const float *angular_velocity, const float dt, const uint32_t n)
+{
+	rotate_kernel_lanes<ScalarOps>(angle, angular_velocity, dt, n);
+}
+
+// ---------------------------------------------------
+
+} // end namespace App
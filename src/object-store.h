@@ -0,0 +1,162 @@
+#ifndef __CUBE3D_SDL_OBJECT_STORE_HEADER_H__
+#define __CUBE3D_SDL_OBJECT_STORE_HEADER_H__
+
+#include <span>
+#include <vector>
+#include <limits>
+
+#include <cstdint>
+
+#include <my-lib/std.h>
+#include <my-lib/macros.h>
+
+#include "graphics.h"
+#include "cube-geometry.h"
+#include "thread-pool.h"
+#include "spatial-grid.h"
+
+namespace App
+{
+
+// ---------------------------------------------------
+
+/*
+	Objects stored as a structure of arrays: each component is a contiguous array,
+	indexed by the dense index of the object, so the physics is a tight loop over
+	plain arrays and the renderer receives the cubes and positions as they are.
+
+	Objects are referenced by handles, which don't change when other objects are destroyed.
+	destroy moves the last object to the freed index (swap-remove), so the arrays have no holes,
+	and the order of the objects changes.
+	Destroyed handles are reused by the next objects.
+
+	process_physics integrates all the objects with SIMD kernels (selected with cpuid, like
+	CubeGeometry::calc_corners_batch), split in chunks among the threads of a pool when there are many.
+	The rotation angles are kept in their own array, so they are also integrated with SIMD,
+	and then copied to the cubes.
+
+	An optional SpatialGrid, keyed by handle, is kept up to date with the bounding spheres of the cubes:
+	create and destroy insert and remove the objects, and process_physics updates all of them,
+	including the changes made through get_ref_pos and get_ref_cube since the previous frame.
+*/
+
+class ObjectStore
+{
+public:
+	using Handle = uint32_t;
+	static constexpr Handle invalid_handle = std::numeric_limits<Handle>::max();
+
+	static constexpr uint32_t parallel_min_objects = 65536; // less than this runs in the calling thread
+	static constexpr uint32_t chunk_size = 16384; // objects integrated by a thread at a time
+
+protected:
+	static constexpr uint32_t invalid_index = std::numeric_limits<uint32_t>::max();
+
+	// components, indexed by the dense index
+	std::vector<Graphics::Point> positions;
+	std::vector<Graphics::Vector> velocities;
+	std::vector<Graphics::Cube3d> cubes; // size, rotation and colors
+	std::vector<Graphics::fp_t> angles; // rotation angle of the cubes, copied to them by process_physics
+	std::vector<Graphics::fp_t> angular_velocities; // around the rotation axis of the cube, in radians/s
+	std::vector<Handle> handles;
+
+	// handle -> dense index, invalid_index when the handle is free
+	std::vector<uint32_t> indices;
+	std::vector<Handle> free_handles;
+
+	OO_ENCAPSULATE_SCALAR_INIT(Graphics::CubeGeometry::Isa, isa, Graphics::CubeGeometry::get_best_isa())
+
+protected:
+	SpatialGrid *spatial_grid = nullptr; // not owned
+
+protected:
+	void process_physics_range (const uint32_t first, const uint32_t n, const Graphics::fp_t dt);
+	void update_spatial_grid ();
+
+public:
+	Handle create (const Graphics::Cube3d& cube, const Graphics::Point& pos, const Graphics::Vector& velocity, const Graphics::fp_t angular_velocity);
+	void destroy (const Handle handle);
+
+	// pos += velocity * dt, and rotates the cubes
+	void process_physics (const Graphics::fp_t dt, Graphics::ThreadPool *pool = nullptr);
+
+	// inserts all the objects in the grid, which must be empty, nullptr stops updating the current one
+	void set_spatial_grid (SpatialGrid *grid);
+
+	inline SpatialGrid* get_spatial_grid () const noexcept
+	{
+		return this->spatial_grid;
+	}
+
+	inline uint32_t size () const noexcept
+	{
+		return this->handles.size();
+	}
+
+	inline bool is_alive (const Handle handle) const noexcept
+	{
+		return handle < this->indices.size() && this->indices[handle] != invalid_index;
+	}
+
+	// dense index of the object, changes when other objects are destroyed
+	inline uint32_t get_index (const Handle handle) const noexcept
+	{
+		return this->indices[handle];
+	}
+
+	inline Graphics::Point& get_ref_pos (const Handle handle) noexcept
+	{
+		return this->positions[ this->get_index(handle) ];
+	}
+
+	inline Graphics::Vector& get_ref_velocity (const Handle handle) noexcept
+	{
+		return this->velocities[ this->get_index(handle) ];
+	}
+
+	inline Graphics::Cube3d& get_ref_cube (const Handle handle) noexcept
+	{
+		return this->cubes[ this->get_index(handle) ];
+	}
+
+	inline Graphics::fp_t& get_ref_angular_velocity (const Handle handle) noexcept
+	{
+		return this->angular_velocities[ this->get_index(handle) ];
+	}
+
+	// the angle set directly in the cube is overwritten by process_physics
+	inline void set_rotation_angle (const Handle handle, const Graphics::fp_t angle) noexcept
+	{
+		const uint32_t i = this->get_index(handle);
+		this->cubes[i].set_rotation_angle_bounded(angle);
+		this->angles[i] = this->cubes[i].get_rotation_angle();
+	}
+
+	// whole components, indexed by the dense index
+
+	inline std::span<const Graphics::Point> get_positions () const noexcept
+	{
+		return this->positions;
+	}
+
+	inline std::span<const Graphics::Vector> get_velocities () const noexcept
+	{
+		return this->velocities;
+	}
+
+	inline std::span<const Graphics::Cube3d> get_cubes () const noexcept
+	{
+		return this->cubes;
+	}
+
+	inline std::span<const Handle> get_handles () const noexcept
+	{
+		return this->handles;
+	}
+};
+
+// ---------------------------------------------------
+
+} // end namespace App
+
+#endif
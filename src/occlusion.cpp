@@ -0,0 +1,314 @@
+#include <algorithm>
+#include <limits>
+#include <bit>
+#include <cmath>
+
+#include <my-lib/std.h>
+
+#include "occlusion.h"
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+
+// ---------------------------------------------------
+
+// corners with a smaller clip w are too close to the camera plane to be projected
+static constexpr float min_clip_w = 1.0e-4f;
+
+// ---------------------------------------------------
+
+OcclusionBuffer::OcclusionBuffer (const Config& config_)
+	: config(config_)
+{
+	mylib_assert_exception_msg(std::has_single_bit(config_.width) && std::has_single_bit(config_.height), "occlusion buffer size ", config_.width, "x", config_.height, " must be a power of 2")
+
+	uint32_t width = this->config.width;
+	uint32_t height = this->config.height;
+
+	while (true) {
+		this->levels.push_back(Level { .width = width, .height = height, .depth = std::vector<float>(width * height, 1.0f) });
+
+		if (width == 1 && height == 1)
+			break;
+
+		width = std::max(width / 2, uint32_t(1));
+		height = std::max(height / 2, uint32_t(1));
+	}
+}
+
+OcclusionBuffer::Config OcclusionBuffer::get_default_config () noexcept
+{
+	return Config {
+		.width = 256,
+		.height = 256,
+		.max_occluders = 1024,
+		.min_occluder_size = 4,
+	};
+}
+
+bool OcclusionBuffer::project (const float *m, const CubeGeometry::Corners& corners, const Vector& offset, ProjectedCorners& out) const noexcept
+{
+	const float half_width = static_cast<float>(this->config.width) * 0.5f;
+	const float half_height = static_cast<float>(this->config.height) * 0.5f;
+
+	out.min_z = std::numeric_limits<float>::max();
+	out.max_z = std::numeric_limits<float>::lowest();
+
+	for (uint32_t i = 0; i < Cube3d::get_n_vertices(); i++) {
+		const Point p = corners[i] + offset;
+		const float w = m[12]*p.x + m[13]*p.y + m[14]*p.z + m[15];
+
+		if (w < min_clip_w)
+			return false;
+
+		const float inv_w = 1.0f / w;
+		const float x = (m[0]*p.x + m[1]*p.y + m[2]*p.z + m[3]) * inv_w;
+		const float y = (m[4]*p.x + m[5]*p.y + m[6]*p.z + m[7]) * inv_w;
+		const float z = (m[8]*p.x + m[9]*p.y + m[10]*p.z + m[11]) * inv_w;
+
+		out.x[i] = (x + 1.0f) * half_width;
+		out.y[i] = (y + 1.0f) * half_height;
+		out.min_z = std::min(out.min_z, z);
+		out.max_z = std::max(out.max_z, z);
+	}
+
+	return true;
+}
+
+void OcclusionBuffer::rasterize_occluder (const ProjectedCorners& p)
+{
+	constexpr uint32_t n = Cube3d::get_n_vertices();
+
+	// convex hull of the corners (Andrew's monotone chain), counter-clockwise
+
+	std::array<uint32_t, n> sorted;
+
+	for (uint32_t i = 0; i < n; i++)
+		sorted[i] = i;
+
+	std::sort(sorted.begin(), sorted.end(), [&p] (const uint32_t a, const uint32_t b) {
+		return (p.x[a] < p.x[b]) || (p.x[a] == p.x[b] && p.y[a] < p.y[b]);
+	});
+
+	auto cross = [&p] (const uint32_t o, const uint32_t a, const uint32_t b) -> float {
+		return (p.x[a] - p.x[o]) * (p.y[b] - p.y[o]) - (p.y[a] - p.y[o]) * (p.x[b] - p.x[o]);
+	};
+
+	std::array<uint32_t, 2 * n> hull;
+	uint32_t n_hull = 0;
+
+	for (uint32_t i = 0; i < n; i++) {
+		while (n_hull >= 2 && cross(hull[n_hull - 2], hull[n_hull - 1], sorted[i]) <= 0)
+			n_hull--;
+		hull[n_hull++] = sorted[i];
+	}
+
+	for (int32_t i = n - 2, lower = n_hull + 1; i >= 0; i--) {
+		while (n_hull >= static_cast<uint32_t>(lower) && cross(hull[n_hull - 2], hull[n_hull - 1], sorted[i]) <= 0)
+			n_hull--;
+		hull[n_hull++] = sorted[i];
+	}
+
+	n_hull--; // the first point is repeated at the end
+
+	if (n_hull < 3)
+		return;
+
+	// edge functions, positive inside, with the margin that makes them
+	// positive in the whole texel when they are at its center
+
+	struct Edge {
+		float a;
+		float b;
+		float c;
+	};
+
+	std::array<Edge, 2 * n> edges;
+	float min_x = std::numeric_limits<float>::max();
+	float max_x = std::numeric_limits<float>::lowest();
+	float min_y = std::numeric_limits<float>::max();
+	float max_y = std::numeric_limits<float>::lowest();
+
+	for (uint32_t i = 0; i < n_hull; i++) {
+		const uint32_t v0 = hull[i];
+		const uint32_t v1 = hull[(i + 1) % n_hull];
+		const float dx = p.x[v1] - p.x[v0];
+		const float dy = p.y[v1] - p.y[v0];
+
+		edges[i] = Edge {
+			.a = -dy,
+			.b = dx,
+			.c = dy * p.x[v0] - dx * p.y[v0] - 0.5f * (std::abs(dx) + std::abs(dy))
+		};
+
+		min_x = std::min(min_x, p.x[v0]);
+		max_x = std::max(max_x, p.x[v0]);
+		min_y = std::min(min_y, p.y[v0]);
+		max_y = std::max(max_y, p.y[v0]);
+	}
+
+	Level& level = this->levels[0];
+
+	// texels whose whole area is inside the bounding box
+	const int32_t x0 = std::max(static_cast<int32_t>(std::ceil(min_x)), 0);
+	const int32_t y0 = std::max(static_cast<int32_t>(std::ceil(min_y)), 0);
+	const int32_t x1 = std::min(static_cast<int32_t>(std::floor(max_x)), static_cast<int32_t>(level.width)) - 1;
+	const int32_t y1 = std::min(static_cast<int32_t>(std::floor(max_y)), static_cast<int32_t>(level.height)) - 1;
+
+	for (int32_t y = y0; y <= y1; y++) {
+		const float cy = static_cast<float>(y) + 0.5f;
+		float *row = level.depth.data() + y * level.width;
+
+		for (int32_t x = x0; x <= x1; x++) {
+			const float cx = static_cast<float>(x) + 0.5f;
+			bool inside = true;
+
+			for (uint32_t i = 0; i < n_hull; i++) {
+				if ((edges[i].a * cx + edges[i].b * cy + edges[i].c) < 0) {
+					inside = false;
+					break;
+				}
+			}
+
+			if (inside)
+				row[x] = std::min(row[x], p.max_z);
+		}
+	}
+}
+
+void OcclusionBuffer::build_pyramid ()
+{
+	for (uint32_t i = 1; i < this->levels.size(); i++) {
+		const Level& src = this->levels[i - 1];
+		Level& dst = this->levels[i];
+
+		for (uint32_t y = 0; y < dst.height; y++) {
+			const uint32_t sy0 = std::min(y * 2, src.height - 1);
+			const uint32_t sy1 = std::min(y * 2 + 1, src.height - 1);
+
+			for (uint32_t x = 0; x < dst.width; x++) {
+				const uint32_t sx0 = std::min(x * 2, src.width - 1);
+				const uint32_t sx1 = std::min(x * 2 + 1, src.width - 1);
+
+				dst.depth[y * dst.width + x] = std::max(
+					std::max(src.depth[sy0 * src.width + sx0], src.depth[sy0 * src.width + sx1]),
+					std::max(src.depth[sy1 * src.width + sx0], src.depth[sy1 * src.width + sx1])
+					);
+			}
+		}
+	}
+}
+
+bool OcclusionBuffer::is_occluded (const ProjectedCorners& p) const noexcept
+{
+	const auto [min_x, max_x] = std::minmax_element(p.x.begin(), p.x.end());
+	const auto [min_y, max_y] = std::minmax_element(p.y.begin(), p.y.end());
+
+	// texels touched by the screen rectangle, the parts outside the screen are not drawn anyway
+	const int32_t x0 = std::max(static_cast<int32_t>(std::floor(*min_x)), 0);
+	const int32_t y0 = std::max(static_cast<int32_t>(std::floor(*min_y)), 0);
+	const int32_t x1 = std::min(static_cast<int32_t>(std::floor(*max_x)), static_cast<int32_t>(this->config.width) - 1);
+	const int32_t y1 = std::min(static_cast<int32_t>(std::floor(*max_y)), static_cast<int32_t>(this->config.height) - 1);
+
+	if (x0 > x1 || y0 > y1)
+		return false;
+
+	uint32_t l = 0;
+
+	while (((x1 >> l) - (x0 >> l)) > 1 || ((y1 >> l) - (y0 >> l)) > 1)
+		l++;
+
+	const Level& level = this->levels[l];
+	float max_depth = std::numeric_limits<float>::lowest();
+
+	for (int32_t y = (y0 >> l); y <= (y1 >> l); y++) {
+		for (int32_t x = (x0 >> l); x <= (x1 >> l); x++)
+			max_depth = std::max(max_depth, level.depth[y * level.width + x]);
+	}
+
+	return p.min_z > max_depth;
+}
+
+uint32_t OcclusionBuffer::cull (const Matrix4& m, std::span<const Cube3d> cubes, std::span<const Vector> offsets, std::vector<uint8_t>& visible)
+{
+	const float *r = m.get_raw();
+
+	std::fill(this->levels[0].depth.begin(), this->levels[0].depth.end(), 1.0f);
+
+	// occluders are the nearest visible cubes that are big on the screen,
+	// their size in texels is about w * (projection scale of y) / (clip w)
+
+	const float scale_y = std::sqrt(r[4]*r[4] + r[5]*r[5] + r[6]*r[6]) * static_cast<float>(this->config.height) * 0.5f;
+
+	this->candidates.clear();
+	this->candidate_w.clear();
+
+	for (uint32_t i = 0; i < cubes.size(); i++) {
+		if (!visible[i])
+			continue;
+
+		const Vector& c = offsets[i];
+		const float w = r[12]*c.x + r[13]*c.y + r[14]*c.z + r[15];
+
+		if (w < min_clip_w || (cubes[i].get_w() * scale_y) < (this->config.min_occluder_size * w))
+			continue;
+
+		this->candidates.push_back(i);
+		this->candidate_w.push_back(w);
+	}
+
+	if (this->candidates.size() > this->config.max_occluders) {
+		std::vector<uint32_t> order(this->candidates.size());
+
+		for (uint32_t i = 0; i < order.size(); i++)
+			order[i] = i;
+
+		std::nth_element(order.begin(), order.begin() + this->config.max_occluders, order.end(), [this] (const uint32_t a, const uint32_t b) {
+			return this->candidate_w[a] < this->candidate_w[b];
+		});
+
+		order.resize(this->config.max_occluders);
+
+		for (uint32_t& i : order)
+			i = this->candidates[i];
+
+		this->candidates = std::move(order);
+	}
+
+	this->n_occluders = 0;
+
+	ProjectedCorners p;
+
+	for (const uint32_t i : this->candidates) {
+		if (this->project(r, CubeGeometry::calc_corners(cubes[i]), offsets[i], p)) {
+			this->rasterize_occluder(p);
+			this->n_occluders++;
+		}
+	}
+
+	if (this->n_occluders == 0)
+		return 0;
+
+	this->build_pyramid();
+
+	uint32_t n_occluded = 0;
+
+	for (uint32_t i = 0; i < cubes.size(); i++) {
+		if (!visible[i])
+			continue;
+
+		// cubes crossing the camera plane are kept
+		if (this->project(r, CubeGeometry::calc_corners(cubes[i]), offsets[i], p) && this->is_occluded(p)) {
+			visible[i] = 0;
+			n_occluded++;
+		}
+	}
+
+	return n_occluded;
+}
+
+// ---------------------------------------------------
+
+} // end namespace Graphics
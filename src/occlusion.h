@@ -0,0 +1,101 @@
+#ifndef __CUBE3D_SDL_OCCLUSION_HEADER_H__
+#define __CUBE3D_SDL_OCCLUSION_HEADER_H__
+
+#include <span>
+#include <vector>
+#include <array>
+
+#include <cstdint>
+
+#include <my-lib/std.h>
+#include <my-lib/macros.h>
+
+#include "graphics.h"
+#include "cube-geometry.h"
+
+namespace Graphics
+{
+
+// ---------------------------------------------------
+
+/*
+	Occlusion culling with a small depth buffer rasterized by the CPU, before the frame is drawn.
+	The nearest big cubes are the occluders. Each one is rasterized as its silhouette,
+	the convex hull of its projected corners, with the farthest depth of its corners,
+	and only in the texels the silhouette covers entirely, so the buffer never claims
+	more than the cubes really hide.
+	A pyramid of the farthest depth of 2x2 texels (hierarchical Z) is built from it,
+	and a cube is occluded when the nearest depth of its corners is behind the farthest depth
+	under its screen rectangle, read from the level where the rectangle covers at most 2x2 texels.
+	Depths are ndc z, texel coords are ndc x and y mapped to [0, width] and [0, height].
+*/
+
+class OcclusionBuffer
+{
+public:
+	struct Config {
+		uint32_t width; // texels of the level 0, power of 2
+		uint32_t height; // texels of the level 0, power of 2
+		uint32_t max_occluders; // only the nearest occluders are rasterized
+		fp_t min_occluder_size; // in texels, smaller cubes are not occluders
+	};
+
+protected:
+	struct Level {
+		uint32_t width;
+		uint32_t height;
+		std::vector<float> depth; // rows from bottom to top
+	};
+
+	struct ProjectedCorners {
+		std::array<float, Cube3d::get_n_vertices()> x;
+		std::array<float, Cube3d::get_n_vertices()> y;
+		float min_z;
+		float max_z;
+	};
+
+	OO_ENCAPSULATE_OBJ_READONLY(Config, config)
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(uint32_t, n_occluders, 0) // rasterized by the last cull
+
+protected:
+	std::vector<Level> levels; // levels[0] is the full resolution, the last one is 1x1
+	std::vector<uint32_t> candidates; // cubes that may be occluders
+	std::vector<float> candidate_w; // clip w of the center of the candidates, their distance along the view direction
+
+protected:
+	// false if a corner is not in front of the near plane
+	bool project (const float *m, const CubeGeometry::Corners& corners, const Vector& offset, ProjectedCorners& out) const noexcept;
+
+	void rasterize_occluder (const ProjectedCorners& p);
+	void build_pyramid ();
+	bool is_occluded (const ProjectedCorners& p) const noexcept;
+
+public:
+	OcclusionBuffer (const Config& config_);
+
+	// default configuration, a 256x256 buffer and up to 1024 occluders of at least 4 texels
+	static Config get_default_config () noexcept;
+
+	/*
+		Tests the cubes whose visible[i] is set against each other, with the projection * look-at matrix m,
+		the same given to Frustum. Occluded cubes get visible[i] = 0.
+		Returns the number of occluded cubes.
+	*/
+	uint32_t cull (const Matrix4& m, std::span<const Cube3d> cubes, std::span<const Vector> offsets, std::vector<uint8_t>& visible);
+
+	inline const Level& get_level (const uint32_t i) const noexcept
+	{
+		return this->levels[i];
+	}
+
+	inline uint32_t get_n_levels () const noexcept
+	{
+		return this->levels.size();
+	}
+};
+
+// ---------------------------------------------------
+
+} // end namespace Graphics
+
+#endif
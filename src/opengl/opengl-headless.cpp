@@ -0,0 +1,156 @@
+#include <string_view>
+
+#include <cstring>
+
+#include "../debug.h"
+#include "../profiler.h"
+#include "opengl-headless.h"
+
+// ---------------------------------------------------
+
+using App::dprint;
+using App::dprintln;
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+namespace Opengl
+{
+
+// ---------------------------------------------------
+
+HeadlessRenderer::HeadlessRenderer (const uint32_t width_px, const uint32_t height_px)
+	: Renderer(width_px, height_px, NoWindow {})
+{
+	this->create_egl_context();
+	this->init_opengl();
+	this->create_framebuffer();
+}
+
+HeadlessRenderer::~HeadlessRenderer ()
+{
+	// the programs must be deleted while the context is current
+	this->unload_opengl_programs();
+
+	glDeleteFramebuffers(1, &this->fbo);
+	glDeleteRenderbuffers(1, &this->color_renderbuffer);
+	glDeleteRenderbuffers(1, &this->depth_renderbuffer);
+
+	eglMakeCurrent(this->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(this->egl_display, this->egl_context);
+	eglTerminate(this->egl_display);
+}
+
+void HeadlessRenderer::create_egl_context ()
+{
+	// prefer the surfaceless platform, it doesn't need X11, wayland or a drm device
+
+	const char *client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+	if (client_extensions != nullptr && std::string_view(client_extensions).find("EGL_MESA_platform_surfaceless") != std::string_view::npos) {
+		auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>( eglGetProcAddress("eglGetPlatformDisplayEXT") );
+
+		if (get_platform_display != nullptr)
+			this->egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	}
+#endif
+
+	if (this->egl_display == EGL_NO_DISPLAY)
+		this->egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+	mylib_assert_exception_msg(this->egl_display != EGL_NO_DISPLAY, "Error: no EGL display")
+
+	EGLint major, minor;
+
+	mylib_assert_exception_msg(eglInitialize(this->egl_display, &major, &minor) == EGL_TRUE, "Error: eglInitialize failed with error ", eglGetError())
+
+	dprintln("EGL ", major, ".", minor, " vendor=", eglQueryString(this->egl_display, EGL_VENDOR));
+
+	mylib_assert_exception_msg(eglBindAPI(EGL_OPENGL_API) == EGL_TRUE, "Error: EGL doesn't support desktop Opengl")
+
+	// we render to our own framebuffer, the config doesn't need any surface type
+
+	static constexpr EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, 0,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_NONE
+	};
+
+	EGLConfig config;
+	EGLint n_configs = 0;
+
+	eglChooseConfig(this->egl_display, config_attribs, &config, 1, &n_configs);
+
+	mylib_assert_exception_msg(n_configs > 0, "Error: no EGL config with desktop Opengl")
+
+	static constexpr EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+
+	this->egl_context = eglCreateContext(this->egl_display, config, EGL_NO_CONTEXT, context_attribs);
+
+	mylib_assert_exception_msg(this->egl_context != EGL_NO_CONTEXT, "Error: eglCreateContext failed with error ", eglGetError())
+
+	// requires EGL_KHR_surfaceless_context
+	mylib_assert_exception_msg(eglMakeCurrent(this->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, this->egl_context) == EGL_TRUE,
+		"Error: eglMakeCurrent without surface failed with error ", eglGetError())
+}
+
+void HeadlessRenderer::create_framebuffer ()
+{
+	const GLsizei width = this->window_width_px;
+	const GLsizei height = this->window_height_px;
+
+	glGenRenderbuffers(1, &this->color_renderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, this->color_renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+	glGenRenderbuffers(1, &this->depth_renderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, this->depth_renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+	glGenFramebuffers(1, &this->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, this->fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->color_renderbuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depth_renderbuffer);
+
+	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	mylib_assert_exception_msg(status == GL_FRAMEBUFFER_COMPLETE, "Error: incomplete framebuffer, status ", status)
+
+	// the framebuffer stays bound, every frame is rendered into it
+
+	glViewport(0, 0, width, height);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	dprintln("headless framebuffer ", width, "x", height);
+}
+
+void HeadlessRenderer::present ()
+{
+	CUBE3D_PROFILE_ZONE("swap");
+
+	if (this->readback) {
+		this->pixels.resize(static_cast<size_t>(this->window_width_px) * this->window_height_px * 4);
+
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glReadPixels(0, 0, this->window_width_px, this->window_height_px, GL_RGBA, GL_UNSIGNED_BYTE, this->pixels.data());
+	}
+	else
+		glFinish();
+}
+
+// ---------------------------------------------------
+
+} // end namespace Opengl
+} // end namespace Graphics
@@ -0,0 +1,70 @@
+#ifndef __CUBE3D_SDL_GRAPHICS_OPENGL_HEADLESS_HEADER_H__
+#define __CUBE3D_SDL_GRAPHICS_OPENGL_HEADLESS_HEADER_H__
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <span>
+#include <vector>
+
+#include <cstdint>
+
+#include <my-lib/std.h>
+#include <my-lib/macros.h>
+
+#include "opengl.h"
+
+namespace Graphics
+{
+namespace Opengl
+{
+
+// ---------------------------------------------------
+
+/*
+	Opengl renderer without a window.
+	The context is created with EGL without any surface (surfaceless Mesa platform when available,
+	so it works with llvmpipe on machines without GPU and display),
+	and the frames are rendered into a framebuffer object of window_width_px x window_height_px.
+	There is no vsync: present waits for the GPU to finish the frame,
+	so the time of draw_cube3d -> render is the real cost of the frame.
+*/
+
+class HeadlessRenderer : public Renderer
+{
+protected:
+	EGLDisplay egl_display = EGL_NO_DISPLAY;
+	EGLContext egl_context = EGL_NO_CONTEXT;
+
+	GLuint fbo = 0;
+	GLuint color_renderbuffer = 0;
+	GLuint depth_renderbuffer = 0;
+
+	// when enabled, present copies the frame to pixels with glReadPixels
+	OO_ENCAPSULATE_SCALAR_INIT(bool, readback, false)
+
+	// RGBA8, rows from bottom to top, filled by present when readback is enabled
+	std::vector<uint8_t> pixels;
+
+protected:
+	void create_egl_context ();
+	void create_framebuffer ();
+
+	void present () override final;
+
+public:
+	HeadlessRenderer (const uint32_t width_px, const uint32_t height_px);
+	~HeadlessRenderer ();
+
+	inline std::span<const uint8_t> get_pixels () const noexcept
+	{
+		return this->pixels;
+	}
+};
+
+// ---------------------------------------------------
+
+} // end namespace Opengl
+} // end namespace Graphics
+
+#endif
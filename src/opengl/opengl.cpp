@@ -1,15 +1,26 @@
 #include <iostream>
 #include <fstream>
-#include <sstream>
+#include <filesystem>
 #include <numbers>
+#include <chrono>
 #include <utility>
+#include <string>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <numeric>
 
 #include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
 #include <cmath>
 
 #include <my-lib/math.h>
 
 #include "../debug.h"
+#include "../profiler.h"
+#include "../log.h"
 #include "opengl.h"
 
 // ---------------------------------------------------
@@ -28,316 +39,2334 @@ namespace Opengl
 
 // ---------------------------------------------------
 
-Shader::Shader (const GLenum shader_type_, const char *fname_)
+// unit quaternion equivalent to rotating rotation_angle radians around rotation_axis
+
+static Vector4 calc_rotation_quaternion (const Cube3d& cube)
+{
+	const Vector& axis = cube.get_ref_rotation_axis();
+	const fp_t length = axis.length();
+
+	if (cube.get_rotation_angle() == fp(0) || length == fp(0))
+		return Vector4(0, 0, 0, 1);
+
+	const fp_t half_angle = cube.get_rotation_angle() * fp(0.5);
+	const fp_t s = std::sin(half_angle) / length;
+
+	return Vector4(axis.x * s, axis.y * s, axis.z * s, std::cos(half_angle));
+}
+
+static void fill_instance (ProgramCubeInstanced::Instance& instance, const Cube3d& cube, const Vector& offset)
+{
+	Vector delta = cube.get_value_delta();
+
+	if (cube.get_rotation_angle() != fp(0))
+		delta.rotate_around_axis(cube.get_ref_rotation_axis(), cube.get_rotation_angle());
+
+	instance.center = offset + delta;
+	instance.w = cube.get_w();
+	instance.rotation = calc_rotation_quaternion(cube);
+
+	for (uint32_t i = 0; auto& color : instance.colors)
+		color = pack_color_rgba8(cube.get_vertex_color(static_cast<Cube3d::PositionIndex>(i++)));
+}
+
+// ---------------------------------------------------
+
+Shader::Shader (const GLenum shader_type_, const char *fname_, const char *defines_)
 : shader_type(shader_type_),
-  fname(fname_)
+  fname(fname_),
+  defines(defines_)
+{
+	this->shader_id = glCreateShader(this->shader_type);
+}
+
+Shader::~Shader ()
+{
+	glDeleteShader(this->shader_id);
+}
+
+void Shader::load_source ()
+{
+	std::ifstream file(this->fname, std::ios::binary | std::ios::ate);
+	mylib_assert_exception_msg(file.is_open(), "could not open shader ", this->fname)
+
+	std::string buffer(static_cast<size_t>(file.tellg()), '\0');
+	file.seekg(0);
+	file.read(buffer.data(), buffer.size());
+
+	this->set_source(std::move(buffer));
+
+	dprintln("loaded shader (", this->fname, ")");
+}
+
+void Shader::set_source (std::string source_)
+{
+	this->source = insert_defines(std::move(source_), this->defines, this->fname);
+}
+
+void Shader::set_preprocessed_source (std::string source_)
+{
+	this->source = std::move(source_);
+}
+
+std::string Shader::insert_defines (std::string source, const std::string_view defines, const std::string_view fname)
+{
+	if (!defines.empty()) {
+		const auto version_end = source.find('\n');
+		mylib_assert_exception_msg(version_end != std::string::npos, fname, " must start with a #version line")
+		source.insert(version_end + 1, std::string(defines) + '\n');
+	}
+
+	return source;
+}
+
+void Shader::compile ()
+{
+	const char *c_str = this->source.c_str();
+	glShaderSource(this->shader_id, 1, ( const GLchar ** )&c_str, nullptr);
+	glCompileShader(this->shader_id);
+
+	this->compile_started = true;
+}
+
+bool Shader::is_compiled () const
+{
+	GLint status;
+	glGetShaderiv(this->shader_id, GL_COMPILE_STATUS, &status);
+
+	return (status == GL_TRUE);
+}
+
+std::string Shader::get_info_log () const
+{
+	GLint logSize = 0;
+	glGetShaderiv(this->shader_id, GL_INFO_LOG_LENGTH, &logSize);
+
+	std::string berror(std::max(logSize, 1), '\0');
+
+	glGetShaderInfoLog(this->shader_id, logSize, nullptr, berror.data());
+
+	return berror;
+}
+
+void Shader::check_compile_status ()
+{
+	if (!this->is_compiled())
+		mylib_throw_exception_msg(this->fname, " shader compilation failed", '\n', this->get_info_log());
+}
+
+// ---------------------------------------------------
+
+// compile logs of the shaders that failed, or the link log of the program
+
+static std::string get_link_error (const GLuint program_id, const std::array<Shader*, 4>& shaders)
+{
+	for (const Shader *shader : shaders) {
+		if (shader != nullptr && !shader->is_compiled())
+			return shader->get_ref_fname() + " shader compilation failed\n" + shader->get_info_log();
+	}
+
+	GLint logSize = 0;
+	glGetProgramiv(program_id, GL_INFO_LOG_LENGTH, &logSize);
+
+	std::string berror(std::max(logSize, 1), '\0');
+
+	glGetProgramInfoLog(program_id, logSize, nullptr, berror.data());
+
+	for (const Shader *shader : shaders) {
+		if (shader != nullptr)
+			return "program link failed (" + shader->get_ref_fname() + ")\n" + berror;
+	}
+
+	return berror;
+}
+
+static bool is_program_link_done (const GLuint program_id)
+{
+#ifdef GL_KHR_parallel_shader_compile
+	if (Program::cache != nullptr && Program::cache->get_parallel_compile()) {
+		GLint done;
+		glGetProgramiv(program_id, GL_COMPLETION_STATUS_KHR, &done);
+
+		return (done == GL_TRUE);
+	}
+#endif
+
+	// glGetProgramiv(GL_LINK_STATUS) will wait for it
+	return true;
+}
+
+Program::Program ()
+{
+	this->vs = nullptr;
+	this->gs = nullptr;
+	this->fs = nullptr;
+	this->cs = nullptr;
+	this->program_id = glCreateProgram();
+}
+
+Program::~Program ()
+{
+	this->cancel_reload();
+
+	for (Shader *shader : this->get_shaders()) {
+		if (shader != nullptr)
+			delete shader;
+	}
+
+	glDeleteProgram(this->program_id);
+}
+
+void Program::set_shaders (const std::array<Shader*, 4>& shaders)
+{
+	this->vs = shaders[0];
+	this->gs = shaders[1];
+	this->fs = shaders[2];
+	this->cs = shaders[3];
+}
+
+void Program::bind_attrib_location (const GLuint index, const char *name)
+{
+	glBindAttribLocation(this->program_id, index, name);
+
+	this->attrib_locations.push_back(AttribLocation { .index = index, .name = name });
+	this->link_state += "attrib " + std::to_string(index) + ' ' + name + '\n';
+}
+
+void Program::set_transform_feedback_varyings (std::span<const char*> varyings)
+{
+	glTransformFeedbackVaryings(this->program_id, varyings.size(), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+
+	for (const char *name : varyings) {
+		this->feedback_varyings.push_back(name);
+		this->link_state += std::string("varying ") + name + '\n';
+	}
+}
+
+void Program::attach_shaders ()
+{
+	for (const Shader *shader : this->get_shaders()) {
+		if (shader != nullptr)
+			glAttachShader(this->program_id, shader->shader_id);
+	}
+}
+
+void Program::compile_and_link ()
+{
+	for (Shader *shader : this->get_shaders()) {
+		if (shader != nullptr)
+			shader->compile();
+	}
+
+	this->attach_shaders();
+	glLinkProgram(this->program_id);
+}
+
+void Program::link_program ()
+{
+	for (Shader *shader : this->get_shaders()) {
+		if (shader != nullptr)
+			shader->load_source();
+	}
+
+	if (cache != nullptr && cache->get_binary_supported()) {
+		this->cache_key = cache->calc_key(*this);
+
+		if (cache->load(this->program_id, this->cache_key)) {
+			this->from_cache = true;
+			return;
+		}
+
+		glProgramParameteri(this->program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	this->compile_and_link();
+}
+
+void Program::finish_link ()
+{
+	if (this->linked)
+		return;
+
+	GLint status;
+	glGetProgramiv(this->program_id, GL_LINK_STATUS, &status);
+
+	// binaries are rejected when the driver changes in a way the driver string doesn't show
+	if (status == GL_FALSE && this->from_cache) {
+		cache->reject(this->cache_key);
+		this->from_cache = false;
+
+		glProgramParameteri(this->program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		this->compile_and_link();
+
+		glGetProgramiv(this->program_id, GL_LINK_STATUS, &status);
+	}
+
+	if (status == GL_FALSE)
+		mylib_throw_exception_msg(get_link_error(this->program_id, this->get_shaders()));
+
+	if (cache != nullptr && cache->get_binary_supported() && !this->from_cache)
+		cache->store(this->program_id, this->cache_key);
+
+	this->read_uniform_locations();
+	this->linked = true;
+
+	glUseProgram(this->program_id);
+	this->setup_uniforms();
+}
+
+void Program::read_uniform_locations ()
+{
+	// locations of the active uniforms, arrays are found by their name without [0]
+
+	GLint n_uniforms = 0;
+	GLint max_length = 0;
+	glGetProgramiv(this->program_id, GL_ACTIVE_UNIFORMS, &n_uniforms);
+	glGetProgramiv(this->program_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+	std::string name(std::max(max_length, 1), '\0');
+
+	this->uniform_locations.clear();
+
+	for (GLint i = 0; i < n_uniforms; i++) {
+		GLsizei length;
+		GLint size;
+		GLenum type;
+
+		glGetActiveUniform(this->program_id, i, name.size(), &length, &size, &type, name.data());
+
+		std::string uniform(name.data(), length);
+
+		if (uniform.ends_with("[0]"))
+			uniform.resize(uniform.size() - 3);
+
+		this->uniform_locations.push_back(UniformLocation {
+			.name = uniform,
+			.location = glGetUniformLocation(this->program_id, name.data())
+			});
+	}
+}
+
+GLint Program::get_uniform_location (const std::string_view name) const noexcept
+{
+	// programs have only a few uniforms, a linear search is faster than hashing
+	for (const UniformLocation& u : this->uniform_locations) {
+		if (u.name == name)
+			return u.location;
+	}
+
+	return -1;
+}
+
+bool Program::start_reload (std::span<const ShaderWatcher::Change> changes)
+{
+	// a reload still linking is the base of the new one, so its changes are not lost
+	std::array<Shader*, 4> shaders = (this->reload != nullptr) ? this->reload->shaders : this->get_shaders();
+	bool changed = false;
+
+	for (Shader*& shader : shaders) {
+		if (shader == nullptr)
+			continue;
+
+		// the watcher already inserted the defines, in its own thread
+		const auto it = std::find_if(changes.begin(), changes.end(), [shader] (const ShaderWatcher::Change& c) {
+			return c.fname == shader->get_ref_fname() && c.defines == shader->get_ref_defines();
+		});
+
+		if (it != changes.end()) {
+			shader = new Shader(shader->get_shader_type(), shader->get_ref_fname().c_str(), shader->get_ref_defines().c_str());
+			shader->set_preprocessed_source(it->source);
+			changed = true;
+		}
+	}
+
+	if (!changed)
+		return false;
+
+	for (Shader *shader : shaders) {
+		// shaders of a program loaded from the cache were never compiled
+		if (shader != nullptr && !shader->get_compile_started())
+			shader->compile();
+	}
+
+	Reload *r = new Reload { .program_id = glCreateProgram(), .shaders = shaders };
+
+	for (const Shader *shader : shaders) {
+		if (shader != nullptr)
+			glAttachShader(r->program_id, shader->get_shader_id());
+	}
+
+	for (const AttribLocation& attrib : this->attrib_locations)
+		glBindAttribLocation(r->program_id, attrib.index, attrib.name.c_str());
+
+	if (!this->feedback_varyings.empty()) {
+		std::vector<const char*> varyings;
+
+		for (const std::string& name : this->feedback_varyings)
+			varyings.push_back(name.c_str());
+
+		glTransformFeedbackVaryings(r->program_id, varyings.size(), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+	}
+
+	if (cache != nullptr && cache->get_binary_supported())
+		glProgramParameteri(r->program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	glLinkProgram(r->program_id);
+
+	if (this->reload != nullptr) {
+		// shaders of the previous reload that were not changed again now belong to the new one,
+		// the others are deleted with it
+		for (uint32_t i = 0; i < shaders.size(); i++) {
+			if (shaders[i] == this->reload->shaders[i])
+				this->reload->shaders[i] = this->get_shaders()[i];
+		}
+
+		this->cancel_reload();
+	}
+
+	this->reload = r;
+
+	return true;
+}
+
+void Program::cancel_reload ()
+{
+	if (this->reload == nullptr)
+		return;
+
+	const std::array<Shader*, 4> current = this->get_shaders();
+
+	for (uint32_t i = 0; i < current.size(); i++) {
+		if (this->reload->shaders[i] != nullptr && this->reload->shaders[i] != current[i])
+			delete this->reload->shaders[i];
+	}
+
+	glDeleteProgram(this->reload->program_id);
+
+	delete this->reload;
+	this->reload = nullptr;
+}
+
+bool Program::update_reload ()
+{
+	if (this->reload == nullptr || !is_program_link_done(this->reload->program_id))
+		return false;
+
+	GLint status;
+	glGetProgramiv(this->reload->program_id, GL_LINK_STATUS, &status);
+
+	if (status == GL_FALSE) {
+		log_error("shader reload failed, the previous program is kept\n", get_link_error(this->reload->program_id, this->reload->shaders));
+		this->cancel_reload();
+		return false;
+	}
+
+	// the replaced shaders and program object are deleted, the shared ones are kept
+
+	const std::array<Shader*, 4> old = this->get_shaders();
+
+	for (uint32_t i = 0; i < old.size(); i++) {
+		if (old[i] != nullptr && old[i] != this->reload->shaders[i])
+			delete old[i];
+	}
+
+	glDeleteProgram(this->program_id);
+
+	this->program_id = this->reload->program_id;
+	this->set_shaders(this->reload->shaders);
+	this->from_cache = false;
+
+	delete this->reload;
+	this->reload = nullptr;
+
+	if (cache != nullptr && cache->get_binary_supported()) {
+		this->cache_key = cache->calc_key(*this);
+		cache->store(this->program_id, this->cache_key);
+	}
+
+	this->read_uniform_locations();
+	this->linked = true;
+
+	glUseProgram(this->program_id);
+	this->setup_uniforms();
+
+	return true;
+}
+
+// ---------------------------------------------------
+
+struct ProgramBinaryHeader {
+	uint32_t magic;
+	uint32_t format;
+};
+
+static constexpr uint32_t program_binary_magic = 0x43334450; // "PD3C"
+
+ProgramCache::ProgramCache (const char *dir_)
+: dir(dir_)
+{
+	for (const GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+		const GLubyte *str = glGetString(name);
+
+		if (str != nullptr)
+			this->driver += reinterpret_cast<const char*>(str);
+
+		this->driver += '\n';
+	}
+
+	if (GLEW_ARB_get_program_binary) {
+		GLint n_formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &n_formats);
+		this->binary_supported = (n_formats > 0);
+	}
+
+#ifdef GL_KHR_parallel_shader_compile
+	if (GLEW_KHR_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF); // as many as the driver wants
+		this->parallel_compile = true;
+	}
+#endif
+
+	dprintln("program cache: binaries ", this->binary_supported, " parallel compile ", this->parallel_compile);
+}
+
+uint64_t ProgramCache::calc_key (const Program& program) const
+{
+	// FNV-1a
+	uint64_t hash = 0xCBF29CE484222325;
+
+	auto add = [&hash] (const std::string_view str) {
+		for (const char c : str) {
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 0x100000001B3;
+		}
+
+		hash ^= 0xFF; // separator, so "ab" + "c" differs from "a" + "bc"
+		hash *= 0x100000001B3;
+	};
+
+	add(this->driver);
+
+	for (const Shader *shader : program.get_shaders()) {
+		if (shader != nullptr) {
+			add(std::to_string(shader->get_shader_type()));
+			add(shader->get_ref_source());
+		}
+	}
+
+	add(program.get_ref_link_state());
+
+	return hash;
+}
+
+std::string ProgramCache::get_fname (const uint64_t key) const
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+
+	return (std::filesystem::path(this->dir) / name).string();
+}
+
+bool ProgramCache::load (const GLuint program_id, const uint64_t key)
+{
+	std::ifstream file(this->get_fname(key), std::ios::binary | std::ios::ate);
+
+	if (!file.is_open()) {
+		this->n_misses++;
+		return false;
+	}
+
+	const size_t size = static_cast<size_t>(file.tellg());
+	ProgramBinaryHeader header;
+
+	if (size <= sizeof(header)) {
+		this->n_misses++;
+		return false;
+	}
+
+	std::vector<char> binary(size - sizeof(header));
+
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	file.read(binary.data(), binary.size());
+
+	if (!file || header.magic != program_binary_magic) {
+		this->n_misses++;
+		return false;
+	}
+
+	glProgramBinary(program_id, header.format, binary.data(), binary.size());
+	this->n_hits++;
+
+	return true;
+}
+
+void ProgramCache::store (const GLuint program_id, const uint64_t key)
+{
+	GLint size = 0;
+	glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &size);
+
+	if (size <= 0)
+		return;
+
+	std::vector<char> binary(size);
+	ProgramBinaryHeader header = { .magic = program_binary_magic, .format = 0 };
+	GLenum format;
+
+	glGetProgramBinary(program_id, size, nullptr, &format, binary.data());
+	header.format = format;
+
+	// the cache is optional, failing to write it only makes the next run slower
+
+	std::error_code error;
+	std::filesystem::create_directories(this->dir, error);
+
+	std::ofstream file(this->get_fname(key), std::ios::binary | std::ios::trunc);
+
+	if (!file.is_open()) {
+		dprintln("could not write program binary ", this->get_fname(key));
+		return;
+	}
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(binary.data(), binary.size());
+}
+
+void ProgramCache::reject (const uint64_t key)
+{
+	this->n_hits--;
+	this->n_misses++;
+
+	std::error_code error;
+	std::filesystem::remove(this->get_fname(key), error);
+}
+
+// ---------------------------------------------------
+
+ProgramTriangle::ProgramTriangle ()
+	: Program ()
+{
+	static_assert(sizeof(Vector) == sizeof(fp_t) * 3);
+	static_assert(sizeof(Vector) == sizeof(Point));
+	static_assert(sizeof(Color) == sizeof(float) * 4);
+#ifndef OPENGL_SOFTWARE_CALCULATE_MATRIX
+	static_assert(sizeof(Vertex) == (sizeof(Point) + sizeof(Vector) + sizeof(Color)));
+#else
+	static_assert(sizeof(Vertex) == (sizeof(Point4) + sizeof(Vector) + sizeof(Color)));
+#endif
+
+	this->vs = new Shader(GL_VERTEX_SHADER, "shaders/triangles.vert");
+	this->fs = new Shader(GL_FRAGMENT_SHADER, "shaders/triangles.frag");
+
+	this->bind_attrib_location(std::to_underlying(Attrib::Position), "i_position");
+	this->bind_attrib_location(std::to_underlying(Attrib::Offset), "i_offset");
+	this->bind_attrib_location(std::to_underlying(Attrib::Color), "i_color");
+
+	this->link_program();
+
+	glGenVertexArrays(1, &(this->vao));
+	glGenBuffers(1, &(this->vbo));
+}
+
+ProgramTriangle::~ProgramTriangle ()
+{
+	if (this->stream_buffer != nullptr)
+		delete this->stream_buffer;
+}
+
+void ProgramTriangle::set_upload_mode (const UploadMode mode)
+{
+	if (mode == this->upload_mode)
+		return;
+
+	if (this->stream_buffer != nullptr) {
+		delete this->stream_buffer;
+		this->stream_buffer = nullptr;
+	}
+
+	this->triangle_buffer.clear();
+	this->upload_mode = mode;
+
+	if (this->is_streaming()) {
+		this->stream_buffer = new StreamVertexBuffer<Vertex>(65536, mode == UploadMode::StreamPersistent);
+		this->stream_buffer->begin_frame();
+
+		dprintln("triangle program streaming vertices (persistent=", this->stream_buffer->get_persistent(), ")");
+	}
+
+	// vao must point to the new vertex buffer
+	this->bind_vertex_array();
+	this->bind_vertex_buffer();
+	this->setup_vertex_array();
+	this->stream_generation = this->is_streaming() ? this->stream_buffer->get_generation() : 0;
+}
+
+void ProgramTriangle::bind_vertex_array ()
+{
+	glBindVertexArray(this->vao);
+}
+
+void ProgramTriangle::bind_vertex_buffer ()
+{
+	glBindBuffer(GL_ARRAY_BUFFER, this->is_streaming() ? this->stream_buffer->get_vbo() : this->vbo);
+}
+
+void ProgramTriangle::setup_vertex_array ()
+{
+	uint32_t pos, length;
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::Position) );
+	glEnableVertexAttribArray( std::to_underlying(Attrib::Offset) );
+	glEnableVertexAttribArray( std::to_underlying(Attrib::Color) );
+
+	pos = 0;
+#ifndef OPENGL_SOFTWARE_CALCULATE_MATRIX
+	length = 3;
+#else
+	length = 4;
+#endif
+	glVertexAttribPointer( std::to_underlying(Attrib::Position), length, GL_FLOAT, GL_FALSE, sizeof(Vertex), ( void * )(pos * sizeof(float)) );
+	
+	pos += length;
+	length = 3;
+	glVertexAttribPointer( std::to_underlying(Attrib::Offset), length, GL_FLOAT, GL_FALSE, sizeof(Vertex), ( void * )(pos * sizeof(float)) );
+	
+	pos += length;
+	length = 4;
+	glVertexAttribPointer( std::to_underlying(Attrib::Color), length, GL_FLOAT, GL_FALSE, sizeof(Vertex), ( void * )(pos * sizeof(float)) );
+}
+
+uint32_t ProgramTriangle::upload_vertex_buffer ()
+{
+	CUBE3D_PROFILE_ZONE("upload_vertex_buffer");
+
+	if (this->is_streaming()) {
+		// vertices are already in GPU-visible memory
+
+		if (this->stream_generation != this->stream_buffer->get_generation()) {
+			this->bind_vertex_buffer();
+			this->setup_vertex_array();
+			this->stream_generation = this->stream_buffer->get_generation();
+		}
+
+		return this->stream_buffer->end_frame();
+	}
+
+	uint32_t n = this->triangle_buffer.get_vertex_buffer_used();
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * n, this->triangle_buffer.get_vertex_buffer(), GL_DYNAMIC_DRAW);
+	return sizeof(Vertex) * n;
+}
+
+void ProgramTriangle::upload_projection_matrix (const Matrix4& m)
+{
+	glUniformMatrix4fv( this->get_uniform_location("u_projection_matrix"), 1, GL_TRUE, m.get_raw() );
+	//dprintln( "projection matrix sent to GPU" )
+}
+
+void ProgramTriangle::draw ()
+{
+	CUBE3D_PROFILE_ZONE("draw");
+
+	uint32_t n = this->get_n_vertices();
+	glDrawArrays(GL_TRIANGLES, this->get_first_vertex(), n);
+
+	if (this->is_streaming())
+		this->stream_buffer->fence_frame();
+}
+
+void ProgramTriangle::debug ()
+{
+	const uint32_t n = this->get_n_vertices();
+
+	if (this->is_streaming()) // mapped memory is write-only
+		return;
+
+	for (uint32_t i=0; i<n; i++) {
+		const Vertex& v = this->triangle_buffer.get_vertex(i);
+
+		if ((i % 3) == 0)
+			dprintln();
+
+		dprintln("vertex[", i,
+			"] x=", v.local_pos.x,
+			" y=", v.local_pos.y,
+			" z=", v.local_pos.z,
+		#ifdef OPENGL_SOFTWARE_CALCULATE_MATRIX
+			" w=", v->local_pos.w,
+		#endif
+			" offset_x=", v.offset.x,
+			" offset_y=", v.offset.y,
+			" offset_z=", v.offset.z,
+			" r=", v.color.r,
+			" g=", v.color.g,
+			" b=", v.color.b,
+			" a=", v.color.a
+		);
+	}
+}
+
+ProgramTriangleIndexed::ProgramTriangleIndexed ()
+	: ProgramTriangle ()
+{
+	static_assert(max_cubes_per_batch * Cube3d::get_n_vertices() - 1 <= std::numeric_limits<GLushort>::max());
+
+	glGenBuffers(1, &(this->ebo));
+}
+
+void ProgramTriangleIndexed::setup_vertex_array ()
+{
+	this->ProgramTriangle::setup_vertex_array();
+
+	// generate the indices for a whole batch only once
+
+	std::vector<GLushort> indices(max_cubes_per_batch * CubeGeometry::triangles.size());
+
+	for (uint32_t cube = 0, i = 0; cube < max_cubes_per_batch; cube++) {
+		for (const Cube3d::PositionIndex p : CubeGeometry::triangles)
+			indices[i++] = static_cast<GLushort>(cube * Cube3d::get_n_vertices() + p);
+	}
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->ebo); // element buffer binding is stored in the vao
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+
+	dprintln("uploaded static element buffer for ", max_cubes_per_batch, " cubes (", indices.size() * sizeof(GLushort), " bytes)");
+}
+
+void ProgramTriangleIndexed::draw ()
+{
+	CUBE3D_PROFILE_ZONE("draw");
+
+	const uint32_t n_cubes = this->get_n_cubes();
+
+	for (uint32_t first = 0; first < n_cubes; first += max_cubes_per_batch) {
+		const uint32_t n = std::min(n_cubes - first, max_cubes_per_batch);
+		glDrawElementsBaseVertex(GL_TRIANGLES, n * CubeGeometry::triangles.size(), GL_UNSIGNED_SHORT, nullptr, this->get_first_vertex() + first * Cube3d::get_n_vertices());
+	}
+
+	if (this->is_streaming())
+		this->stream_buffer->fence_frame();
+}
+
+TextureBufferBatches::TextureBufferBatches (const uint32_t object_size_)
+	: object_size(object_size_)
+{
+	constexpr uint32_t texel_size = sizeof(float) * 4; // GL_RGBA32F
+
+	mylib_assert_exception_msg((this->object_size % texel_size) == 0, "object size ", this->object_size, " is not a multiple of a texel")
+
+	GLint max_texels = 65536; // minimum of GL 3.3
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+
+	this->max_objects = static_cast<uint32_t>(max_texels) / (this->object_size / texel_size);
+
+	if (GLEW_ARB_texture_buffer_range) {
+		GLint alignment = 1;
+		glGetIntegerv(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+		// every batch must start at a multiple of the alignment
+		const uint32_t step = static_cast<uint32_t>(alignment) / std::gcd(static_cast<uint32_t>(alignment), this->object_size);
+		this->max_objects -= this->max_objects % step;
+		this->range_supported = true;
+	}
+
+	dprintln("texture buffer batches of ", this->max_objects, " objects of ", this->object_size, " bytes, ranges ", this->range_supported);
+}
+
+// ---------------------------------------------------
+
+ProgramTrianglePacked::ProgramTrianglePacked ()
+	: Program (),
+	  cube_batches(sizeof(CubeData))
+{
+	static_assert(sizeof(Vertex) == (sizeof(int16_t) * 4 + sizeof(uint32_t)));
+	static_assert(sizeof(Vertex) <= 16);
+	static_assert(sizeof(CubeData) == sizeof(float) * 4); // one GL_RGBA32F texel
+
+	this->vs = new Shader(GL_VERTEX_SHADER, "shaders/triangles.vert", "#define PACKED_VERTEX");
+	this->fs = new Shader(GL_FRAGMENT_SHADER, "shaders/triangles.frag");
+
+	this->bind_attrib_location(std::to_underlying(Attrib::Position), "i_position");
+	this->bind_attrib_location(std::to_underlying(Attrib::Color), "i_color");
+
+	this->link_program();
+
+	glGenVertexArrays(1, &(this->vao));
+	glGenBuffers(1, &(this->vbo));
+	glGenBuffers(1, &(this->cube_buffer_id));
+	glGenTextures(1, &(this->cube_texture_id));
+
+	glBindBuffer(GL_TEXTURE_BUFFER, this->cube_buffer_id);
+	glBindTexture(GL_TEXTURE_BUFFER, this->cube_texture_id);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, this->cube_buffer_id);
+}
+
+void ProgramTrianglePacked::setup_uniforms ()
+{
+	glUniform1i( this->get_uniform_location("u_cubes"), 0 ); // texture unit 0
+}
+
+void ProgramTrianglePacked::bind_vertex_array ()
+{
+	glBindVertexArray(this->vao);
+}
+
+void ProgramTrianglePacked::setup_vertex_array ()
+{
+	glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::Position) );
+	glVertexAttribPointer( std::to_underlying(Attrib::Position), 3, GL_SHORT, GL_TRUE, sizeof(Vertex), ( void * )offsetof(Vertex, local_pos) );
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::Color) );
+	glVertexAttribPointer( std::to_underlying(Attrib::Color), 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), ( void * )offsetof(Vertex, color) );
+}
+
+uint32_t ProgramTrianglePacked::upload_vertex_buffer ()
+{
+	CUBE3D_PROFILE_ZONE("upload_vertex_buffer");
+
+	const uint32_t n_vertices = this->vertex_buffer.get_vertex_buffer_used();
+	const uint32_t n_cubes = this->cube_buffer.get_vertex_buffer_used();
+
+	glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * n_vertices, this->vertex_buffer.get_vertex_buffer(), GL_DYNAMIC_DRAW);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, this->cube_buffer_id);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(CubeData) * n_cubes, this->cube_buffer.get_vertex_buffer(), GL_DYNAMIC_DRAW);
+
+	return sizeof(Vertex) * n_vertices + sizeof(CubeData) * n_cubes;
+}
+
+void ProgramTrianglePacked::upload_projection_matrix (const Matrix4& m)
+{
+	glUniformMatrix4fv( this->get_uniform_location("u_projection_matrix"), 1, GL_TRUE, m.get_raw() );
+}
+
+void ProgramTrianglePacked::draw ()
+{
+	CUBE3D_PROFILE_ZONE("draw");
+
+	const GLint first_object_location = this->get_uniform_location("u_first_object");
+
+	// one cube per n_vertices_per_cube vertices
+	this->cube_batches.draw(this->cube_texture_id, this->cube_buffer_id, this->cube_buffer.get_vertex_buffer_used(), [first_object_location] (const uint32_t first, const uint32_t count) {
+		glUniform1i(first_object_location, first);
+		glDrawArrays(GL_TRIANGLES, first * n_vertices_per_cube, count * n_vertices_per_cube);
+	});
+}
+
+ProgramTriangleTransform::ProgramTriangleTransform ()
+	: Program (),
+	  transform_batches(sizeof(Transform))
+{
+	static_assert(sizeof(Vertex) == (sizeof(Point) + sizeof(uint32_t)));
+	static_assert(sizeof(Transform) == sizeof(float) * 8); // two GL_RGBA32F texels
+
+	this->vs = new Shader(GL_VERTEX_SHADER, "shaders/triangles.vert", "#define OBJECT_TRANSFORM");
+	this->fs = new Shader(GL_FRAGMENT_SHADER, "shaders/triangles.frag");
+
+	this->bind_attrib_location(std::to_underlying(Attrib::Position), "i_position");
+	this->bind_attrib_location(std::to_underlying(Attrib::Color), "i_color");
+
+	this->link_program();
+
+	glGenVertexArrays(1, &(this->vao));
+	glGenBuffers(1, &(this->vbo));
+	glGenBuffers(1, &(this->transform_buffer_id));
+	glGenTextures(1, &(this->transform_texture_id));
+
+	glBindBuffer(GL_TEXTURE_BUFFER, this->transform_buffer_id);
+	glBindTexture(GL_TEXTURE_BUFFER, this->transform_texture_id);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, this->transform_buffer_id);
+}
+
+void ProgramTriangleTransform::setup_uniforms ()
+{
+	glUniform1i( this->get_uniform_location("u_transforms"), 0 ); // texture unit 0
+}
+
+void ProgramTriangleTransform::resize (const uint32_t n_slots)
+{
+	// new slots have an empty geometry, which generates no fragments
+	this->geometries.resize(n_slots, Geometry { .w = 0, .delta = Vector::zero(), .colors = {} });
+	this->vertices.resize(n_slots * n_vertices_per_object, Vertex { .local_pos = Point::zero(), .color = 0 });
+	this->transforms.resize(n_slots, Transform { .rotation = Vector4(0, 0, 0, 1), .translation = Vector::zero(), .padding = 0 });
+
+	this->dirty_geometries.resize(n_slots);
+	this->dirty_transforms.resize(n_slots);
+}
+
+void ProgramTriangleTransform::set_geometry (const uint32_t slot, const Cube3d& cube)
+{
+	Geometry& geometry = this->geometries[slot];
+	const Vector& delta = cube.get_ref_delta();
+
+	const bool changed = (geometry.w != cube.get_w())
+		|| (geometry.delta.x != delta.x) || (geometry.delta.y != delta.y) || (geometry.delta.z != delta.z)
+		|| (geometry.colors != cube.get_colors_ref());
+
+	if (!changed)
+		return;
+
+	geometry.w = cube.get_w();
+	geometry.delta = delta;
+	geometry.colors = cube.get_colors_ref();
+
+	Vertex *v = this->vertices.data() + slot * n_vertices_per_object;
+
+	for (const Cube3d::PositionIndex p : CubeGeometry::triangles) {
+		v->local_pos = delta + CubeGeometry::get_unit_corner(p) * cube.get_w();
+		v->color = pack_color_rgba8(geometry.colors[p]);
+		v++;
+	}
+
+	this->dirty_geometries.mark(slot);
+}
+
+void ProgramTriangleTransform::set_transform (const uint32_t slot, const Transform& transform)
+{
+	Transform& current = this->transforms[slot];
+
+	if (std::memcmp(&current, &transform, sizeof(Transform)) == 0)
+		return;
+
+	current = transform;
+	this->dirty_transforms.mark(slot);
+}
+
+void ProgramTriangleTransform::clear_geometry (const uint32_t slot)
+{
+	this->geometries[slot].w = 0;
+
+	Vertex *v = this->vertices.data() + slot * n_vertices_per_object;
+
+	for (uint32_t i = 0; i < n_vertices_per_object; i++)
+		v[i].local_pos = Point::zero(); // degenerate triangles
+
+	this->dirty_geometries.mark(slot);
+}
+
+void ProgramTriangleTransform::bind_vertex_array ()
+{
+	glBindVertexArray(this->vao);
+}
+
+void ProgramTriangleTransform::setup_vertex_array ()
+{
+	glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::Position) );
+	glVertexAttribPointer( std::to_underlying(Attrib::Position), 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), ( void * )offsetof(Vertex, local_pos) );
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::Color) );
+	glVertexAttribPointer( std::to_underlying(Attrib::Color), 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), ( void * )offsetof(Vertex, color) );
+}
+
+uint32_t ProgramTriangleTransform::upload_buffers ()
+{
+	CUBE3D_PROFILE_ZONE("upload_vertex_buffer");
+
+	const uint32_t n_slots = this->get_n_slots();
+	uint32_t bytes = 0;
+
+	glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+	glBindBuffer(GL_TEXTURE_BUFFER, this->transform_buffer_id);
+
+	if (this->gpu_n_slots < n_slots) {
+		// gpu buffers must grow, so everything is uploaded
+
+		glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * this->vertices.size(), this->vertices.data(), GL_STATIC_DRAW);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(Transform) * this->transforms.size(), this->transforms.data(), GL_DYNAMIC_DRAW);
+
+		this->gpu_n_slots = n_slots;
+		this->dirty_geometries.clear();
+		this->dirty_transforms.clear();
+
+		return sizeof(Vertex) * this->vertices.size() + sizeof(Transform) * this->transforms.size();
+	}
+
+	this->dirty_geometries.consume_ranges([this, &bytes] (const uint32_t first, const uint32_t count) {
+		const GLsizeiptr size = sizeof(Vertex) * n_vertices_per_object * count;
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(Vertex) * n_vertices_per_object * first, size, this->vertices.data() + first * n_vertices_per_object);
+		bytes += size;
+	});
+
+	this->dirty_transforms.consume_ranges([this, &bytes] (const uint32_t first, const uint32_t count) {
+		const GLsizeiptr size = sizeof(Transform) * count;
+		glBufferSubData(GL_TEXTURE_BUFFER, sizeof(Transform) * first, size, this->transforms.data() + first);
+		bytes += size;
+	});
+
+	return bytes;
+}
+
+void ProgramTriangleTransform::upload_projection_matrix (const Matrix4& m)
+{
+	glUniformMatrix4fv( this->get_uniform_location("u_projection_matrix"), 1, GL_TRUE, m.get_raw() );
+}
+
+void ProgramTriangleTransform::draw ()
+{
+	CUBE3D_PROFILE_ZONE("draw");
+
+	const GLint first_object_location = this->get_uniform_location("u_first_object");
+
+	this->transform_batches.draw(this->transform_texture_id, this->transform_buffer_id, this->n_slots_drawn, [first_object_location] (const uint32_t first, const uint32_t count) {
+		glUniform1i(first_object_location, first);
+		glDrawArrays(GL_TRIANGLES, first * n_vertices_per_object, count * n_vertices_per_object);
+	});
+}
+
+ProgramCubeInstanced::ProgramCubeInstanced ()
+	: Program ()
+{
+	static_assert(sizeof(MeshVertex) == sizeof(Point));
+	static_assert(sizeof(Vector4) == sizeof(fp_t) * 4);
+	static_assert(sizeof(Instance) == (sizeof(Point) + sizeof(fp_t) + sizeof(Vector4) + sizeof(uint32_t) * Cube3d::get_n_vertices()));
+
+	this->vs = new Shader(GL_VERTEX_SHADER, "shaders/cube-instanced.vert");
+	this->fs = new Shader(GL_FRAGMENT_SHADER, "shaders/triangles.frag");
+
+	this->bind_attrib_location(std::to_underlying(Attrib::Position), "i_position");
+	this->bind_attrib_location(std::to_underlying(Attrib::CenterSize), "i_center_size");
+	this->bind_attrib_location(std::to_underlying(Attrib::Rotation), "i_rotation");
+
+	for (uint32_t i = 0; i < Cube3d::get_n_vertices(); i++) {
+		const std::string name = "i_color" + std::to_string(i);
+		this->bind_attrib_location(std::to_underlying(Attrib::Color0) + i, name.c_str());
+	}
+
+	this->link_program();
+
+	glGenVertexArrays(1, &(this->vao));
+	glGenBuffers(1, &(this->vbo_mesh));
+	glGenBuffers(1, &(this->vbo_instances));
+}
+
+void ProgramCubeInstanced::bind_vertex_array ()
+{
+	glBindVertexArray(this->vao);
+}
+
+void ProgramCubeInstanced::setup_vertex_array ()
+{
+	this->setup_vertex_array(this->vbo_instances);
+}
+
+void ProgramCubeInstanced::setup_vertex_array (const GLuint instances_vbo)
+{
+	std::array<MeshVertex, CubeGeometry::triangles.size()> mesh;
+
+	for (uint32_t i = 0; i < CubeGeometry::triangles.size(); i++)
+		mesh[i].local_pos = CubeGeometry::get_unit_corner(CubeGeometry::triangles[i]);
+
+	glBindBuffer(GL_ARRAY_BUFFER, this->vbo_mesh);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(mesh), mesh.data(), GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::Position) );
+	glVertexAttribPointer( std::to_underlying(Attrib::Position), 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), ( void * )0 );
+
+	glBindBuffer(GL_ARRAY_BUFFER, instances_vbo);
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::CenterSize) );
+	glVertexAttribPointer( std::to_underlying(Attrib::CenterSize), 4, GL_FLOAT, GL_FALSE, sizeof(Instance), ( void * )offsetof(Instance, center) );
+	glVertexAttribDivisor( std::to_underlying(Attrib::CenterSize), 1 );
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::Rotation) );
+	glVertexAttribPointer( std::to_underlying(Attrib::Rotation), 4, GL_FLOAT, GL_FALSE, sizeof(Instance), ( void * )offsetof(Instance, rotation) );
+	glVertexAttribDivisor( std::to_underlying(Attrib::Rotation), 1 );
+
+	for (uint32_t i = 0; i < Cube3d::get_n_vertices(); i++) {
+		const GLuint attrib = std::to_underlying(Attrib::Color0) + i;
+
+		glEnableVertexAttribArray(attrib);
+		glVertexAttribPointer(attrib, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance), ( void * )(offsetof(Instance, colors) + i * sizeof(uint32_t)) );
+		glVertexAttribDivisor(attrib, 1);
+	}
+}
+
+uint32_t ProgramCubeInstanced::upload_instance_buffer ()
+{
+	CUBE3D_PROFILE_ZONE("upload_vertex_buffer");
+
+	const uint32_t n = this->instance_buffer.get_vertex_buffer_used();
+	glBindBuffer(GL_ARRAY_BUFFER, this->vbo_instances);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Instance) * n, this->instance_buffer.get_vertex_buffer(), GL_DYNAMIC_DRAW);
+	return sizeof(Instance) * n;
+}
+
+void ProgramCubeInstanced::upload_projection_matrix (const Matrix4& m)
+{
+	glUniformMatrix4fv( this->get_uniform_location("u_projection_matrix"), 1, GL_TRUE, m.get_raw() );
+}
+
+void ProgramCubeInstanced::draw ()
+{
+	CUBE3D_PROFILE_ZONE("draw");
+
+	const uint32_t n = this->instance_buffer.get_vertex_buffer_used();
+	glDrawArraysInstanced(GL_TRIANGLES, 0, CubeGeometry::triangles.size(), n);
+}
+
+ProgramCubeImpostor::ProgramCubeImpostor ()
+	: Program ()
+{
+	static_assert(sizeof(Impostor) == (sizeof(Point) + sizeof(fp_t) + sizeof(uint32_t)));
+
+	this->vs = new Shader(GL_VERTEX_SHADER, "shaders/impostor.vert");
+	this->fs = new Shader(GL_FRAGMENT_SHADER, "shaders/triangles.frag");
+
+	this->bind_attrib_location(std::to_underlying(Attrib::CenterSize), "i_center_size");
+	this->bind_attrib_location(std::to_underlying(Attrib::Color), "i_color");
+
+	this->link_program();
+
+	glGenVertexArrays(1, &(this->vao));
+	glGenBuffers(1, &(this->vbo));
+}
+
+void ProgramCubeImpostor::bind_vertex_array ()
+{
+	glBindVertexArray(this->vao);
+}
+
+void ProgramCubeImpostor::setup_vertex_array ()
+{
+	glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::CenterSize) );
+	glVertexAttribPointer( std::to_underlying(Attrib::CenterSize), 4, GL_FLOAT, GL_FALSE, sizeof(Impostor), ( void * )offsetof(Impostor, center) );
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::Color) );
+	glVertexAttribPointer( std::to_underlying(Attrib::Color), 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Impostor), ( void * )offsetof(Impostor, color) );
+}
+
+uint32_t ProgramCubeImpostor::upload_vertex_buffer ()
+{
+	CUBE3D_PROFILE_ZONE("upload_vertex_buffer");
+
+	const uint32_t n = this->impostor_buffer.get_vertex_buffer_used();
+	glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Impostor) * n, this->impostor_buffer.get_vertex_buffer(), GL_DYNAMIC_DRAW);
+	return sizeof(Impostor) * n;
+}
+
+void ProgramCubeImpostor::upload_projection_matrix (const Matrix4& m)
+{
+	glUniformMatrix4fv( this->get_uniform_location("u_projection_matrix"), 1, GL_TRUE, m.get_raw() );
+}
+
+void ProgramCubeImpostor::draw ()
+{
+	CUBE3D_PROFILE_ZONE("draw");
+
+	glDrawArrays(GL_POINTS, 0, this->impostor_buffer.get_vertex_buffer_used());
+}
+
+ProgramVoxel::ProgramVoxel ()
+	: Program ()
+{
+	static_assert(sizeof(VoxelWorld::Vertex) == 8);
+
+	this->vs = new Shader(GL_VERTEX_SHADER, "shaders/voxel.vert");
+	this->fs = new Shader(GL_FRAGMENT_SHADER, "shaders/triangles.frag");
+
+	this->bind_attrib_location(std::to_underlying(Attrib::Position), "i_position");
+	this->bind_attrib_location(std::to_underlying(Attrib::Color), "i_color");
+
+	this->link_program();
+}
+
+void ProgramVoxel::setup_uniforms ()
+{
+	this->u_projection_matrix = this->get_uniform_location("u_projection_matrix");
+	this->u_chunk_origin = this->get_uniform_location("u_chunk_origin");
+	this->u_voxel_size = this->get_uniform_location("u_voxel_size");
+}
+
+ProgramVoxel::~ProgramVoxel ()
+{
+	this->clear_chunk_buffers();
+}
+
+void ProgramVoxel::clear_chunk_buffers ()
+{
+	for (ChunkBuffer& buffer : this->chunk_buffers) {
+		glDeleteVertexArrays(1, &(buffer.vao));
+		glDeleteBuffers(1, &(buffer.vbo));
+	}
+
+	this->chunk_buffers.clear();
+}
+
+uint32_t ProgramVoxel::upload_chunks (const VoxelWorld& world)
+{
+	CUBE3D_PROFILE_ZONE("upload_voxel_chunks");
+
+	if (world.get_id() != this->world_id) {
+		this->clear_chunk_buffers();
+		this->world_id = world.get_id();
+	}
+
+	const auto& chunks = world.get_ref_chunks();
+	uint32_t n_bytes = 0;
+
+	// new chunks of the world
+	while (this->chunk_buffers.size() < chunks.size()) {
+		ChunkBuffer buffer = { .vao = 0, .vbo = 0, .mesh_version = 0, .n_vertices = 0 };
+
+		glGenVertexArrays(1, &(buffer.vao));
+		glGenBuffers(1, &(buffer.vbo));
+
+		glBindVertexArray(buffer.vao);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+
+		glEnableVertexAttribArray( std::to_underlying(Attrib::Position) );
+		glVertexAttribPointer( std::to_underlying(Attrib::Position), 3, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(VoxelWorld::Vertex), ( void * )offsetof(VoxelWorld::Vertex, x) );
+
+		glEnableVertexAttribArray( std::to_underlying(Attrib::Color) );
+		glVertexAttribPointer( std::to_underlying(Attrib::Color), 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(VoxelWorld::Vertex), ( void * )offsetof(VoxelWorld::Vertex, color) );
+
+		this->chunk_buffers.push_back(buffer);
+	}
+
+	for (uint32_t i = 0; i < chunks.size(); i++) {
+		const VoxelWorld::Chunk& chunk = chunks[i];
+		ChunkBuffer& buffer = this->chunk_buffers[i];
+
+		if (buffer.mesh_version == chunk.mesh_version)
+			continue;
+
+		// a new buffer store, so the driver doesn't wait for the draws of the previous frames
+		const uint32_t size = chunk.mesh.size() * sizeof(VoxelWorld::Vertex);
+
+		glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+		glBufferData(GL_ARRAY_BUFFER, size, chunk.mesh.data(), GL_STATIC_DRAW);
+
+		buffer.mesh_version = chunk.mesh_version;
+		buffer.n_vertices = chunk.mesh.size();
+		n_bytes += size;
+	}
+
+	return n_bytes;
+}
+
+void ProgramVoxel::upload_projection_matrix (const Matrix4& m)
+{
+	glUniformMatrix4fv(this->u_projection_matrix, 1, GL_TRUE, m.get_raw());
+}
+
+uint32_t ProgramVoxel::draw (const VoxelWorld& world, const Frustum& frustum)
+{
+	CUBE3D_PROFILE_ZONE("draw");
+
+	const auto& chunks = world.get_ref_chunks();
+	uint32_t n_triangles = 0;
+
+	glUniform1f(this->u_voxel_size, world.get_voxel_size());
+
+	for (uint32_t i = 0; i < chunks.size(); i++) {
+		const ChunkBuffer& buffer = this->chunk_buffers[i];
+
+		if (buffer.n_vertices == 0 || frustum.is_outside(world.get_chunk_bounding_sphere(chunks[i])))
+			continue;
+
+		const Point origin = world.get_chunk_origin(chunks[i]);
+
+		glUniform3f(this->u_chunk_origin, origin.x, origin.y, origin.z);
+		glBindVertexArray(buffer.vao);
+		glDrawArrays(GL_TRIANGLES, 0, buffer.n_vertices);
+
+		n_triangles += buffer.n_vertices / 3;
+	}
+
+	return n_triangles;
+}
+
+GpuCulledCubes::GpuCulledCubes (const Method method_)
+	: method(method_)
+{
+	static_assert(sizeof(Instance) == (sizeof(float) * 8 + sizeof(uint32_t) * 8)); // std430 layout of shaders/cube-cull.comp
+	static_assert(sizeof(DrawCommand) == (sizeof(uint32_t) * 4));
+
+	mylib_assert_exception_msg(this->method != Method::Unsupported, "gpu culling is not supported")
+
+	glGenBuffers(1, &(this->vbo_instances));
+	glGenBuffers(1, &(this->vbo_visible));
+
+	if (this->method == Method::Compute) {
+		this->program_cull = new Program;
+		this->program_cull->set_cs( new Shader(GL_COMPUTE_SHADER, "shaders/cube-cull.comp") );
+		this->program_cull->link_program();
+
+		this->program_instanced = new ProgramCubeInstanced;
+		this->program_instanced->use_program();
+		this->program_instanced->bind_vertex_array();
+		this->program_instanced->setup_vertex_array(this->vbo_visible);
+
+		glGenBuffers(1, &(this->indirect_buffer));
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->indirect_buffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand), nullptr, GL_DYNAMIC_DRAW);
+	}
+	else {
+		auto bind_attrib_locations = [] (Program& program) {
+			program.bind_attrib_location(std::to_underlying(Attrib::CenterSize), "i_center_size");
+			program.bind_attrib_location(std::to_underlying(Attrib::Rotation), "i_rotation");
+			program.bind_attrib_location(std::to_underlying(Attrib::Colors0), "i_colors0");
+			program.bind_attrib_location(std::to_underlying(Attrib::Colors1), "i_colors1");
+		};
+
+		// captured in the same layout as Instance
+		const char *varyings[] = { "o_center_size", "o_rotation", "o_colors0", "o_colors1" };
+
+		this->program_cull = new Program;
+		this->program_cull->set_vs( new Shader(GL_VERTEX_SHADER, "shaders/cube-record.vert") );
+		this->program_cull->set_gs( new Shader(GL_GEOMETRY_SHADER, "shaders/cube-cull.geom") );
+		bind_attrib_locations(*this->program_cull);
+		this->program_cull->set_transform_feedback_varyings(varyings);
+		this->program_cull->link_program();
+
+		this->program_expand = new Program;
+		this->program_expand->set_vs( new Shader(GL_VERTEX_SHADER, "shaders/cube-record.vert") );
+		this->program_expand->set_gs( new Shader(GL_GEOMETRY_SHADER, "shaders/cube-expand.geom") );
+		this->program_expand->set_fs( new Shader(GL_FRAGMENT_SHADER, "shaders/triangles.frag") );
+		bind_attrib_locations(*this->program_expand);
+		this->program_expand->link_program();
+
+		glGenVertexArrays(1, &(this->vao_cull));
+		glBindVertexArray(this->vao_cull);
+		this->setup_record_attribs(this->vbo_instances);
+
+		glGenVertexArrays(1, &(this->vao_expand));
+		glBindVertexArray(this->vao_expand);
+		this->setup_record_attribs(this->vbo_visible);
+
+		glGenTransformFeedbacks(1, &(this->transform_feedback));
+	}
+}
+
+GpuCulledCubes::~GpuCulledCubes ()
+{
+	delete this->program_cull;
+	delete this->program_expand;
+	delete this->program_instanced;
+
+	if (this->vao_cull != 0)
+		glDeleteVertexArrays(1, &(this->vao_cull));
+	if (this->vao_expand != 0)
+		glDeleteVertexArrays(1, &(this->vao_expand));
+	if (this->indirect_buffer != 0)
+		glDeleteBuffers(1, &(this->indirect_buffer));
+	if (this->transform_feedback != 0)
+		glDeleteTransformFeedbacks(1, &(this->transform_feedback));
+
+	glDeleteBuffers(1, &(this->vbo_instances));
+	glDeleteBuffers(1, &(this->vbo_visible));
+}
+
+GpuCulledCubes::Method GpuCulledCubes::get_best_method ()
+{
+	// the context requested by Renderer is 3.3 core, but drivers usually give the latest version they support
+	if (GLEW_VERSION_4_3)
+		return Method::Compute;
+	else if (GLEW_ARB_transform_feedback2)
+		return Method::TransformFeedback;
+	else
+		return Method::Unsupported;
+}
+
+const char* GpuCulledCubes::get_method_str (const Method method)
+{
+	static constexpr auto strs = std::to_array<const char*>({
+		"Compute",
+		"TransformFeedback",
+		"Unsupported"
+	});
+
+	return strs[ std::to_underlying(method) ];
+}
+
+void GpuCulledCubes::setup_record_attribs (const GLuint vbo)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::CenterSize) );
+	glVertexAttribPointer( std::to_underlying(Attrib::CenterSize), 4, GL_FLOAT, GL_FALSE, sizeof(Instance), ( void * )offsetof(Instance, center) );
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::Rotation) );
+	glVertexAttribPointer( std::to_underlying(Attrib::Rotation), 4, GL_FLOAT, GL_FALSE, sizeof(Instance), ( void * )offsetof(Instance, rotation) );
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::Colors0) );
+	glVertexAttribIPointer( std::to_underlying(Attrib::Colors0), 4, GL_UNSIGNED_INT, sizeof(Instance), ( void * )offsetof(Instance, colors) );
+
+	glEnableVertexAttribArray( std::to_underlying(Attrib::Colors1) );
+	glVertexAttribIPointer( std::to_underlying(Attrib::Colors1), 4, GL_UNSIGNED_INT, sizeof(Instance), ( void * )(offsetof(Instance, colors) + 4 * sizeof(uint32_t)) );
+}
+
+void GpuCulledCubes::upload_frustum_planes (const Program& program, const Frustum& frustum)
+{
+	std::array<GLfloat, std::tuple_size_v<decltype(Frustum::planes)> * 4> planes;
+
+	for (uint32_t i = 0; const Frustum::Plane& plane : frustum.planes) {
+		planes[i++] = plane.normal.x;
+		planes[i++] = plane.normal.y;
+		planes[i++] = plane.normal.z;
+		planes[i++] = plane.d;
+	}
+
+	glUniform4fv( program.get_uniform_location("u_frustum_planes"), frustum.planes.size(), planes.data() );
+}
+
+void GpuCulledCubes::resize (const uint32_t n_slots)
+{
+	// new slots are free, which are always culled
+	this->instances.resize(n_slots, Instance { .center = Point::zero(), .w = 0, .rotation = Vector4(0, 0, 0, 1), .colors = {} });
+	this->dirty.resize(n_slots);
+}
+
+void GpuCulledCubes::set_instance (const uint32_t slot, const Instance& instance)
+{
+	Instance& current = this->instances[slot];
+
+	if (std::memcmp(&current, &instance, sizeof(Instance)) == 0)
+		return;
+
+	current = instance;
+	this->dirty.mark(slot);
+}
+
+void GpuCulledCubes::clear_instance (const uint32_t slot)
+{
+	this->instances[slot].w = 0;
+	this->dirty.mark(slot);
+}
+
+uint32_t GpuCulledCubes::upload_buffers ()
+{
+	CUBE3D_PROFILE_ZONE("upload_vertex_buffer");
+
+	const uint32_t n_slots = this->get_n_slots();
+	uint32_t bytes = 0;
+
+	glBindBuffer(GL_ARRAY_BUFFER, this->vbo_instances);
+
+	if (this->gpu_n_slots < n_slots) {
+		// gpu buffers must grow, so everything is uploaded
+		// vbo_visible must hold every slot, in case all of them are visible
+
+		glBufferData(GL_ARRAY_BUFFER, sizeof(Instance) * n_slots, this->instances.data(), GL_DYNAMIC_DRAW);
+
+		glBindBuffer(GL_ARRAY_BUFFER, this->vbo_visible);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(Instance) * n_slots, nullptr, GL_DYNAMIC_COPY);
+
+		this->gpu_n_slots = n_slots;
+		this->dirty.clear();
+
+		return sizeof(Instance) * n_slots;
+	}
+
+	this->dirty.consume_ranges([this, &bytes] (const uint32_t first, const uint32_t count) {
+		const GLsizeiptr size = sizeof(Instance) * count;
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(Instance) * first, size, this->instances.data() + first);
+		bytes += size;
+	});
+
+	return bytes;
+}
+
+void GpuCulledCubes::cull (const Frustum& frustum)
+{
+	CUBE3D_PROFILE_ZONE("cull");
+
+	this->program_cull->use_program();
+	this->upload_frustum_planes(*this->program_cull, frustum);
+
+	if (this->method == Method::Compute) {
+		const DrawCommand command = {
+			.count = CubeGeometry::triangles.size(),
+			.instance_count = 0, // incremented by the shader
+			.first = 0,
+			.base_instance = 0
+		};
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->indirect_buffer);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(DrawCommand), &command);
+
+		glUniform1ui( this->program_cull->get_uniform_location("u_n_instances"), this->n_slots_drawn );
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->vbo_instances);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->vbo_visible);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, this->indirect_buffer);
+
+		glDispatchCompute((this->n_slots_drawn + compute_group_size - 1) / compute_group_size, 1, 1);
+
+		// the results are read as vertex attributes and as the draw command
+		glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+	}
+	else {
+		glBindVertexArray(this->vao_cull);
+		glEnable(GL_RASTERIZER_DISCARD);
+
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, this->transform_feedback);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, this->vbo_visible);
+
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, 0, this->n_slots_drawn);
+		glEndTransformFeedback();
+
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+		glDisable(GL_RASTERIZER_DISCARD);
+	}
+}
+
+void GpuCulledCubes::draw (const Matrix4& projection_matrix)
+{
+	CUBE3D_PROFILE_ZONE("draw");
+
+	if (this->method == Method::Compute) {
+		this->program_instanced->use_program();
+		this->program_instanced->bind_vertex_array();
+		this->program_instanced->upload_projection_matrix(projection_matrix);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, this->indirect_buffer);
+		glDrawArraysIndirect(GL_TRIANGLES, nullptr);
+	}
+	else {
+		this->program_expand->use_program();
+		glUniformMatrix4fv( this->program_expand->get_uniform_location("u_projection_matrix"), 1, GL_TRUE, projection_matrix.get_raw() );
+
+		glBindVertexArray(this->vao_expand);
+		glDrawTransformFeedback(GL_POINTS, this->transform_feedback);
+	}
+}
+
+GpuTimer::GpuTimer ()
+{
+	this->supported = GLEW_ARB_timer_query;
+
+	dprintln("gpu timer queries ", this->supported ? "supported" : "not supported");
+}
+
+GpuTimer::~GpuTimer ()
+{
+	for (Frame& f : this->frames) {
+		if (!f.queries.empty())
+			glDeleteQueries(f.queries.size(), f.queries.data());
+	}
+}
+
+bool GpuTimer::read_frame (Frame& f, Graphics::Renderer::GpuStats& stats)
+{
+	const uint32_t n = f.phases.size();
+	GLint available = 0;
+
+	// queries complete in order, so the last one tells about all of them
+	glGetQueryObjectiv(f.queries[n - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+
+	if (!available)
+		return false;
+
+	stats.upload_time = 0;
+	stats.draw_time = 0;
+	stats.present_time = 0;
+
+	GLuint64 previous;
+	glGetQueryObjectui64v(f.queries[0], GL_QUERY_RESULT, &previous);
+
+	for (uint32_t i = 1; i < n; i++) {
+		GLuint64 t;
+		glGetQueryObjectui64v(f.queries[i], GL_QUERY_RESULT, &t);
+
+		const double dt = static_cast<double>(t - previous) * 1.0e-9; // nanoseconds
+		previous = t;
+
+		switch (f.phases[i]) {
+			case Phase::Upload:
+				stats.upload_time += dt;
+			break;
+
+			case Phase::Draw:
+				stats.draw_time += dt;
+			break;
+
+			case Phase::Present:
+				stats.present_time += dt;
+			break;
+
+			case Phase::Begin:
+			break;
+		}
+	}
+
+	stats.valid = true;
+	stats.frame = f.frame;
+	stats.latency = this->frame - f.frame;
+
+	return true;
+}
+
+void GpuTimer::begin_frame (Graphics::Renderer::GpuStats& stats)
+{
+	if (!this->supported)
+		return;
+
+	Frame& f = this->frames[this->frame % n_frames];
+
+	if (f.pending && !this->read_frame(f, stats))
+		stats.n_dropped++;
+
+	f.phases.clear();
+	f.frame = this->frame;
+	f.pending = true;
+
+	this->frame++;
+
+	this->mark(Phase::Begin);
+}
+
+void GpuTimer::mark (const Phase phase)
+{
+	if (!this->supported)
+		return;
+
+	Frame& f = this->frames[(this->frame - 1) % n_frames];
+	const uint32_t i = f.phases.size();
+
+	if (i == f.queries.size()) {
+		GLuint query;
+		glGenQueries(1, &query);
+		f.queries.push_back(query);
+	}
+
+	glQueryCounter(f.queries[i], GL_TIMESTAMP);
+	f.phases.push_back(phase);
+}
+
+Renderer::Renderer (const uint32_t window_width_px_, const uint32_t window_height_px_, const bool fullscreen_)
+	: Graphics::Renderer (window_width_px_, window_height_px_, fullscreen_)
+{
+	SDL_GL_SetAttribute( SDL_GL_DOUBLEBUFFER, 1 );
+	SDL_GL_SetAttribute( SDL_GL_ACCELERATED_VISUAL, 1 );
+	SDL_GL_SetAttribute( SDL_GL_RED_SIZE, 8 );
+	SDL_GL_SetAttribute( SDL_GL_GREEN_SIZE, 8 );
+	SDL_GL_SetAttribute( SDL_GL_BLUE_SIZE, 8 );
+	SDL_GL_SetAttribute( SDL_GL_ALPHA_SIZE, 8 );
+
+	SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 3 );
+	SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 3 );
+	SDL_GL_SetAttribute( SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE );
+
+	this->sdl_window = SDL_CreateWindow("", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, this->window_width_px, this->window_height_px, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+
+	this->sdl_gl_context = SDL_GL_CreateContext(this->sdl_window);
+
+	this->init_opengl();
+}
+
+Renderer::Renderer (const uint32_t window_width_px_, const uint32_t window_height_px_, NoWindow)
+	: Graphics::Renderer (window_width_px_, window_height_px_, false)
+{
+	this->sdl_window = nullptr;
+	this->sdl_gl_context = nullptr;
+}
+
+void Renderer::init_opengl ()
+{
+	glewExperimental = GL_TRUE; // required to load core profile entry points with older GLEW
+	GLenum err = glewInit();
+
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	// GLEW built for GLX fails on contexts without an X display (EGL), but the GL entry points are loaded
+	if (err == GLEW_ERROR_NO_GLX_DISPLAY && this->sdl_window == nullptr)
+		err = GLEW_OK;
+#endif
+
+	mylib_assert_exception_msg(err == GLEW_OK, "Error: ", glewGetErrorString(err))
+
+	dprintln("Status: Using GLEW ", glewGetString(GLEW_VERSION));
+
+	//glDisable(GL_DEPTH_TEST);
+	glEnable(GL_DEPTH_TEST);
+
+	// CubeGeometry::triangles and shaders/cube-expand.geom are counter-clockwise when seen from outside
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+	glFrontFace(GL_CCW);
+
+	glEnable(GL_PROGRAM_POINT_SIZE); // impostors set their size in the shader
+
+	glClearColor(this->background_color.r, this->background_color.g, this->background_color.b, 1.0);
+	glViewport(0, 0, this->window_width_px, this->window_height_px);
+
+	this->program_cache = new ProgramCache("shader-cache");
+	Program::cache = this->program_cache;
+
+	this->load_opengl_programs();
+
+	dprintln("loaded opengl stuff");
+
+	this->wait_next_frame();
+}
+
+void Renderer::load_opengl_programs ()
+{
+	const auto tbegin = std::chrono::steady_clock::now();
+
+	// all the programs are created first, so the driver can compile them in parallel,
+	// and use_program waits for each one to finish its link
+
+	this->program_triangle = new ProgramTriangle;
+	this->program_triangle_indexed = new ProgramTriangleIndexed;
+	this->program_triangle_packed = new ProgramTrianglePacked;
+	this->program_triangle_transform = new ProgramTriangleTransform;
+	this->program_retained = new ProgramTriangleTransform;
+	this->program_cube_instanced = new ProgramCubeInstanced;
+	this->program_cube_impostor = new ProgramCubeImpostor;
+	this->program_voxel = new ProgramVoxel;
+
+	this->program_triangle->use_program();
+	
+	this->program_triangle->bind_vertex_array();
+	this->program_triangle->bind_vertex_buffer();
+
+	this->program_triangle->setup_vertex_array();
+
+	dprintln("generated and binded opengl world vertex array/buffer");
+
+	this->program_triangle_indexed->use_program();
+	this->program_triangle_indexed->bind_vertex_array();
+	this->program_triangle_indexed->bind_vertex_buffer();
+	this->program_triangle_indexed->setup_vertex_array();
+
+	this->program_triangle_packed->use_program();
+	this->program_triangle_packed->bind_vertex_array();
+	this->program_triangle_packed->setup_vertex_array();
+
+	this->program_triangle_transform->use_program();
+	this->program_triangle_transform->bind_vertex_array();
+	this->program_triangle_transform->setup_vertex_array();
+
+	this->program_retained->use_program();
+	this->program_retained->bind_vertex_array();
+	this->program_retained->setup_vertex_array();
+
+	this->program_cube_instanced->use_program();
+	this->program_cube_instanced->bind_vertex_array();
+	this->program_cube_instanced->setup_vertex_array();
+
+	dprintln("generated and binded opengl cube instanced vertex array/buffers");
+
+	this->program_cube_impostor->use_program();
+	this->program_cube_impostor->bind_vertex_array();
+	this->program_cube_impostor->setup_vertex_array();
+
+	this->program_voxel->use_program();
+
+	dprintln("loaded opengl programs in ", std::chrono::duration<double>(std::chrono::steady_clock::now() - tbegin).count() * 1000.0, " ms",
+		" (cache hits ", this->program_cache->get_n_hits(), " misses ", this->program_cache->get_n_misses(), ")");
+
+	this->gpu_timer = new GpuTimer;
+
+	this->update_shader_variants();
+}
+
+Renderer::~Renderer ()
+{
+	this->unload_opengl_programs();
+
+	if (this->sdl_window != nullptr) {
+		SDL_GL_DeleteContext(this->sdl_gl_context);
+		SDL_DestroyWindow(this->sdl_window);
+	}
+}
+
+// must be called while the context is still current, can be called more than once
+
+void Renderer::unload_opengl_programs ()
 {
-	this->shader_id = glCreateShader(this->shader_type);
+	delete this->program_triangle;
+	delete this->program_triangle_indexed;
+	delete this->program_triangle_packed;
+	delete this->program_triangle_transform;
+	delete this->program_retained;
+	delete this->program_cube_instanced;
+	delete this->program_cube_impostor;
+	delete this->program_voxel;
+	delete this->gpu_culled_cubes;
+	delete this->gpu_timer;
+
+	this->program_triangle = nullptr;
+	this->program_triangle_indexed = nullptr;
+	this->program_triangle_packed = nullptr;
+	this->program_triangle_transform = nullptr;
+	this->program_retained = nullptr;
+	this->program_cube_instanced = nullptr;
+	this->program_cube_impostor = nullptr;
+	this->program_voxel = nullptr;
+	this->gpu_culled_cubes = nullptr;
+	this->gpu_timer = nullptr;
+
+	delete this->shader_watcher;
+	this->shader_watcher = nullptr;
+
+	if (this->program_cache != nullptr) {
+		if (Program::cache == this->program_cache)
+			Program::cache = nullptr;
+
+		delete this->program_cache;
+		this->program_cache = nullptr;
+	}
 }
 
-void Shader::compile ()
+std::vector<Program*> Renderer::get_programs () const
 {
-	std::ifstream t(this->fname);
-	std::stringstream str_stream;
-	str_stream << t.rdbuf();
-	std::string buffer = str_stream.str();
+	std::vector<Program*> programs = {
+		this->program_triangle,
+		this->program_triangle_indexed,
+		this->program_triangle_packed,
+		this->program_triangle_transform,
+		this->program_retained,
+		this->program_cube_instanced,
+		this->program_cube_impostor,
+		this->program_voxel
+	};
 
-	dprintln("loaded shader (", this->fname, ")");
-	//dprint( buffer )
-	
-	const char *c_str = buffer.c_str();
-	glShaderSource(this->shader_id, 1, ( const GLchar ** )&c_str, nullptr);
-	glCompileShader(this->shader_id);
+	if (this->gpu_culled_cubes != nullptr) {
+		for (Program *program : this->gpu_culled_cubes->get_programs())
+			programs.push_back(program);
+	}
 
-	GLint status;
-	glGetShaderiv(this->shader_id, GL_COMPILE_STATUS, &status);
+	std::erase(programs, nullptr);
 
-	if (status == GL_FALSE) {
-		GLint logSize = 0;
-		glGetShaderiv(this->shader_id, GL_INFO_LOG_LENGTH, &logSize);
+	return programs;
+}
+
+void Renderer::update_shader_variants ()
+{
+	if (this->shader_watcher == nullptr)
+		return;
 
-		char *berror = new char [logSize];
+	std::vector<ShaderWatcher::Variant> variants;
 
-		glGetShaderInfoLog(this->shader_id, logSize, nullptr, berror);
+	for (const Program *program : this->get_programs()) {
+		for (const Shader *shader : program->get_shaders()) {
+			if (shader == nullptr)
+				continue;
 
-		mylib_throw_exception_msg(this->fname, " shader compilation failed", '\n', berror);
+			const bool found = std::any_of(variants.begin(), variants.end(), [shader] (const ShaderWatcher::Variant& v) {
+				return v.fname == shader->get_ref_fname() && v.defines == shader->get_ref_defines();
+			});
+
+			if (!found)
+				variants.push_back(ShaderWatcher::Variant { .fname = shader->get_ref_fname(), .defines = shader->get_ref_defines() });
+		}
 	}
+
+	this->shader_watcher->set_variants(std::move(variants));
 }
 
-Program::Program ()
+bool Renderer::set_shader_hot_reload (const bool enabled)
 {
-	this->vs = nullptr;
-	this->fs = nullptr;
-	this->program_id = glCreateProgram();
+	if (!enabled) {
+		delete this->shader_watcher;
+		this->shader_watcher = nullptr;
+		return true;
+	}
+
+	if (this->shader_watcher == nullptr) {
+		this->shader_watcher = new ShaderWatcher("shaders");
+
+		if (!this->shader_watcher->get_supported()) {
+			delete this->shader_watcher;
+			this->shader_watcher = nullptr;
+			return false;
+		}
+
+		this->update_shader_variants();
+	}
+
+	return true;
 }
 
-void Program::attach_shaders ()
+void Renderer::reload_shaders ()
 {
-	glAttachShader(this->program_id, this->vs->shader_id);
-	glAttachShader(this->program_id, this->fs->shader_id);
+	CUBE3D_PROFILE_ZONE("reload_shaders");
+
+	const std::vector<ShaderWatcher::Change> changes = this->shader_watcher->get_changes();
+
+	for (Program *program : this->get_programs()) {
+		if (!changes.empty())
+			program->start_reload(changes);
+
+		if (program->is_reloading() && program->update_reload())
+			log_info("shaders reloaded (", program->get_vs() ? program->get_vs()->get_ref_fname() : program->get_cs()->get_ref_fname(), ")");
+	}
 }
 
-void Program::link_program ()
+Renderer::CubeHandle Renderer::create_cube (const Cube3d& cube, const Vector& offset)
 {
-	glLinkProgram(this->program_id);
+	CubeHandle handle;
+
+	if (this->retained_free_slots.empty()) {
+		handle = this->n_retained_slots++;
+
+		if (this->gpu_culling) {
+			if (handle >= this->gpu_culled_cubes->get_n_slots())
+				this->gpu_culled_cubes->resize( std::max(handle + 1, this->gpu_culled_cubes->get_n_slots() * 2) );
+		}
+		else if (handle >= this->program_retained->get_n_slots())
+			this->program_retained->resize( std::max(handle + 1, this->program_retained->get_n_slots() * 2) );
+	}
+	else {
+		handle = this->retained_free_slots.back();
+		this->retained_free_slots.pop_back();
+	}
+
+	if (handle >= this->retained_alive.size())
+		this->retained_alive.resize(handle + 1, 0);
+
+	this->retained_alive[handle] = 1;
+	this->n_retained_alive++;
+	this->update_cube(handle, cube, offset);
+
+	return handle;
 }
 
-void Program::use_program ()
+void Renderer::update_cube (const CubeHandle handle, const Cube3d& cube, const Vector& offset)
 {
-	glUseProgram(this->program_id);
+	mylib_assert_exception_msg(handle < this->retained_alive.size() && this->retained_alive[handle], "invalid cube handle ", handle)
+
+	// only slots whose geometry or transform really changed are uploaded
+
+	if (this->gpu_culling) {
+		ProgramCubeInstanced::Instance instance;
+		fill_instance(instance, cube, offset);
+		this->gpu_culled_cubes->set_instance(handle, instance);
+		return;
+	}
+
+	this->program_retained->set_geometry(handle, cube);
+
+	this->program_retained->set_transform(handle, ProgramTriangleTransform::Transform {
+		.rotation = calc_rotation_quaternion(cube),
+		.translation = offset,
+		.padding = 0
+		});
 }
 
-ProgramTriangle::ProgramTriangle ()
-	: Program ()
+void Renderer::destroy_cube (const CubeHandle handle)
 {
-	static_assert(sizeof(Vector) == sizeof(fp_t) * 3);
-	static_assert(sizeof(Vector) == sizeof(Point));
-	static_assert(sizeof(Color) == sizeof(float) * 4);
-#ifndef OPENGL_SOFTWARE_CALCULATE_MATRIX
-	static_assert(sizeof(Vertex) == (sizeof(Point) + sizeof(Vector) + sizeof(Color)));
-#else
-	static_assert(sizeof(Vertex) == (sizeof(Point4) + sizeof(Vector) + sizeof(Color)));
-#endif
+	mylib_assert_exception_msg(handle < this->retained_alive.size() && this->retained_alive[handle], "invalid cube handle ", handle)
 
-	this->vs = new Shader(GL_VERTEX_SHADER, "shaders/triangles.vert");
-	this->vs->compile();
+	this->retained_alive[handle] = 0;
 
-	this->fs = new Shader(GL_FRAGMENT_SHADER, "shaders/triangles.frag");
-	this->fs->compile();
+	if (this->gpu_culling)
+		this->gpu_culled_cubes->clear_instance(handle);
+	else
+		this->program_retained->clear_geometry(handle);
 
-	this->attach_shaders();
+	this->retained_free_slots.push_back(handle);
+	this->n_retained_alive--;
+}
 
-	glBindAttribLocation(this->program_id, std::to_underlying(Attrib::Position), "i_position");
-	glBindAttribLocation(this->program_id, std::to_underlying(Attrib::Offset), "i_offset");
-	glBindAttribLocation(this->program_id, std::to_underlying(Attrib::Color), "i_color");
+bool Renderer::set_gpu_culling (const bool enabled)
+{
+	mylib_assert_exception_msg(this->n_retained_alive == 0, "gpu culling can't change while there are retained cubes")
 
-	this->link_program();
+	if (enabled && this->gpu_culled_cubes == nullptr) {
+		const GpuCulledCubes::Method method = GpuCulledCubes::get_best_method();
 
-	glGenVertexArrays(1, &(this->vao));
-	glGenBuffers(1, &(this->vbo));
+		dprintln("gpu culling method: ", GpuCulledCubes::get_method_str(method));
+
+		if (method == GpuCulledCubes::Method::Unsupported)
+			return false;
+
+		this->gpu_culled_cubes = new GpuCulledCubes(method);
+		this->update_shader_variants();
+	}
+
+	// the slots of the previous program are all free
+	this->gpu_culling = enabled;
+	this->retained_free_slots.clear();
+	this->retained_alive.clear();
+	this->n_retained_slots = 0;
+
+	return true;
 }
 
-void ProgramTriangle::bind_vertex_array ()
+bool Renderer::draw_voxel_world (const VoxelWorld& world)
 {
-	glBindVertexArray(this->vao);
+	this->voxel_world = &world;
+
+	return true;
 }
 
-void ProgramTriangle::bind_vertex_buffer ()
+void Renderer::set_vertex_upload_mode (const ProgramTriangle::UploadMode mode)
 {
-	glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+	this->program_triangle->set_upload_mode(mode);
+	this->program_triangle_indexed->set_upload_mode(mode);
 }
 
-void ProgramTriangle::setup_vertex_array ()
+void Renderer::wait_next_frame ()
 {
-	uint32_t pos, length;
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glEnableVertexAttribArray( std::to_underlying(Attrib::Position) );
-	glEnableVertexAttribArray( std::to_underlying(Attrib::Offset) );
-	glEnableVertexAttribArray( std::to_underlying(Attrib::Color) );
+	this->program_triangle->clear();
+	this->program_triangle_indexed->clear();
+	this->program_triangle_packed->clear();
+	this->program_cube_instanced->clear();
+	this->program_cube_impostor->clear();
+	this->n_transform_cubes = 0;
+	this->voxel_world = nullptr;
 
-	pos = 0;
-#ifndef OPENGL_SOFTWARE_CALCULATE_MATRIX
-	length = 3;
-#else
-	length = 4;
-#endif
-	glVertexAttribPointer( std::to_underlying(Attrib::Position), length, GL_FLOAT, GL_FALSE, sizeof(Vertex), ( void * )(pos * sizeof(float)) );
-	
-	pos += length;
-	length = 3;
-	glVertexAttribPointer( std::to_underlying(Attrib::Offset), length, GL_FLOAT, GL_FALSE, sizeof(Vertex), ( void * )(pos * sizeof(float)) );
-	
-	pos += length;
-	length = 4;
-	glVertexAttribPointer( std::to_underlying(Attrib::Color), length, GL_FLOAT, GL_FALSE, sizeof(Vertex), ( void * )(pos * sizeof(float)) );
-}
+	if (this->shader_watcher != nullptr)
+		this->reload_shaders();
 
-void ProgramTriangle::upload_vertex_buffer ()
-{
-	uint32_t n = this->triangle_buffer.get_vertex_buffer_used();
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * n, this->triangle_buffer.get_vertex_buffer(), GL_DYNAMIC_DRAW);
+	this->reset_stats();
 }
 
-void ProgramTriangle::upload_projection_matrix (const Matrix4& m)
+void Renderer::draw_cube3d (const Cube3d& cube, const Vector& offset)
 {
-	glUniformMatrix4fv( glGetUniformLocation(this->program_id, "u_projection_matrix"), 1, GL_TRUE, m.get_raw() );
-	//dprintln( "projection matrix sent to GPU" )
+	CUBE3D_PROFILE_ZONE("draw_cube3d");
+
+	if (this->lod_selector.get_ref_config().enabled) {
+		const LodSelector::Lod lod = this->lod_selector.select(cube, offset);
+
+		if (lod == LodSelector::Lod::Full)
+			this->draw_cube3d_full(cube, offset);
+		else if (lod == LodSelector::Lod::Impostor)
+			this->draw_cube3d_impostor(cube, offset);
+
+		this->stats.lod_histogram[ std::to_underlying(lod) ]++;
+	}
+	else
+		this->draw_cube3d_full(cube, offset);
+
+	this->stats.n_cubes++;
 }
 
-void ProgramTriangle::draw ()
+void Renderer::draw_cube3d_full (const Cube3d& cube, const Vector& offset)
 {
-	uint32_t n = this->triangle_buffer.get_vertex_buffer_used();
-	glDrawArrays(GL_TRIANGLES, 0, n);
+	if (this->cube_draw_mode == CubeDrawMode::Instanced)
+		this->draw_cube3d_instanced(cube, offset);
+	else if (this->cube_draw_mode == CubeDrawMode::Transform)
+		this->draw_cube3d_transform(cube, offset);
+	else
+		this->draw_cube3d_corners(cube, offset, CubeGeometry::calc_corners(cube));
 }
 
-void ProgramTriangle::debug ()
+void Renderer::draw_cube3d_batch (std::span<const Cube3d> cubes, std::span<const Vector> offsets)
 {
-	const uint32_t n = this->triangle_buffer.get_vertex_buffer_used();
+	CUBE3D_PROFILE_ZONE("draw_cube3d_batch");
 
-	for (uint32_t i=0; i<n; i++) {
-		const Vertex& v = this->triangle_buffer.get_vertex(i);
+	mylib_assert_exception_msg(offsets.size() >= cubes.size(), "batch of ", cubes.size(), " cubes has only ", offsets.size(), " offsets")
 
-		if ((i % 3) == 0)
-			dprintln();
+	if (this->lod_selector.get_ref_config().enabled) {
+		// impostors are drawn right away, the full cubes are still drawn as a batch
+		this->lod_full_cubes.clear();
+		this->lod_full_offsets.clear();
 
-		dprintln("vertex[", i,
-			"] x=", v.local_pos.x,
-			" y=", v.local_pos.y,
-			" z=", v.local_pos.z,
-		#ifdef OPENGL_SOFTWARE_CALCULATE_MATRIX
-			" w=", v->local_pos.w,
-		#endif
-			" offset_x=", v.offset.x,
-			" offset_y=", v.offset.y,
-			" offset_z=", v.offset.z,
-			" r=", v.color.r,
-			" g=", v.color.g,
-			" b=", v.color.b,
-			" a=", v.color.a
-		);
+		for (size_t i = 0; i < cubes.size(); i++) {
+			const LodSelector::Lod lod = this->lod_selector.select(cubes[i], offsets[i]);
+
+			if (lod == LodSelector::Lod::Full) {
+				this->lod_full_cubes.push_back(cubes[i]);
+				this->lod_full_offsets.push_back(offsets[i]);
+			}
+			else if (lod == LodSelector::Lod::Impostor)
+				this->draw_cube3d_impostor(cubes[i], offsets[i]);
+
+			this->stats.lod_histogram[ std::to_underlying(lod) ]++;
+		}
+
+		this->draw_cube3d_batch_full(this->lod_full_cubes, this->lod_full_offsets);
 	}
+	else
+		this->draw_cube3d_batch_full(cubes, offsets);
+
+	this->stats.n_cubes += cubes.size();
 }
 
-Renderer::Renderer (const uint32_t window_width_px_, const uint32_t window_height_px_, const bool fullscreen_)
-	: Graphics::Renderer (window_width_px_, window_height_px_, fullscreen_)
+void Renderer::draw_cube3d_batch_full (std::span<const Cube3d> cubes, std::span<const Vector> offsets)
 {
-	SDL_GL_SetAttribute( SDL_GL_DOUBLEBUFFER, 1 );
-	SDL_GL_SetAttribute( SDL_GL_ACCELERATED_VISUAL, 1 );
-	SDL_GL_SetAttribute( SDL_GL_RED_SIZE, 8 );
-	SDL_GL_SetAttribute( SDL_GL_GREEN_SIZE, 8 );
-	SDL_GL_SetAttribute( SDL_GL_BLUE_SIZE, 8 );
-	SDL_GL_SetAttribute( SDL_GL_ALPHA_SIZE, 8 );
+	if (this->cube_draw_mode == CubeDrawMode::Instanced) {
+		for (size_t i = 0; i < cubes.size(); i++)
+			this->draw_cube3d_instanced(cubes[i], offsets[i]);
+	}
+	else if (this->cube_draw_mode == CubeDrawMode::Transform) {
+		for (size_t i = 0; i < cubes.size(); i++)
+			this->draw_cube3d_transform(cubes[i], offsets[i]);
+	}
+	else if (this->thread_pool != nullptr && cubes.size() >= parallel_batch_min_cubes && this->cube_draw_mode == CubeDrawMode::Triangles)
+		this->draw_cube3d_batch_parallel(*this->program_triangle, cubes, offsets);
+	else if (this->thread_pool != nullptr && cubes.size() >= parallel_batch_min_cubes && this->cube_draw_mode == CubeDrawMode::Indexed)
+		this->draw_cube3d_batch_parallel(*this->program_triangle_indexed, cubes, offsets);
+	else {
+		constexpr uint32_t block_size = 256;
+		std::array<CubeGeometry::Corners, block_size> corners;
+
+		for (size_t first = 0; first < cubes.size(); first += block_size) {
+			const size_t n = std::min<size_t>(block_size, cubes.size() - first);
+
+			CubeGeometry::calc_corners_batch(cubes.subspan(first, n), corners);
+
+			for (size_t i = 0; i < n; i++)
+				this->draw_cube3d_corners(cubes[first + i], offsets[first + i], corners[i]);
+		}
+	}
+}
 
-	SDL_GL_SetAttribute( SDL_GL_CONTEXT_MAJOR_VERSION, 3 );
-	SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 2 );
-	SDL_GL_SetAttribute( SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE );
+/*
+	Each worker thread builds the vertices of chunks of cubes in its own arena.
+	Then the arenas are copied in parallel to the vertex buffer of the program,
+	at offsets given by a prefix sum, keeping the order of the cubes.
+*/
 
-	this->sdl_window = SDL_CreateWindow("", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, this->window_width_px, this->window_height_px, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+void Renderer::draw_cube3d_batch_parallel (ProgramTriangle& program, std::span<const Cube3d> cubes, std::span<const Vector> offsets)
+{
+	using Vertex = ProgramTriangle::Vertex;
 
-	this->sdl_gl_context = SDL_GL_CreateContext(this->sdl_window);
+	constexpr uint32_t block_size = 256;
+	const bool indexed = (this->cube_draw_mode == CubeDrawMode::Indexed);
+	const uint32_t n_vertices_per_cube = indexed ? Cube3d::get_n_vertices() : CubeGeometry::triangles.size();
+	const uint32_t n_chunks = (cubes.size() + parallel_batch_chunk_size - 1) / parallel_batch_chunk_size;
 
-	GLenum err = glewInit();
+	const uint64_t n_vertices = this->arena_builder.build(*this->thread_pool, n_chunks, [&] (const uint32_t chunk, auto& emit) {
+		const size_t chunk_first = chunk * parallel_batch_chunk_size;
+		const size_t chunk_end = std::min<size_t>(chunk_first + parallel_batch_chunk_size, cubes.size());
+		std::array<CubeGeometry::Corners, block_size> corners;
 
-	mylib_assert_exception_msg(err == GLEW_OK, "Error: ", glewGetErrorString(err))
+		for (size_t first = chunk_first; first < chunk_end; first += block_size) {
+			const size_t n = std::min<size_t>(block_size, chunk_end - first);
 
-	dprintln("Status: Using GLEW ", glewGetString(GLEW_VERSION));
+			CubeGeometry::calc_corners_batch(cubes.subspan(first, n), corners);
 
-	//glDisable(GL_DEPTH_TEST);
-	glEnable(GL_DEPTH_TEST);
+			std::span<Vertex> vertices = emit(n * n_vertices_per_cube);
 
-	glClearColor(this->background_color.r, this->background_color.g, this->background_color.b, 1.0);
-	glViewport(0, 0, this->window_width_px, this->window_height_px);
+			for (size_t i = 0; i < n; i++) {
+				std::span<Vertex> cube_vertices = vertices.subspan(i * n_vertices_per_cube, n_vertices_per_cube);
 
-	this->load_opengl_programs();
+				if (indexed)
+					CubeGeometry::mount_corners(cube_vertices, cubes[first + i], offsets[first + i], corners[i]);
+				else
+					CubeGeometry::mount_triangles(cube_vertices, cubes[first + i], offsets[first + i], corners[i]);
+			}
+		}
+	});
 
-	dprintln("loaded opengl stuff");
+	this->arena_builder.stitch(*this->thread_pool, program.alloc_vertices(n_vertices));
 
-	this->wait_next_frame();
+	this->stats.n_vertices += n_vertices;
 }
 
-void Renderer::load_opengl_programs ()
+void Renderer::draw_cube3d_corners (const Cube3d& cube, const Vector& offset, const CubeGeometry::Corners& points)
 {
-	this->program_triangle = new ProgramTriangle;
+	switch (this->cube_draw_mode) {
+		case CubeDrawMode::Triangles:
+			this->draw_cube3d_triangles(cube, offset, points);
+		break;
 
-	dprintln("loaded opengl triangle program");
-
-	this->program_triangle->use_program();
-	
-	this->program_triangle->bind_vertex_array();
-	this->program_triangle->bind_vertex_buffer();
+		case CubeDrawMode::Indexed:
+			this->draw_cube3d_indexed(cube, offset, points);
+		break;
 
-	this->program_triangle->setup_vertex_array();
+		case CubeDrawMode::Packed:
+			this->draw_cube3d_packed(cube, offset, points);
+		break;
 
-	dprintln("generated and binded opengl world vertex array/buffer");
+		default:
+			mylib_throw_exception_msg("cube draw mode doesn't use corners");
+	}
 }
 
-Renderer::~Renderer ()
+void Renderer::draw_cube3d_indexed (const Cube3d& cube, const Vector& offset, const CubeGeometry::Corners& points)
 {
-	delete this->program_triangle;
+	std::span<ProgramTriangle::Vertex> vertices = this->program_triangle_indexed->alloc_vertices(Cube3d::get_n_vertices());
 
-	SDL_GL_DeleteContext(this->sdl_gl_context);
-	SDL_DestroyWindow(this->sdl_window);
+	CubeGeometry::mount_corners(vertices, cube, offset, points);
+
+	this->stats.n_vertices += Cube3d::get_n_vertices();
 }
 
-void Renderer::wait_next_frame ()
+void Renderer::draw_cube3d_packed (const Cube3d& cube, const Vector& offset, const CubeGeometry::Corners& points)
 {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	using PackedVertex = ProgramTrianglePacked::Vertex;
 
-	this->program_triangle->clear();
+	fp_t scale = 0;
+
+	for (const Point& p : points)
+		scale = std::max({ scale, std::abs(p.x), std::abs(p.y), std::abs(p.z) });
+
+	ProgramTrianglePacked::CubeData& cube_data = this->program_triangle_packed->alloc_cube();
+	cube_data.offset = offset;
+	cube_data.scale = scale;
+
+	// quantize the 8 corners only once
+
+	const fp_t to_snorm = (scale > fp(0)) ? (fp(32767) / scale) : fp(0);
+	std::array<PackedVertex, 8> corners;
+
+	for (uint32_t i = 0; i < Cube3d::get_n_vertices(); i++) {
+		corners[i].local_pos = {
+			static_cast<int16_t>( std::lround(points[i].x * to_snorm) ),
+			static_cast<int16_t>( std::lround(points[i].y * to_snorm) ),
+			static_cast<int16_t>( std::lround(points[i].z * to_snorm) ),
+			0
+		};
+		corners[i].color = pack_color_rgba8(cube.get_vertex_color(static_cast<Cube3d::PositionIndex>(i)));
+	}
+
+	std::span<PackedVertex> vertices = this->program_triangle_packed->alloc_vertices();
+
+	for (uint32_t i = 0; const Cube3d::PositionIndex p : CubeGeometry::triangles)
+		vertices[i++] = corners[p];
+
+	this->stats.n_vertices += vertices.size();
 }
 
-void Renderer::draw_cube3d (const Cube3d& cube, const Vector& offset)
+void Renderer::draw_cube3d_transform (const Cube3d& cube, const Vector& offset)
 {
-	const Vector local_pos = cube.get_value_delta();
-	//const Vector world_pos = Vector(4.0f, 4.0f);
+	ProgramTriangleTransform& program = *this->program_triangle_transform;
+	const uint32_t slot = this->n_transform_cubes++;
 
-	using PositionIndex = Cube3d::PositionIndex;
-	using enum PositionIndex;
-	
-#if 0
-	dprint( "local_pos:" )
-	Mylib::Math::println(world_pos);
+	if (slot >= program.get_n_slots())
+		program.resize( std::max(slot + 1, program.get_n_slots() * 2) );
 
-	dprint( "clip_pos:" )
-	Mylib::Math::println(clip_pos);
-//exit(1);
-#endif
+	program.set_geometry(slot, cube);
 
-	std::array<Point, 8> points;
+	program.set_transform(slot, ProgramTriangleTransform::Transform {
+		.rotation = calc_rotation_quaternion(cube),
+		.translation = offset,
+		.padding = 0
+		});
+}
 
-	points[LeftTopFront] = Point(
-		local_pos.x - cube.get_w()*fp(0.5),
-		local_pos.y + cube.get_h()*fp(0.5),
-		local_pos.z - cube.get_d()*fp(0.5)
-		);
-	
-	points[LeftBottomFront] = Point(
-		local_pos.x - cube.get_w()*fp(0.5),
-		local_pos.y - cube.get_h()*fp(0.5),
-		local_pos.z - cube.get_d()*fp(0.5)
-		);
-	
-	points[RightTopFront] = Point(
-		local_pos.x + cube.get_w()*fp(0.5),
-		local_pos.y + cube.get_h()*fp(0.5),
-		local_pos.z - cube.get_d()*fp(0.5)
-		);
-	
-	points[RightBottomFront] = Point(
-		local_pos.x + cube.get_w()*fp(0.5),
-		local_pos.y - cube.get_h()*fp(0.5),
-		local_pos.z - cube.get_d()*fp(0.5)
-		);
-	
-	points[LeftTopBack] = Point(
-		local_pos.x - cube.get_w()*fp(0.5),
-		local_pos.y + cube.get_h()*fp(0.5),
-		local_pos.z + cube.get_d()*fp(0.5)
-		);
-	
-	points[LeftBottomBack] = Point(
-		local_pos.x - cube.get_w()*fp(0.5),
-		local_pos.y - cube.get_h()*fp(0.5),
-		local_pos.z + cube.get_d()*fp(0.5)
-		);
-	
-	points[RightTopBack] = Point(
-		local_pos.x + cube.get_w()*fp(0.5),
-		local_pos.y + cube.get_h()*fp(0.5),
-		local_pos.z + cube.get_d()*fp(0.5)
-		);
-	
-	points[RightBottomBack] = Point(
-		local_pos.x + cube.get_w()*fp(0.5),
-		local_pos.y - cube.get_h()*fp(0.5),
-		local_pos.z + cube.get_d()*fp(0.5)
-		);
-	
-	if (cube.get_rotation_angle() != fp(0)) {
-		for (auto& p : points)
-			p.rotate_around_axis(cube.get_ref_rotation_axis(), cube.get_rotation_angle());
+void Renderer::draw_cube3d_instanced (const Cube3d& cube, const Vector& offset)
+{
+	fill_instance(this->program_cube_instanced->alloc_instance(), cube, offset);
+}
+
+void Renderer::draw_cube3d_impostor (const Cube3d& cube, const Vector& offset)
+{
+	ProgramCubeImpostor::Impostor& impostor = this->program_cube_impostor->alloc_impostor();
+	Color color = { .r = 0, .g = 0, .b = 0, .a = 0 };
+
+	for (const Color& c : cube.get_colors_ref()) {
+		color.r += c.r;
+		color.g += c.g;
+		color.b += c.b;
+		color.a += c.a;
 	}
 
+	constexpr float inv_n = 1.0f / static_cast<float>(Cube3d::get_n_vertices());
+
+	impostor.center = offset;
+	impostor.size_px = this->lod_selector.calc_size_px(cube, offset);
+	impostor.color = pack_color_rgba8({ .r = color.r * inv_n, .g = color.g * inv_n, .b = color.b * inv_n, .a = color.a * inv_n });
+}
+
+void Renderer::draw_cube3d_triangles (const Cube3d& cube, const Vector& offset, const CubeGeometry::Corners& points)
+{
 #ifdef OPENGL_SOFTWARE_CALCULATE_MATRIX
 	std::array<Point4, 8> points4;
 
@@ -362,56 +2391,17 @@ void Renderer::draw_cube3d (const Cube3d& cube, const Vector& offset)
 	}
 #endif
 	
-	constexpr uint32_t n_triangles = 12; // 6 faces * 2 triangles per face
-	constexpr uint32_t n_vertices = n_triangles * 3;
+	constexpr uint32_t n_vertices = CubeGeometry::triangles.size();
 
 	std::span<ProgramTriangle::Vertex> vertices = this->program_triangle->alloc_vertices(n_vertices);
-	uint32_t i = 0;
 
 #ifndef OPENGL_SOFTWARE_CALCULATE_MATRIX
-	auto& points_ = points;
+	CubeGeometry::mount_triangles(vertices, cube, offset, points);
 #else
-	auto& points_ = points4;
+	CubeGeometry::mount_triangles(vertices, cube, offset, points4);
 #endif
 
-	auto mount = [&i, vertices, &points_, &cube, &offset] (const PositionIndex p) -> void {
-		vertices[i].local_pos = points_[p];
-		vertices[i].offset = offset;
-		vertices[i].color = cube.get_vertex_color(p);
-		i++;
-	};
-
-	auto mount_triangle = [&mount] (const PositionIndex p1, const PositionIndex p2, const PositionIndex p3) -> void {
-		mount(p1);
-		mount(p2);
-		mount(p3);
-	};
-
-	// bottom
-	mount_triangle(LeftBottomFront, RightBottomFront, LeftBottomBack);
-	mount_triangle(RightBottomBack, RightBottomFront, LeftBottomBack);
-
-	// top
-	mount_triangle(LeftTopFront, RightTopFront, LeftTopBack);
-	mount_triangle(RightTopBack, RightTopFront, LeftTopBack);
-
-	// front
-	mount_triangle(LeftTopFront, LeftBottomFront, RightTopFront);
-	mount_triangle(RightBottomFront, LeftBottomFront, RightTopFront);
-
-	// back
-	mount_triangle(LeftTopBack, LeftBottomBack, RightTopBack);
-	mount_triangle(RightBottomBack, LeftBottomBack, RightTopBack);
-
-	// left
-	mount_triangle(LeftTopFront, LeftBottomFront, LeftTopBack);
-	mount_triangle(LeftBottomBack, LeftBottomFront, LeftTopBack);
-
-	// right
-	mount_triangle(RightTopFront, RightBottomFront, RightTopBack);
-	mount_triangle(RightBottomBack, RightBottomFront, RightTopBack);
-
-	mylib_assert_exception(i == n_vertices)
+	this->stats.n_vertices += n_vertices;
 }
 
 void Renderer::setup_projection_matrix (const RenderArgs& args)
@@ -433,22 +2423,132 @@ void Renderer::setup_projection_matrix (const RenderArgs& args)
 	this->projection_matrix = Mylib::Math::gen_identity_matrix<fp_t, 4>();
 #endif
 
-#if 1
-	dprintln("projection matrix:");
-	dprintln(this->projection_matrix);
-	dprintln();
-	dprintln("camera position: ", args.world_camera_pos);
-	dprintln("camera target: ", args.world_camera_target);
-	dprintln("camera vector: ", args.world_camera_target - args.world_camera_pos);
-#endif
+	this->frustum = Frustum(this->projection_matrix);
+	this->cull_matrix = this->projection_matrix;
+	this->lod_selector.setup(args, this->window_height_px);
+
+	log_trace("projection matrix:\n", this->projection_matrix);
+	log_trace("camera position: ", args.world_camera_pos);
+	log_trace("camera target: ", args.world_camera_target);
+	log_trace("camera vector: ", args.world_camera_target - args.world_camera_pos);
 }
 
 void Renderer::render ()
 {
+	CUBE3D_PROFILE_ZONE("render");
+
 	//this->program_triangle->debug();
-	this->program_triangle->upload_projection_matrix(this->projection_matrix);
-	this->program_triangle->upload_vertex_buffer();
-	this->program_triangle->draw();
+
+	PhaseTimer timer;
+
+	this->gpu_timer->begin_frame(this->gpu_stats);
+
+	auto lap = [this, &timer] (double& time, const GpuTimer::Phase phase) {
+		timer.lap(time);
+		this->gpu_timer->mark(phase);
+	};
+
+	if (this->voxel_world != nullptr) {
+		this->program_voxel->use_program();
+		this->program_voxel->upload_projection_matrix(this->projection_matrix);
+		this->stats.uploaded_bytes += this->program_voxel->upload_chunks(*this->voxel_world);
+		lap(this->stats.upload_time, GpuTimer::Phase::Upload);
+		this->stats.n_voxel_triangles += this->program_voxel->draw(*this->voxel_world, this->frustum);
+		lap(this->stats.draw_time, GpuTimer::Phase::Draw);
+	}
+
+	if (this->program_triangle->get_n_vertices() > 0) {
+		this->program_triangle->use_program();
+		this->program_triangle->bind_vertex_array();
+		this->program_triangle->bind_vertex_buffer();
+		this->program_triangle->upload_projection_matrix(this->projection_matrix);
+		this->stats.uploaded_bytes += this->program_triangle->upload_vertex_buffer();
+		lap(this->stats.upload_time, GpuTimer::Phase::Upload);
+		this->program_triangle->draw();
+		lap(this->stats.draw_time, GpuTimer::Phase::Draw);
+	}
+
+	if (this->program_triangle_indexed->get_n_vertices() > 0) {
+		this->program_triangle_indexed->use_program();
+		this->program_triangle_indexed->bind_vertex_array();
+		this->program_triangle_indexed->bind_vertex_buffer();
+		this->program_triangle_indexed->upload_projection_matrix(this->projection_matrix);
+		this->stats.uploaded_bytes += this->program_triangle_indexed->upload_vertex_buffer();
+		lap(this->stats.upload_time, GpuTimer::Phase::Upload);
+		this->program_triangle_indexed->draw();
+		lap(this->stats.draw_time, GpuTimer::Phase::Draw);
+	}
+
+	if (this->program_triangle_packed->get_n_vertices() > 0) {
+		this->program_triangle_packed->use_program();
+		this->program_triangle_packed->bind_vertex_array();
+		this->program_triangle_packed->upload_projection_matrix(this->projection_matrix);
+		this->stats.uploaded_bytes += this->program_triangle_packed->upload_vertex_buffer();
+		lap(this->stats.upload_time, GpuTimer::Phase::Upload);
+		this->program_triangle_packed->draw();
+		lap(this->stats.draw_time, GpuTimer::Phase::Draw);
+	}
+
+	if (this->n_retained_slots > 0 && this->gpu_culling) {
+		this->gpu_culled_cubes->set_n_slots_drawn(this->n_retained_slots);
+		this->stats.uploaded_bytes += this->gpu_culled_cubes->upload_buffers();
+		lap(this->stats.upload_time, GpuTimer::Phase::Upload);
+		this->gpu_culled_cubes->cull(this->frustum);
+		this->gpu_culled_cubes->draw(this->projection_matrix);
+		lap(this->stats.draw_time, GpuTimer::Phase::Draw);
+		this->stats.n_retained_cubes = this->n_retained_alive;
+	}
+	else if (this->n_retained_slots > 0) {
+		this->program_retained->set_n_slots_drawn(this->n_retained_slots);
+		this->program_retained->use_program();
+		this->program_retained->bind_vertex_array();
+		this->program_retained->upload_projection_matrix(this->projection_matrix);
+		this->stats.uploaded_bytes += this->program_retained->upload_buffers();
+		lap(this->stats.upload_time, GpuTimer::Phase::Upload);
+		this->program_retained->draw();
+		lap(this->stats.draw_time, GpuTimer::Phase::Draw);
+		this->stats.n_retained_cubes = this->n_retained_alive;
+	}
+
+	if (this->n_transform_cubes > 0) {
+		this->program_triangle_transform->set_n_slots_drawn(this->n_transform_cubes);
+		this->program_triangle_transform->use_program();
+		this->program_triangle_transform->bind_vertex_array();
+		this->program_triangle_transform->upload_projection_matrix(this->projection_matrix);
+		this->stats.uploaded_bytes += this->program_triangle_transform->upload_buffers();
+		lap(this->stats.upload_time, GpuTimer::Phase::Upload);
+		this->program_triangle_transform->draw();
+		lap(this->stats.draw_time, GpuTimer::Phase::Draw);
+	}
+
+	if (this->program_cube_instanced->get_n_instances() > 0) {
+		this->program_cube_instanced->use_program();
+		this->program_cube_instanced->bind_vertex_array();
+		this->program_cube_instanced->upload_projection_matrix(this->projection_matrix);
+		this->stats.uploaded_bytes += this->program_cube_instanced->upload_instance_buffer();
+		lap(this->stats.upload_time, GpuTimer::Phase::Upload);
+		this->program_cube_instanced->draw();
+		lap(this->stats.draw_time, GpuTimer::Phase::Draw);
+	}
+
+	if (this->program_cube_impostor->get_n_impostors() > 0) {
+		this->program_cube_impostor->use_program();
+		this->program_cube_impostor->bind_vertex_array();
+		this->program_cube_impostor->upload_projection_matrix(this->projection_matrix);
+		this->stats.uploaded_bytes += this->program_cube_impostor->upload_vertex_buffer();
+		lap(this->stats.upload_time, GpuTimer::Phase::Upload);
+		this->program_cube_impostor->draw();
+		lap(this->stats.draw_time, GpuTimer::Phase::Draw);
+	}
+
+	this->present();
+	lap(this->stats.present_time, GpuTimer::Phase::Present);
+}
+
+void Renderer::present ()
+{
+	CUBE3D_PROFILE_ZONE("swap");
+
 	SDL_GL_SwapWindow(this->sdl_window);
 }
 
@@ -13,13 +13,20 @@
 #include <cstring>
 
 #include <string>
+#include <string_view>
 #include <span>
+#include <array>
+#include <vector>
+#include <algorithm>
 
 #include <my-lib/std.h>
 #include <my-lib/macros.h>
 #include <my-lib/matrix.h>
 
 #include "../graphics.h"
+#include "../cube-geometry.h"
+#include "../voxel.h"
+#include "shader-watcher.h"
 
 namespace Graphics
 {
@@ -33,6 +40,7 @@ namespace Opengl
 // ---------------------------------------------------
 
 class Program;
+class ProgramCache;
 
 // ---------------------------------------------------
 
@@ -42,28 +50,184 @@ protected:
 	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, shader_id)
 	OO_ENCAPSULATE_SCALAR_READONLY(GLenum, shader_type)
 	OO_ENCAPSULATE_OBJ_READONLY(std::string, fname)
+	OO_ENCAPSULATE_OBJ_READONLY(std::string, defines) // inserted right after the #version line
+	OO_ENCAPSULATE_OBJ_READONLY(std::string, source) // with the defines, set by load_source or set_source
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(bool, compile_started, false) // false in programs loaded from the cache
 
 public:
-	Shader (const GLenum shader_type_, const char *fname_);
+	Shader (const GLenum shader_type_, const char *fname_, const char *defines_ = "");
+	~Shader ();
+
+	// reads fname and calls set_source
+	void load_source ();
+
+	// source as in the file, the defines are inserted
+	void set_source (std::string source_);
+
+	// source that already has the defines of the shader, from insert_defines
+	void set_preprocessed_source (std::string source_);
+
+	// inserts the defines right after the #version line, throws if there is no line after it
+	static std::string insert_defines (std::string source, const std::string_view defines, const std::string_view fname);
+
+	// only starts the compilation, the driver may still be compiling when it returns
 	void compile ();
 
+	// wait for the compilation
+	bool is_compiled () const;
+	std::string get_info_log () const;
+
+	// throws with the compile log if it failed
+	void check_compile_status ();
+
 	friend class Program;
 };
 
 // ---------------------------------------------------
 
+/*
+	Programs are linked in two steps, so many programs can be compiled at the same time:
+	link_program only starts the compilation and link, or loads the linked binary
+	from the ProgramCache, and finish_link waits for it, checks the errors and looks up
+	the locations of the active uniforms, which are kept for get_uniform_location.
+	use_program calls finish_link if it was not called yet.
+	The attribute bindings and transform feedback varyings must be set before link_program,
+	with bind_attrib_location and set_transform_feedback_varyings, since they are part of the cache key.
+
+	Shaders can be replaced while the program is in use, for hot reload:
+	start_reload compiles and links a second program object with the new sources,
+	the same attribute bindings and varyings, and update_reload swaps it in place of
+	the current one once it is linked, called at the start of a frame.
+	If the link fails, the error is logged and the current program is kept.
+	The vertex arrays and buffers of the subclasses don't depend on the program,
+	and setup_uniforms is called again for the new one.
+*/
+
 class Program
 {
+public:
+	// binary cache and parallel compilation of the current context, set by the renderer, optional
+	static inline ProgramCache *cache = nullptr;
+
 protected:
+	struct UniformLocation {
+		std::string name; // without the [0] of arrays
+		GLint location;
+	};
+
+	struct AttribLocation {
+		GLuint index;
+		std::string name;
+	};
+
+	// second program object being linked by start_reload
+	struct Reload {
+		GLuint program_id;
+		std::array<Shader*, 4> shaders; // unchanged shaders are shared with the current program
+	};
+
 	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, program_id)
 	OO_ENCAPSULATE_PTR(Shader*, vs)
+	OO_ENCAPSULATE_PTR(Shader*, gs) // optional
 	OO_ENCAPSULATE_PTR(Shader*, fs)
+	OO_ENCAPSULATE_PTR(Shader*, cs) // compute programs only have this one
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(bool, linked, false) // finish_link was called
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(bool, from_cache, false) // loaded from a cached binary
+	OO_ENCAPSULATE_OBJ_READONLY(std::string, link_state) // attribute bindings and varyings, part of the cache key
+
+protected:
+	uint64_t cache_key = 0;
+	std::vector<UniformLocation> uniform_locations; // looked up by finish_link
+	std::vector<AttribLocation> attrib_locations; // replayed by start_reload
+	std::vector<std::string> feedback_varyings;
+	Reload *reload = nullptr;
+
+	void compile_and_link ();
+	void read_uniform_locations ();
+	void cancel_reload ();
+	void set_shaders (const std::array<Shader*, 4>& shaders);
+
+	// called by finish_link with the program in use, to set the uniforms that never change
+	virtual void setup_uniforms ()
+	{
+	}
 
 public:
 	Program ();
+	virtual ~Program ();
+
+	inline std::array<Shader*, 4> get_shaders () const noexcept
+	{
+		return { this->vs, this->gs, this->fs, this->cs };
+	}
+
+	void bind_attrib_location (const GLuint index, const char *name);
+	void set_transform_feedback_varyings (std::span<const char*> varyings);
 	void attach_shaders ();
 	void link_program ();
-	void use_program ();
+	void finish_link ();
+
+	inline void use_program ()
+	{
+		if (!this->linked) [[unlikely]]
+			this->finish_link();
+
+		glUseProgram(this->program_id);
+	}
+
+	// -1 if the uniform is not active, like glGetUniformLocation, but without calling the driver
+	GLint get_uniform_location (const std::string_view name) const noexcept;
+
+	// returns false if none of the changes is a shader of the program
+	bool start_reload (std::span<const ShaderWatcher::Change> changes);
+
+	// returns true if the program was replaced, never blocks with KHR_parallel_shader_compile
+	bool update_reload ();
+
+	inline bool is_reloading () const noexcept
+	{
+		return (this->reload != nullptr);
+	}
+};
+
+// ---------------------------------------------------
+
+/*
+	Cache of linked program binaries in a directory (ARB_get_program_binary, core in GL 4.1),
+	so the next runs skip the compilation of the shaders.
+	The key is a hash of the shader sources, the link state of the program and the
+	vendor, renderer and version strings of the driver, so a change in any of them misses the cache.
+	Binaries rejected by the driver are compiled again by Program::finish_link.
+	It also enables KHR_parallel_shader_compile, which lets the driver compile
+	the programs started by link_program in its own threads.
+*/
+
+class ProgramCache
+{
+protected:
+	OO_ENCAPSULATE_OBJ_READONLY(std::string, dir)
+	OO_ENCAPSULATE_OBJ_READONLY(std::string, driver)
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(bool, binary_supported, false)
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(bool, parallel_compile, false)
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(uint32_t, n_hits, 0)
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(uint32_t, n_misses, 0) // includes the binaries rejected by the driver
+
+protected:
+	std::string get_fname (const uint64_t key) const;
+
+public:
+	// the directory is created when the first binary is stored
+	ProgramCache (const char *dir_);
+
+	uint64_t calc_key (const Program& program) const;
+
+	// false if there is no binary for the key, the link status tells if the driver accepted it
+	bool load (const GLuint program_id, const uint64_t key);
+
+	void store (const GLuint program_id, const uint64_t key);
+
+	// a binary returned by load was rejected by the driver
+	void reject (const uint64_t key);
 };
 
 // ---------------------------------------------------
@@ -137,6 +301,220 @@ public:
 
 // ---------------------------------------------------
 
+/*
+	Vertex buffer that lives directly in GPU-visible memory,
+	so vertices are written without any intermediate copy.
+	The gl buffer is split in n_segments regions, one per frame in flight.
+	Each frame writes to its own region, which is protected by a fence
+	until the GPU finishes reading it.
+	When ARB_buffer_storage is available the buffer is persistently mapped,
+	otherwise each region is mapped every frame with
+	GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT.
+*/
+
+template <typename T, uint32_t n_segments=3>
+class StreamVertexBuffer
+{
+protected:
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(GLuint, vbo, 0)
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(bool, persistent, false)
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(uint32_t, segment_capacity, 0) // in vertices
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(uint32_t, segment, 0) // segment of the current frame
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(uint32_t, vertex_buffer_used, 0) // inside the current segment
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(uint32_t, generation, 0) // incremented every time vbo changes
+
+protected:
+	T *mapped = nullptr; // persistent: whole buffer, otherwise only the current segment
+	bool segment_mapped = false;
+	std::array<GLsync, n_segments> fences;
+
+	void create (const uint32_t capacity)
+	{
+		const GLsizeiptr size = static_cast<GLsizeiptr>(capacity) * n_segments * sizeof(T);
+
+		this->segment_capacity = capacity;
+		this->generation++;
+
+		glGenBuffers(1, &(this->vbo));
+		glBindBuffer(GL_COPY_WRITE_BUFFER, this->vbo);
+
+		if (this->persistent) {
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+			this->mapped = static_cast<T*>( glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags) );
+			mylib_assert_exception_msg(this->mapped != nullptr, "failed to map persistent vertex buffer")
+		}
+		else
+			glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+
+		for (auto& fence : this->fences)
+			fence = nullptr;
+	}
+
+	void destroy ()
+	{
+		for (auto& fence : this->fences) {
+			if (fence != nullptr) {
+				glDeleteSync(fence);
+				fence = nullptr;
+			}
+		}
+
+		if (this->segment_mapped || this->persistent) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, this->vbo);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			this->segment_mapped = false;
+		}
+
+		// the driver keeps the storage alive while the GPU still uses it
+		glDeleteBuffers(1, &(this->vbo));
+
+		this->vbo = 0;
+		this->mapped = nullptr;
+	}
+
+	void wait_fence (const uint32_t s)
+	{
+		GLsync& fence = this->fences[s];
+
+		if (fence == nullptr)
+			return;
+
+		while (true) {
+			const GLenum r = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			if (r == GL_ALREADY_SIGNALED || r == GL_CONDITION_SATISFIED)
+				break;
+			mylib_assert_exception_msg(r != GL_WAIT_FAILED, "glClientWaitSync failed")
+		}
+
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	// When unsynchronized, the caller must have already waited for the fence of the segment.
+	// Otherwise, the contents of the segment are preserved and the driver synchronizes.
+	void map_segment (const bool unsynchronized)
+	{
+		if (this->persistent || this->segment_mapped)
+			return;
+
+		const GLbitfield flags = unsynchronized
+			? (GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT)
+			: GL_MAP_WRITE_BIT;
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, this->vbo);
+		this->mapped = static_cast<T*>( glMapBufferRange(GL_COPY_WRITE_BUFFER,
+			static_cast<GLintptr>(this->get_first_vertex()) * sizeof(T),
+			static_cast<GLsizeiptr>(this->segment_capacity) * sizeof(T),
+			flags) );
+		mylib_assert_exception_msg(this->mapped != nullptr, "failed to map vertex buffer segment")
+		this->segment_mapped = true;
+	}
+
+	inline T* get_segment_ptr () noexcept
+	{
+		return this->persistent ? (this->mapped + this->get_first_vertex()) : this->mapped;
+	}
+
+	// Like VertexBuffer::realloc, previously returned spans become invalid.
+	// The vertices of the current frame are copied by the GPU to the new buffer.
+	void realloc (const uint32_t target_capacity)
+	{
+		const GLuint old_vbo = this->vbo;
+		const GLintptr old_offset = static_cast<GLintptr>(this->get_first_vertex()) * sizeof(T);
+		const GLsizeiptr used_bytes = static_cast<GLsizeiptr>(this->vertex_buffer_used) * sizeof(T);
+
+		if (this->segment_mapped) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, old_vbo);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			this->segment_mapped = false;
+		}
+
+		for (auto& fence : this->fences) {
+			if (fence != nullptr)
+				glDeleteSync(fence);
+		}
+
+		if (this->persistent) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, old_vbo);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		}
+
+		this->create( std::max(this->segment_capacity * 2, target_capacity) );
+		this->segment = 0;
+
+		glBindBuffer(GL_COPY_READ_BUFFER, old_vbo);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, this->vbo);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, old_offset, 0, used_bytes);
+
+		glDeleteBuffers(1, &old_vbo);
+
+		this->map_segment(false);
+	}
+
+public:
+	StreamVertexBuffer (const uint32_t segment_capacity_, const bool try_persistent)
+	{
+		this->persistent = try_persistent && GLEW_ARB_buffer_storage;
+		this->create(segment_capacity_);
+	}
+
+	~StreamVertexBuffer ()
+	{
+		this->destroy();
+	}
+
+	inline GLint get_first_vertex () const noexcept
+	{
+		return static_cast<GLint>(this->segment * this->segment_capacity);
+	}
+
+	// move to the next segment, waiting for the GPU if it still reads it
+	void begin_frame ()
+	{
+		this->end_frame(); // in case nothing was drawn in the previous frame
+
+		this->segment = (this->segment + 1) % n_segments;
+		this->vertex_buffer_used = 0;
+
+		this->wait_fence(this->segment);
+		this->map_segment(true);
+	}
+
+	inline std::span<T> alloc_vertices (const uint32_t n)
+	{
+		const uint32_t free_space = this->segment_capacity - this->vertex_buffer_used;
+
+		if (free_space < n) [[unlikely]]
+			this->realloc(this->vertex_buffer_used + n);
+
+		T *vertices = this->get_segment_ptr() + this->vertex_buffer_used;
+		this->vertex_buffer_used += n;
+
+		return std::span<T>{vertices, n};
+	}
+
+	// must be called before drawing, returns the number of bytes written
+	uint32_t end_frame ()
+	{
+		if (this->segment_mapped) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, this->vbo);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			this->segment_mapped = false;
+		}
+
+		return this->vertex_buffer_used * sizeof(T);
+	}
+
+	// must be called after the draw commands that read the current segment
+	void fence_frame ()
+	{
+		this->fences[this->segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+};
+
+// ---------------------------------------------------
+
 class ProgramTriangle: public Program
 {
 protected:
@@ -147,6 +525,12 @@ protected:
 	};
 
 public:
+	enum class UploadMode {
+		BufferData, // vertices are built in a heap array and copied by glBufferData every frame
+		StreamPersistent, // StreamVertexBuffer, persistent mapped if ARB_buffer_storage is available
+		StreamMapRange // StreamVertexBuffer, always glMapBufferRange
+	};
+
 	struct Vertex {
 	#ifndef OPENGL_SOFTWARE_CALCULATE_MATRIX
 		Point local_pos; // local x,y,z coords
@@ -160,31 +544,61 @@ public:
 	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, vao) // vertex array descriptor id
 	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, vbo) // vertex buffer id
 
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(UploadMode, upload_mode, UploadMode::BufferData)
+
 protected:
 	VertexBuffer<Vertex, 8192> triangle_buffer;
+	StreamVertexBuffer<Vertex> *stream_buffer = nullptr;
+	uint32_t stream_generation = 0; // generation of stream_buffer bound to the vao
 
 public:
 	ProgramTriangle ();
+	~ProgramTriangle ();
 
 	consteval static uint32_t get_stride_in_floats ()
 	{
 		return (sizeof(Vertex) / sizeof(GLfloat));
 	}
 
+	inline bool is_streaming () const noexcept
+	{
+		return (this->upload_mode != UploadMode::BufferData);
+	}
+
 	inline void clear ()
 	{
-		this->triangle_buffer.clear();
+		if (this->is_streaming())
+			this->stream_buffer->begin_frame();
+		else
+			this->triangle_buffer.clear();
+	}
+
+	inline uint32_t get_n_vertices () const
+	{
+		return this->is_streaming() ? this->stream_buffer->get_vertex_buffer_used() : this->triangle_buffer.get_vertex_buffer_used();
+	}
+
+	// index of the first vertex of the frame inside the vbo
+	inline GLint get_first_vertex () const
+	{
+		return this->is_streaming() ? this->stream_buffer->get_first_vertex() : 0;
 	}
 
 	inline std::span<ProgramTriangle::Vertex> alloc_vertices (const uint32_t n)
 	{
-		return this->triangle_buffer.alloc_vertices(n);
+		if (this->is_streaming())
+			return this->stream_buffer->alloc_vertices(n);
+		else
+			return this->triangle_buffer.alloc_vertices(n);
 	}
 
+	// must be called between frames
+	void set_upload_mode (const UploadMode mode);
+
 	void bind_vertex_array ();
 	void bind_vertex_buffer ();
 	void setup_vertex_array ();
-	void upload_vertex_buffer ();
+	uint32_t upload_vertex_buffer (); // returns number of bytes uploaded
 	void upload_projection_matrix (const Matrix4& m);
 	void draw ();
 
@@ -193,13 +607,699 @@ public:
 
 // ---------------------------------------------------
 
+/*
+	Same shaders and vertex format as ProgramTriangle,
+	but each cube only writes its 8 corners.
+	The 36 indices of each cube come from a static element buffer,
+	generated once for a whole batch of cubes.
+*/
+
+class ProgramTriangleIndexed: public ProgramTriangle
+{
+public:
+	// 16-bit indices address up to 65536 vertices
+	static constexpr uint32_t max_cubes_per_batch = 65536 / Cube3d::get_n_vertices();
+
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, ebo) // element buffer id
+
+public:
+	ProgramTriangleIndexed ();
+
+	inline uint32_t get_n_cubes () const
+	{
+		return this->get_n_vertices() / Cube3d::get_n_vertices();
+	}
+
+	void setup_vertex_array ();
+	void draw ();
+};
+
+// ---------------------------------------------------
+
+/*
+	A texture buffer view has at most GL_MAX_TEXTURE_BUFFER_SIZE texels, only 65536 in GL 3.3.
+	Draws of more objects are split in batches of at most max_objects, each one with a view
+	of its range of the buffer (ARB_texture_buffer_range). The shader gets the first object
+	of the batch in u_first_object, since gl_VertexID counts from the start of the draw.
+	Without ARB_texture_buffer_range, more than max_objects is an error.
+*/
+
+class TextureBufferBatches
+{
+protected:
+	OO_ENCAPSULATE_SCALAR_READONLY(uint32_t, object_size) // bytes, a multiple of a GL_RGBA32F texel
+	OO_ENCAPSULATE_SCALAR_READONLY(uint32_t, max_objects) // per batch
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(bool, range_supported, false)
+
+public:
+	// reads the limits of the driver, the context must be current
+	TextureBufferBatches (const uint32_t object_size_);
+
+	// Binds texture_id to the texture unit 0 and calls draw_batch(first, count) for each batch.
+	// texture_id must be a view of the whole buffer_id, and is again when it returns.
+	template <typename Function>
+	void draw (const GLuint texture_id, const GLuint buffer_id, const uint32_t n_objects, Function&& draw_batch)
+	{
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_BUFFER, texture_id);
+
+		if (n_objects <= this->max_objects) {
+			draw_batch(0, n_objects);
+			return;
+		}
+
+		mylib_assert_exception_msg(this->range_supported, n_objects, " objects don't fit in a texture buffer of ", this->max_objects, " objects, and ARB_texture_buffer_range is not supported")
+
+		for (uint32_t first = 0; first < n_objects; first += this->max_objects) {
+			const uint32_t count = std::min(this->max_objects, n_objects - first);
+
+			glTexBufferRange(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer_id, static_cast<GLintptr>(first) * this->object_size, static_cast<GLsizeiptr>(count) * this->object_size);
+			draw_batch(first, count);
+		}
+
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer_id);
+	}
+};
+
+// ---------------------------------------------------
+
+/*
+	Same geometry as ProgramTriangle, but with a compact vertex format.
+	Positions are snorm16 relative to the cube center and colors are rgba8.
+	The offset, instead of being repeated in every vertex, is stored once per cube
+	in a texture buffer, fetched by the vertex shader using gl_VertexID.
+	Uses shaders/triangles.vert compiled with PACKED_VERTEX.
+*/
+
+class ProgramTrianglePacked: public Program
+{
+protected:
+	enum class Attrib : uint32_t {
+		Position,
+		Color
+	};
+
+public:
+	static constexpr uint32_t n_vertices_per_cube = 36;
+
+	struct Vertex {
+		std::array<int16_t, 4> local_pos; // snorm16 x,y,z in units of CubeData::scale, last one is padding
+		uint32_t color; // rgba8, see pack_color_rgba8
+	};
+
+	struct CubeData {
+		Vector offset; // world x,y,z coords of the center of the cube
+		fp_t scale; // a local_pos component of 1.0 corresponds to scale
+	};
+
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, vao) // vertex array descriptor id
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, vbo) // vertex buffer id
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, cube_buffer_id) // buffer of CubeData
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, cube_texture_id) // texture buffer view of cube_buffer_id
+
+protected:
+	VertexBuffer<Vertex, 8192> vertex_buffer;
+	VertexBuffer<CubeData, 1024> cube_buffer;
+	TextureBufferBatches cube_batches;
+
+protected:
+	void setup_uniforms () override;
+
+public:
+	ProgramTrianglePacked ();
+
+	inline void clear ()
+	{
+		this->vertex_buffer.clear();
+		this->cube_buffer.clear();
+	}
+
+	inline uint32_t get_n_vertices () const
+	{
+		return this->vertex_buffer.get_vertex_buffer_used();
+	}
+
+	inline CubeData& alloc_cube ()
+	{
+		return this->cube_buffer.alloc_vertices(1)[0];
+	}
+
+	inline std::span<Vertex> alloc_vertices ()
+	{
+		return this->vertex_buffer.alloc_vertices(n_vertices_per_cube);
+	}
+
+	void bind_vertex_array ();
+	void setup_vertex_array ();
+	uint32_t upload_vertex_buffer (); // returns number of bytes uploaded
+	void upload_projection_matrix (const Matrix4& m);
+	void draw ();
+};
+
+// ---------------------------------------------------
+
+// Slots modified since the last upload, consumed as ranges of consecutive slots.
+
+class DirtySlots
+{
+protected:
+	std::vector<uint32_t> slots;
+	std::vector<uint8_t> flags;
+
+public:
+	inline void resize (const uint32_t n)
+	{
+		this->flags.resize(n, 0);
+	}
+
+	inline void mark (const uint32_t slot)
+	{
+		if (!this->flags[slot]) {
+			this->flags[slot] = 1;
+			this->slots.push_back(slot);
+		}
+	}
+
+	inline bool empty () const noexcept
+	{
+		return this->slots.empty();
+	}
+
+	void clear () noexcept
+	{
+		for (const uint32_t slot : this->slots)
+			this->flags[slot] = 0;
+		this->slots.clear();
+	}
+
+	// calls function(first, count) for every range of dirty slots and clears them
+	template <typename Function>
+	void consume_ranges (Function&& function)
+	{
+		std::sort(this->slots.begin(), this->slots.end());
+
+		for (size_t i = 0; i < this->slots.size(); ) {
+			const uint32_t first = this->slots[i];
+			uint32_t count = 1;
+
+			while ((i + count) < this->slots.size() && this->slots[i + count] == (first + count))
+				count++;
+
+			function(first, count);
+			i += count;
+		}
+
+		this->clear();
+	}
+};
+
+// ---------------------------------------------------
+
+/*
+	The CPU never touches rotated vertex positions.
+	Each object has a slot with 36 vertices in local coords (not rotated),
+	which are uploaded only when the shape or colors of the object change.
+	The rotation and translation of each object are stored in a texture buffer,
+	and applied by shaders/triangles.vert compiled with OBJECT_TRANSFORM.
+*/
+
+class ProgramTriangleTransform: public Program
+{
+protected:
+	enum class Attrib : uint32_t {
+		Position,
+		Color
+	};
+
+public:
+	static constexpr uint32_t n_vertices_per_object = 36;
+
+	struct Vertex {
+		Point local_pos; // local x,y,z coords, not rotated
+		uint32_t color; // rgba8, see pack_color_rgba8
+	};
+
+	struct Transform {
+		Vector4 rotation; // unit quaternion
+		Vector translation;
+		fp_t padding;
+	};
+
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, vao) // vertex array descriptor id
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, vbo) // vertex buffer id
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, transform_buffer_id) // buffer of Transform
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, transform_texture_id) // texture buffer view of transform_buffer_id
+
+	// only slots [0, n_slots_drawn) are drawn
+	OO_ENCAPSULATE_SCALAR_INIT(uint32_t, n_slots_drawn, 0)
+
+protected:
+	struct Geometry {
+		fp_t w;
+		Vector delta;
+		std::array<Color, Cube3d::get_n_vertices()> colors;
+	};
+
+	// cpu copies of the gpu buffers
+	std::vector<Geometry> geometries;
+	std::vector<Vertex> vertices;
+	std::vector<Transform> transforms;
+
+	DirtySlots dirty_geometries;
+	DirtySlots dirty_transforms;
+
+	TextureBufferBatches transform_batches;
+
+	uint32_t gpu_n_slots = 0; // slots allocated in the gpu buffers
+
+protected:
+	void setup_uniforms () override;
+
+public:
+	ProgramTriangleTransform ();
+
+	inline uint32_t get_n_slots () const noexcept
+	{
+		return this->transforms.size();
+	}
+
+	void resize (const uint32_t n_slots);
+
+	// vertices are rebuilt and uploaded only if the geometry changed
+	void set_geometry (const uint32_t slot, const Cube3d& cube);
+
+	// marked to upload only if the transform changed
+	void set_transform (const uint32_t slot, const Transform& transform);
+
+	// the slot will not generate fragments anymore
+	void clear_geometry (const uint32_t slot);
+
+	void bind_vertex_array ();
+	void setup_vertex_array ();
+	uint32_t upload_buffers (); // returns number of bytes uploaded
+	void upload_projection_matrix (const Matrix4& m);
+	void draw ();
+};
+
+// ---------------------------------------------------
+
+/*
+	Draws cubes using instancing.
+	A single unit cube mesh (36 vertices) is uploaded once,
+	and each cube only streams a compact per-instance record.
+*/
+
+class ProgramCubeInstanced: public Program
+{
+protected:
+	enum class Attrib : uint32_t {
+		Position,
+		CenterSize,
+		Rotation,
+		Color0 // Color0 ... Color7 use consecutive locations
+	};
+
+public:
+	struct MeshVertex {
+		Point local_pos; // unit cube coords, in range [-0.5, 0.5]
+	};
+
+	struct Instance {
+		Point center; // world x,y,z coords of the center of the cube, delta already included
+		fp_t w; // cube width
+		Vector4 rotation; // unit quaternion (x, y, z, w)
+		std::array<uint32_t, Cube3d::get_n_vertices()> colors; // rgba8, see pack_color_rgba8
+	};
+
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, vao) // vertex array descriptor id
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, vbo_mesh) // static unit cube mesh
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, vbo_instances) // per-instance data
+
+protected:
+	VertexBuffer<Instance, 1024> instance_buffer;
+
+public:
+	ProgramCubeInstanced ();
+
+	inline void clear ()
+	{
+		this->instance_buffer.clear();
+	}
+
+	inline uint32_t get_n_instances () const
+	{
+		return this->instance_buffer.get_vertex_buffer_used();
+	}
+
+	inline Instance& alloc_instance ()
+	{
+		return this->instance_buffer.alloc_vertices(1)[0];
+	}
+
+	void bind_vertex_array ();
+	void setup_vertex_array ();
+	void setup_vertex_array (const GLuint instances_vbo); // instances read from another buffer
+	uint32_t upload_instance_buffer (); // returns number of bytes uploaded
+	void upload_projection_matrix (const Matrix4& m);
+	void draw ();
+};
+
+// ---------------------------------------------------
+
+/*
+	Impostors of far cubes, see LodSelector.
+	Each cube is a single point sprite, a screen-aligned square with the
+	projected size of the cube and the average color of its corners.
+	Uses shaders/impostor.vert.
+*/
+
+class ProgramCubeImpostor: public Program
+{
+protected:
+	enum class Attrib : uint32_t {
+		CenterSize,
+		Color
+	};
+
+public:
+	struct Impostor {
+		Point center; // world x,y,z coords of the center of the cube
+		fp_t size_px; // point size
+		uint32_t color; // rgba8, see pack_color_rgba8
+	};
+
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, vao) // vertex array descriptor id
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, vbo) // vertex buffer id
+
+protected:
+	VertexBuffer<Impostor, 4096> impostor_buffer;
+
+public:
+	ProgramCubeImpostor ();
+
+	inline void clear ()
+	{
+		this->impostor_buffer.clear();
+	}
+
+	inline uint32_t get_n_impostors () const
+	{
+		return this->impostor_buffer.get_vertex_buffer_used();
+	}
+
+	inline Impostor& alloc_impostor ()
+	{
+		return this->impostor_buffer.alloc_vertices(1)[0];
+	}
+
+	void bind_vertex_array ();
+	void setup_vertex_array ();
+	uint32_t upload_vertex_buffer (); // returns number of bytes uploaded
+	void upload_projection_matrix (const Matrix4& m);
+	void draw ();
+};
+
+// ---------------------------------------------------
+
+/*
+	Chunk meshes of a VoxelWorld.
+	Each chunk has its own static vertex buffer, uploaded again only when
+	the mesh_version of the chunk changes, and chunks outside the frustum are not drawn.
+	Uses shaders/voxel.vert.
+*/
+
+class ProgramVoxel: public Program
+{
+protected:
+	enum class Attrib : uint32_t {
+		Position,
+		Color
+	};
+
+	struct ChunkBuffer {
+		GLuint vao;
+		GLuint vbo;
+		uint64_t mesh_version; // of the uploaded mesh
+		uint32_t n_vertices;
+	};
+
+	std::vector<ChunkBuffer> chunk_buffers; // indexed like the chunks of the world
+	uint64_t world_id = 0; // VoxelWorld::id of the chunk buffers, the address could be reused by another world
+
+	// set once per chunk, so they are kept apart from the lookup of get_uniform_location
+	GLint u_projection_matrix = -1;
+	GLint u_chunk_origin = -1;
+	GLint u_voxel_size = -1;
+
+protected:
+	void clear_chunk_buffers ();
+	void setup_uniforms () override;
+
+public:
+	ProgramVoxel ();
+	~ProgramVoxel ();
+
+	uint32_t upload_chunks (const VoxelWorld& world); // returns number of bytes uploaded
+	void upload_projection_matrix (const Matrix4& m);
+	uint32_t draw (const VoxelWorld& world, const Frustum& frustum); // returns number of triangles drawn
+};
+
+// ---------------------------------------------------
+
+/*
+	Retained cubes culled against the frustum by the GPU,
+	so the CPU cost of a frame depends on the cubes that changed, not on the number of cubes.
+	Every slot has an instance record in a gpu buffer, uploaded only when it changes.
+	Free slots have w = 0 and are always culled.
+	Every frame, the GPU copies the records whose bounding sphere is not outside the frustum
+	to a second buffer, which is drawn with a count that only the GPU knows:
+	- Compute (GL 4.3): shaders/cube-cull.comp appends the visible records and counts them
+	  in a glDrawArraysIndirect command, drawn by a ProgramCubeInstanced.
+	- TransformFeedback (GL 3.3 and ARB_transform_feedback2): shaders/cube-cull.geom emits the
+	  visible records, captured by transform feedback and drawn as points by glDrawTransformFeedback,
+	  which shaders/cube-expand.geom expands to cubes.
+*/
+
+class GpuCulledCubes
+{
+public:
+	enum class Method {
+		Compute,
+		TransformFeedback,
+		Unsupported
+	};
+
+	using Instance = ProgramCubeInstanced::Instance;
+
+	struct DrawCommand { // same as DrawArraysIndirectCommand
+		uint32_t count;
+		uint32_t instance_count;
+		uint32_t first;
+		uint32_t base_instance;
+	};
+
+	static constexpr uint32_t compute_group_size = 64; // local_size_x of shaders/cube-cull.comp
+
+protected:
+	// records as points, in the TransformFeedback method
+	enum class Attrib : uint32_t {
+		CenterSize,
+		Rotation,
+		Colors0, // colors of the corners 0 to 3
+		Colors1 // colors of the corners 4 to 7
+	};
+
+	OO_ENCAPSULATE_SCALAR_READONLY(Method, method)
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, vbo_instances) // one record per slot
+	OO_ENCAPSULATE_SCALAR_READONLY(GLuint, vbo_visible) // records that passed the cull in the last frame
+
+	// only slots [0, n_slots_drawn) are culled and drawn
+	OO_ENCAPSULATE_SCALAR_INIT(uint32_t, n_slots_drawn, 0)
+
+protected:
+	std::vector<Instance> instances; // cpu copy of vbo_instances
+	DirtySlots dirty;
+
+	uint32_t gpu_n_slots = 0; // slots allocated in the gpu buffers
+
+	Program *program_cull = nullptr;
+	Program *program_expand = nullptr; // TransformFeedback only
+	ProgramCubeInstanced *program_instanced = nullptr; // Compute only
+
+	GLuint vao_cull = 0; // TransformFeedback, vbo_instances as points
+	GLuint vao_expand = 0; // TransformFeedback, vbo_visible as points
+	GLuint indirect_buffer = 0; // Compute, one DrawCommand
+	GLuint transform_feedback = 0; // TransformFeedback, knows how many records were captured
+
+protected:
+	void setup_record_attribs (const GLuint vbo);
+	void upload_frustum_planes (const Program& program, const Frustum& frustum);
+
+public:
+	GpuCulledCubes (const Method method_);
+	~GpuCulledCubes ();
+
+	static Method get_best_method ();
+	static const char* get_method_str (const Method method);
+
+	// some are nullptr, depending on the method
+	inline std::array<Program*, 3> get_programs () const noexcept
+	{
+		return { this->program_cull, this->program_expand, this->program_instanced };
+	}
+
+	inline uint32_t get_n_slots () const noexcept
+	{
+		return this->instances.size();
+	}
+
+	void resize (const uint32_t n_slots);
+
+	// marked to upload only if the record changed
+	void set_instance (const uint32_t slot, const Instance& instance);
+
+	// the slot will always be culled
+	void clear_instance (const uint32_t slot);
+
+	uint32_t upload_buffers (); // returns number of bytes uploaded
+	void cull (const Frustum& frustum);
+	void draw (const Matrix4& projection_matrix);
+};
+
+// ---------------------------------------------------
+
+/*
+	GPU time of the phases of render, measured with GL_TIMESTAMP queries (ARB_timer_query, core in 3.3).
+	A timestamp is written to the command stream in the beginning of the frame and after each phase,
+	and the time of a phase is the difference to the previous timestamp.
+	The queries of a frame are only read n_frames later, when the ring wraps around,
+	and only if the GPU already has the results, so measuring never stalls the pipeline.
+*/
+
+class GpuTimer
+{
+public:
+	static constexpr uint32_t n_frames = 4;
+
+	enum class Phase : uint8_t {
+		Begin,
+		Upload,
+		Draw,
+		Present
+	};
+
+protected:
+	struct Frame {
+		std::vector<GLuint> queries;
+		std::vector<Phase> phases; // of the queries used in the frame
+		uint64_t frame;
+		bool pending = false;
+	};
+
+	std::array<Frame, n_frames> frames;
+	uint64_t frame = 0;
+
+	OO_ENCAPSULATE_SCALAR_READONLY(bool, supported)
+
+protected:
+	bool read_frame (Frame& f, Graphics::Renderer::GpuStats& stats);
+
+public:
+	GpuTimer ();
+	~GpuTimer ();
+
+	// reads the results of the frame that is reused, then starts a new one
+	void begin_frame (Graphics::Renderer::GpuStats& stats);
+
+	// the gpu time since the previous mark is added to phase
+	void mark (const Phase phase);
+};
+
+// ---------------------------------------------------
+
 class Renderer : public Graphics::Renderer
 {
+public:
+	enum class CubeDrawMode {
+		Triangles, // ProgramTriangle, 36 vertices per cube built on the CPU
+		Indexed,   // ProgramTriangleIndexed, 8 vertices per cube and static indices
+		Packed,    // ProgramTrianglePacked, 36 compact vertices per cube
+		Instanced, // ProgramCubeInstanced, one instance record per cube
+		Transform  // ProgramTriangleTransform, vertices reused across frames, only transforms are uploaded
+	};
+
 protected:
 	SDL_GLContext sdl_gl_context;
 	Matrix4 projection_matrix;
 
-	ProgramTriangle *program_triangle;
+	ProgramTriangle *program_triangle = nullptr;
+	ProgramTriangleIndexed *program_triangle_indexed = nullptr;
+	ProgramTrianglePacked *program_triangle_packed = nullptr;
+	ProgramTriangleTransform *program_triangle_transform = nullptr;
+	ProgramTriangleTransform *program_retained = nullptr; // retained mode, slot = handle
+
+	std::vector<CubeHandle> retained_free_slots;
+	std::vector<uint8_t> retained_alive; // indexed by slot, to validate the handles
+	uint32_t n_retained_slots = 0;
+	uint32_t n_retained_alive = 0;
+	ProgramCubeInstanced *program_cube_instanced = nullptr;
+	ProgramCubeImpostor *program_cube_impostor = nullptr;
+	ProgramVoxel *program_voxel = nullptr;
+	GpuCulledCubes *gpu_culled_cubes = nullptr; // retained mode instead of program_retained when gpu_culling is set
+
+	GpuTimer *gpu_timer = nullptr;
+	ProgramCache *program_cache = nullptr; // set as Program::cache while the context exists
+	ShaderWatcher *shader_watcher = nullptr; // only with shader hot reload
+
+	OO_ENCAPSULATE_SCALAR_INIT(CubeDrawMode, cube_draw_mode, CubeDrawMode::Triangles)
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(bool, gpu_culling, false)
+
+	// Batches of the Triangles and Indexed modes with at least parallel_batch_min_cubes
+	// are built by the thread pool, in chunks of parallel_batch_chunk_size cubes.
+	static constexpr uint32_t parallel_batch_min_cubes = 4096;
+	static constexpr uint32_t parallel_batch_chunk_size = 1024;
+	ParallelArenaBuilder<ProgramTriangle::Vertex> arena_builder;
+
+	// In Transform mode, the i-th cube drawn in a frame reuses the slot of the i-th cube of the previous frame.
+	uint32_t n_transform_cubes = 0;
+
+	// set by draw_voxel_world, drawn by render
+	const VoxelWorld *voxel_world = nullptr;
+
+	// cubes of a batch drawn with the full mesh, when the LodSelector is enabled
+	std::vector<Cube3d> lod_full_cubes;
+	std::vector<Vector> lod_full_offsets;
+
+protected:
+	void draw_cube3d_batch_parallel (ProgramTriangle& program, std::span<const Cube3d> cubes, std::span<const Vector> offsets);
+	void draw_cube3d_corners (const Cube3d& cube, const Vector& offset, const CubeGeometry::Corners& points);
+	void draw_cube3d_triangles (const Cube3d& cube, const Vector& offset, const CubeGeometry::Corners& points);
+	void draw_cube3d_indexed (const Cube3d& cube, const Vector& offset, const CubeGeometry::Corners& points);
+	void draw_cube3d_packed (const Cube3d& cube, const Vector& offset, const CubeGeometry::Corners& points);
+	void draw_cube3d_instanced (const Cube3d& cube, const Vector& offset);
+	void draw_cube3d_transform (const Cube3d& cube, const Vector& offset);
+	void draw_cube3d_impostor (const Cube3d& cube, const Vector& offset);
+	void draw_cube3d_full (const Cube3d& cube, const Vector& offset);
+	void draw_cube3d_batch_full (std::span<const Cube3d> cubes, std::span<const Vector> offsets);
+
+	// Used by subclasses that create their own context instead of an SDL window.
+	// They must call init_opengl once the context is current.
+	struct NoWindow {};
+	Renderer (const uint32_t window_width_px_, const uint32_t window_height_px_, NoWindow);
+
+	void init_opengl ();
+	void unload_opengl_programs ();
+
+	std::vector<Program*> get_programs () const;
+
+	// called by wait_next_frame, so programs are only replaced between frames
+	void reload_shaders ();
+
+	// tells the shader watcher the defines of the shaders of the programs, when they change
+	void update_shader_variants ();
+
+	// called in the end of render, swaps the window buffers
+	virtual void present ();
 
 public:
 	Renderer (const uint32_t window_width_px_, const uint32_t window_height_px_, const bool fullscreen_);
@@ -207,10 +1307,27 @@ public:
 
 	void wait_next_frame () override final;
 	void draw_cube3d (const Cube3d& cube, const Vector& offset) override final;
+	void draw_cube3d_batch (std::span<const Cube3d> cubes, std::span<const Vector> offsets) override final;
 	void setup_projection_matrix (const RenderArgs& args) override final;
 	void render () override final;
 
+	CubeHandle create_cube (const Cube3d& cube, const Vector& offset) override final;
+	void update_cube (const CubeHandle handle, const Cube3d& cube, const Vector& offset) override final;
+	void destroy_cube (const CubeHandle handle) override final;
+	bool set_gpu_culling (const bool enabled) override final;
+	bool set_shader_hot_reload (const bool enabled) override final;
+	bool draw_voxel_world (const VoxelWorld& world) override final;
+
+	// upload mode of the Triangles and Indexed cube draw modes
+	void set_vertex_upload_mode (const ProgramTriangle::UploadMode mode);
+
 	void load_opengl_programs ();
+
+	// hits and misses of the programs loaded since the context was created
+	inline const ProgramCache* get_program_cache () const noexcept
+	{
+		return this->program_cache;
+	}
 };
 
 // ---------------------------------------------------
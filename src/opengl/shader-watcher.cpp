@@ -0,0 +1,196 @@
+#include <fstream>
+#include <utility>
+#include <algorithm>
+#include <exception>
+
+#include <cstring>
+#include <cerrno>
+
+#ifdef __linux__
+	#include <sys/inotify.h>
+	#include <poll.h>
+	#include <unistd.h>
+#endif
+
+#include "../debug.h"
+#include "../profiler.h"
+#include "../log.h"
+#include "shader-watcher.h"
+#include "opengl.h"
+
+// ---------------------------------------------------
+
+using App::dprintln;
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+namespace Opengl
+{
+
+// ---------------------------------------------------
+
+// the background thread checks the stop flag at least this often
+static constexpr int poll_timeout_ms = 100;
+
+// ---------------------------------------------------
+
+ShaderWatcher::ShaderWatcher (const char *dir_)
+	: dir(dir_)
+{
+#ifdef __linux__
+	this->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (this->fd < 0) {
+		dprintln("inotify_init1 failed: ", std::strerror(errno));
+		return;
+	}
+
+	if (inotify_add_watch(this->fd, this->dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		dprintln("could not watch ", this->dir, ": ", std::strerror(errno));
+		close(this->fd);
+		this->fd = -1;
+		return;
+	}
+
+	this->supported = true;
+	this->thread = std::thread(&ShaderWatcher::thread_loop, this);
+
+	dprintln("watching shaders in ", this->dir);
+#endif
+}
+
+ShaderWatcher::~ShaderWatcher ()
+{
+	if (this->thread.joinable()) {
+		this->stop.store(true, std::memory_order_release);
+		this->thread.join();
+	}
+
+#ifdef __linux__
+	if (this->fd >= 0)
+		close(this->fd);
+#endif
+}
+
+bool ShaderWatcher::is_shader_fname (const std::string& fname) noexcept
+{
+	for (const char *ext : { ".vert", ".geom", ".frag", ".comp" }) {
+		if (fname.ends_with(ext))
+			return true;
+	}
+
+	return false;
+}
+
+void ShaderWatcher::add_change (Change&& change)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	auto it = std::find_if(this->changes.begin(), this->changes.end(), [&change] (const Change& c) { return c.fname == change.fname && c.defines == change.defines; });
+
+	if (it != this->changes.end())
+		*it = std::move(change);
+	else
+		this->changes.push_back(std::move(change));
+}
+
+std::vector<ShaderWatcher::Change> ShaderWatcher::get_changes ()
+{
+	std::vector<Change> r;
+
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		r.swap(this->changes);
+	}
+
+	return r;
+}
+
+void ShaderWatcher::set_variants (std::vector<Variant> variants_)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	this->variants = std::move(variants_);
+}
+
+void ShaderWatcher::thread_loop ()
+{
+#ifdef __linux__
+	Profiler::set_thread_name("shader_watcher");
+
+	// aligned as inotify_event, enough for many events per read
+	alignas(inotify_event) char buffer[4096];
+
+	while (!this->stop.load(std::memory_order_acquire)) {
+		pollfd pfd = { .fd = this->fd, .events = POLLIN, .revents = 0 };
+
+		if (poll(&pfd, 1, poll_timeout_ms) <= 0)
+			continue;
+
+		const ssize_t length = read(this->fd, buffer, sizeof(buffer));
+
+		if (length <= 0)
+			continue;
+
+		for (ssize_t i = 0; i < length;) {
+			const inotify_event *event = reinterpret_cast<const inotify_event*>(buffer + i);
+			i += sizeof(inotify_event) + event->len;
+
+			if (event->len == 0)
+				continue;
+
+			const std::string name(event->name);
+
+			// editors also write backup and swap files in the same directory
+			if (!is_shader_fname(name))
+				continue;
+
+			const std::string fname = this->dir + '/' + name;
+			std::ifstream file(fname, std::ios::binary | std::ios::ate);
+
+			if (!file.is_open())
+				continue;
+
+			std::string source(static_cast<size_t>(file.tellg()), '\0');
+			file.seekg(0);
+			file.read(source.data(), source.size());
+
+			if (!file)
+				continue;
+
+			dprintln("shader changed (", fname, ")");
+
+			std::vector<Change> file_changes;
+
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+
+				for (const Variant& variant : this->variants) {
+					if (variant.fname == fname)
+						file_changes.push_back(Change { .fname = fname, .defines = variant.defines, .source = {} });
+				}
+			}
+
+			// all the variants or none, so the programs that share the file stay consistent
+			try {
+				for (Change& change : file_changes)
+					change.source = Shader::insert_defines(source, change.defines, fname);
+			}
+			catch (const std::exception& e) {
+				log_error("shader reload failed, the previous program is kept\n", e.what());
+				continue;
+			}
+
+			for (Change& change : file_changes)
+				this->add_change(std::move(change));
+		}
+	}
+#endif
+}
+
+// ---------------------------------------------------
+
+} // end namespace Opengl
+} // end namespace Graphics
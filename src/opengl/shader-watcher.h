@@ -0,0 +1,85 @@
+#ifndef __CUBE3D_SDL_GRAPHICS_OPENGL_SHADER_WATCHER_HEADER_H__
+#define __CUBE3D_SDL_GRAPHICS_OPENGL_SHADER_WATCHER_HEADER_H__
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#include <cstdint>
+
+#include <my-lib/std.h>
+#include <my-lib/macros.h>
+
+namespace Graphics
+{
+namespace Opengl
+{
+
+// ---------------------------------------------------
+
+/*
+	Watches the shader files of a directory with inotify (Linux only).
+	A background thread waits for the files to be written, or moved in by editors
+	that save to a temporary file, and reads the new sources, so the render thread
+	never touches the disk. It also inserts the defines of every variant of the file
+	registered with set_variants, so the render thread gets sources ready to compile.
+	A file that can't take the defines, such as one emptied while it is saved, is logged
+	and dropped, and the running programs are kept.
+	get_changes returns them once per variant, the last version if it was saved more than once in between.
+	On other systems, or if the directory can't be watched, supported is false and there are never changes.
+*/
+
+class ShaderWatcher
+{
+public:
+	// a shader file compiled with some defines, by one or more programs
+	struct Variant {
+		std::string fname; // dir/name, as given to Shader
+		std::string defines;
+	};
+
+	struct Change {
+		std::string fname;
+		std::string defines;
+		std::string source; // with the defines, ready to compile
+	};
+
+protected:
+	OO_ENCAPSULATE_OBJ_READONLY(std::string, dir)
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(bool, supported, false)
+
+protected:
+	int fd = -1; // inotify instance
+	std::thread thread;
+	std::atomic<bool> stop = false;
+
+	std::mutex mutex; // only held to swap changes and variants
+	std::vector<Change> changes;
+	std::vector<Variant> variants;
+
+protected:
+	void thread_loop ();
+	void add_change (Change&& change);
+
+public:
+	ShaderWatcher (const char *dir_);
+	~ShaderWatcher ();
+
+	// never blocks on the disk, only on the swap of the list with the background thread
+	std::vector<Change> get_changes ();
+
+	// replaces the variants, called again when the programs change
+	void set_variants (std::vector<Variant> variants_);
+
+	// .vert, .geom, .frag and .comp
+	static bool is_shader_fname (const std::string& fname) noexcept;
+};
+
+// ---------------------------------------------------
+
+} // end namespace Opengl
+} // end namespace Graphics
+
+#endif
@@ -0,0 +1,193 @@
+#include <vector>
+#include <mutex>
+#include <fstream>
+#include <iomanip>
+#include <string>
+
+#include "profiler.h"
+#include "debug.h"
+
+// ---------------------------------------------------
+
+namespace Profiler
+{
+
+// ---------------------------------------------------
+
+#ifdef CUBE3D_PROFILER
+
+std::atomic<bool> capturing = false;
+
+// the mutex only protects the registration of new threads and the names,
+// the events are never written under it
+static std::mutex registry_mutex;
+static std::vector<std::unique_ptr<ThreadBuffer>> registry;
+
+// only used by the main thread, in capture_frames and end_frame
+static std::string capture_fname;
+static uint32_t capture_remaining_frames = 0;
+static uint64_t capture_begin_ns = 0;
+static uint64_t frame_begin_ns = 0;
+
+// ---------------------------------------------------
+
+static ThreadBuffer& register_thread ()
+{
+	std::scoped_lock lock(registry_mutex);
+
+	auto buffer = std::make_unique<ThreadBuffer>();
+	buffer->thread_id = registry.size();
+	buffer->thread_name = "thread " + std::to_string(buffer->thread_id);
+
+	// the buffers live until the end of the program, so the trace still has the threads that ended
+	registry.push_back(std::move(buffer));
+
+	return *registry.back();
+}
+
+ThreadBuffer& get_thread_buffer ()
+{
+	thread_local ThreadBuffer& buffer = register_thread();
+	return buffer;
+}
+
+void set_thread_name (const std::string_view name)
+{
+	ThreadBuffer& buffer = get_thread_buffer();
+
+	std::scoped_lock lock(registry_mutex);
+	buffer.thread_name = name;
+}
+
+// ---------------------------------------------------
+
+static void write_string (std::ofstream& out, const std::string_view str)
+{
+	out << '"';
+
+	for (const char c : str) {
+		if (c == '"' || c == '\\')
+			out << '\\' << c;
+		else if (static_cast<unsigned char>(c) < 0x20)
+			out << ' ';
+		else
+			out << c;
+	}
+
+	out << '"';
+}
+
+static void write_trace ()
+{
+	std::ofstream out(capture_fname);
+
+	if (!out.is_open()) {
+		App::dprintln("profiler: failed to open ", capture_fname);
+		return;
+	}
+
+	std::scoped_lock lock(registry_mutex);
+
+	uint64_t n_written = 0;
+	uint32_t n_dropped_threads = 0;
+
+	out << std::fixed << std::setprecision(3); // microseconds
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	for (const auto& buffer : registry) {
+		// acquire pairs with the release of Zone, events after n are still being written
+		const uint32_t n = buffer->n_events.load(std::memory_order_acquire);
+
+		if (n == 0)
+			continue;
+
+		if (n == ThreadBuffer::capacity)
+			n_dropped_threads++;
+
+		if (n_written > 0)
+			out << ',';
+		out << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << buffer->thread_id << ",\"args\":{\"name\":";
+		write_string(out, buffer->thread_name);
+		out << "}}";
+
+		for (uint32_t i = 0; i < n; i++) {
+			const Event& event = buffer->events[i];
+
+			// zones started before the capture
+			if (event.begin_ns < capture_begin_ns)
+				continue;
+
+			out << ",\n{\"name\":";
+			write_string(out, event.name);
+			out << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->thread_id
+				<< ",\"ts\":" << static_cast<double>(event.begin_ns - capture_begin_ns) / 1000.0
+				<< ",\"dur\":" << static_cast<double>(event.end_ns - event.begin_ns) / 1000.0 << '}';
+		}
+
+		n_written += n;
+	}
+
+	out << "\n]}\n";
+
+	App::dprintln("profiler: wrote ", n_written, " events to ", capture_fname);
+
+	if (n_dropped_threads > 0)
+		App::dprintln("profiler: ", n_dropped_threads, " threads filled their buffer, the last events were dropped");
+}
+
+// ---------------------------------------------------
+
+void capture_frames (const uint32_t n_frames, const std::string_view fname)
+{
+	if (capturing.load(std::memory_order_relaxed) || n_frames == 0)
+		return;
+
+	{
+		std::scoped_lock lock(registry_mutex);
+
+		for (auto& buffer : registry)
+			buffer->n_events.store(0, std::memory_order_relaxed);
+	}
+
+	capture_fname = fname;
+	capture_remaining_frames = n_frames;
+	capture_begin_ns = now_ns();
+	frame_begin_ns = capture_begin_ns;
+
+	capturing.store(true, std::memory_order_relaxed);
+
+	App::dprintln("profiler: capturing ", n_frames, " frames");
+}
+
+void end_frame ()
+{
+	if (!capturing.load(std::memory_order_relaxed))
+		return;
+
+	// the frame itself, so the zones of the main thread are grouped by frame in the viewer
+	{
+		ThreadBuffer& buffer = get_thread_buffer();
+		const uint32_t i = buffer.n_events.load(std::memory_order_relaxed);
+		const uint64_t t = now_ns();
+
+		if (i < ThreadBuffer::capacity) {
+			buffer.events[i] = Event { .name = "frame", .begin_ns = frame_begin_ns, .end_ns = t };
+			buffer.n_events.store(i + 1, std::memory_order_release);
+		}
+
+		frame_begin_ns = t;
+	}
+
+	capture_remaining_frames--;
+
+	if (capture_remaining_frames == 0) {
+		capturing.store(false, std::memory_order_relaxed);
+		write_trace();
+	}
+}
+
+#endif
+
+// ---------------------------------------------------
+
+} // end namespace Profiler
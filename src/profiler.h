@@ -0,0 +1,125 @@
+#ifndef __CUBE3D_SDL_PROFILER_HEADER_H__
+#define __CUBE3D_SDL_PROFILER_HEADER_H__
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <memory>
+
+#include <cstdint>
+
+// ---------------------------------------------------
+
+/*
+	Hot path profiler.
+
+	CUBE3D_PROFILE_ZONE("name") measures the time until the end of the scope.
+	Zones are only recorded while a capture is running, started with capture_frames,
+	so outside of a capture a zone costs a relaxed atomic load.
+	Each thread writes its zones to its own buffer, without locks.
+	After the requested number of frames (counted by end_frame), the capture is written
+	as Chrome trace_event JSON, that can be opened in chrome://tracing or ui.perfetto.dev.
+
+	Disabled at compile time with cmake -DPROFILER=OFF: the macros expand to nothing.
+	Zone names must be string literals (or live until the capture is written).
+*/
+
+#ifdef CUBE3D_PROFILER
+	#define CUBE3D_PROFILE_CONCAT_(a, b) a##b
+	#define CUBE3D_PROFILE_CONCAT(a, b) CUBE3D_PROFILE_CONCAT_(a, b)
+	#define CUBE3D_PROFILE_ZONE(name) Profiler::Zone CUBE3D_PROFILE_CONCAT(profiler_zone_, __LINE__) (name)
+#else
+	#define CUBE3D_PROFILE_ZONE(name)
+#endif
+
+namespace Profiler
+{
+
+// ---------------------------------------------------
+
+#ifdef CUBE3D_PROFILER
+
+struct Event {
+	const char *name;
+	uint64_t begin_ns;
+	uint64_t end_ns;
+};
+
+// written only by its thread, read by the thread that writes the capture
+struct ThreadBuffer {
+	static constexpr uint32_t capacity = 1 << 16; // events per capture, extra events are dropped
+
+	std::unique_ptr<Event[]> events = std::make_unique<Event[]>(capacity);
+	std::atomic<uint32_t> n_events = 0;
+	uint32_t thread_id;
+	std::string thread_name;
+};
+
+extern std::atomic<bool> capturing;
+
+ThreadBuffer& get_thread_buffer ();
+
+inline uint64_t now_ns () noexcept
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class Zone
+{
+private:
+	const char *name;
+	uint64_t begin_ns;
+
+public:
+	inline Zone (const char *name_) noexcept
+		: name(name_), begin_ns(0)
+	{
+		if (capturing.load(std::memory_order_relaxed)) [[unlikely]]
+			this->begin_ns = now_ns();
+	}
+
+	inline ~Zone ()
+	{
+		if (this->begin_ns != 0) [[unlikely]] {
+			ThreadBuffer& buffer = get_thread_buffer();
+			const uint32_t i = buffer.n_events.load(std::memory_order_relaxed);
+
+			if (i < ThreadBuffer::capacity) {
+				buffer.events[i] = Event { .name = this->name, .begin_ns = this->begin_ns, .end_ns = now_ns() };
+				buffer.n_events.store(i + 1, std::memory_order_release); // publishes the event to the writer
+			}
+		}
+	}
+};
+
+// name of the calling thread in the trace
+void set_thread_name (const std::string_view name);
+
+// starts recording, the trace is written to fname after n_frames calls of end_frame
+void capture_frames (const uint32_t n_frames, const std::string_view fname);
+
+// must be called once per frame by the main thread
+void end_frame ();
+
+#else
+
+inline void set_thread_name (const std::string_view name)
+{
+}
+
+inline void capture_frames (const uint32_t n_frames, const std::string_view fname)
+{
+}
+
+inline void end_frame ()
+{
+}
+
+#endif
+
+// ---------------------------------------------------
+
+} // end namespace Profiler
+
+#endif
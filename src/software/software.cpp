@@ -0,0 +1,542 @@
+#include <algorithm>
+#include <utility>
+#include <array>
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+	#include <emmintrin.h>
+	#define CUBE3D_SOFTWARE_SSE2
+#endif
+
+#include <my-lib/math.h>
+
+#include "../debug.h"
+#include "../profiler.h"
+#include "software.h"
+
+// ---------------------------------------------------
+
+using App::dprint;
+using App::dprintln;
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+namespace Software
+{
+
+// ---------------------------------------------------
+
+struct ClipVertex {
+	Vector4 pos; // clip coords, after the projection matrix
+	Color color;
+};
+
+// distance to the near plane in clip coords, the vertex is visible when >= 0 (-w <= z)
+
+static inline float near_distance (const ClipVertex& v)
+{
+	return v.pos.z + v.pos.w;
+}
+
+static inline ClipVertex lerp (const ClipVertex& a, const ClipVertex& b, const float t)
+{
+	return ClipVertex {
+		.pos = Vector4(
+			a.pos.x + (b.pos.x - a.pos.x) * t,
+			a.pos.y + (b.pos.y - a.pos.y) * t,
+			a.pos.z + (b.pos.z - a.pos.z) * t,
+			a.pos.w + (b.pos.w - a.pos.w) * t
+		),
+		.color = Color {
+			.r = a.color.r + (b.color.r - a.color.r) * t,
+			.g = a.color.g + (b.color.g - a.color.g) * t,
+			.b = a.color.b + (b.color.b - a.color.b) * t,
+			.a = a.color.a + (b.color.a - a.color.a) * t
+		}
+	};
+}
+
+// Sutherland-Hodgman against the near plane, returns the number of vertices of the polygon (0, 3 or 4)
+
+static uint32_t clip_near (const std::array<ClipVertex, 3>& in, std::array<ClipVertex, 4>& out)
+{
+	uint32_t n = 0;
+
+	for (uint32_t i = 0; i < 3; i++) {
+		const ClipVertex& a = in[i];
+		const ClipVertex& b = in[(i + 1) % 3];
+		const float da = near_distance(a);
+		const float db = near_distance(b);
+
+		if (da >= 0)
+			out[n++] = a;
+
+		if ((da >= 0) != (db >= 0))
+			out[n++] = lerp(a, b, da / (da - db));
+	}
+
+	return n;
+}
+
+static inline Plane interpolate_plane (const std::array<Plane, 3>& barycentric, const float v0, const float v1, const float v2)
+{
+	return Plane {
+		.dx = barycentric[0].dx * v0 + barycentric[1].dx * v1 + barycentric[2].dx * v2,
+		.dy = barycentric[0].dy * v0 + barycentric[1].dy * v1 + barycentric[2].dy * v2,
+		.c = barycentric[0].c * v0 + barycentric[1].c * v1 + barycentric[2].c * v2
+	};
+}
+
+static inline uint32_t pack_argb (const Color& color)
+{
+	auto channel = [] (const float v) -> uint32_t {
+		return static_cast<uint32_t>( std::nearbyint(std::clamp(v, 0.0f, 1.0f) * 255.0f) );
+	};
+
+	return (channel(color.a) << 24) | (channel(color.r) << 16) | (channel(color.g) << 8) | channel(color.b);
+}
+
+// ---------------------------------------------------
+
+/*
+	Converts the triangle to window coords (y pointing down, like the rows of the framebuffer)
+	and computes the planes used by the rasterizer.
+	Returns false if the triangle is degenerate or outside of the screen.
+*/
+
+static bool setup_triangle (const ClipVertex& c0, const ClipVertex& c1, const ClipVertex& c2, const uint32_t width, const uint32_t height, RasterTriangle& t)
+{
+	struct WindowVertex {
+		float x, y, z, inv_w;
+		std::array<float, 4> color_w;
+	};
+
+	auto to_window = [width, height] (const ClipVertex& c) -> WindowVertex {
+		const float inv_w = 1.0f / c.pos.w;
+
+		return WindowVertex {
+			.x = (c.pos.x * inv_w * 0.5f + 0.5f) * static_cast<float>(width),
+			.y = (0.5f - c.pos.y * inv_w * 0.5f) * static_cast<float>(height),
+			.z = c.pos.z * inv_w * 0.5f + 0.5f,
+			.inv_w = inv_w,
+			.color_w = { c.color.r * inv_w, c.color.g * inv_w, c.color.b * inv_w, c.color.a * inv_w }
+		};
+	};
+
+	const WindowVertex v0 = to_window(c0);
+	const WindowVertex v1 = to_window(c1);
+	const WindowVertex v2 = to_window(c2);
+
+	const float area2 = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+
+	// back faces, like GL_CULL_FACE: front faces are counter-clockwise in ndc,
+	// which is clockwise (negative area) in window coords, since y points down,
+	// written this way to also reject the NaN of vertices with w = 0
+	if (!(area2 <= -1.0e-8f))
+		return false;
+
+	// guard band: vertices close to w = 0 project far out of the screen,
+	// the bounds are clamped before the conversion to int, which would overflow
+
+	const float fwidth = static_cast<float>(width);
+	const float fheight = static_cast<float>(height);
+
+	auto to_int = [] (const float v, const float size) -> int32_t {
+		return static_cast<int32_t>( std::clamp(v, -size, 2.0f * size) );
+	};
+
+	t.min_x = std::max(0, to_int(std::floor(std::min({ v0.x, v1.x, v2.x })), fwidth));
+	t.min_y = std::max(0, to_int(std::floor(std::min({ v0.y, v1.y, v2.y })), fheight));
+	t.max_x = std::min(static_cast<int32_t>(width) - 1, to_int(std::ceil(std::max({ v0.x, v1.x, v2.x })), fwidth));
+	t.max_y = std::min(static_cast<int32_t>(height) - 1, to_int(std::ceil(std::max({ v0.y, v1.y, v2.y })), fheight));
+
+	if (t.min_x > t.max_x || t.min_y > t.max_y)
+		return false;
+
+	// barycentric coordinate of vertex i, from the edge opposite to it,
+	// divided by the signed area, so they are positive inside
+
+	const float inv_area2 = 1.0f / area2;
+
+	auto edge = [inv_area2] (const WindowVertex& a, const WindowVertex& b) -> Plane {
+		const float dx = (a.y - b.y) * inv_area2;
+		const float dy = (b.x - a.x) * inv_area2;
+		const float c = (a.x * b.y - b.x * a.y) * inv_area2;
+
+		// sample at the center of the pixel, so the planes are evaluated at integer coords
+		return Plane { .dx = dx, .dy = dy, .c = c + 0.5f * dx + 0.5f * dy };
+	};
+
+	t.edges = { edge(v1, v2), edge(v2, v0), edge(v0, v1) };
+
+	t.depth = interpolate_plane(t.edges, v0.z, v1.z, v2.z);
+	t.inv_w = interpolate_plane(t.edges, v0.inv_w, v1.inv_w, v2.inv_w);
+
+	for (uint32_t i = 0; i < 4; i++)
+		t.color[i] = interpolate_plane(t.edges, v0.color_w[i], v1.color_w[i], v2.color_w[i]);
+
+	return true;
+}
+
+// ---------------------------------------------------
+
+static void raster_triangle (const RasterTriangle& t, const int32_t x0, const int32_t x1, const int32_t y0, const int32_t y1, uint32_t *color_buffer, float *depth_buffer, const uint32_t stride)
+{
+	// x0 must be a multiple of 4, pixels up to the next multiple of 4 after x1 may be written
+
+#ifdef CUBE3D_SOFTWARE_SSE2
+	constexpr uint32_t n_planes = 9;
+
+	const std::array<const Plane*, n_planes> planes = {
+		&t.edges[0], &t.edges[1], &t.edges[2], &t.depth, &t.inv_w, &t.color[0], &t.color[1], &t.color[2], &t.color[3]
+	};
+
+	__m128 dx[n_planes];
+
+	for (uint32_t i = 0; i < n_planes; i++)
+		dx[i] = _mm_set1_ps(planes[i]->dx);
+
+	const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 max_channel = _mm_set1_ps(255.0f);
+
+	for (int32_t y = y0; y <= y1; y++) {
+		__m128 row[n_planes];
+
+		for (uint32_t i = 0; i < n_planes; i++)
+			row[i] = _mm_set1_ps(planes[i]->dy * static_cast<float>(y) + planes[i]->c);
+
+		uint32_t *color_row = color_buffer + y * stride;
+		float *depth_row = depth_buffer + y * stride;
+
+		for (int32_t x = x0; x <= x1; x += 4) {
+			const __m128 vx = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lanes);
+
+			auto eval = [&] (const uint32_t i) -> __m128 {
+				return _mm_add_ps(_mm_mul_ps(dx[i], vx), row[i]);
+			};
+
+			const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(eval(0), zero), _mm_cmpge_ps(eval(1), zero)), _mm_cmpge_ps(eval(2), zero));
+
+			if (_mm_movemask_ps(inside) == 0)
+				continue;
+
+			const __m128 z = eval(3);
+			const __m128 old_z = _mm_loadu_ps(depth_row + x);
+			const __m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(z, old_z));
+
+			if (_mm_movemask_ps(pass) == 0)
+				continue;
+
+			_mm_storeu_ps(depth_row + x, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, old_z)));
+
+			const __m128 w = _mm_div_ps(one, eval(4));
+
+			auto channel = [&] (const uint32_t i) -> __m128i {
+				const __m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(eval(i), w), zero), one);
+				return _mm_cvtps_epi32(_mm_mul_ps(v, max_channel));
+			};
+
+			const __m128i argb = _mm_or_si128(
+				_mm_or_si128(_mm_slli_epi32(channel(8), 24), _mm_slli_epi32(channel(5), 16)),
+				_mm_or_si128(_mm_slli_epi32(channel(6), 8), channel(7))
+			);
+
+			const __m128i mask = _mm_castps_si128(pass);
+			__m128i *dest = reinterpret_cast<__m128i*>(color_row + x);
+			const __m128i old_color = _mm_loadu_si128(dest);
+
+			_mm_storeu_si128(dest, _mm_or_si128(_mm_and_si128(mask, argb), _mm_andnot_si128(mask, old_color)));
+		}
+	}
+#else
+	auto eval = [] (const Plane& p, const float x, const float y) -> float {
+		return p.dx * x + p.dy * y + p.c;
+	};
+
+	for (int32_t y = y0; y <= y1; y++) {
+		const float fy = static_cast<float>(y);
+
+		for (int32_t x = x0; x < ((x1 + 4) & ~3); x++) {
+			const float fx = static_cast<float>(x);
+
+			if (eval(t.edges[0], fx, fy) < 0 || eval(t.edges[1], fx, fy) < 0 || eval(t.edges[2], fx, fy) < 0)
+				continue;
+
+			const float z = eval(t.depth, fx, fy);
+			float& depth = depth_buffer[y * stride + x];
+
+			if (!(z < depth))
+				continue;
+
+			depth = z;
+
+			const float w = 1.0f / eval(t.inv_w, fx, fy);
+
+			color_buffer[y * stride + x] = pack_argb( Color {
+				.r = eval(t.color[0], fx, fy) * w,
+				.g = eval(t.color[1], fx, fy) * w,
+				.b = eval(t.color[2], fx, fy) * w,
+				.a = eval(t.color[3], fx, fy) * w
+			} );
+		}
+	}
+#endif
+}
+
+// ---------------------------------------------------
+
+Renderer::Renderer (const uint32_t window_width_px_, const uint32_t window_height_px_, const bool fullscreen_, const bool create_window)
+	: Graphics::Renderer (window_width_px_, window_height_px_, fullscreen_),
+	  single_thread_pool(1)
+{
+	static_assert(tile_size % 4 == 0);
+
+	this->stride = (this->window_width_px + 3) & ~3u;
+	this->color_buffer.resize(this->stride * this->window_height_px);
+	this->depth_buffer.resize(this->stride * this->window_height_px);
+
+	this->n_tiles_x = (this->stride + tile_size - 1) / tile_size;
+	this->n_tiles_y = (this->window_height_px + tile_size - 1) / tile_size;
+
+	if (create_window) {
+		this->sdl_window = SDL_CreateWindow("", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, this->window_width_px, this->window_height_px, SDL_WINDOW_SHOWN);
+
+		mylib_assert_exception_msg(this->sdl_window != nullptr, "Error: ", SDL_GetError())
+	}
+
+	dprintln("software renderer ", this->window_width_px, "x", this->window_height_px, " tiles=", this->n_tiles_x, "x", this->n_tiles_y);
+
+	this->wait_next_frame();
+}
+
+Renderer::~Renderer ()
+{
+	if (this->sdl_window != nullptr)
+		SDL_DestroyWindow(this->sdl_window);
+}
+
+void Renderer::wait_next_frame ()
+{
+	this->cubes.clear();
+	this->offsets.clear();
+
+	this->reset_stats();
+}
+
+void Renderer::draw_cube3d (const Cube3d& cube, const Vector& offset)
+{
+	CUBE3D_PROFILE_ZONE("draw_cube3d");
+
+	this->cubes.push_back(cube);
+	this->offsets.push_back(offset);
+
+	this->stats.n_cubes++;
+}
+
+void Renderer::draw_cube3d_batch (std::span<const Cube3d> cubes, std::span<const Vector> offsets)
+{
+	CUBE3D_PROFILE_ZONE("draw_cube3d_batch");
+
+	mylib_assert_exception_msg(offsets.size() >= cubes.size(), "batch of ", cubes.size(), " cubes has only ", offsets.size(), " offsets")
+
+	this->cubes.insert(this->cubes.end(), cubes.begin(), cubes.end());
+	this->offsets.insert(this->offsets.end(), offsets.begin(), offsets.begin() + cubes.size());
+
+	this->stats.n_cubes += cubes.size();
+}
+
+void Renderer::setup_projection_matrix (const RenderArgs& args)
+{
+	// same matrix as the Opengl renderer
+	this->projection_matrix = Mylib::Math::gen_perspective_matrix<fp_t>(
+			args.fovy,
+			static_cast<fp_t>(this->window_width_px),
+			static_cast<fp_t>(this->window_height_px),
+			args.z_near,
+			args.z_far,
+			fp(1)
+		)
+		* Mylib::Math::gen_look_at_matrix<fp_t>(
+			args.world_camera_pos,
+			args.world_camera_target,
+			Vector(0, 1, 0));
+
+	this->frustum = Frustum(this->projection_matrix);
+	this->cull_matrix = this->projection_matrix;
+}
+
+// transforms, clips and bins the cubes of a chunk
+
+void Renderer::build_chunk (const uint32_t chunk, auto& emit)
+{
+	CUBE3D_PROFILE_ZONE("build_chunk");
+
+	constexpr uint32_t block_size = 256;
+
+	const size_t chunk_first = chunk * chunk_size;
+	const size_t chunk_end = std::min<size_t>(chunk_first + chunk_size, this->cubes.size());
+	const float *m = this->projection_matrix.get_raw(); // row-major
+	std::vector<std::vector<uint32_t>>& bins = this->chunk_bins[chunk];
+	uint32_t n_triangles = 0;
+
+	std::array<CubeGeometry::Corners, block_size> corners;
+
+	auto add_triangle = [&] (const ClipVertex& a, const ClipVertex& b, const ClipVertex& c) {
+		constexpr int32_t size = tile_size;
+		RasterTriangle t;
+
+		if (!setup_triangle(a, b, c, this->window_width_px, this->window_height_px, t))
+			return;
+
+		emit(1)[0] = t;
+
+		for (int32_t ty = t.min_y / size; ty <= t.max_y / size; ty++) {
+			for (int32_t tx = t.min_x / size; tx <= t.max_x / size; tx++)
+				bins[ty * this->n_tiles_x + tx].push_back(n_triangles);
+		}
+
+		n_triangles++;
+	};
+
+	for (size_t first = chunk_first; first < chunk_end; first += block_size) {
+		const size_t n = std::min<size_t>(block_size, chunk_end - first);
+
+		CubeGeometry::calc_corners_batch(std::span<const Cube3d>(this->cubes).subspan(first, n), corners);
+
+		for (size_t i = 0; i < n; i++) {
+			const Cube3d& cube = this->cubes[first + i];
+			const Vector& offset = this->offsets[first + i];
+			std::array<ClipVertex, Cube3d::get_n_vertices()> clip;
+
+			for (uint32_t v = 0; v < Cube3d::get_n_vertices(); v++) {
+				const Point p = corners[i][v] + offset;
+
+				clip[v].pos = Vector4(
+					m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3],
+					m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7],
+					m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11],
+					m[12] * p.x + m[13] * p.y + m[14] * p.z + m[15]
+				);
+				clip[v].color = cube.get_vertex_color(static_cast<Cube3d::PositionIndex>(v));
+			}
+
+			for (uint32_t j = 0; j < CubeGeometry::triangles.size(); j += 3) {
+				const std::array<ClipVertex, 3> tri = {
+					clip[ CubeGeometry::triangles[j] ],
+					clip[ CubeGeometry::triangles[j + 1] ],
+					clip[ CubeGeometry::triangles[j + 2] ]
+				};
+
+				if (near_distance(tri[0]) >= 0 && near_distance(tri[1]) >= 0 && near_distance(tri[2]) >= 0)
+					add_triangle(tri[0], tri[1], tri[2]);
+				else {
+					std::array<ClipVertex, 4> polygon;
+					const uint32_t n_vertices = clip_near(tri, polygon);
+
+					for (uint32_t k = 2; k < n_vertices; k++)
+						add_triangle(polygon[0], polygon[k - 1], polygon[k]);
+				}
+			}
+		}
+	}
+}
+
+void Renderer::raster_tile (const uint32_t tile, const uint32_t clear_color)
+{
+	CUBE3D_PROFILE_ZONE("raster_tile");
+
+	const int32_t tile_x0 = (tile % this->n_tiles_x) * tile_size;
+	const int32_t tile_y0 = (tile / this->n_tiles_x) * tile_size;
+	const int32_t tile_x1 = std::min<int32_t>(tile_x0 + tile_size, this->stride) - 1;
+	const int32_t tile_y1 = std::min<int32_t>(tile_y0 + tile_size, this->window_height_px) - 1;
+
+	for (int32_t y = tile_y0; y <= tile_y1; y++) {
+		std::fill_n(this->color_buffer.data() + y * this->stride + tile_x0, tile_x1 - tile_x0 + 1, clear_color);
+		std::fill_n(this->depth_buffer.data() + y * this->stride + tile_x0, tile_x1 - tile_x0 + 1, 1.0f);
+	}
+
+	for (uint32_t chunk = 0; chunk < this->chunk_bins.size(); chunk++) {
+		std::span<const RasterTriangle> triangles = this->triangles.get_chunk(chunk);
+
+		for (const uint32_t i : this->chunk_bins[chunk][tile]) {
+			const RasterTriangle& t = triangles[i];
+
+			raster_triangle(t,
+				std::max(t.min_x, tile_x0) & ~3,
+				std::min(t.max_x, tile_x1),
+				std::max(t.min_y, tile_y0),
+				std::min(t.max_y, tile_y1),
+				this->color_buffer.data(), this->depth_buffer.data(), this->stride);
+		}
+	}
+}
+
+void Renderer::render ()
+{
+	CUBE3D_PROFILE_ZONE("render");
+
+	// the retained cubes are gathered in the build phase, like the immediate ones
+	PhaseTimer timer;
+
+	this->draw_retained_cubes();
+
+	ThreadPool& pool = this->get_pool();
+	const uint32_t n_tiles = this->n_tiles_x * this->n_tiles_y;
+	const uint32_t n_chunks = (this->cubes.size() + chunk_size - 1) / chunk_size;
+
+	this->chunk_bins.resize(n_chunks);
+
+	for (auto& bins : this->chunk_bins) {
+		bins.resize(n_tiles);
+
+		for (auto& bin : bins)
+			bin.clear();
+	}
+
+	this->triangles.build(pool, n_chunks, [this] (const uint32_t chunk, auto& emit) {
+		this->build_chunk(chunk, emit);
+	});
+
+	timer.lap(this->stats.build_time);
+
+	const uint32_t clear_color = pack_argb(this->background_color);
+
+	pool.parallel_for(n_tiles, [this, clear_color] (const uint32_t tile, const uint32_t thread_id) {
+		this->raster_tile(tile, clear_color);
+	});
+
+	timer.lap(this->stats.draw_time);
+
+	this->stats.n_vertices += this->cubes.size() * Cube3d::get_n_vertices();
+
+	if (this->sdl_window != nullptr) {
+		CUBE3D_PROFILE_ZONE("swap");
+
+		SDL_Surface *surface = SDL_GetWindowSurface(this->sdl_window);
+
+		if (SDL_MUSTLOCK(surface))
+			SDL_LockSurface(surface);
+
+		SDL_ConvertPixels(this->window_width_px, this->window_height_px,
+			SDL_PIXELFORMAT_ARGB8888, this->color_buffer.data(), this->stride * sizeof(uint32_t),
+			surface->format->format, surface->pixels, surface->pitch);
+
+		if (SDL_MUSTLOCK(surface))
+			SDL_UnlockSurface(surface);
+
+		SDL_UpdateWindowSurface(this->sdl_window);
+	}
+
+	timer.lap(this->stats.present_time);
+}
+
+// ---------------------------------------------------
+
+} // end namespace Software
+} // end namespace Graphics
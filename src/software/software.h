@@ -0,0 +1,127 @@
+#ifndef __CUBE3D_SDL_GRAPHICS_SOFTWARE_HEADER_H__
+#define __CUBE3D_SDL_GRAPHICS_SOFTWARE_HEADER_H__
+
+#ifdef __MINGW32__
+	#define SDL_MAIN_HANDLED
+#endif
+
+#include <SDL.h>
+
+#include <span>
+#include <array>
+#include <vector>
+
+#include <cstdint>
+
+#include <my-lib/std.h>
+#include <my-lib/macros.h>
+
+#include "../graphics.h"
+#include "../cube-geometry.h"
+#include "../thread-pool.h"
+
+namespace Graphics
+{
+namespace Software
+{
+
+// ---------------------------------------------------
+
+/*
+	Pure cpu renderer, no graphics api.
+	Useful on hosts without GPU, and as a reference to validate the output of the Opengl renderer,
+	since it follows the same conventions (same projection matrix, depth test GL_LESS,
+	perspective-correct interpolation of the vertex colors, back faces culled with CCW front faces).
+
+	draw_cube3d only stores the cube. In render:
+	1) cubes are split in chunks, and each chunk is transformed, clipped against the near plane
+	   and binned into screen tiles in parallel;
+	2) tiles are rasterized in parallel, each one by a single thread, so there is no lock
+	   on the color and depth buffers. Inside a tile, triangles are drawn in submission order,
+	   so the output doesn't depend on the number of threads.
+	The inner loop of the rasterizer shades 4 pixels at a time with SSE2 when available.
+*/
+
+// edge function or interpolated attribute, value(x, y) = dx*x + dy*y + c
+struct Plane {
+	float dx;
+	float dy;
+	float c;
+};
+
+struct RasterTriangle {
+	std::array<Plane, 3> edges; // barycentric coordinates, the pixel is inside when all are >= 0
+	Plane depth;                // window z in [0, 1]
+	Plane inv_w;                // 1/w, for perspective-correct interpolation
+	std::array<Plane, 4> color; // rgba / w
+	int32_t min_x;
+	int32_t min_y;
+	int32_t max_x;
+	int32_t max_y;
+};
+
+class Renderer : public Graphics::Renderer
+{
+public:
+	static constexpr uint32_t tile_size = 64; // pixels, multiple of 4
+	static constexpr uint32_t chunk_size = 1024; // cubes processed by a thread at a time
+
+protected:
+	Matrix4 projection_matrix;
+
+	// framebuffer, rows from top to bottom, stride is the width aligned to 4 pixels
+	OO_ENCAPSULATE_SCALAR_READONLY(uint32_t, stride)
+	std::vector<uint32_t> color_buffer; // ARGB8888
+	std::vector<float> depth_buffer;
+
+	uint32_t n_tiles_x;
+	uint32_t n_tiles_y;
+
+	// cubes of the frame
+	std::vector<Cube3d> cubes;
+	std::vector<Vector> offsets;
+
+	// triangles of the frame, generated by chunk
+	ParallelArenaBuilder<RasterTriangle> triangles;
+	std::vector<std::vector<std::vector<uint32_t>>> chunk_bins; // [chunk][tile] -> triangles of the chunk
+
+	// used when there is no thread pool
+	ThreadPool single_thread_pool;
+
+protected:
+	inline ThreadPool& get_pool () noexcept
+	{
+		return (this->thread_pool != nullptr) ? *this->thread_pool : this->single_thread_pool;
+	}
+
+	void build_chunk (const uint32_t chunk, auto& emit);
+	void raster_tile (const uint32_t tile, const uint32_t clear_color);
+
+public:
+	// without a window, the frame is only kept in memory, see get_color_buffer
+	Renderer (const uint32_t window_width_px_, const uint32_t window_height_px_, const bool fullscreen_, const bool create_window = true);
+	~Renderer ();
+
+	void wait_next_frame () override final;
+	void draw_cube3d (const Cube3d& cube, const Vector& offset) override final;
+	void draw_cube3d_batch (std::span<const Cube3d> cubes, std::span<const Vector> offsets) override final;
+	void setup_projection_matrix (const RenderArgs& args) override final;
+	void render () override final;
+
+	inline std::span<const uint32_t> get_color_buffer () const noexcept
+	{
+		return this->color_buffer;
+	}
+
+	inline std::span<const float> get_depth_buffer () const noexcept
+	{
+		return this->depth_buffer;
+	}
+};
+
+// ---------------------------------------------------
+
+} // end namespace Software
+} // end namespace Graphics
+
+#endif
@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <cmath>
+
+#include "spatial-grid.h"
+
+// ---------------------------------------------------
+
+namespace App
+{
+
+// ---------------------------------------------------
+
+using Graphics::fp_t;
+using Graphics::fp;
+using Graphics::Vector;
+using Graphics::Point;
+using Graphics::Sphere;
+using Graphics::Frustum;
+
+// ---------------------------------------------------
+
+static inline fp_t dot (const Vector& a, const Vector& b) noexcept
+{
+	return a.x*b.x + a.y*b.y + a.z*b.z;
+}
+
+static inline bool sphere_overlaps_box (const Sphere& s, const Point& min, const Point& max) noexcept
+{
+	fp_t distance2 = 0;
+
+	for (uint32_t axis = 0; axis < 3; axis++) {
+		const fp_t v = std::clamp(s.center[axis], min[axis], max[axis]) - s.center[axis];
+		distance2 += v * v;
+	}
+
+	return distance2 <= (s.radius * s.radius);
+}
+
+// ---------------------------------------------------
+
+SpatialGrid::SpatialGrid (const fp_t cell_size_)
+	: cell_size(cell_size_)
+{
+	mylib_assert_exception_msg(cell_size_ > 0, "invalid cell size ", cell_size_)
+
+	this->inv_cell_size = fp(1) / this->cell_size;
+}
+
+void SpatialGrid::add_to_cell (const Id id, const CellCoords& coords)
+{
+	const uint64_t key = pack_coords(coords);
+	const auto [it, created] = this->cell_indices.try_emplace(key, this->cells.size());
+
+	if (created)
+		this->cells.push_back(Cell { .coords = coords, .ids = {} });
+
+	Cell& cell = this->cells[it->second];
+
+	mylib_assert_exception_msg(cell.coords == coords, "position ", this->spheres[id].center, " too far from the origin")
+
+	this->keys[id] = key;
+	this->locations[id] = Location { .cell = it->second, .slot = static_cast<uint32_t>(cell.ids.size()) };
+	cell.ids.push_back(id);
+}
+
+void SpatialGrid::remove_from_cell (const Id id)
+{
+	Location& location = this->locations[id];
+	Cell& cell = this->cells[location.cell];
+	const Id last = cell.ids.back();
+
+	cell.ids[location.slot] = last;
+	this->locations[last].slot = location.slot;
+	cell.ids.pop_back();
+
+	location.cell = invalid_cell;
+}
+
+void SpatialGrid::insert (const Id id, const Sphere& sphere)
+{
+	mylib_assert_exception_msg(sphere.radius <= (this->cell_size * fp(0.5)), "radius ", sphere.radius, " bigger than half of the cell size ", this->cell_size)
+
+	if (id >= this->locations.size()) {
+		this->spheres.resize(id + 1);
+		this->keys.resize(id + 1);
+		this->locations.resize(id + 1, Location { .cell = invalid_cell, .slot = 0 });
+	}
+
+	mylib_assert_exception_msg(!this->contains(id), "id ", id, " already in the grid")
+
+	this->spheres[id] = sphere;
+	this->add_to_cell(id, this->calc_coords(sphere.center));
+	this->size++;
+}
+
+void SpatialGrid::remove (const Id id)
+{
+	mylib_assert_exception_msg(this->contains(id), "id ", id, " not in the grid")
+
+	this->remove_from_cell(id);
+	this->size--;
+}
+
+void SpatialGrid::move_to_cell (const Id id, const CellCoords& coords)
+{
+	this->remove_from_cell(id);
+	this->add_to_cell(id, coords);
+	this->n_cell_changes++;
+}
+
+void SpatialGrid::clear ()
+{
+	this->spheres.clear();
+	this->keys.clear();
+	this->locations.clear();
+	this->cells.clear();
+	this->cell_indices.clear();
+	this->size = 0;
+}
+
+template <typename Function>
+void SpatialGrid::for_each_cell (const Point& min, const Point& max, Function&& function) const
+{
+	const Vector margin(this->cell_size * fp(0.5), this->cell_size * fp(0.5), this->cell_size * fp(0.5));
+	const CellCoords cmin = this->calc_coords(min - margin);
+	const CellCoords cmax = this->calc_coords(max + margin);
+
+	const uint64_t n_cells_in_box = static_cast<uint64_t>(cmax.x - cmin.x + 1)
+		* static_cast<uint64_t>(cmax.y - cmin.y + 1)
+		* static_cast<uint64_t>(cmax.z - cmin.z + 1);
+
+	// big boxes are faster checking every existing cell than every cell of the box
+	if (n_cells_in_box > this->cells.size()) {
+		for (const Cell& cell : this->cells) {
+			const CellCoords& c = cell.coords;
+
+			if (!cell.ids.empty()
+				&& c.x >= cmin.x && c.x <= cmax.x
+				&& c.y >= cmin.y && c.y <= cmax.y
+				&& c.z >= cmin.z && c.z <= cmax.z)
+				function(cell);
+		}
+
+		return;
+	}
+
+	for (int32_t x = cmin.x; x <= cmax.x; x++) {
+		for (int32_t y = cmin.y; y <= cmax.y; y++) {
+			for (int32_t z = cmin.z; z <= cmax.z; z++) {
+				const Cell *cell = this->find_cell(CellCoords { .x = x, .y = y, .z = z });
+
+				if (cell != nullptr)
+					function(*cell);
+			}
+		}
+	}
+}
+
+void SpatialGrid::query_box (const Point& min, const Point& max, std::vector<Id>& out) const
+{
+	this->for_each_cell(min, max, [this, &min, &max, &out] (const Cell& cell) {
+		for (const Id id : cell.ids) {
+			if (sphere_overlaps_box(this->spheres[id], min, max))
+				out.push_back(id);
+		}
+	});
+}
+
+void SpatialGrid::query_sphere (const Sphere& sphere, std::vector<Id>& out) const
+{
+	const Vector r(sphere.radius, sphere.radius, sphere.radius);
+
+	this->for_each_cell(sphere.center - r, sphere.center + r, [this, &sphere, &out] (const Cell& cell) {
+		for (const Id id : cell.ids) {
+			const Sphere& s = this->spheres[id];
+			const Vector d = s.center - sphere.center;
+			const fp_t radius = s.radius + sphere.radius;
+
+			if (dot(d, d) <= (radius * radius))
+				out.push_back(id);
+		}
+	});
+}
+
+SpatialGrid::RayHit SpatialGrid::query_ray (const Point& origin, const Vector& direction, const fp_t max_t) const
+{
+	RayHit hit = { .id = invalid_id, .t = max_t };
+
+	const fp_t a = dot(direction, direction);
+
+	if (a == 0 || this->size == 0)
+		return hit;
+
+	if (this->ray_stamps.size() < this->spheres.size())
+		this->ray_stamps.resize(this->spheres.size(), 0);
+
+	if (++this->ray_stamp == 0) {
+		std::fill(this->ray_stamps.begin(), this->ray_stamps.end(), 0);
+		this->ray_stamp = 1;
+	}
+
+	// 3d DDA (Amanatides and Woo), visits the cells crossed by the ray in order
+
+	CellCoords c = this->calc_coords(origin);
+	int32_t *cell[3] = { &c.x, &c.y, &c.z };
+	int32_t step[3];
+	fp_t t_next[3]; // t of the next cell boundary of each axis
+	fp_t t_delta[3]; // t between boundaries of each axis
+
+	for (uint32_t axis = 0; axis < 3; axis++) {
+		const fp_t d = direction[axis];
+
+		if (d == 0) {
+			step[axis] = 0;
+			t_next[axis] = std::numeric_limits<fp_t>::max();
+			t_delta[axis] = std::numeric_limits<fp_t>::max();
+		}
+		else {
+			step[axis] = (d > 0) ? 1 : -1;
+			const fp_t boundary = static_cast<fp_t>(*cell[axis] + ((d > 0) ? 1 : 0)) * this->cell_size;
+			t_next[axis] = (boundary - origin[axis]) / d;
+			t_delta[axis] = this->cell_size / std::abs(d);
+		}
+	}
+
+	auto test_sphere = [&] (const Id id) {
+		if (this->ray_stamps[id] == this->ray_stamp)
+			return;
+
+		this->ray_stamps[id] = this->ray_stamp;
+
+		const Sphere& s = this->spheres[id];
+		const Vector oc = origin - s.center;
+		const fp_t b = dot(oc, direction);
+		const fp_t k = dot(oc, oc) - (s.radius * s.radius); // negative when the origin is inside
+		const fp_t discriminant = b*b - a*k;
+
+		if (discriminant < 0)
+			return;
+
+		fp_t t = (-b - std::sqrt(discriminant)) / a;
+
+		if (t < 0) {
+			if (k > 0)
+				return; // behind the origin
+			t = 0; // the origin is inside the sphere
+		}
+
+		if (t <= hit.t)
+			hit = RayHit { .id = id, .t = t };
+	};
+
+	fp_t t_entry = 0;
+
+	// A sphere hit at t is overlapped by the cell of the hit point,
+	// so it is in that cell or in one of its neighbors, and was tested when that cell was visited.
+	// Once t_entry passes the closest hit, no other sphere can be closer.
+	while (t_entry <= hit.t) {
+		for (int32_t x = c.x - 1; x <= c.x + 1; x++) {
+			for (int32_t y = c.y - 1; y <= c.y + 1; y++) {
+				for (int32_t z = c.z - 1; z <= c.z + 1; z++) {
+					const Cell *neighbor = this->find_cell(CellCoords { .x = x, .y = y, .z = z });
+
+					if (neighbor != nullptr) {
+						for (const Id id : neighbor->ids)
+							test_sphere(id);
+					}
+				}
+			}
+		}
+
+		uint32_t axis = 0;
+
+		if (t_next[1] < t_next[axis])
+			axis = 1;
+		if (t_next[2] < t_next[axis])
+			axis = 2;
+
+		t_entry = t_next[axis];
+		*cell[axis] += step[axis];
+		t_next[axis] += t_delta[axis];
+	}
+
+	return hit;
+}
+
+void SpatialGrid::query_frustum (const Frustum& frustum, std::vector<Id>& out) const
+{
+	const fp_t margin = this->cell_size * fp(0.5);
+
+	for (const Cell& cell : this->cells) {
+		if (cell.ids.empty())
+			continue;
+
+		// loose bounds of the cell
+		const Point min(
+			static_cast<fp_t>(cell.coords.x) * this->cell_size - margin,
+			static_cast<fp_t>(cell.coords.y) * this->cell_size - margin,
+			static_cast<fp_t>(cell.coords.z) * this->cell_size - margin
+			);
+		const Point max = min + Vector(this->cell_size + 2*margin, this->cell_size + 2*margin, this->cell_size + 2*margin);
+
+		bool outside = false;
+		bool inside = true;
+
+		for (const Frustum::Plane& plane : frustum.planes) {
+			fp_t near_distance = plane.d; // corner farthest along the normal
+			fp_t far_distance = plane.d; // corner farthest against the normal
+
+			for (uint32_t axis = 0; axis < 3; axis++) {
+				const fp_t n = plane.normal[axis];
+				near_distance += n * ((n >= 0) ? max[axis] : min[axis]);
+				far_distance += n * ((n >= 0) ? min[axis] : max[axis]);
+			}
+
+			if (near_distance < 0) {
+				outside = true;
+				break;
+			}
+
+			if (far_distance < 0)
+				inside = false;
+		}
+
+		if (outside)
+			continue;
+
+		if (inside) {
+			out.insert(out.end(), cell.ids.begin(), cell.ids.end());
+			continue;
+		}
+
+		for (const Id id : cell.ids) {
+			if (!frustum.is_outside(this->spheres[id]))
+				out.push_back(id);
+		}
+	}
+}
+
+// ---------------------------------------------------
+
+} // end namespace App
@@ -0,0 +1,172 @@
+#ifndef __CUBE3D_SDL_SPATIAL_GRID_HEADER_H__
+#define __CUBE3D_SDL_SPATIAL_GRID_HEADER_H__
+
+#include <vector>
+#include <unordered_map>
+#include <limits>
+
+#include <cstdint>
+
+#include <my-lib/std.h>
+#include <my-lib/macros.h>
+
+#include "graphics.h"
+
+namespace App
+{
+
+// ---------------------------------------------------
+
+/*
+	Hashed uniform grid of bounding spheres, for spatial queries over many objects.
+	Only the cells that have objects exist, in a hash table keyed by the cell coords,
+	so the world is only bounded by the 2^21 cells per axis of the key.
+
+	The cells are loose: an object is stored only in the cell of its center,
+	and its radius must be at most half of cell_size, so it only overlaps that cell
+	and its neighbors. Queries expand their region by half a cell to find them.
+
+	update is cheap when the object stays in its cell, which is most of the frames
+	for objects slower than cell_size per frame: only the sphere is written.
+	Then the cost is the memory traffic, 24 bytes per object.
+	Removing from a cell swaps the last id of the cell into the free slot.
+
+	Ids are chosen by the caller, like the handles of an ObjectStore, and
+	should be dense, since the grid keeps an entry for every id up to the largest one.
+	Queries don't modify the grid, except query_ray, which can't run concurrently
+	with other calls of query_ray.
+*/
+
+class SpatialGrid
+{
+public:
+	using Id = uint32_t;
+	static constexpr Id invalid_id = std::numeric_limits<Id>::max();
+
+	struct RayHit {
+		Id id; // invalid_id when nothing was hit
+		Graphics::fp_t t; // the hit point is origin + direction * t
+	};
+
+protected:
+	static constexpr uint32_t invalid_cell = std::numeric_limits<uint32_t>::max();
+
+	struct CellCoords {
+		int32_t x;
+		int32_t y;
+		int32_t z;
+
+		constexpr bool operator== (const CellCoords& other) const noexcept = default;
+	};
+
+	struct Cell {
+		CellCoords coords;
+		std::vector<Id> ids;
+	};
+
+	struct Location {
+		uint32_t cell; // invalid_cell when the id is not in the grid
+		uint32_t slot; // position in the ids of the cell
+	};
+
+	OO_ENCAPSULATE_SCALAR_READONLY(Graphics::fp_t, cell_size)
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(uint32_t, size, 0) // objects in the grid
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(uint64_t, n_cell_changes, 0) // updates that moved an object to another cell
+
+protected:
+	Graphics::fp_t inv_cell_size;
+
+	// indexed by id, in separate arrays so update only reads the key and writes the sphere
+	// of the objects that stay in their cell
+	std::vector<Graphics::Sphere> spheres;
+	std::vector<uint64_t> keys; // packed coords of the cell
+	std::vector<Location> locations;
+	std::vector<Cell> cells; // empty cells are kept, to be reused
+	std::unordered_map<uint64_t, uint32_t> cell_indices; // packed coords -> index in cells
+
+	// objects already tested by the running query_ray
+	mutable std::vector<uint32_t> ray_stamps;
+	mutable uint32_t ray_stamp = 0;
+
+protected:
+	// floor without the call to std::floor, which is not inlined without sse4.1
+	static inline int32_t floor_to_int (const Graphics::fp_t v) noexcept
+	{
+		const int32_t i = static_cast<int32_t>(v);
+		return i - static_cast<int32_t>(v < static_cast<Graphics::fp_t>(i));
+	}
+
+	inline CellCoords calc_coords (const Graphics::Point& p) const noexcept
+	{
+		return CellCoords {
+			.x = floor_to_int(p.x * this->inv_cell_size),
+			.y = floor_to_int(p.y * this->inv_cell_size),
+			.z = floor_to_int(p.z * this->inv_cell_size)
+		};
+	}
+
+	// 21 bits per axis, so the coords must be in [-2^20, 2^20)
+	static inline uint64_t pack_coords (const CellCoords& c) noexcept
+	{
+		constexpr uint64_t mask = (uint64_t(1) << 21) - 1;
+		return ((static_cast<uint64_t>(c.x) & mask) << 42) | ((static_cast<uint64_t>(c.y) & mask) << 21) | (static_cast<uint64_t>(c.z) & mask);
+	}
+
+	inline const Cell* find_cell (const CellCoords& c) const
+	{
+		const auto it = this->cell_indices.find(pack_coords(c));
+		return (it == this->cell_indices.end()) ? nullptr : &this->cells[it->second];
+	}
+
+	void add_to_cell (const Id id, const CellCoords& coords);
+	void remove_from_cell (const Id id);
+	void move_to_cell (const Id id, const CellCoords& coords);
+
+	// calls function(cell) for every existing cell whose loose bounds overlap the box
+	template <typename Function>
+	void for_each_cell (const Graphics::Point& min, const Graphics::Point& max, Function&& function) const;
+
+public:
+	SpatialGrid (const Graphics::fp_t cell_size_);
+
+	inline bool contains (const Id id) const noexcept
+	{
+		return id < this->locations.size() && this->locations[id].cell != invalid_cell;
+	}
+
+	void insert (const Id id, const Graphics::Sphere& sphere);
+	void remove (const Id id);
+	// inline, since it is called for every object in every frame
+	inline void update (const Id id, const Graphics::Sphere& sphere)
+	{
+		// the queries only look half a cell around the cells they cover
+		mylib_assert_exception_msg(sphere.radius <= (this->cell_size * Graphics::fp(0.5)), "radius ", sphere.radius, " bigger than half of the cell size ", this->cell_size)
+
+		const CellCoords coords = this->calc_coords(sphere.center);
+
+		this->spheres[id] = sphere;
+
+		if (pack_coords(coords) != this->keys[id]) [[unlikely]]
+			this->move_to_cell(id, coords);
+	}
+
+	void clear ();
+
+	// ids of the objects whose sphere overlaps the box, appended to out, in no order
+	void query_box (const Graphics::Point& min, const Graphics::Point& max, std::vector<Id>& out) const;
+
+	// ids of the objects whose sphere overlaps the sphere, appended to out, in no order
+	void query_sphere (const Graphics::Sphere& sphere, std::vector<Id>& out) const;
+
+	// closest object hit by the ray, with t in [0, max_t], walking the cells along the ray, max_t must be finite
+	RayHit query_ray (const Graphics::Point& origin, const Graphics::Vector& direction, const Graphics::fp_t max_t) const;
+
+	// ids of the objects whose sphere is not outside the frustum, appended to out, in no order
+	void query_frustum (const Graphics::Frustum& frustum, std::vector<Id>& out) const;
+};
+
+// ---------------------------------------------------
+
+} // end namespace App
+
+#endif
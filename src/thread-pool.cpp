@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <string>
+
+#include "thread-pool.h"
+#include "profiler.h"
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+
+// ---------------------------------------------------
+
+ThreadPool::ThreadPool (const uint32_t n_threads_)
+{
+	this->n_threads = (n_threads_ > 0) ? n_threads_ : std::max(1u, std::thread::hardware_concurrency());
+	this->ranges = std::make_unique<Range[]>(this->n_threads);
+
+	for (uint32_t i = 0; i < this->n_threads; i++) {
+		this->ranges[i].next.store(0, std::memory_order_relaxed);
+		this->ranges[i].end = 0;
+	}
+
+	// thread 0 is the caller of parallel_for
+	for (uint32_t i = 1; i < this->n_threads; i++)
+		this->threads.emplace_back(&ThreadPool::worker_loop, this, i);
+}
+
+ThreadPool::~ThreadPool ()
+{
+	this->stop.store(true, std::memory_order_relaxed);
+	this->job_generation.fetch_add(1, std::memory_order_release);
+	this->job_generation.notify_all();
+
+	for (auto& thread : this->threads)
+		thread.join();
+}
+
+void ThreadPool::run (const uint32_t n_chunks)
+{
+	const uint32_t per_thread = n_chunks / this->n_threads;
+	const uint32_t remainder = n_chunks % this->n_threads;
+
+	for (uint32_t i = 0, first = 0; i < this->n_threads; i++) {
+		const uint32_t n = per_thread + ((i < remainder) ? 1 : 0);
+		this->ranges[i].next.store(first, std::memory_order_relaxed);
+		this->ranges[i].end = first + n;
+		first += n;
+	}
+
+	this->n_working.store(this->n_threads - 1, std::memory_order_relaxed);
+
+	// release publishes the ranges and the job to the workers
+	this->job_generation.fetch_add(1, std::memory_order_release);
+	this->job_generation.notify_all();
+
+	this->run_job(0);
+
+	while (true) {
+		const uint32_t n = this->n_working.load(std::memory_order_acquire);
+		if (n == 0)
+			break;
+		this->n_working.wait(n, std::memory_order_acquire);
+	}
+}
+
+void ThreadPool::run_job (const uint32_t thread_id)
+{
+	// own chunks first, then steal from the other threads
+
+	for (uint32_t i = 0; i < this->n_threads; i++) {
+		Range& range = this->ranges[(thread_id + i) % this->n_threads];
+
+		while (true) {
+			const uint32_t chunk = range.next.fetch_add(1, std::memory_order_relaxed);
+			if (chunk >= range.end)
+				break;
+			this->job_function(this->job_ctx, chunk, thread_id);
+		}
+	}
+}
+
+void ThreadPool::worker_loop (const uint32_t thread_id)
+{
+	uint32_t generation = 0;
+
+	Profiler::set_thread_name("worker " + std::to_string(thread_id));
+
+	while (true) {
+		this->job_generation.wait(generation, std::memory_order_acquire);
+		generation = this->job_generation.load(std::memory_order_acquire);
+
+		if (this->stop.load(std::memory_order_relaxed))
+			break;
+
+		this->run_job(thread_id);
+
+		if (this->n_working.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			this->n_working.notify_one();
+	}
+}
+
+// ---------------------------------------------------
+
+} // end namespace Graphics
@@ -0,0 +1,169 @@
+#ifndef __CUBE3D_SDL_THREAD_POOL_HEADER_H__
+#define __CUBE3D_SDL_THREAD_POOL_HEADER_H__
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <span>
+#include <utility>
+
+#include <cstdint>
+
+#include <my-lib/std.h>
+#include <my-lib/macros.h>
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+
+// ---------------------------------------------------
+
+/*
+	Fork-join pool for data-parallel loops.
+	The chunks of a loop are split evenly among the threads,
+	and a thread that finishes its own chunks steals chunks from the others.
+	Chunks are taken with fetch_add on per-thread counters, so there is no lock on the hot path.
+	The thread that calls parallel_for works as thread 0.
+	Only one parallel_for can run at a time.
+*/
+
+class ThreadPool
+{
+protected:
+	struct alignas(64) Range { // one cache line per thread, avoids false sharing
+		std::atomic<uint32_t> next;
+		uint32_t end;
+	};
+
+	using JobFunction = void (*) (void *ctx, const uint32_t chunk, const uint32_t thread_id);
+
+	OO_ENCAPSULATE_SCALAR_READONLY(uint32_t, n_threads)
+
+protected:
+	std::vector<std::thread> threads;
+	std::unique_ptr<Range[]> ranges;
+
+	JobFunction job_function = nullptr;
+	void *job_ctx = nullptr;
+
+	std::atomic<uint32_t> job_generation = 0;
+	std::atomic<uint32_t> n_working = 0;
+	std::atomic<bool> stop = false;
+
+	void worker_loop (const uint32_t thread_id);
+	void run_job (const uint32_t thread_id);
+	void run (const uint32_t n_chunks);
+
+public:
+	// n_threads includes the calling thread, 0 means all hardware threads
+	ThreadPool (const uint32_t n_threads_);
+	~ThreadPool ();
+
+	// Calls function(chunk, thread_id) for every chunk in [0, n_chunks).
+	// Blocks until all chunks are processed.
+	template <typename Function>
+	void parallel_for (const uint32_t n_chunks, Function&& function)
+	{
+		this->job_ctx = &function;
+		this->job_function = [] (void *ctx, const uint32_t chunk, const uint32_t thread_id) {
+			(*static_cast<std::remove_reference_t<Function>*>(ctx))(chunk, thread_id);
+		};
+
+		this->run(n_chunks);
+	}
+};
+
+// ---------------------------------------------------
+
+/*
+	Builds a variable number of elements per chunk in parallel, without locks.
+	Each thread appends to its own arena, then a prefix sum over the chunks
+	gives the final position of every chunk, and the arenas are copied
+	in chunk order to the destination.
+*/
+
+template <typename T>
+class ParallelArenaBuilder
+{
+protected:
+	struct ChunkResult {
+		uint32_t thread_id;
+		uint32_t arena_offset;
+		uint32_t count;
+	};
+
+	std::vector<std::vector<T>> arenas; // one per thread, reused across frames
+	std::vector<ChunkResult> chunks;
+	std::vector<uint64_t> chunk_dest; // prefix sum of chunks[].count
+
+public:
+	/*
+		Calls generate(chunk, emit) for every chunk in parallel in the pool,
+		where emit(n) returns a std::span<T> of n elements in the arena of the thread.
+		The span is valid until the next call of emit.
+		Returns the total number of elements generated.
+	*/
+	template <typename Generate>
+	uint64_t build (ThreadPool& pool, const uint32_t n_chunks, Generate&& generate)
+	{
+		this->chunks.resize(n_chunks);
+		this->chunk_dest.resize(n_chunks);
+		this->arenas.resize(pool.get_n_threads());
+
+		for (auto& arena : this->arenas)
+			arena.clear();
+
+		pool.parallel_for(n_chunks, [this, &generate] (const uint32_t chunk, const uint32_t thread_id) {
+			std::vector<T>& arena = this->arenas[thread_id];
+			const uint32_t arena_offset = arena.size();
+
+			auto emit = [&arena] (const uint32_t n) -> std::span<T> {
+				const size_t first = arena.size();
+				arena.resize(first + n);
+				return std::span<T>(arena.data() + first, n);
+			};
+
+			generate(chunk, emit);
+
+			this->chunks[chunk] = ChunkResult {
+				.thread_id = thread_id,
+				.arena_offset = arena_offset,
+				.count = static_cast<uint32_t>(arena.size() - arena_offset)
+			};
+		});
+
+		uint64_t total = 0;
+
+		for (uint32_t i = 0; i < n_chunks; i++) {
+			this->chunk_dest[i] = total;
+			total += this->chunks[i].count;
+		}
+
+		return total;
+	}
+
+	// elements generated by a chunk in the last build, in the order they were emitted
+	inline std::span<const T> get_chunk (const uint32_t chunk) const noexcept
+	{
+		const ChunkResult& r = this->chunks[chunk];
+		return std::span<const T>(this->arenas[r.thread_id].data() + r.arena_offset, r.count);
+	}
+
+	// copies the result of the last build to dest, dest.size() must be the value returned by build
+	void stitch (ThreadPool& pool, std::span<T> dest)
+	{
+		pool.parallel_for(this->chunks.size(), [this, dest] (const uint32_t chunk, const uint32_t thread_id) {
+			const ChunkResult& r = this->chunks[chunk];
+			const T *src = this->arenas[r.thread_id].data() + r.arena_offset;
+			std::copy(src, src + r.count, dest.data() + this->chunk_dest[chunk]);
+		});
+	}
+};
+
+// ---------------------------------------------------
+
+} // end namespace Graphics
+
+#endif
@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <array>
+
+#include "voxel.h"
+#include "profiler.h"
+
+// ---------------------------------------------------
+
+namespace Graphics
+{
+
+// ---------------------------------------------------
+
+VoxelWorld::VoxelWorld (const fp_t voxel_size_, const uint32_t n_threads)
+	: id(next_id.fetch_add(1, std::memory_order_relaxed)),
+	  voxel_size(voxel_size_)
+{
+	mylib_assert_exception_msg(voxel_size_ > 0, "invalid voxel size ", voxel_size_)
+
+	if (n_threads != 1)
+		this->pool = new ThreadPool(n_threads);
+
+	this->thread = std::thread(&VoxelWorld::thread_loop, this);
+}
+
+VoxelWorld::~VoxelWorld ()
+{
+	// a running job is finished first
+	this->requested_job.store(stop_job, std::memory_order_release);
+	this->requested_job.notify_one();
+	this->thread.join();
+
+	if (this->pool != nullptr)
+		delete this->pool;
+}
+
+VoxelWorld::Chunk& VoxelWorld::create_chunk (const ChunkCoords& c)
+{
+	this->chunk_indices.emplace(pack_coords(c), this->chunks.size());
+
+	return this->chunks.emplace_back(Chunk {
+		.coords = c,
+		.voxels = std::vector<Voxel>(n_voxels_per_chunk, 0),
+		.n_solid = 0,
+		.dirty = false,
+		.meshing = false,
+		.mesh_version = 0,
+		.mesh = {}
+		});
+}
+
+void VoxelWorld::mark_dirty (Chunk& chunk)
+{
+	if (chunk.dirty)
+		return;
+
+	chunk.dirty = true;
+	this->dirty_chunks.push_back(static_cast<uint32_t>(&chunk - this->chunks.data()));
+}
+
+VoxelWorld::Voxel VoxelWorld::get_voxel (const int32_t x, const int32_t y, const int32_t z) const noexcept
+{
+	const Chunk *chunk = this->find_chunk(get_chunk_coords(x, y, z));
+
+	if (chunk == nullptr)
+		return 0;
+
+	return chunk->voxels[ get_voxel_index(x & (chunk_size - 1), y & (chunk_size - 1), z & (chunk_size - 1)) ];
+}
+
+void VoxelWorld::set_voxel (const int32_t x, const int32_t y, const int32_t z, const Voxel voxel)
+{
+	const ChunkCoords coords = get_chunk_coords(x, y, z);
+	Chunk *chunk = this->find_chunk(coords);
+
+	if (chunk == nullptr) {
+		if (voxel == 0)
+			return;
+
+		chunk = &this->create_chunk(coords);
+	}
+
+	const std::array<int32_t, 3> local = { x & (chunk_size - 1), y & (chunk_size - 1), z & (chunk_size - 1) };
+	Voxel& v = chunk->voxels[ get_voxel_index(local[0], local[1], local[2]) ];
+
+	if (v == voxel)
+		return;
+
+	chunk->n_solid += static_cast<uint32_t>(voxel != 0) - static_cast<uint32_t>(v != 0);
+	v = voxel;
+
+	this->mark_dirty(*chunk);
+
+	// faces of the neighbor chunks touching the voxel
+
+	for (uint32_t axis = 0; axis < 3; axis++) {
+		if (local[axis] != 0 && local[axis] != (chunk_size - 1))
+			continue;
+
+		std::array<int32_t, 3> c = { coords.x, coords.y, coords.z };
+		c[axis] += (local[axis] == 0) ? -1 : 1;
+
+		Chunk *neighbor = this->find_chunk(ChunkCoords { .x = c[0], .y = c[1], .z = c[2] });
+
+		if (neighbor != nullptr)
+			this->mark_dirty(*neighbor);
+	}
+}
+
+void VoxelWorld::copy_padded (const uint32_t chunk_index, std::vector<Voxel>& padded) const
+{
+	const Chunk& chunk = this->chunks[chunk_index];
+
+	auto padded_index = [] (const int32_t x, const int32_t y, const int32_t z) -> uint32_t {
+		return static_cast<uint32_t>((x + 1) + padded_size * ((y + 1) + padded_size * (z + 1)));
+	};
+
+	padded.assign(padded_size * padded_size * padded_size, 0);
+
+	for (int32_t z = 0; z < chunk_size; z++) {
+		for (int32_t y = 0; y < chunk_size; y++) {
+			const Voxel *src = chunk.voxels.data() + get_voxel_index(0, y, z);
+			std::copy(src, src + chunk_size, padded.data() + padded_index(0, y, z));
+		}
+	}
+
+	// one slice of each of the 6 neighbors, the edges and corners of the border are not used
+
+	for (uint32_t axis = 0; axis < 3; axis++) {
+		const uint32_t u = (axis + 1) % 3;
+		const uint32_t v = (axis + 2) % 3;
+
+		for (const int32_t side : { -1, 1 }) {
+			std::array<int32_t, 3> c = { chunk.coords.x, chunk.coords.y, chunk.coords.z };
+			c[axis] += side;
+
+			const Chunk *neighbor = this->find_chunk(ChunkCoords { .x = c[0], .y = c[1], .z = c[2] });
+
+			if (neighbor == nullptr || neighbor->n_solid == 0)
+				continue;
+
+			std::array<int32_t, 3> src;
+			std::array<int32_t, 3> dst;
+
+			src[axis] = (side > 0) ? 0 : (chunk_size - 1);
+			dst[axis] = (side > 0) ? chunk_size : -1;
+
+			for (int32_t b = 0; b < chunk_size; b++) {
+				for (int32_t a = 0; a < chunk_size; a++) {
+					src[u] = dst[u] = a;
+					src[v] = dst[v] = b;
+					padded[ padded_index(dst[0], dst[1], dst[2]) ] = neighbor->voxels[ get_voxel_index(src[0], src[1], src[2]) ];
+				}
+			}
+		}
+	}
+}
+
+void VoxelWorld::build_mesh (const std::vector<Voxel>& padded, std::vector<Vertex>& mesh)
+{
+	CUBE3D_PROFILE_ZONE("build_voxel_mesh");
+
+	constexpr int32_t n = chunk_size;
+	std::array<Voxel, n * n> mask; // faces of a slice, indexed by a + n*b
+
+	std::array<int32_t, 3> stride;
+	stride[0] = 1;
+	stride[1] = padded_size;
+	stride[2] = padded_size * padded_size;
+
+	const Voxel *inner = padded.data() + (1 + padded_size * (1 + padded_size)); // voxel (0, 0, 0)
+
+	// each slice of voxels along each axis, with the faces of one side at a time,
+	// u and v are the other two axes, with u x v pointing to the positive side of the axis
+
+	for (uint32_t axis = 0; axis < 3; axis++) {
+		const uint32_t u = (axis + 1) % 3;
+		const uint32_t v = (axis + 2) % 3;
+
+		for (const int32_t side : { -1, 1 }) {
+			for (int32_t i = 0; i < n; i++) {
+				// faces of the slice that are not hidden by the neighbor voxel
+
+				for (int32_t b = 0; b < n; b++) {
+					for (int32_t a = 0; a < n; a++) {
+						const Voxel *p = inner + i*stride[axis] + a*stride[u] + b*stride[v];
+						const Voxel voxel = *p;
+						mask[a + n*b] = (voxel != 0 && p[side * stride[axis]] == 0) ? voxel : 0;
+					}
+				}
+
+				// greedy merging: each face grows along u while the color is the same,
+				// then along v while the whole row is the same
+
+				const int32_t plane = i + ((side > 0) ? 1 : 0);
+
+				for (int32_t b = 0; b < n; b++) {
+					for (int32_t a = 0; a < n;) {
+						const Voxel color = mask[a + n*b];
+
+						if (color == 0) {
+							a++;
+							continue;
+						}
+
+						int32_t w = 1;
+
+						while ((a + w) < n && mask[(a + w) + n*b] == color)
+							w++;
+
+						int32_t h = 1;
+
+						while ((b + h) < n) {
+							const Voxel *row = mask.data() + a + n*(b + h);
+
+							if (!std::all_of(row, row + w, [color] (const Voxel c) { return c == color; }))
+								break;
+
+							h++;
+						}
+
+						for (int32_t k = 0; k < h; k++)
+							std::fill_n(mask.data() + a + n*(b + k), w, 0);
+
+						auto corner = [axis, u, v, plane, color] (const int32_t cu, const int32_t cv) -> Vertex {
+							std::array<uint8_t, 3> pos;
+							pos[axis] = static_cast<uint8_t>(plane);
+							pos[u] = static_cast<uint8_t>(cu);
+							pos[v] = static_cast<uint8_t>(cv);
+							return Vertex { .x = pos[0], .y = pos[1], .z = pos[2], .unused = 0, .color = color };
+						};
+
+						const Vertex p0 = corner(a, b);
+						const Vertex p1 = corner(a + w, b);
+						const Vertex p2 = corner(a + w, b + h);
+						const Vertex p3 = corner(a, b + h);
+
+						// counter-clockwise seen from the side the face points to
+						if (side > 0)
+							mesh.insert(mesh.end(), { p0, p1, p2, p0, p2, p3 });
+						else
+							mesh.insert(mesh.end(), { p0, p2, p1, p0, p3, p2 });
+
+						a += w;
+					}
+				}
+			}
+		}
+	}
+}
+
+void VoxelWorld::thread_loop ()
+{
+	uint64_t job = 0;
+
+	Profiler::set_thread_name("voxel_mesher");
+
+	while (true) {
+		this->requested_job.wait(job, std::memory_order_acquire);
+		job = this->requested_job.load(std::memory_order_acquire);
+
+		if (job == stop_job)
+			break;
+
+		auto mesh_chunk = [this] (const uint32_t i) {
+			Job& j = this->jobs[i];
+			j.mesh.clear();
+			build_mesh(j.padded, j.mesh);
+		};
+
+		if (this->pool != nullptr)
+			this->pool->parallel_for(this->n_jobs, [&mesh_chunk] (const uint32_t i, const uint32_t thread_id) { mesh_chunk(i); });
+		else {
+			for (uint32_t i = 0; i < this->n_jobs; i++)
+				mesh_chunk(i);
+		}
+
+		this->done_job.store(job, std::memory_order_release);
+		this->done_job.notify_one();
+	}
+}
+
+void VoxelWorld::start_job ()
+{
+	CUBE3D_PROFILE_ZONE("copy_voxel_chunks");
+
+	this->n_jobs = std::min(static_cast<uint32_t>(this->dirty_chunks.size()), max_chunks_per_job);
+
+	if (this->jobs.size() < this->n_jobs)
+		this->jobs.resize(this->n_jobs);
+
+	for (uint32_t i = 0; i < this->n_jobs; i++) {
+		const uint32_t chunk_index = this->dirty_chunks.back();
+		Chunk& chunk = this->chunks[chunk_index];
+
+		this->dirty_chunks.pop_back();
+		chunk.dirty = false;
+		chunk.meshing = true;
+
+		this->jobs[i].chunk = chunk_index;
+		this->copy_padded(chunk_index, this->jobs[i].padded);
+	}
+
+	this->job_running = true;
+	this->requested_job.store(this->requested_job.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	this->requested_job.notify_one();
+}
+
+uint32_t VoxelWorld::publish_job ()
+{
+	for (uint32_t i = 0; i < this->n_jobs; i++) {
+		Job& job = this->jobs[i];
+		Chunk& chunk = this->chunks[job.chunk];
+
+		// the old mesh goes to the job, and its memory is reused by the next one
+		chunk.mesh.swap(job.mesh);
+		chunk.mesh_version++;
+		chunk.meshing = false;
+	}
+
+	this->n_meshed_chunks += this->n_jobs;
+	this->job_running = false;
+
+	return this->n_jobs;
+}
+
+uint32_t VoxelWorld::update_meshes ()
+{
+	uint32_t n_published = 0;
+
+	if (this->job_running && this->done_job.load(std::memory_order_acquire) == this->requested_job.load(std::memory_order_relaxed))
+		n_published = this->publish_job();
+
+	if (!this->job_running && !this->dirty_chunks.empty())
+		this->start_job();
+
+	return n_published;
+}
+
+void VoxelWorld::flush_meshes ()
+{
+	while (this->is_meshing()) {
+		if (this->job_running) {
+			const uint64_t done = this->done_job.load(std::memory_order_acquire);
+
+			if (done != this->requested_job.load(std::memory_order_relaxed))
+				this->done_job.wait(done, std::memory_order_acquire);
+		}
+
+		this->update_meshes();
+	}
+}
+
+// ---------------------------------------------------
+
+} // end namespace Graphics
@@ -0,0 +1,207 @@
+#ifndef __CUBE3D_SDL_VOXEL_HEADER_H__
+#define __CUBE3D_SDL_VOXEL_HEADER_H__
+
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <limits>
+
+#include <cstdint>
+
+#include <my-lib/std.h>
+#include <my-lib/macros.h>
+
+#include "graphics.h"
+#include "thread-pool.h"
+
+namespace Graphics
+{
+
+// ---------------------------------------------------
+
+/*
+	World of axis-aligned cubes of the same size in a grid, the voxels,
+	split in chunks of chunk_size^3 voxels.
+	The voxel of coords (x, y, z) fills the box from (x, y, z) * voxel_size to (x+1, y+1, z+1) * voxel_size.
+	Only the chunks that ever had a voxel exist, in a hash table keyed by the chunk coords.
+
+	Each chunk has a triangle mesh of its surface, built with greedy meshing:
+	faces between two solid voxels are removed, and the remaining faces of the same
+	direction, plane and color are merged into the biggest rectangles, so the number of
+	triangles follows the surface of the voxels instead of their volume.
+
+	Changing a voxel marks its chunk dirty, and also the neighbor chunk when the voxel is
+	on the border, since it may hide a face of the neighbor.
+	update_meshes, called once per frame, copies the dirty chunks and meshes them in a
+	background thread, with a ThreadPool when there are more threads, and the new meshes
+	are published by a later call of update_meshes. Until then, the old mesh is kept.
+	The voxels can be changed while meshes are being built, those chunks are meshed again.
+	All the functions must be called from the same thread.
+*/
+
+class VoxelWorld
+{
+public:
+	using Voxel = uint32_t; // rgba8, see pack_color_rgba8, 0 is empty
+
+	static constexpr int32_t chunk_shift = 5;
+	static constexpr int32_t chunk_size = 1 << chunk_shift;
+	static constexpr uint32_t n_voxels_per_chunk = chunk_size * chunk_size * chunk_size;
+
+	// chunks copied to the background thread by each update_meshes
+	static constexpr uint32_t max_chunks_per_job = 64;
+
+	struct ChunkCoords {
+		int32_t x;
+		int32_t y;
+		int32_t z;
+
+		constexpr bool operator== (const ChunkCoords& other) const noexcept = default;
+	};
+
+	// 8 bytes, the renderers upload it as is
+	struct Vertex {
+		uint8_t x; // position in voxels relative to the chunk origin, in [0, chunk_size]
+		uint8_t y;
+		uint8_t z;
+		uint8_t unused;
+		uint32_t color; // rgba8
+	};
+
+	struct Chunk {
+		ChunkCoords coords;
+		std::vector<Voxel> voxels; // n_voxels_per_chunk, x varies first, then y, then z
+		uint32_t n_solid; // voxels that are not empty
+		bool dirty; // changed since it was last copied to the background thread
+		bool meshing; // in the running job
+		uint64_t mesh_version; // incremented every time the mesh is replaced
+		std::vector<Vertex> mesh; // triangles, counter-clockwise seen from outside
+	};
+
+protected:
+	static constexpr int32_t padded_size = chunk_size + 2;
+	static constexpr uint64_t stop_job = std::numeric_limits<uint64_t>::max();
+
+	// chunk copied with a border of one voxel from the neighbor chunks, meshed by the background thread
+	struct Job {
+		uint32_t chunk;
+		std::vector<Voxel> padded; // padded_size^3
+		std::vector<Vertex> mesh;
+	};
+
+	OO_ENCAPSULATE_SCALAR_READONLY(uint64_t, id) // unique in the process, never 0
+	OO_ENCAPSULATE_SCALAR_READONLY(fp_t, voxel_size)
+	OO_ENCAPSULATE_OBJ_READONLY(std::vector<Chunk>, chunks) // chunks are never removed, so the indices are stable
+	OO_ENCAPSULATE_SCALAR_INIT_READONLY(uint64_t, n_meshed_chunks, 0) // meshes published since the creation
+
+protected:
+	std::unordered_map<uint64_t, uint32_t> chunk_indices; // packed coords -> index in chunks
+	std::vector<uint32_t> dirty_chunks; // indices of the chunks with dirty set, in no order
+
+	std::vector<Job> jobs; // only touched by the background thread between request and done
+	uint32_t n_jobs = 0; // used entries of jobs in the running request
+	bool job_running = false;
+
+	ThreadPool *pool = nullptr; // used by the background thread, nullptr when it meshes alone
+	std::thread thread;
+	std::atomic<uint64_t> requested_job = 0; // written by the owner thread
+	std::atomic<uint64_t> done_job = 0; // written by the background thread
+
+	static inline std::atomic<uint64_t> next_id = 1;
+
+protected:
+	// 21 bits per axis, like SpatialGrid
+	static inline uint64_t pack_coords (const ChunkCoords& c) noexcept
+	{
+		constexpr uint64_t mask = (uint64_t(1) << 21) - 1;
+		return ((static_cast<uint64_t>(c.x) & mask) << 42) | ((static_cast<uint64_t>(c.y) & mask) << 21) | (static_cast<uint64_t>(c.z) & mask);
+	}
+
+	static inline uint32_t get_voxel_index (const int32_t x, const int32_t y, const int32_t z) noexcept
+	{
+		return static_cast<uint32_t>(x + chunk_size * (y + chunk_size * z));
+	}
+
+	// coords of the chunk of a voxel, the shift rounds down the negative coords
+	static inline ChunkCoords get_chunk_coords (const int32_t x, const int32_t y, const int32_t z) noexcept
+	{
+		return ChunkCoords { .x = x >> chunk_shift, .y = y >> chunk_shift, .z = z >> chunk_shift };
+	}
+
+	inline Chunk* find_chunk (const ChunkCoords& c) noexcept
+	{
+		const auto it = this->chunk_indices.find(pack_coords(c));
+		return (it == this->chunk_indices.end()) ? nullptr : &this->chunks[it->second];
+	}
+
+	inline const Chunk* find_chunk (const ChunkCoords& c) const noexcept
+	{
+		const auto it = this->chunk_indices.find(pack_coords(c));
+		return (it == this->chunk_indices.end()) ? nullptr : &this->chunks[it->second];
+	}
+
+	Chunk& create_chunk (const ChunkCoords& c);
+	void mark_dirty (Chunk& chunk);
+	void copy_padded (const uint32_t chunk, std::vector<Voxel>& padded) const;
+	void thread_loop ();
+	void start_job ();
+	uint32_t publish_job ();
+
+public:
+	// n_threads is the number of threads that build meshes, 0 means all hardware threads
+	VoxelWorld (const fp_t voxel_size_, const uint32_t n_threads = 1);
+	~VoxelWorld ();
+
+	static inline Voxel make_voxel (const Color& color) noexcept
+	{
+		return pack_color_rgba8(Color { .r = color.r, .g = color.g, .b = color.b, .a = 1.0f });
+	}
+
+	Voxel get_voxel (const int32_t x, const int32_t y, const int32_t z) const noexcept;
+	void set_voxel (const int32_t x, const int32_t y, const int32_t z, const Voxel voxel);
+
+	// world coords of the corner (0, 0, 0) of a chunk
+	inline Point get_chunk_origin (const Chunk& chunk) const noexcept
+	{
+		const fp_t size = static_cast<fp_t>(chunk_size) * this->voxel_size;
+		return Point(static_cast<fp_t>(chunk.coords.x) * size, static_cast<fp_t>(chunk.coords.y) * size, static_cast<fp_t>(chunk.coords.z) * size);
+	}
+
+	inline Sphere get_chunk_bounding_sphere (const Chunk& chunk) const noexcept
+	{
+		constexpr fp_t half_diagonal = fp(0.8660254); // sqrt(3) / 2
+		const fp_t size = static_cast<fp_t>(chunk_size) * this->voxel_size;
+		return Sphere { .center = this->get_chunk_origin(chunk) + Vector(size * fp(0.5), size * fp(0.5), size * fp(0.5)), .radius = size * half_diagonal };
+	}
+
+	inline bool is_meshing () const noexcept
+	{
+		return this->job_running || !this->dirty_chunks.empty();
+	}
+
+	/*
+		Publishes the meshes built by the background thread, if it finished,
+		and copies the next dirty chunks to it, if it is idle.
+		Returns the number of meshes published.
+		Never blocks.
+	*/
+	uint32_t update_meshes ();
+
+	// blocks until every dirty chunk is meshed and published
+	void flush_meshes ();
+
+	/*
+		Greedy meshing of a chunk with a border of one voxel from its neighbors,
+		padded_size^3 voxels, x varies first, then y, then z.
+		The triangles of the faces of the inner chunk_size^3 voxels that are not hidden
+		by another voxel are appended to mesh.
+	*/
+	static void build_mesh (const std::vector<Voxel>& padded, std::vector<Vertex>& mesh);
+};
+
+// ---------------------------------------------------
+
+} // end namespace Graphics
+
+#endif